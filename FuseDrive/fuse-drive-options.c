@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "fuse-drive-options.h"
 
@@ -22,6 +23,18 @@
 #define OPTION_CACHETTL 500
 #define OPTION_CHUNKSIZE 501
 #define OPTION_MAXCHUNKS 502
+#define OPTION_MULTITHREADED 503
+#define OPTION_LISTPAGESIZE 504
+#define OPTION_KERNELCACHE 505
+#define OPTION_CACHESIZE 506
+#define OPTION_CACHEDIR 507
+#define OPTION_BLOCKSIZE 508
+#define OPTION_DIRTYLIMIT 509
+#define OPTION_FETCHPOLICY 510
+#define OPTION_FETCHCONNECTIONS 511
+#define OPTION_QUERYRATE 512
+#define OPTION_BYTERATE 513
+#define OPTION_STATS 514
 #define OPTION_STRING "+a:c:i:p:d:"
 
 #define DEFAULT_GDRIVE_ACCESS GDRIVE_ACCESS_WRITE
@@ -33,6 +46,18 @@
 #define DEFAULT_MAXCHUNKS 15
 #define DEFAULT_FILEPERMS 0644
 #define DEFAULT_DIRPERMS 07777
+#define DEFAULT_MULTITHREADED false
+#define DEFAULT_LISTPAGESIZE 1000
+#define DEFAULT_KERNELCACHE false
+#define DEFAULT_CACHESIZE 268435456
+#define DEFAULT_CACHEDIR NULL
+#define DEFAULT_BLOCKSIZE 0
+#define DEFAULT_DIRTYLIMIT 268435456
+#define DEFAULT_FETCHPOLICY GDRIVE_FETCH_ADAPTIVE
+#define DEFAULT_FETCHCONNECTIONS 4
+#define DEFAULT_QUERYRATE 20
+#define DEFAULT_BYTERATE 0
+#define DEFAULT_STATS false
 
 
 /**
@@ -60,6 +85,30 @@ static bool fudr_options_set_chunksize(Fudr_Options* pOptions, const char* arg);
 
 static bool fudr_options_set_maxchunks(Fudr_Options* pOptions, const char* arg);
 
+static bool fudr_options_set_listpagesize(Fudr_Options* pOptions, 
+                                          const char* arg);
+
+static bool fudr_options_set_cachesize(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_cachedir(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_blocksize(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_dirtylimit(Fudr_Options* pOptions, 
+                                        const char* arg);
+
+static bool fudr_options_set_fetchpolicy(Fudr_Options* pOptions, 
+                                         const char* arg);
+
+static bool fudr_options_set_fetchconnections(Fudr_Options* pOptions, 
+                                              const char* arg);
+
+static bool fudr_options_set_queryrate(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_byterate(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_add_kernel_timeouts(Fudr_Options* pOptions);
+
 static bool fudr_options_set_failed(Fudr_Options* pOptions, int arg, 
                                     const struct option* longopts, 
                                     int longIndex);
@@ -145,6 +194,78 @@ Fudr_Options* fudr_options_create(int argc, char** argv)
                 .flag = NULL,
                 .val = OPTION_DIRPERM
             },
+            {
+                .name = "multithreaded",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_MULTITHREADED
+            },
+            {
+                .name = "list-page-size",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_LISTPAGESIZE
+            },
+            {
+                .name = "kernel-cache",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_KERNELCACHE
+            },
+            {
+                .name = "cache-size",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_CACHESIZE
+            },
+            {
+                .name = "cache-dir",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_CACHEDIR
+            },
+            {
+                .name = "block-size",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_BLOCKSIZE
+            },
+            {
+                .name = "dirty-limit",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_DIRTYLIMIT
+            },
+            {
+                .name = "fetch-policy",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_FETCHPOLICY
+            },
+            {
+                .name = "fetch-connections",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_FETCHCONNECTIONS
+            },
+            {
+                .name = "query-rate",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_QUERYRATE
+            },
+            {
+                .name = "byte-rate",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_BYTERATE
+            },
+            {
+                .name = "stats",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_STATS
+            },
             {
                 // End the array with an 
                 // all-zero element
@@ -193,6 +314,55 @@ Fudr_Options* fudr_options_create(int argc, char** argv)
                     // Set max chunks
                     hasError = fudr_options_set_maxchunks(pOptions, optarg);
                     break;
+                case OPTION_MULTITHREADED:
+                    // Let FUSE handle requests in multiple threads
+                    pOptions->multithreaded = true;
+                    break;
+                case OPTION_LISTPAGESIZE:
+                    // Set folder listing page size
+                    hasError = fudr_options_set_listpagesize(pOptions, optarg);
+                    break;
+                case OPTION_KERNELCACHE:
+                    // Let the kernel cache attributes and lookups
+                    pOptions->kernel_cache = true;
+                    break;
+                case OPTION_CACHESIZE:
+                    // Set the size of the file contents cache
+                    hasError = fudr_options_set_cachesize(pOptions, optarg);
+                    break;
+                case OPTION_CACHEDIR:
+                    // Set the directory for keeping file contents
+                    hasError = fudr_options_set_cachedir(pOptions, optarg);
+                    break;
+                case OPTION_BLOCKSIZE:
+                    // Set the download size for random reads
+                    hasError = fudr_options_set_blocksize(pOptions, optarg);
+                    break;
+                case OPTION_DIRTYLIMIT:
+                    // Set the limit on data waiting to be uploaded
+                    hasError = fudr_options_set_dirtylimit(pOptions, optarg);
+                    break;
+                case OPTION_FETCHPOLICY:
+                    // Set how much of a file to download at a time
+                    hasError = fudr_options_set_fetchpolicy(pOptions, optarg);
+                    break;
+                case OPTION_FETCHCONNECTIONS:
+                    // Set the number of connections per download
+                    hasError = 
+                            fudr_options_set_fetchconnections(pOptions, optarg);
+                    break;
+                case OPTION_QUERYRATE:
+                    // Set the limit on requests per second
+                    hasError = fudr_options_set_queryrate(pOptions, optarg);
+                    break;
+                case OPTION_BYTERATE:
+                    // Set the limit on bytes transferred per second
+                    hasError = fudr_options_set_byterate(pOptions, optarg);
+                    break;
+                case OPTION_STATS:
+                    // Print statistics when unmounting
+                    pOptions->stats = true;
+                    break;
                 case '?': 
                     // Fall through to default
                     default:
@@ -230,7 +400,7 @@ Fudr_Options* fudr_options_create(int argc, char** argv)
             optind++;
         }
         pOptions->fuse_argc = argc - optind + 1;
-        pOptions->fuse_argv = malloc((pOptions->fuse_argc + 2) * sizeof(char*));
+        pOptions->fuse_argv = malloc((pOptions->fuse_argc + 4) * sizeof(char*));
         if (!pOptions->fuse_argv)
         {
             // Memory error
@@ -251,8 +421,22 @@ Fudr_Options* fudr_options_create(int argc, char** argv)
         // option sometimes, always add it to be consistent.
         pOptions->fuse_argv[pOptions->fuse_argc++] = "-f";
         
-        // Enforce single-threaded mode
-        pOptions->fuse_argv[pOptions->fuse_argc++] = "-s";
+        // Enforce single-threaded mode unless multi-threaded mode was 
+        // requested
+        if (!pOptions->multithreaded)
+        {
+            pOptions->fuse_argv[pOptions->fuse_argc++] = "-s";
+        }
+        
+        // If requested, let the kernel cache attributes and lookups for as 
+        // long as we cache them ourselves.
+        if (pOptions->kernel_cache && 
+                fudr_options_add_kernel_timeouts(pOptions))
+        {
+            // Memory error
+            fudr_options_free(pOptions);
+            return NULL;
+        }
     }
     
     return pOptions;
@@ -282,6 +466,21 @@ void fudr_options_free(Fudr_Options* pOptions)
     pOptions->gdrive_max_chunks = 0;
     pOptions->file_perms = 0;
     pOptions->dir_perms = 0;
+    pOptions->multithreaded = false;
+    pOptions->gdrive_list_page_size = 0;
+    pOptions->kernel_cache = false;
+    pOptions->gdrive_cache_size = 0;
+    free(pOptions->gdrive_cache_dir);
+    pOptions->gdrive_cache_dir = NULL;
+    pOptions->gdrive_block_size = 0;
+    pOptions->gdrive_dirty_limit = 0;
+    pOptions->gdrive_fetch_policy = 0;
+    pOptions->gdrive_fetch_connections = 0;
+    pOptions->gdrive_query_rate = 0;
+    pOptions->gdrive_byte_rate = 0;
+    pOptions->stats = false;
+    free(pOptions->fuse_timeout_opts);
+    pOptions->fuse_timeout_opts = NULL;
     free(pOptions->fuse_argv);
     pOptions->fuse_argv = NULL;
     pOptions->fuse_argc = 0;
@@ -317,6 +516,19 @@ static Fudr_Options* fudr_options_default()
     pOptions->gdrive_max_chunks = DEFAULT_MAXCHUNKS;
     pOptions->file_perms = DEFAULT_FILEPERMS;
     pOptions->dir_perms = DEFAULT_DIRPERMS;
+    pOptions->multithreaded = DEFAULT_MULTITHREADED;
+    pOptions->gdrive_list_page_size = DEFAULT_LISTPAGESIZE;
+    pOptions->kernel_cache = DEFAULT_KERNELCACHE;
+    pOptions->gdrive_cache_size = DEFAULT_CACHESIZE;
+    pOptions->gdrive_cache_dir = DEFAULT_CACHEDIR;
+    pOptions->gdrive_block_size = DEFAULT_BLOCKSIZE;
+    pOptions->gdrive_dirty_limit = DEFAULT_DIRTYLIMIT;
+    pOptions->gdrive_fetch_policy = DEFAULT_FETCHPOLICY;
+    pOptions->gdrive_fetch_connections = DEFAULT_FETCHCONNECTIONS;
+    pOptions->gdrive_query_rate = DEFAULT_QUERYRATE;
+    pOptions->gdrive_byte_rate = DEFAULT_BYTERATE;
+    pOptions->stats = DEFAULT_STATS;
+    pOptions->fuse_timeout_opts = NULL;
     pOptions->fuse_argv = NULL;
     pOptions->fuse_argc = 0;
     pOptions->error = false;
@@ -608,6 +820,277 @@ static bool fudr_options_set_maxchunks(Fudr_Options* pOptions, const char* arg)
     return false;
 }
 
+/**
+ * Set folder listing page size
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_listpagesize(Fudr_Options* pOptions, 
+                                          const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long pageSize = strtol(arg, &end, 10);
+    if (end == arg)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid list page size '%s', not an integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    if (pageSize < 1 || pageSize > GDRIVE_MAX_LIST_PAGE_SIZE)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid list page size '%s', must be between 1 "
+                "and 1000\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_list_page_size = pageSize;
+    return false;
+}
+
+/**
+ * Set the size of the file contents cache
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_cachesize(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long long cacheSize = strtoll(arg, &end, 10);
+    if (end == arg || cacheSize < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid cache size '%s', not a non-negative "
+                "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_cache_size = cacheSize;
+    return false;
+}
+
+/**
+ * Set the directory for keeping file contents
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_cachedir(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    free(pOptions->gdrive_cache_dir);
+    pOptions->gdrive_cache_dir = malloc(strlen(arg) + 1);
+    if (!pOptions->gdrive_cache_dir)
+    {
+        // Memory error
+        pOptions->error = true;
+        const char* fmtStr = "Could not allocate memory for cache directory "
+                "'%s'\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    
+    strcpy(pOptions->gdrive_cache_dir, arg);
+    return false;
+}
+
+/**
+ * Set the block size for random reads
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_blocksize(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long long blockSize = strtoll(arg, &end, 10);
+    if (end == arg || blockSize < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid block size '%s', not a non-negative "
+                "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_block_size = blockSize;
+    return false;
+}
+
+/**
+ * Set the limit on data waiting to be uploaded in the background
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_dirtylimit(Fudr_Options* pOptions, 
+                                        const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long long dirtyLimit = strtoll(arg, &end, 10);
+    if (end == arg || dirtyLimit < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid dirty limit '%s', not a non-negative "
+                "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_dirty_limit = dirtyLimit;
+    return false;
+}
+
+/**
+ * Set the policy for how much of a file to download at a time
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_fetchpolicy(Fudr_Options* pOptions, 
+                                         const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    if (!strcmp(arg, "fixed"))
+    {
+        pOptions->gdrive_fetch_policy = GDRIVE_FETCH_FIXED;
+    }
+    else if (!strcmp(arg, "adaptive"))
+    {
+        pOptions->gdrive_fetch_policy = GDRIVE_FETCH_ADAPTIVE;
+    }
+    else
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Unrecognized fetch policy '%s'. Valid values "
+                             "are adaptive and fixed\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Set the number of connections used to download each large chunk
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_fetchconnections(Fudr_Options* pOptions, 
+                                              const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long connections = strtol(arg, &end, 10);
+    if (end == arg || connections < 1)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid fetch connections '%s', not a positive "
+                "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_fetch_connections = connections;
+    return false;
+}
+
+/**
+ * Set the limit on requests sent to Google Drive per second
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_queryrate(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long queryRate = strtol(arg, &end, 10);
+    if (end == arg || queryRate < 0 || queryRate > INT_MAX)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid query rate '%s', not a non-negative "
+                "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_query_rate = queryRate;
+    return false;
+}
+
+/**
+ * Set the limit on bytes uploaded and downloaded per second
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_byterate(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long long byteRate = strtoll(arg, &end, 10);
+    if (end == arg || byteRate < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid byte rate '%s', not a non-negative "
+                "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_byte_rate = byteRate;
+    return false;
+}
+
+/**
+ * Add FUSE options so that the kernel caches file attributes, name lookups and
+ * failed lookups for cachettl seconds
+ * @param pOptions: fuse_argv must have room for two more arguments
+ * @return false on success, true on error
+ */
+static bool fudr_options_add_kernel_timeouts(Fudr_Options* pOptions)
+{
+    // Nothing should be NULL
+    assert(pOptions && pOptions->fuse_argv);
+    
+    long ttl = (long) pOptions->gdrive_cachettl;
+    const char* fmtStr = 
+            "entry_timeout=%ld,attr_timeout=%ld,negative_timeout=%ld";
+    int length = snprintf(NULL, 0, fmtStr, ttl, ttl, ttl);
+    pOptions->fuse_timeout_opts = malloc(length + 1);
+    if (!pOptions->fuse_timeout_opts)
+    {
+        // Memory error
+        return true;
+    }
+    snprintf(pOptions->fuse_timeout_opts, length + 1, fmtStr, ttl, ttl, ttl);
+    
+    pOptions->fuse_argv[pOptions->fuse_argc++] = "-o";
+    pOptions->fuse_argv[pOptions->fuse_argc++] = pOptions->fuse_timeout_opts;
+    return false;
+}
+
 /**
  * Set unrecognized option or option with required value but no value provided
  * @param pOptions
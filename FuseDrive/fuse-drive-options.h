@@ -46,6 +46,49 @@ typedef struct Fudr_Options
     // Permissions for files. Interpreted as a 3-digit octal number
     unsigned long dir_perms;
     
+    // If true, allow FUSE to handle requests in multiple threads
+    bool multithreaded;
+    
+    // Number of files to request in each page of a folder listing
+    int gdrive_list_page_size;
+    
+    // If true, let the kernel cache attributes and lookups for cachettl 
+    // seconds
+    bool kernel_cache;
+    
+    // Maximum number of bytes of downloaded file contents to keep on disk
+    size_t gdrive_cache_size;
+    
+    // Directory in which to keep file contents between mounts, or NULL to use
+    // anonymous temporary files
+    char* gdrive_cache_dir;
+    
+    // Number of bytes to download at a time for random reads, or 0 to use 
+    // gdrive_chunk_size
+    size_t gdrive_block_size;
+    
+    // Most bytes of closed files waiting to be uploaded in the background, or
+    // 0 to upload files while closing them
+    size_t gdrive_dirty_limit;
+    
+    // How much of a file to download at a time
+    enum Gdrive_Fetch_Policy gdrive_fetch_policy;
+    
+    // Number of connections used to download each large chunk of a file
+    int gdrive_fetch_connections;
+    
+    // Most requests per second to send to Google Drive, or 0 for no limit
+    int gdrive_query_rate;
+    
+    // Most bytes per second to upload and download, or 0 for no limit
+    size_t gdrive_byte_rate;
+    
+    // If true, print cache statistics to stderr when unmounting
+    bool stats;
+    
+    // FUSE option string for kernel cache timeouts, referenced by fuse_argv
+    char* fuse_timeout_opts;
+    
     // Arguments to be passed on to FUSE
     char** fuse_argv;
     
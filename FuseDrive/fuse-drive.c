@@ -6,6 +6,8 @@
 #include <stdbool.h>
 #include <time.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <libgen.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -19,6 +21,36 @@
 #include "gdrive/gdrive.h"
 #include "fuse-drive-options.h"
 
+/**Directory handle stored in fi->fh between opendir and releasedir. It keeps
+ * one page of the folder listing at a time, so that large folders are passed
+ * on to FUSE page by page instead of being read in all at once.**/
+typedef struct Fudr_Dir_Handle
+{
+    char* folderId;
+    char* path;
+    // The current page of the listing, or NULL before the first page
+    Gdrive_Fileinfo_Array* pPage;
+    // Index (within the whole listing) of the first file in pPage
+    off_t pageStart;
+    // Token for the page after pPage, or NULL if pPage is the last page
+    char* nextPageToken;
+} Fudr_Dir_Handle;
+
+/**Directory offsets given to filler(). Offsets 1 and 2 are "." and "..", and
+ * the file at index i within the listing has offset i + FUDR_DIR_FIRST_FILE.**/
+#define FUDR_DIR_FIRST_FILE 3
+
+/**FUSE only reads from a descriptor returned by read_file_buf() after
+ * read_file_buf() has returned, so the descriptor can't be closed right away.
+ * Each thread keeps its last one here (stored as fd + 1, so that NULL means
+ * none) and closes it on its next call, or when the thread exits.**/
+static pthread_key_t readBufFdKey;
+static pthread_once_t readBufFdKeyOnce = PTHREAD_ONCE_INIT;
+static bool readBufFdKeyCreated = false;
+
+// If true, destroy_link() prints statistics before cleaning up (see --stats)
+static bool printStats = false;
+
 /**Function Prototypes*********/
 //1:Aditya
 //2:Shubhika
@@ -56,8 +88,20 @@ static int open_file(const char *path, struct fuse_file_info *fi);//1
 
 static int read_file(const char *path, char *buf, size_t size, off_t offset,struct fuse_file_info *fi);//2
 
+static int read_file_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi);
+
+static void close_read_buf_fd(void* value);
+
+static void create_read_buf_fd_key(void);
+
+static int open_dir(const char* path, struct fuse_file_info* fi);
+
 static int read_dir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);//4
 
+static int release_dir(const char* path, struct fuse_file_info* fi);
+
+static int fetch_dir_page(Fudr_Dir_Handle* pDir, bool restart);
+
 static int release_file(const char* path, struct fuse_file_info *fi);//4
 
 static int rename_file_or_dir(const char* from, const char* to);//4
@@ -82,15 +126,18 @@ static int write_file(const char* path, const char *buf, size_t size,off_t offse
  * */
 static int set_fileinfo(const Gdrive_Fileinfo* pFileinfo,bool isRoot, struct stat* stbuf)
 {
+    // Suppress unused parameter warning
+    (void) isRoot;
+
     switch (pFileinfo->type)
     {
         case GDRIVE_FILETYPE_FOLDER:
             stbuf->st_mode = S_IFDIR; //directory mode
-            stbuf->st_nlink = pFileinfo->nParents + pFileinfo->nChildren;
-            // Account for ".".  Also, if the root of the filesystem, account
-            // for  "..", which is outside of the Google Drive filesystem and
-            // thus not included in nParents.
-            stbuf->st_nlink += isRoot ? 2 : 1;  //set if root directory or not
+            // Counting subdirectories would take a folder listing for every
+            // stat, so report a link count of 1 like many network filesystems
+            // do. Tools such as find treat 1 as "unknown" rather than using it
+            // to skip subdirectories.
+            stbuf->st_nlink = 1;
             break;
 
         case GDRIVE_FILETYPE_FILE:
@@ -125,7 +172,7 @@ static int set_fileinfo(const Gdrive_Fileinfo* pFileinfo,bool isRoot, struct sta
     return 0;
 }
 /** function to remove a file or directory when id of that file or directory is given
- * find the number of hard links i.e, parents of that file, it gets the info of the file using func gdrive_finfo_get_by_id
+ * find the number of hard links i.e, parents of that file, it gets the info of the file using func gdrive_finfo_get_by_id_copy
  * (which is in file gdrive_fileinfo.c) and then if the result is not null that is file exists then no. of parents are found
  * if multiple parents then remove parents..
  **/
@@ -136,8 +183,15 @@ static int remove_by_id(const char* fileId, const char* parentId)
     assert(fileId != NULL);
 
     // Find the number of parents, which is the number of "hard" links.
-    const Gdrive_Fileinfo* pFileinfo = gdrive_finfo_get_by_id(fileId);
-    if (pFileinfo->nParents > 1)
+    Gdrive_Fileinfo fileinfo;
+    if (gdrive_finfo_get_by_id_copy(fileId, &fileinfo) != 0)
+    {
+        // File not found
+        return -ENOENT;
+    }
+    int nParents = fileinfo.nParents;
+    gdrive_finfo_cleanup(&fileinfo);
+    if (nParents > 1)
     {
         return gdrive_remove_parent(fileId, parentId);
     }
@@ -201,7 +255,7 @@ static bool match_user_to_group(gid_t gidToMatch, gid_t gid, uid_t uid)
 
 /**
  * This function gets the file id from the path passed ,
- * then it retrieves the file info by calling gdrive_finfo_get_by_id function()
+ * then it retrieves a copy of the file info by calling gdrive_finfo_get_by_id_copy()
  * from the fileinfo we get the file permissions  and we also fetch the maximum file permissions using get_max_perms () function.
  * We fetch the system permissions as well and accordingly grant access (return 0) to the calling method.
  *
@@ -216,24 +270,26 @@ static int check_access(const char* path, int mask)
         // File doesn't exist
         return -ENOENT;
     }
-    const Gdrive_Fileinfo* pFileinfo = gdrive_finfo_get_by_id(fileId);
+    Gdrive_Fileinfo fileinfo;
+    int error = gdrive_finfo_get_by_id_copy(fileId, &fileinfo);
     free(fileId);
-    if (!pFileinfo)
+    if (error)
     {
         // Unknown error
         return -EIO;
     }
 
+    unsigned int filePerms = gdrive_finfo_real_perms(&fileinfo);
+    unsigned int maxPerms =
+        get_max_permissions(fileinfo.type == GDRIVE_FILETYPE_FOLDER);
+    gdrive_finfo_cleanup(&fileinfo);
+
     if (mask == F_OK)
     {
         // Only checking whether the file exists
         return 0;
     }
 
-    unsigned int filePerms = gdrive_finfo_real_perms(pFileinfo);
-    unsigned int maxPerms =
-        get_max_permissions(pFileinfo->type == GDRIVE_FILETYPE_FOLDER);
-
     const struct fuse_context* context = fuse_get_context();
 
     if (context->uid == geteuid())
@@ -301,6 +357,15 @@ static void destroy_link(void* private_data)
     // Silence compiler warning about unused parameter
     (void) private_data;
 
+    if (printStats)
+    {
+        unsigned long missingHits;
+        unsigned long missingMisses;
+        gdrive_get_missing_stats(&missingHits, &missingMisses);
+        fprintf(stderr, "Missing paths: %lu of %lu lookups answered from the "
+                "cache\n", missingHits, missingHits + missingMisses);
+    }
+
     gdrive_cleanup();
 }
 
@@ -309,16 +374,21 @@ static int get_file_attr(const char* path, struct stat* stbuf,
                          struct fuse_file_info* fi)
 {
     Gdrive_File* fh = (Gdrive_File*) fi->fh;
-    const Gdrive_Fileinfo* pFileinfo = (fi->fh == (uint64_t) NULL) ?
-        NULL : gdrive_file_get_info(fh);
-
-    if (pFileinfo == NULL)
+    Gdrive_Fileinfo fileinfo;
+    if (fi->fh == (uint64_t) NULL)
     {
         // Invalid file handle
         return -EBADF;
     }
+    if (gdrive_file_get_info_copy(fh, &fileinfo) != 0)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
 
-    return set_fileinfo(pFileinfo, strcmp(path, "/") == 0, stbuf);
+    int result = set_fileinfo(&fileinfo, strcmp(path, "/") == 0, stbuf);
+    gdrive_finfo_cleanup(&fileinfo);
+    return result;
 }
 
 /**This function calls for gdrive_file_sync() function to sync the metadata of file with google drive
@@ -328,7 +398,6 @@ static int get_file_attr(const char* path, struct stat* stbuf,
 static int sync_file(const char* path, int isdatasync,struct fuse_file_info* fi)
 {
 
-    (void) isdatasync;
     (void) path;
     /** check to see if file handle is NULL**/
     if (fi->fh == (uint64_t) NULL)
@@ -337,7 +406,14 @@ static int sync_file(const char* path, int isdatasync,struct fuse_file_info* fi)
         return -EBADF;
     }
 
-    return gdrive_file_sync((Gdrive_File*) fi->fh);
+    // Closed files are uploaded in the background, so this is the only way to
+    // know the changes have reached Google Drive.
+    int error = gdrive_file_sync((Gdrive_File*) fi->fh);
+    if (error == 0 && !isdatasync)
+    {
+        error = gdrive_file_sync_metadata((Gdrive_File*) fi->fh);
+    }
+    return error;
 }
 /**the file is given write access first by check_access function, which returns 0 on successful completion
  * and then function returns control to gdrive_file_truncate which is in gdrive_file.h file, this functio
@@ -362,7 +438,7 @@ static int truncate_file(const char* path, off_t size,
 
     return gdrive_file_truncate(fh, size);
 }
-/**gdrive_filepath_to_id() is in gdrive-info.c, gdrive_finfo_get_by_id() is in gdrive-fileinfo.c,
+/**gdrive_filepath_to_id() is in gdrive-info.c, gdrive_finfo_get_by_id_copy() is in gdrive-fileinfo.c,
  * set_fileinfo is in this file only
  * **/
 static int get_attr(const char *path, struct stat *stbuf)
@@ -376,15 +452,18 @@ static int get_attr(const char *path, struct stat *stbuf)
         return -ENOENT;
     }
 
-    const Gdrive_Fileinfo* pFileinfo = gdrive_finfo_get_by_id(fileId);
+    Gdrive_Fileinfo fileinfo;
+    int error = gdrive_finfo_get_by_id_copy(fileId, &fileinfo);
     free(fileId);
-    if (pFileinfo == NULL)
+    if (error)
     {
         // An error occurred.
         return -ENOENT;
     }
 
-    return set_fileinfo(pFileinfo, strcmp(path, "/") == 0, stbuf);
+    int result = set_fileinfo(&fileinfo, strcmp(path, "/") == 0, stbuf);
+    gdrive_finfo_cleanup(&fileinfo);
+    return result;
 }
 
 /*This function is used to initialize filesystem
@@ -401,6 +480,10 @@ static void* init_fuse(struct fuse_conn_info *conn)
     // Need to turn off async read here, too.
     conn->async_read = 0;
 
+    // Let FUSE splice cached file contents from read_file_buf() straight into
+    // the reply.
+    conn->want = conn->want | FUSE_CAP_SPLICE_WRITE;
+
     return fuse_get_context()->private_data;
 }
 
@@ -476,6 +559,99 @@ static int read_file(const char *path, char *buf, size_t size, off_t offset,stru
     return gdrive_file_read(pFile, buf, size, offset);
 }
 
+/**
+ * Same as read_file(), but when the requested range is cached in one piece,
+ * hands FUSE the cached file's descriptor instead of copying the data into a
+ * buffer, so that it can be spliced into the reply.
+ * */
+static int read_file_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi)
+{
+    /** Check for read access **/
+    int accessResult = check_access(path, R_OK);
+    if (accessResult)
+    {
+        return accessResult;
+    }
+
+    Gdrive_File* pFile = (Gdrive_File*) fi->fh;
+
+    struct fuse_bufvec* pBufv = malloc(sizeof(struct fuse_bufvec));
+    if (pBufv == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    *pBufv = FUSE_BUFVEC_INIT(0);
+
+    // FUSE is done with the descriptor from this thread's previous call.
+    pthread_once(&readBufFdKeyOnce, create_read_buf_fd_key);
+    void* pPrevFd = readBufFdKeyCreated ?
+        pthread_getspecific(readBufFdKey) : NULL;
+    if (pPrevFd != NULL)
+    {
+        close_read_buf_fd(pPrevFd);
+        pthread_setspecific(readBufFdKey, NULL);
+    }
+
+    int fd = -1;
+    off_t fdOffset = 0;
+    char* mem = NULL;
+    int bytesRead = gdrive_file_read_fd(pFile, size, offset,
+                                        &fd, &fdOffset, &mem);
+    if (bytesRead < 0)
+    {
+        // Read error
+        free(pBufv);
+        return bytesRead;
+    }
+
+    if (fd >= 0 && (!readBufFdKeyCreated ||
+            pthread_setspecific(readBufFdKey, (void*) (intptr_t) (fd + 1))
+            != 0))
+    {
+        // No way to close the descriptor later, so copy the data out now.
+        mem = malloc(bytesRead);
+        ssize_t bytesCopied = (mem == NULL) ?
+            -1 : pread(fd, mem, bytesRead, fdOffset);
+        close(fd);
+        fd = -1;
+        if (bytesCopied < 0)
+        {
+            free(mem);
+            free(pBufv);
+            return -EIO;
+        }
+        bytesRead = bytesCopied;
+    }
+
+    pBufv->buf[0].size = bytesRead;
+    if (fd >= 0)
+    {
+        pBufv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        pBufv->buf[0].fd = fd;
+        pBufv->buf[0].pos = fdOffset;
+    }
+    else
+    {
+        // FUSE frees the memory along with the bufvec.
+        pBufv->buf[0].mem = mem;
+    }
+
+    *bufp = pBufv;
+    return 0;
+}
+
+static void close_read_buf_fd(void* value)
+{
+    close((int) ((intptr_t) value - 1));
+}
+
+static void create_read_buf_fd_key(void)
+{
+    readBufFdKeyCreated =
+        (pthread_key_create(&readBufFdKey, close_read_buf_fd) == 0);
+}
+
 /**
  * This function checks whether the directory name already exists in this same path,
  * if so, it returns an error
@@ -571,17 +747,12 @@ static int open_file(const char *path, struct fuse_file_info *fi)
     return 0;
 }
 
-/*This function reads the gdrive by using the filler function. It checks
-* for read access first and then use the filler function to read the gdrive
+/*This function opens a directory for reading. It checks for read access and
+* sets up a directory handle, but the listing itself is only fetched by read_dir
 */
 
-static int read_dir(const char *path, void *buf, fuse_fill_dir_t filler,
-                        off_t offset, struct fuse_file_info *fi)
+static int open_dir(const char* path, struct fuse_file_info* fi)
 {
-    // Suppress warnings for unused function parameters
-    (void) offset;
-    (void) fi;
-
     char* folderId = gdrive_filepath_to_id(path);
     if (folderId == NULL)
     {
@@ -596,39 +767,178 @@ static int read_dir(const char *path, void *buf, fuse_fill_dir_t filler,
         return accessResult;
     }
 
-    Gdrive_Fileinfo_Array* pFileArray =
-            gdrive_folder_list(folderId);
-    free(folderId);
-    if (pFileArray == NULL)
+    Fudr_Dir_Handle* pDir = malloc(sizeof(Fudr_Dir_Handle));
+    char* pathCopy = malloc(strlen(path) + 1);
+    if (pDir == NULL || pathCopy == NULL)
     {
-        // An error occurred.
-        return -ENOENT;
+        // Memory error
+        free(pDir);
+        free(pathCopy);
+        free(folderId);
+        return -ENOMEM;
     }
+    strcpy(pathCopy, path);
+    pDir->folderId = folderId;
+    pDir->path = pathCopy;
+    pDir->pPage = NULL;
+    pDir->pageStart = 0;
+    pDir->nextPageToken = NULL;
 
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
-    const Gdrive_Fileinfo* pCurrentFile;
-    for (pCurrentFile = gdrive_finfoarray_get_first(pFileArray);
-            pCurrentFile != NULL;
-            pCurrentFile = gdrive_finfoarray_get_next(pFileArray, pCurrentFile)
-            )
+    /** Store the directory handle **/
+    fi->fh = (uint64_t) pDir;
+    return 0;
+}
+
+/*This function reads the gdrive by using the filler function. The listing is
+* fetched one page at a time, and each entry is given its offset within the 
+* directory so that FUSE can call back for the rest once its buffer is full
+*/
+
+static int read_dir(const char *path, void *buf, fuse_fill_dir_t filler,
+                        off_t offset, struct fuse_file_info *fi)
+{
+    // Suppress warnings for unused function parameters
+    (void) path;
+
+    Fudr_Dir_Handle* pDir = (Fudr_Dir_Handle*) fi->fh;
+    if (pDir == NULL)
+    {
+        // Bad directory handle
+        return -EBADF;
+    }
+
+    if (offset < 1 && filler(buf, ".", NULL, 1))
+    {
+        return 0;
+    }
+    if (offset < 2 && filler(buf, "..", NULL, 2))
+    {
+        return 0;
+    }
+
+    // Index (within the whole listing) of the next file to pass to filler()
+    off_t index = (offset > FUDR_DIR_FIRST_FILE - 1) ? 
+        offset - (FUDR_DIR_FIRST_FILE - 1) : 0;
+
+    if (pDir->pPage == NULL || index < pDir->pageStart)
     {
-        struct stat st = {0};
-        switch (pCurrentFile->type)
+        // Either this is the first call, or the directory was rewound past
+        // the current page. Start the listing again from the beginning.
+        int result = fetch_dir_page(pDir, true);
+        if (result)
         {
-            case GDRIVE_FILETYPE_FILE:
-                st.st_mode = S_IFREG;
-                break;
+            return result;
+        }
+    }
 
-            case GDRIVE_FILETYPE_FOLDER:
-                st.st_mode = S_IFDIR;
-                break;
+    while (true)
+    {
+        off_t pageCount = gdrive_finfoarray_get_count(pDir->pPage);
+        if (index >= pDir->pageStart + pageCount)
+        {
+            if (pDir->nextPageToken == NULL)
+            {
+                // End of the listing
+                return 0;
+            }
+            int result = fetch_dir_page(pDir, false);
+            if (result)
+            {
+                return result;
+            }
+            continue;
+        }
+
+        // Skip to the requested file within the current page
+        const Gdrive_Fileinfo* pCurrentFile = 
+                gdrive_finfoarray_get_first(pDir->pPage);
+        for (off_t i = pDir->pageStart; i < index; i++)
+        {
+            pCurrentFile = gdrive_finfoarray_get_next(pDir->pPage, 
+                                                      pCurrentFile);
+        }
+
+        for (; pCurrentFile != NULL; 
+                pCurrentFile = gdrive_finfoarray_get_next(pDir->pPage, 
+                                                          pCurrentFile)
+                )
+        {
+            struct stat st = {0};
+            switch (pCurrentFile->type)
+            {
+                case GDRIVE_FILETYPE_FILE:
+                    st.st_mode = S_IFREG;
+                    break;
+
+                case GDRIVE_FILETYPE_FOLDER:
+                    st.st_mode = S_IFDIR;
+                    break;
+            }
+            index++;
+            if (filler(buf, pCurrentFile->filename, &st, 
+                       index + FUDR_DIR_FIRST_FILE - 1))
+            {
+                // The buffer is full. FUSE will call again with this offset.
+                return 0;
+            }
         }
-        filler(buf, pCurrentFile->filename, &st, 0);
     }
+}
 
-    gdrive_finfoarray_free(pFileArray);
+/*This function releases a directory opened by open_dir
+*/
+
+static int release_dir(const char* path, struct fuse_file_info* fi)
+{
+    // Suppress unused parameter warning
+    (void) path;
 
+    Fudr_Dir_Handle* pDir = (Fudr_Dir_Handle*) fi->fh;
+    if (pDir == NULL)
+    {
+        // Bad directory handle
+        return -EBADF;
+    }
+
+    gdrive_finfoarray_free(pDir->pPage);
+    free(pDir->nextPageToken);
+    free(pDir->folderId);
+    free(pDir->path);
+    free(pDir);
+    fi->fh = (uint64_t) NULL;
+    return 0;
+}
+
+/*This function replaces the current page of a directory handle with the next
+* page of the listing, or with the first page if restart is true
+*/
+
+static int fetch_dir_page(Fudr_Dir_Handle* pDir, bool restart)
+{
+    off_t nextPageStart = 0;
+    const char* pageToken = NULL;
+    if (!restart)
+    {
+        nextPageStart = pDir->pageStart + 
+                gdrive_finfoarray_get_count(pDir->pPage);
+        pageToken = pDir->nextPageToken;
+    }
+
+    char* nextPageToken = NULL;
+    Gdrive_Fileinfo_Array* pPage = 
+            gdrive_folder_list_page(pDir->folderId, pDir->path, pageToken, 
+                                    &nextPageToken);
+    if (pPage == NULL)
+    {
+        // An error occurred.
+        return -ENOENT;
+    }
+
+    gdrive_finfoarray_free(pDir->pPage);
+    free(pDir->nextPageToken);
+    pDir->pPage = pPage;
+    pDir->pageStart = nextPageStart;
+    pDir->nextPageToken = nextPageToken;
     return 0;
 }
 
@@ -691,18 +1001,26 @@ static int rename_file_or_dir(const char* from, const char* to)
         }
 
         // If the source is a directory, destination must be an empty directory
-        const Gdrive_Fileinfo* pFromInfo = gdrive_finfo_get_by_id(fromFileId);
-        if (pFromInfo && pFromInfo->type == GDRIVE_FILETYPE_FOLDER)
+        Gdrive_Fileinfo fromInfo;
+        Gdrive_Fileinfo toInfo;
+        bool haveFromInfo = 
+                (gdrive_finfo_get_by_id_copy(fromFileId, &fromInfo) == 0);
+        enum Gdrive_Filetype fromType = fromInfo.type;
+        gdrive_finfo_cleanup(&fromInfo);
+        if (haveFromInfo && fromType == GDRIVE_FILETYPE_FOLDER)
         {
-            const Gdrive_Fileinfo* pToInfo = gdrive_finfo_get_by_id(toFileId);
-            if (pToInfo && pToInfo->type != GDRIVE_FILETYPE_FOLDER)
+            bool haveToInfo = 
+                    (gdrive_finfo_get_by_id_copy(toFileId, &toInfo) == 0);
+            enum Gdrive_Filetype toType = toInfo.type;
+            gdrive_finfo_cleanup(&toInfo);
+            if (haveToInfo && toType != GDRIVE_FILETYPE_FOLDER)
             {
                 // Destination is not a directory
                 free(toFileId);
                 free(fromFileId);
                 return -ENOTDIR;
             }
-            if (pToInfo && pToInfo->nChildren > 0)
+            if (haveToInfo && gdrive_finfo_get_nchildren(toFileId) != 0)
             {
                 // Destination is not empty
                 free(toFileId);
@@ -832,17 +1150,25 @@ static int remove_dir(const char* path)
     char* fileId = gdrive_filepath_to_id(path);
 
     // Make sure path refers to an empty directory
-    const Gdrive_Fileinfo* pFileinfo = gdrive_finfo_get_by_id(fileId);
+    Gdrive_Fileinfo fileinfo;
+    if (fileId == NULL || gdrive_finfo_get_by_id_copy(fileId, &fileinfo) != 0)
+    {
+        // Not found
+        free(fileId);
+        return -ENOENT;
+    }
+    enum Gdrive_Filetype type = fileinfo.type;
+    gdrive_finfo_cleanup(&fileinfo);
 
-    if (pFileinfo->type != GDRIVE_FILETYPE_FOLDER)
+    if (type != GDRIVE_FILETYPE_FOLDER)
     {
         // Not a directory
         free(fileId);
         return -ENOTDIR;
     }
-    if (pFileinfo->nChildren > 0)
+    if (gdrive_finfo_get_nchildren(fileId) != 0)
     {
-        // Not empty
+        // Not empty (or couldn't tell)
         free(fileId);
         return -ENOTEMPTY;
     }
@@ -1043,9 +1369,11 @@ static struct fuse_operations fo = {
     .open           = open_file,
     .mkdir          = make_dir,
     .read           = read_file,
+    .opendir        = open_dir,
     .readdir        = read_dir,
     .init           = init_fuse,
     .release        = release_file,
+    .releasedir     = release_dir,
     .statfs         = get_filesys_stats,
     .rename         = rename_file_or_dir,
     .rmdir          = remove_dir,
@@ -1068,11 +1396,9 @@ static struct fuse_operations fo = {
     .listxattr      = NULL,
     .lock           = NULL,
     .mknod          = NULL,
-    .opendir        = NULL,
     .poll           = NULL,
-    .read_buf       = NULL,
+    .read_buf       = read_file_buf,
     .readlink       = NULL,
-    .releasedir     = NULL,
     .removexattr    = NULL,
     .setxattr       = NULL,
     .symlink        = NULL,
@@ -1105,6 +1431,22 @@ int main(int argc,char *argv[])
         fputs("Could not set up a Google Drive connection.\n", stderr);
         return 1;
     }
+    gdrive_set_listpagesize(pOptions->gdrive_list_page_size);
+    gdrive_set_contentcachesize(pOptions->gdrive_cache_size);
+    gdrive_set_blocksize(pOptions->gdrive_block_size);
+    gdrive_set_dirtylimit(pOptions->gdrive_dirty_limit);
+    gdrive_set_fetchpolicy(pOptions->gdrive_fetch_policy);
+    gdrive_set_fetchconnections(pOptions->gdrive_fetch_connections);
+    gdrive_set_queryrate(pOptions->gdrive_query_rate);
+    gdrive_set_byterate(pOptions->gdrive_byte_rate);
+    printStats = pOptions->stats;
+    if (pOptions->gdrive_cache_dir != NULL &&
+            gdrive_set_cachedir(pOptions->gdrive_cache_dir) != 0)
+    {
+        fputs("Could not set up the cache directory.\n", stderr);
+        gdrive_cleanup();
+        return 1;
+    }
 
     /**pass the required poptions members to fuse_main() function call to mount the gdrive files and directories**/
     int returnVal = fuse_main(pOptions->fuse_argc, pOptions->fuse_argv, &fo, (void*) ((pOptions->dir_perms << 9) + pOptions->file_perms));
@@ -42,7 +42,7 @@ fuse_unmount() {
 fuse_mount() {
     if [ "$NOMOUNT" -eq 0 ]; then
         fuselog Starting fusedrive
-        $VALGRIND $VALGRIND_OPTS $EXE "$MOUNTPATH" $MOUNTOPTIONS > /dev/stderr 2>> "$VALGRIND_REDIR" &
+        $VALGRIND $VALGRIND_OPTS $EXE $FDOPTIONS "$MOUNTPATH" $MOUNTOPTIONS > /dev/stderr 2>> "$VALGRIND_REDIR" &
         FDPID=$!
 
         fuselog -n "Waiting for mount..."
@@ -69,6 +69,22 @@ fuse_mount() {
     fi
 }
 
+fuse_remount() {
+    # $1 (optional) is the fusedrive-specific options to mount with. Missing or
+    #    empty means the defaults.
+    # Unmounts, remounts, and moves back into the mounted directory.
+    FDOPTIONS="${1:-}"
+    fuse_unmount
+    fuse_mount
+    fuselog -n "Changing working directory back to '$MOUNTPATH'... "
+    if ! test_cd; then
+        # test_cd has already set TEST_RESULT
+        return 1
+    fi
+    fuselog Ok
+    return 0
+}
+
 
 
 
@@ -756,6 +772,402 @@ test_rename_clobber() {
     return 0
 }
 
+check_filled() {
+    # $1 is the filename
+    # $2 is the expected number of bytes
+    # $3 is the character the file should be filled with
+    # Sets TEST_RESULT and returns nonzero if the file doesn't match.
+    fuselog -n "Testing length of '$1'... "
+    get_filesize "$1"
+    if [ "$FILESIZE" -ne $2 ]; then
+        TEST_RESULT="Incorrect size. Expected $2, saw '$FILESIZE'."
+        return 1
+    fi
+    fuselog ok
+    fuselog -n "Testing contents of '$1'... "
+    if [ $(tr -d "$3" < "$1" | wc -c) -ne 0 ]; then
+        TEST_RESULT="Unexpected character(s) found in file, expected only '$3'."
+        return 1
+    fi
+    fuselog ok
+    return 0
+}
+
+test_fsync_readback() {
+    # $1 is the filename
+    # $2 is the number of bytes to write
+    # $3 is the character to fill with
+    # Closing the file only queues its upload, so fsync has to wait for the
+    # upload. Remounting afterwards makes sure the contents really reached
+    # Google Drive rather than just the local cache.
+    fuselog -n "Writing $2 '$3's to '$1' and closing it... "
+    if ! head -c $2 /dev/zero | tr '\000' $3 > "$1"; then
+        TEST_RESULT="Command indicated an error when writing"
+        return 1
+    fi
+    fuselog Ok
+    fuselog -n "Waiting for the upload with fsync... "
+    if ! sync "$1" 2> /dev/null; then
+        TEST_RESULT="sync command indicated failure"
+        return 1
+    fi
+    fuselog Ok
+    if ! fuse_remount; then
+        return 1
+    fi
+    if ! check_filled "$1" $2 $3; then
+        TEST_RESULT="After fsync and remounting: $TEST_RESULT"
+        return 1
+    fi
+    TEST_RESULT=""
+    return 0
+}
+
+test_reopen_unchanged() {
+    # $1 is the filename
+    # $2 is the number of bytes to write
+    # $3 is the character to fill with
+    # Reopens the file while its upload may still be queued, and again after
+    # it has been uploaded. Reading an unchanged file, or opening it for 
+    # writing without writing anything, shouldn't upload it again, which would
+    # change its modification time.
+    local oldmtime
+    
+    fuselog -n "Writing $2 '$3's to '$1' and closing it... "
+    if ! head -c $2 /dev/zero | tr '\000' $3 > "$1"; then
+        TEST_RESULT="Command indicated an error when writing"
+        return 1
+    fi
+    fuselog Ok
+    fuselog "Reopening before the upload is known to be finished."
+    if ! check_filled "$1" $2 $3; then
+        return 1
+    fi
+    fuselog -n "Waiting for the upload with fsync... "
+    if ! sync "$1" 2> /dev/null; then
+        TEST_RESULT="sync command indicated failure"
+        return 1
+    fi
+    fuselog Ok
+    get_mtime "$1"; oldmtime="$MTIME"
+    
+    # Give a new upload a chance to get a different timestamp.
+    sleep 2
+    fuselog "Reopening the unchanged file."
+    if ! check_filled "$1" $2 $3; then
+        return 1
+    fi
+    fuselog -n "Opening it for reading and writing and closing without writing... "
+    if ! exec 3<>"$1"; then
+        TEST_RESULT="Could not open '$1' for reading and writing"
+        return 1
+    fi
+    exec 3>&-
+    fuselog Ok
+    fuselog -n "Closing with fsync... "
+    if ! sync "$1" 2> /dev/null; then
+        TEST_RESULT="sync command indicated failure"
+        return 1
+    fi
+    fuselog Ok
+    if ! fuse_remount; then
+        return 1
+    fi
+    fuselog -n "Comparing modification time to before reopening... "
+    get_mtime "$1"
+    if [ "$MTIME" != "$oldmtime" ]; then
+        TEST_RESULT="Modification time changed from '$oldmtime' to '$MTIME' without writing."
+        return 1
+    fi
+    fuselog Ok
+    TEST_RESULT=""
+    return 0
+}
+
+test_overwrite_append() {
+    # $1 is the filename
+    # $2 is a local file to hold the expected contents
+    # Writes into the middle of a file that isn't cached, starting partway
+    # into a block, and appends to it. Neither write downloads the parts of 
+    # the file around it, so this checks that those parts are still read 
+    # correctly afterwards, before and after remounting.
+    local step
+    local offset
+    local count
+    local char
+    
+    fuselog -n "Writing 3145728 'o's to '$1'... "
+    if ! head -c 3145728 /dev/zero | tr '\000' o | tee "$2" > "$1" || ! sync "$1"; then
+        TEST_RESULT="Command indicated an error when writing"
+        return 1
+    fi
+    fuselog Ok
+    
+    # Remounting discards the cached contents, so the following writes land
+    # in parts of the file that aren't cached.
+    if ! fuse_remount; then
+        return 1
+    fi
+    # Each step is an offset, a number of bytes and a character. The second 
+    # step appends, and the last starts on a block boundary.
+    for step in "1500017 300 X" "3145728 1000 Y" "2097152 65536 Z"; do
+        read offset count char <<< "$step"
+        fuselog -n "Writing $count '$char's at offset $offset... "
+        if ! head -c $count /dev/zero | tr '\000' $char | dd of="$1" bs=$count count=1 seek=$offset oflag=seek_bytes conv=notrunc status=none; then
+            TEST_RESULT="Command indicated an error when writing at offset $offset"
+            return 1
+        fi
+        head -c $count /dev/zero | tr '\000' $char | dd of="$2" bs=$count count=1 seek=$offset oflag=seek_bytes conv=notrunc status=none
+        fuselog Ok
+    done
+    fuselog -n "Comparing '$1' to the expected contents... "
+    if ! cmp -s "$1" "$2"; then
+        TEST_RESULT="Contents don't match after writing."
+        return 1
+    fi
+    fuselog Ok
+    fuselog -n "Waiting for the upload with fsync... "
+    if ! sync "$1" 2> /dev/null; then
+        TEST_RESULT="sync command indicated failure"
+        return 1
+    fi
+    fuselog Ok
+    if ! fuse_remount; then
+        return 1
+    fi
+    fuselog -n "Comparing '$1' to the expected contents after remounting... "
+    if ! cmp -s "$1" "$2"; then
+        TEST_RESULT="Contents don't match after remounting."
+        return 1
+    fi
+    fuselog Ok
+    TEST_RESULT=""
+    return 0
+}
+
+test_cached_reopen() {
+    # $1 is the filename
+    # $2 is the number of bytes to write
+    # $3 is the character to fill with first
+    # $4 is the character to fill with second
+    # Contents stay cached after a file is closed. Reopening an unchanged file
+    # should give the same contents, and reopening it after it changes (even 
+    # to contents of the same size) shouldn't give the old contents.
+    local i
+    
+    fuselog -n "Writing $2 '$3's to '$1'... "
+    if ! head -c $2 /dev/zero | tr '\000' $3 > "$1" || ! sync "$1"; then
+        TEST_RESULT="Command indicated an error when writing"
+        return 1
+    fi
+    fuselog Ok
+    for i in 1 2; do
+        fuselog "Opening and reading '$1' (time $i)."
+        if ! check_filled "$1" $2 $3; then
+            return 1
+        fi
+    done
+    fuselog -n "Overwriting with $2 '$4's... "
+    if ! head -c $2 /dev/zero | tr '\000' $4 > "$1" || ! sync "$1"; then
+        TEST_RESULT="Command indicated an error when overwriting"
+        return 1
+    fi
+    fuselog Ok
+    fuselog "Reopening after the change."
+    if ! check_filled "$1" $2 $4; then
+        TEST_RESULT="Stale contents after overwriting: $TEST_RESULT"
+        return 1
+    fi
+    if ! fuse_remount; then
+        return 1
+    fi
+    if ! check_filled "$1" $2 $4; then
+        TEST_RESULT="After remounting: $TEST_RESULT"
+        return 1
+    fi
+    TEST_RESULT=""
+    return 0
+}
+
+test_cachedir_remount() {
+    # $1 is the filename
+    # $2 is the number of bytes to write
+    # $3 is the character to fill with first
+    # $4 is the character to fill with second
+    # $5 is an empty directory to use as the cache directory
+    # Mounts with a cache directory, so that contents read before unmounting
+    # are kept for the next mount. They should be used only while the file is
+    # unchanged.
+    local cachedir="$5"
+    
+    if [ "$NOMOUNT" -ne 0 ]; then
+        fuselog -n "Can't set the cache directory without mounting, skipping... "
+        TEST_RESULT=""
+        return 0
+    fi
+    if ! fuse_remount "--cache-dir $cachedir"; then
+        return 1
+    fi
+    fuselog -n "Writing $2 '$3's to '$1'... "
+    if ! head -c $2 /dev/zero | tr '\000' $3 > "$1" || ! sync "$1"; then
+        TEST_RESULT="Command indicated an error when writing"
+        return 1
+    fi
+    fuselog Ok
+    fuselog "Reading '$1' so that its contents are cached."
+    if ! check_filled "$1" $2 $3; then
+        return 1
+    fi
+    if ! fuse_remount "--cache-dir $cachedir"; then
+        return 1
+    fi
+    fuselog -n "Looking for kept contents in '$cachedir'... "
+    if ! [ -f "$cachedir/index" ] || ! ls "$cachedir"/block-* > /dev/null 2>&1; then
+        TEST_RESULT="No index or kept contents in the cache directory after unmounting."
+        return 1
+    fi
+    fuselog Ok
+    fuselog "Reading '$1' after remounting with the same cache directory."
+    if ! check_filled "$1" $2 $3; then
+        return 1
+    fi
+    fuselog -n "Overwriting with $2 '$4's... "
+    if ! head -c $2 /dev/zero | tr '\000' $4 > "$1" || ! sync "$1"; then
+        TEST_RESULT="Command indicated an error when overwriting"
+        return 1
+    fi
+    fuselog Ok
+    if ! fuse_remount "--cache-dir $cachedir"; then
+        return 1
+    fi
+    fuselog "Reading '$1' after it changed."
+    if ! check_filled "$1" $2 $4; then
+        TEST_RESULT="Stale contents from the cache directory: $TEST_RESULT"
+        return 1
+    fi
+    TEST_RESULT=""
+    return 0
+}
+
+test_resumable_upload() {
+    # $1 is the filename
+    # $2 is a local file to hold the expected contents
+    # $3 is the number of bytes to write
+    # Mounts with the smallest chunk size, so that the file is bigger than a
+    # chunk and goes up through a resumable upload session, one piece at a 
+    # time. Random contents catch pieces that are sent out of order or twice.
+    if [ "$NOMOUNT" -ne 0 ]; then
+        fuselog -n "Can't set the chunk size without mounting, skipping... "
+        TEST_RESULT=""
+        return 0
+    fi
+    if ! fuse_remount "--chunk-size 262144"; then
+        return 1
+    fi
+    fuselog -n "Writing $3 random bytes to '$1'... "
+    if ! head -c $3 /dev/urandom > "$2" || ! cp "$2" "$1"; then
+        TEST_RESULT="Command indicated an error when writing"
+        return 1
+    fi
+    fuselog Ok
+    fuselog -n "Waiting for the upload with fsync... "
+    if ! sync "$1" 2> /dev/null; then
+        TEST_RESULT="sync command indicated failure"
+        return 1
+    fi
+    fuselog Ok
+    if ! fuse_remount; then
+        return 1
+    fi
+    fuselog -n "Comparing '$1' to the expected contents after remounting... "
+    if ! cmp -s "$1" "$2"; then
+        TEST_RESULT="Contents don't match after uploading."
+        return 1
+    fi
+    fuselog Ok
+    TEST_RESULT=""
+    return 0
+}
+
+test_parallel_read() {
+    # $1 is the filename
+    # $2 is a local file with the expected contents of $1, at least 5 MiB
+    # Mounts so that each 4 MiB chunk is downloaded over several connections 
+    # at once, then reads part of the file from the middle and the whole file
+    # from the start. Each read has to put the ranges back together in order.
+    local offset=1500000
+    local count=3000000
+    
+    if [ "$NOMOUNT" -ne 0 ]; then
+        fuselog -n "Can't set the number of connections without mounting, skipping... "
+        TEST_RESULT=""
+        return 0
+    fi
+    if ! fuse_remount "--fetch-connections 4 --fetch-policy fixed --chunk-size 4194304"; then
+        return 1
+    fi
+    fuselog -n "Comparing $count bytes at offset $offset of '$1' to the expected contents... "
+    if ! cmp -s <(dd if="$1" bs=$count count=1 skip=$offset iflag=skip_bytes status=none) \
+            <(dd if="$2" bs=$count count=1 skip=$offset iflag=skip_bytes status=none); then
+        TEST_RESULT="Contents don't match reading from the middle of the file."
+        return 1
+    fi
+    fuselog Ok
+    fuselog -n "Comparing all of '$1' to the expected contents... "
+    if ! cmp -s "$1" "$2"; then
+        TEST_RESULT="Contents don't match reading the whole file."
+        return 1
+    fi
+    fuselog Ok
+    TEST_RESULT=""
+    return 0
+}
+
+test_dirty_limit() {
+    # $1 is the directory in which to write files
+    # $2 is the number of files to write, up to 8
+    # $3 is the number of bytes to write to each file
+    # Mounts with a dirty limit smaller than a single file, so each writer has
+    # to wait for earlier uploads to catch up, then checks every file after 
+    # remounting with the default options.
+    local chars=abcdefgh
+    local i
+    
+    if [ "$NOMOUNT" -ne 0 ]; then
+        fuselog -n "Can't set the dirty limit without mounting, skipping... "
+        TEST_RESULT=""
+        return 0
+    fi
+    if ! fuse_remount "--dirty-limit $(($3 / 2))"; then
+        return 1
+    fi
+    for i in $(seq 1 $2); do
+        fuselog -n "Writing $3 '${chars:$i-1:1}'s to '$1/dirty$i'... "
+        if ! head -c $3 /dev/zero | tr '\000' ${chars:$i-1:1} > "$1/dirty$i"; then
+            TEST_RESULT="Command indicated an error when writing '$1/dirty$i'"
+            return 1
+        fi
+        fuselog Ok
+    done
+    if ! fuse_remount; then
+        return 1
+    fi
+    for i in $(seq 1 $2); do
+        if ! check_filled "$1/dirty$i" $3 ${chars:$i-1:1}; then
+            return 1
+        fi
+    done
+    
+    # Cleanup. It doesn't matter whether this fails.
+    fuselog "Cleaning up the written files (will say Ok regardless of success)."
+    for i in $(seq 1 $2); do
+        run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_rm "$1/dirty$i"
+    done
+    fuselog Ok
+    TEST_RESULT=""
+    return 0
+}
+
 
 
 
@@ -765,6 +1177,7 @@ test_rename_clobber() {
 
 
 MOUNTOPTIONS='-f -s'
+FDOPTIONS=""
 TIMESTAMP_FMT='+%Y%m%d%H%M.%S'
 LOGFILE=/dev/null
 ORIGINAL_WORKING_DIR=$(pwd)
@@ -1335,6 +1748,154 @@ fi
 
 
 
+fuselog
+fuselog Background uploads
+fuselog "Creating file to work with"
+if ! run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_create_file; then
+    fuselog "Could not create file, can't test background uploads."
+else
+    fuselog Ok
+    UPLOADFILENAME="$TEST_RESULT"
+    fuselog "Closing, waiting for the upload with fsync, and reading back:"
+    if run_test 1 0 0 test_fsync_readback "$UPLOADFILENAME" 3000000 k; then
+        fuselog Ok
+    else
+        fuselog Failed, continuing on.
+    fi
+    fuselog "Reopening an unchanged file:"
+    if run_test 1 0 0 test_reopen_unchanged "$UPLOADFILENAME" 20000 n; then
+        fuselog Ok
+    else
+        fuselog Failed, continuing on.
+    fi
+    fuselog -n "Cleaning up by deleting '$UPLOADFILENAME' (will say Ok regardless of success)... "
+    run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_rm "$UPLOADFILENAME"
+    fuselog Ok
+    unset UPLOADFILENAME
+fi
+
+fuselog "Throttling writers at the dirty limit:"
+fuselog "Creating directory to work with"
+if ! run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_mkdir; then
+    fuselog "Could not create directory, can't test the dirty limit."
+else
+    fuselog Ok
+    DIRNAME="$TEST_RESULT"
+    if run_test 1 0 0 test_dirty_limit "$DIRNAME" 4 2097152; then
+        fuselog Ok
+    else
+        fuselog Failed, continuing on.
+    fi
+    if [ -n "$FDOPTIONS" ]; then
+        fuselog "Remounting with the default options"
+        run_test 1 0 1 fuse_remount
+    fi
+    fuselog -n "Cleaning up by deleting '$DIRNAME' (will say Ok regardless of success)... "
+    run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_rmdir "$DIRNAME"
+    fuselog Ok
+    unset DIRNAME
+fi
+
+fuselog
+fuselog Writing into uncached parts of a file
+fuselog "Creating file to work with"
+if ! run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_create_file; then
+    fuselog "Could not create file, can't test writing into uncached parts."
+else
+    fuselog Ok
+    WRITEFILENAME="$TEST_RESULT"
+    if ! EXPECTEDFILE=$(mktemp); then
+        fuselog "Could not create a local file for the expected contents, continuing on."
+    else
+        fuselog "Overwriting partway into a block, and appending:"
+        if run_test 1 0 0 test_overwrite_append "$WRITEFILENAME" "$EXPECTEDFILE"; then
+            fuselog Ok
+        else
+            fuselog Failed, continuing on.
+        fi
+        rm -f "$EXPECTEDFILE"
+        unset EXPECTEDFILE
+    fi
+    fuselog -n "Cleaning up by deleting '$WRITEFILENAME' (will say Ok regardless of success)... "
+    run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_rm "$WRITEFILENAME"
+    fuselog Ok
+    unset WRITEFILENAME
+fi
+
+fuselog
+fuselog Large uploads and downloads
+fuselog "Creating file to work with"
+if ! run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_create_file; then
+    fuselog "Could not create file, can't test large uploads and downloads."
+else
+    fuselog Ok
+    LARGEFILENAME="$TEST_RESULT"
+    if ! EXPECTEDFILE=$(mktemp); then
+        fuselog "Could not create a local file for the expected contents, continuing on."
+    else
+        fuselog "Uploading a file bigger than one chunk:"
+        if run_test 1 0 0 test_resumable_upload "$LARGEFILENAME" "$EXPECTEDFILE" 6000000; then
+            fuselog Ok
+            fuselog "Reading over several connections:"
+            if run_test 1 0 0 test_parallel_read "$LARGEFILENAME" "$EXPECTEDFILE"; then
+                fuselog Ok
+            else
+                fuselog Failed, continuing on.
+            fi
+        else
+            fuselog Failed, continuing on.
+        fi
+        if [ -n "$FDOPTIONS" ]; then
+            fuselog "Remounting with the default options"
+            run_test 1 0 1 fuse_remount
+        fi
+        rm -f "$EXPECTEDFILE"
+        unset EXPECTEDFILE
+    fi
+    fuselog -n "Cleaning up by deleting '$LARGEFILENAME' (will say Ok regardless of success)... "
+    run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_rm "$LARGEFILENAME"
+    fuselog Ok
+    unset LARGEFILENAME
+fi
+
+fuselog
+fuselog Content cache
+fuselog "Creating file to work with"
+if ! run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_create_file; then
+    fuselog "Could not create file, can't test the content cache."
+else
+    fuselog Ok
+    CACHEFILENAME="$TEST_RESULT"
+    fuselog "Reopening a cached file, before and after it changes:"
+    if run_test 1 0 0 test_cached_reopen "$CACHEFILENAME" 2500000 c h; then
+        fuselog Ok
+    else
+        fuselog Failed, continuing on.
+    fi
+    fuselog "Remounting with a cache directory:"
+    if ! CACHEDIR=$(mktemp -d); then
+        fuselog "Could not create a cache directory, continuing on."
+    else
+        if run_test 1 0 0 test_cachedir_remount "$CACHEFILENAME" 2500000 p w "$CACHEDIR"; then
+            fuselog Ok
+        else
+            fuselog Failed, continuing on.
+        fi
+        if [ -n "$FDOPTIONS" ]; then
+            fuselog "Remounting with the default options"
+            run_test 1 0 1 fuse_remount
+        fi
+        rm -rf "$CACHEDIR"
+        unset CACHEDIR
+    fi
+    fuselog -n "Cleaning up by deleting '$CACHEFILENAME' (will say Ok regardless of success)... "
+    run_test "$DEFAULT_ATTEMPTS" "$DEFAULT_WAIT" 0 test_rm "$CACHEFILENAME"
+    fuselog Ok
+    unset CACHEFILENAME
+fi
+
+
+
 
 
 
@@ -6,6 +6,43 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <limits.h>
+
+
+// Number of slots in a newly created cache node table. Must be a power of 2.
+#define GDRIVE_CNODE_TABLE_INITIAL_SIZE 256
+
+// Longest file ID and checksum read from an index of kept contents
+#define GDRIVE_CNODE_MAX_ID_LENGTH 255
+#define GDRIVE_CNODE_MD5_LENGTH 32
+
+// Most chunks to download ahead of a sequential reader
+#define GDRIVE_CNODE_MAX_READAHEAD 4
+
+// Smallest and largest downloads under GDRIVE_FETCH_ADAPTIVE
+#define GDRIVE_CNODE_MIN_FETCH 65536
+#define GDRIVE_CNODE_MAX_FETCH (64 * GDRIVE_BASE_CHUNK_SIZE)
+
+// Most downloads to start ahead of a sequential reader under 
+// GDRIVE_FETCH_ADAPTIVE (each one is larger than under GDRIVE_FETCH_FIXED)
+#define GDRIVE_CNODE_MAX_ADAPTIVE_READAHEAD 2
+
+// Most chunks a node can hold before writes into uncached parts of the file 
+// download the block around them rather than starting another chunk. Every 
+// chunk holds a file descriptor, and written chunks are never evicted.
+#define GDRIVE_CNODE_MAX_WRITE_CHUNKS 32
+
+// Number of threads uploading closed files in the background, the number of
+// times each upload is attempted before giving up, and the number of seconds
+// to wait before the first retry (doubled for each one after that)
+#define GDRIVE_CNODE_UPLOAD_WORKERS 2
+#define GDRIVE_CNODE_UPLOAD_TRIES 3
+#define GDRIVE_CNODE_UPLOAD_RETRY_DELAY 5
+
+// Size of each piece of a file relayed from Google Drive while uploading (see
+// Gdrive_Cnode_Relay)
+#define GDRIVE_CNODE_RELAY_SIZE (16 * GDRIVE_BASE_CHUNK_SIZE)
 
 
 /*************************************************************************
@@ -13,6 +50,54 @@
  * this file
  *************************************************************************/
 
+/*
+ * Recent reads of a file, which a fetch policy (see gdrive_cnode_fetch_policy)
+ * uses to decide how much to download.
+ */
+typedef struct Gdrive_Cnode_Access
+{
+    // The last read
+    off_t lastOffset;
+    size_t lastSize;
+    // Number of reads in a row that started where the one before ended (0 if 
+    // the last read didn't), and the number of bytes read since the last read
+    // that didn't
+    int sequentialReads;
+    size_t sequentialBytes;
+    // Distance between the starts of the last two reads, and the number of 
+    // reads in a row before that which were the same distance apart
+    off_t stride;
+    int stridedReads;
+} Gdrive_Cnode_Access;
+
+/*
+ * How much of a file to download for the current read, as decided by a fetch
+ * policy.
+ */
+typedef struct Gdrive_Cnode_Fetch
+{
+    // A read that misses the cache downloads the blocks of this size that it 
+    // touches.
+    size_t fillSize;
+    // Ranges to download in the background ahead of the reader: aheadCount 
+    // ranges of aheadSize bytes, the first starting at aheadStart and each
+    // one after that aheadStep bytes after the one before.
+    int aheadCount;
+    off_t aheadStart;
+    size_t aheadSize;
+    off_t aheadStep;
+} Gdrive_Cnode_Fetch;
+
+/*
+ * A fetch policy fills in pFetch based on pAccess (whose last read is the 
+ * current one), the file size and the normal chunk size from 
+ * gdrive_cnode_get_chunksize(). There is one for each enum 
+ * Gdrive_Fetch_Policy value.
+ */
+typedef void (*gdrive_cnode_fetch_policy)(const Gdrive_Cnode_Access* pAccess, 
+                                          size_t fileSize, size_t chunkSize, 
+                                          Gdrive_Cnode_Fetch* pFetch);
+
 typedef struct Gdrive_Cache_Node
 {
     time_t lastUpdateTime;
@@ -21,31 +106,282 @@ typedef struct Gdrive_Cache_Node
     bool dirty;
     bool deleted;
     Gdrive_Fileinfo fileinfo;
-    Gdrive_File_Contents* pContents;
-    struct Gdrive_Cache_Node* pParent;
-    struct Gdrive_Cache_Node* pLeft;
-    struct Gdrive_Cache_Node* pRight;
+    Gdrive_Fcontents_Index contents;
+    // The version of the file that contents was downloaded from, used to 
+    // decide whether the contents can be reused when the file is reopened.
+    char* contentsMd5;
+    struct timespec contentsModTime;
+    size_t contentsSize;
+    // Recent reads, used to decide how much to download. Protected by the 
+    // node lock.
+    Gdrive_Cnode_Access access;
+    // URI of the resumable upload session for the current dirty contents, if
+    // an upload was started but didn't finish. Discarded whenever the contents
+    // change. Protected by the node lock.
+    char* uploadSession;
+    // Number of bytes downloaded by the last gdrive_file_sync()
+    size_t syncDownloaded;
+    // True while a background upload worker is syncing the file, so that the
+    // upload's transfers give way to ones somebody is waiting for. Protected
+    // by the node lock.
+    bool backgroundSync;
+    // Negative error number from a background upload that gave up, reported
+    // (and cleared) by the next gdrive_file_sync() or gdrive_file_open().
+    int uploadError;
+    // Protects pContents and the on-disk cached contents, and makes sure only
+    // one thread at a time reads, writes or uploads the file. Everything else
+    // in the node is protected by the cache lock. If both locks are needed, 
+    // this one must be acquired first.
+    pthread_mutex_t mutex;
 } Gdrive_Cache_Node;
 
-static Gdrive_Cache_Node* gdrive_cnode_create(Gdrive_Cache_Node* pParent);
+/*
+ * One slot in a Gdrive_Cnode_Table. The hash of the file ID is stored 
+ * alongside the node pointer so that probing rarely needs to look at the node
+ * itself. A slot with a NULL pNode is empty.
+ */
+typedef struct Gdrive_Cnode_Table_Entry
+{
+    size_t hash;
+    Gdrive_Cache_Node* pNode;
+} Gdrive_Cnode_Table_Entry;
+
+/*
+ * An open addressing hash table (with linear probing) of cache nodes, keyed by
+ * file ID. The capacity is always a power of 2.
+ */
+typedef struct Gdrive_Cnode_Table
+{
+    Gdrive_Cnode_Table_Entry* pEntries;
+    size_t capacity;
+    size_t count;
+} Gdrive_Cnode_Table;
+
+/*
+ * A file waiting to be uploaded by the background upload workers. The file 
+ * stays open (with the flags it was opened with) until the upload is done, 
+ * which keeps the node and its dirty contents in the cache.
+ */
+typedef struct Gdrive_Cnode_Upload
+{
+    Gdrive_Cache_Node* pNode;
+    int flags;
+    size_t size;
+    int tryNum;
+    // Don't try again before this time, after a failed attempt
+    time_t retryTime;
+    struct Gdrive_Cnode_Upload* pNext;
+} Gdrive_Cnode_Upload;
+
+/*
+ * Files closed with dirty data are uploaded in the order they were closed, by
+ * worker threads that are started when the first file is queued. All members
+ * are protected by mutex.
+ */
+typedef struct Gdrive_Cnode_Upload_Queue
+{
+    Gdrive_Cnode_Upload* pFirst;
+    Gdrive_Cnode_Upload* pLast;
+    // Total size of the queued files, including ones being uploaded
+    size_t queuedBytes;
+    pthread_t workers[GDRIVE_CNODE_UPLOAD_WORKERS];
+    bool running;
+    bool stopping;
+    pthread_mutex_t mutex;
+    // Signaled when a file is queued, and when the workers should stop
+    pthread_cond_t queuedCond;
+    // Signaled when an upload is finished
+    pthread_cond_t doneCond;
+} Gdrive_Cnode_Upload_Queue;
+
+/*
+ * Any part of a file that isn't cached when it's uploaded hasn't been written
+ * (writing caches it first), so it's the same as the copy on Google Drive. 
+ * Rather than downloading such parts into the cache before sending them, 
+ * gdrive_file_sync() relays them through memory, one piece at a time, 
+ * downloading the next piece in the background while the current one is sent.
+ */
+typedef struct Gdrive_Cnode_Relay
+{
+    // The current piece, which starts at start
+    Gdrive_Download_Buffer* pBuf;
+    off_t start;
+    // The download of the next piece, if one has been started
+    Gdrive_Transfer* pNext;
+    off_t nextStart;
+    size_t nextLength;
+    // Total bytes downloaded
+    size_t bytesDownloaded;
+} Gdrive_Cnode_Relay;
+
+/*
+ * The part of a file sent by gdrive_file_uploadcallback().
+ */
+typedef struct Gdrive_Cnode_Upload_Range
+{
+    Gdrive_Cache_Node* pNode;
+    off_t start;
+    size_t length;
+    Gdrive_Cnode_Relay* pRelay;
+} Gdrive_Cnode_Upload_Range;
+
+static Gdrive_Cache_Node* gdrive_cnode_create(void);
+
+/*
+ * Returns the index of the slot holding fileId, or of the empty slot where it
+ * would be inserted. The table must have at least one empty slot.
+ */
+static size_t gdrive_cnode_table_find_slot(const Gdrive_Cnode_Table* pTable, 
+                                           const char* fileId, size_t hash);
 
-static void gdrive_cnode_swap(Gdrive_Cache_Node** ppFromParentOne, 
-                              Gdrive_Cache_Node* pNodeOne, 
-                              Gdrive_Cache_Node** ppFromParentTwo, 
-                              Gdrive_Cache_Node* pNodeTwo);
+/*
+ * Returns 0 on success, other on failure.
+ */
+static int gdrive_cnode_table_grow(Gdrive_Cnode_Table* pTable);
 
 static void gdrive_cnode_free(Gdrive_Cache_Node* pNode);
 
+static size_t gdrive_cnode_get_size(Gdrive_Cache_Node* pNode);
+
+static void gdrive_cnode_set_size(Gdrive_Cache_Node* pNode, size_t size);
+
 static Gdrive_File_Contents* 
-gdrive_cnode_add_contents(Gdrive_Cache_Node* pNode);
+gdrive_cnode_add_contents(Gdrive_Cache_Node* pNode, off_t start);
+
+/*
+ * Records the current version of the file as the version of the cached 
+ * contents. Must be called while holding the cache lock.
+ */
+static void gdrive_cnode_save_contents_version(Gdrive_Cache_Node* pNode);
+
+/*
+ * Returns true if the cached contents were downloaded from the current version
+ * of the file. Must be called while holding the cache lock.
+ */
+static bool gdrive_cnode_contents_current(const Gdrive_Cache_Node* pNode);
+
+/*
+ * Discards the least recently used chunks of any files until the total size
+ * of all cached contents fits within gdrive_get_contentcachesize(). Chunks 
+ * belonging to pKeep (which can be NULL), to files with dirty data, or to files
+ * currently being used by another thread are skipped.
+ */
+static void gdrive_cnode_trim_contents(Gdrive_Cache_Node* pKeep);
+
+/*
+ * Does the work of gdrive_file_close() after any upload is finished: drops 
+ * the open counts, and deletes the node or trims the content cache as needed.
+ */
+static void gdrive_cnode_release(Gdrive_Cache_Node* pNode, int flags);
+
+static Gdrive_Cnode_Upload_Queue* gdrive_cnode_get_upload_queue(void);
+
+/*
+ * Queues a file that was opened with the given flags to be uploaded and 
+ * released in the background. Returns 0 on success, or other if the file 
+ * wasn't queued (because background uploads are turned off, or on error), in
+ * which case the caller still has to upload and release it.
+ */
+static int gdrive_cnode_queue_upload(Gdrive_Cache_Node* pNode, int flags);
+
+/*
+ * Must be called with the queue's mutex held. Returns 0 on success, other on
+ * failure.
+ */
+static int gdrive_cnode_upload_start(Gdrive_Cnode_Upload_Queue* pQueue);
+
+static void* gdrive_cnode_upload_loop(void* arg);
+
+/*
+ * Uploads one queued file. Returns true if the upload is finished (whether or
+ * not it succeeded) and the file has been released, or false if it should be
+ * tried again.
+ */
+static bool gdrive_cnode_upload(Gdrive_Cnode_Upload* pUpload);
+
+/*
+ * Waits until the files queued for upload fit within gdrive_get_dirtylimit().
+ * Must not be called while holding any node lock or the cache lock.
+ */
+static void gdrive_cnode_throttle_writes(void);
 
+/*
+ * Returns the normal chunk size for the file.
+ */
+static size_t gdrive_cnode_get_chunksize(Gdrive_Cache_Node* pNode);
+
+/*
+ * Fills in pFetch for the node's most recent read, using the policy from 
+ * gdrive_get_fetchpolicy().
+ */
+static void gdrive_cnode_get_fetch(Gdrive_Cache_Node* pNode, 
+                                   Gdrive_Cnode_Fetch* pFetch);
+
+/*
+ * Returns the granularity for downloading new chunks, as decided by the fetch
+ * policy (see gdrive_cnode_get_fetch()).
+ */
+static size_t gdrive_cnode_get_fillsize(Gdrive_Cache_Node* pNode);
+
+/*
+ * The fetch policies. gdrive_cnode_fetch_fixed() is GDRIVE_FETCH_FIXED, and 
+ * gdrive_cnode_fetch_adaptive() is GDRIVE_FETCH_ADAPTIVE.
+ */
+static void gdrive_cnode_fetch_fixed(const Gdrive_Cnode_Access* pAccess, 
+                                     size_t fileSize, size_t chunkSize, 
+                                     Gdrive_Cnode_Fetch* pFetch);
+
+static void gdrive_cnode_fetch_adaptive(const Gdrive_Cnode_Access* pAccess, 
+                                        size_t fileSize, size_t chunkSize, 
+                                        Gdrive_Cnode_Fetch* pFetch);
+
+/*
+ * If inBackground is true (only meaningful with fillChunk), the download is 
+ * only started, and the chunk must be finished with gdrive_cnode_find_chunk()
+ * before it's used.
+ */
 static Gdrive_File_Contents* 
 gdrive_cnode_create_chunk(Gdrive_Cache_Node* pNode, off_t offset, size_t size, 
-                          bool fillChunk);
+                          bool fillChunk, bool inBackground);
+
+/*
+ * Like gdrive_fcontents_find_chunk(), but waits for any background download of
+ * the chunk to finish. A chunk whose download failed is deleted, and NULL is 
+ * returned as if it never existed.
+ */
+static Gdrive_File_Contents* 
+gdrive_cnode_find_chunk(Gdrive_Cache_Node* pNode, off_t offset);
+
+/*
+ * Waits for all of the node's background downloads to finish.
+ */
+static void gdrive_cnode_finish_fills(Gdrive_Cache_Node* pNode);
+
+/*
+ * Records a read of size bytes at offset in the node's access history, and 
+ * starts background downloads of whatever the fetch policy expects to be read
+ * next. Must be called while holding the node lock.
+ */
+static void gdrive_cnode_read_ahead(Gdrive_Cache_Node* pNode, off_t offset, 
+                                    size_t size);
+
+/*
+ * Reads size bytes (which must all be within the file) starting at offset, 
+ * as with gdrive_file_read(). Must be called while holding the node lock.
+ */
+static int gdrive_file_read_chunks(Gdrive_File* fh, char* buf, size_t size, 
+                                   off_t offset);
 
 static size_t gdrive_file_read_next_chunk(Gdrive_File* pNode, char* destBuf, 
                                           off_t offset, size_t size);
 
+/*
+ * Writes size bytes starting at offset, as with gdrive_file_write(). Must be 
+ * called while holding the node lock.
+ */
+static int gdrive_file_write_chunks(Gdrive_File* fh, const char* buf, 
+                                    size_t size, off_t offset);
+
 static off_t gdrive_file_write_next_chunk(Gdrive_File* pFile, const char* buf, 
                                           off_t offset, size_t size);
 
@@ -55,6 +391,84 @@ static bool gdrive_file_check_perm(const Gdrive_Cache_Node* pNode,
 static size_t gdrive_file_uploadcallback(char* buffer, off_t offset, 
                                          size_t size, void* userdata);
 
+/*
+ * Returns the URL for uploading the file's contents, or NULL on memory error.
+ * The caller must free the returned string.
+ */
+static char* gdrive_cnode_get_upload_url(Gdrive_Cache_Node* pNode);
+
+/*
+ * Uploads the whole file in a single request. Returns the server's response on
+ * success. On failure, returns NULL and stores a negative error number at 
+ * pError. Must be called while holding the node lock.
+ */
+static Gdrive_Download_Buffer* 
+gdrive_cnode_sync_simple(Gdrive_Cache_Node* pNode, size_t fileSize, 
+                         Gdrive_Cnode_Relay* pRelay, int* pError);
+
+/*
+ * Uploads the file through a resumable upload session, chunkSize bytes at a 
+ * time, picking up where the server left off after a failure. A session left
+ * behind by an earlier failed call is resumed rather than started over. 
+ * Returns as with gdrive_cnode_sync_simple(). Must be called while holding the
+ * node lock.
+ */
+static Gdrive_Download_Buffer* 
+gdrive_cnode_sync_resumable(Gdrive_Cache_Node* pNode, size_t fileSize, 
+                            size_t chunkSize, Gdrive_Cnode_Relay* pRelay, 
+                            int* pError);
+
+/*
+ * Starts a resumable upload session and stores its URI in the node. Returns 0
+ * on success, other on failure.
+ */
+static int gdrive_cnode_session_start(Gdrive_Cache_Node* pNode, 
+                                      size_t fileSize);
+
+/*
+ * Sends length bytes of the file, starting at start, to the node's upload 
+ * session. If length is 0, nothing is sent, and the response tells how much
+ * the session has already received. Returns NULL on connection or memory 
+ * error.
+ */
+static Gdrive_Download_Buffer* 
+gdrive_cnode_session_put(Gdrive_Cache_Node* pNode, off_t start, size_t length,
+                         size_t fileSize, Gdrive_Cnode_Relay* pRelay);
+
+/*
+ * Returns the number of bytes an upload session has received, given a 308 
+ * response from the session.
+ */
+static off_t gdrive_cnode_session_received(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * Copies up to size bytes of the file, starting at offset, into buffer. The 
+ * bytes from offset to end (inclusive) must not be cached. Returns the number 
+ * of bytes copied, or (size_t)(-1) on error. Must be called while holding the
+ * node lock.
+ */
+static size_t gdrive_cnode_relay_read(Gdrive_Cache_Node* pNode, 
+                                      Gdrive_Cnode_Relay* pRelay, char* buffer,
+                                      off_t offset, size_t size, off_t end);
+
+/*
+ * Creates a transfer to download size bytes of the file starting at start 
+ * into memory. Returns NULL on error.
+ */
+static Gdrive_Transfer* gdrive_cnode_relay_transfer(Gdrive_Cache_Node* pNode, 
+                                                    off_t start, size_t size);
+
+/*
+ * Returns the priority for the transfers that upload the node's contents.
+ */
+static enum Gdrive_Xfer_Priority 
+gdrive_cnode_sync_priority(const Gdrive_Cache_Node* pNode);
+
+/*
+ * Waits for any background download and frees the relay's buffers.
+ */
+static void gdrive_cnode_relay_cleanup(Gdrive_Cnode_Relay* pRelay);
+
 static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo, 
                                                  const char* parentId, 
                                                  const char* filename, 
@@ -69,8 +483,29 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
  * Constructors, factory methods, destructors and similar
  ******************/
 
-Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent, 
-                                    Gdrive_Cache_Node** ppNode, 
+Gdrive_Cnode_Table* gdrive_cnode_table_create(void)
+{
+    Gdrive_Cnode_Table* pTable = malloc(sizeof(Gdrive_Cnode_Table));
+    if (pTable == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    pTable->capacity = GDRIVE_CNODE_TABLE_INITIAL_SIZE;
+    pTable->count = 0;
+    pTable->pEntries = calloc(pTable->capacity, 
+                              sizeof(Gdrive_Cnode_Table_Entry)
+            );
+    if (pTable->pEntries == NULL)
+    {
+        // Memory error
+        free(pTable);
+        return NULL;
+    }
+    return pTable;
+}
+
+Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cnode_Table* pTable, 
                                     const char* fileId, 
                                     bool addIfDoesntExist, 
                                     bool* pAlreadyExists
@@ -81,219 +516,141 @@ Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent,
         *pAlreadyExists = false;
     }
     
-    if (*ppNode == NULL)
+    size_t hash = gdrive_string_hash(fileId);
+    size_t slot = gdrive_cnode_table_find_slot(pTable, fileId, hash);
+    if (pTable->pEntries[slot].pNode != NULL)
     {
-        // Item doesn't exist in the cache. Either fail, or create a new item.
-        if (!addIfDoesntExist)
-        {
-            // Not allowed to create a new item, return failure.
-            return NULL;
-        }
-        // else create a new item.
-        *ppNode = gdrive_cnode_create(pParent);
-        if (*ppNode == NULL)
-        {
-            // Memory error
-            return NULL;
-        }
-        // Convenience to avoid things like "return &((*ppNode)->fileinfo);"
-        Gdrive_Cache_Node* pNode = *ppNode;
-        
-        // Get the fileinfo
-        char* url = malloc(strlen(GDRIVE_URL_FILES) + strlen(fileId) + 2);
-        if (!url)
-        {
-            // Memory error
-            return NULL;
-        }
-        strcpy(url, GDRIVE_URL_FILES);
-        strcat(url, "/");
-        strcat(url, fileId);
-        Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-        if (!pTransfer)
-        {
-            // Memory error
-            return NULL;
-        }
-        if (gdrive_xfer_set_url(pTransfer, url))
-        {
-            // Error, probably memory
-            free(url);
-            return NULL;
-        }
-        free(url);
-        gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
-        Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-        gdrive_xfer_free(pTransfer);
-        if (!pBuf || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
-        {
-            // Download or request error
-            free(pBuf);
-            return NULL;
-        }
-        Gdrive_Json_Object* pObj = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        gdrive_dlbuf_free(pBuf);
-        if (!pObj)
+        // Found it.
+        if (pAlreadyExists != NULL)
         {
-            // Couldn't convert network response to JSON
-            return NULL;
+            *pAlreadyExists = true;
         }
-        gdrive_cnode_update_from_json(pNode, pObj);
-        gdrive_json_kill(pObj);
-
-        return pNode;
+        return pTable->pEntries[slot].pNode;
     }
     
-    // Convenience to avoid things like "&((*ppNode)->pRight)"
-    Gdrive_Cache_Node* pNode = *ppNode;
-    
-    // Root node exists, try to find the fileId in the tree.
-    if (!pNode->fileinfo.id)
+    // Item doesn't exist in the cache. Either fail, or create a new item.
+    if (!addIfDoesntExist)
     {
-        puts("NULL File ID");
+        // Not allowed to create a new item, return failure.
+        return NULL;
     }
-    int cmp = strcmp(fileId, pNode->fileinfo.id);
-    if (cmp == 0)
+    // else create a new item.
+    
+    // Keep the load factor at or below 3/4 so that probe sequences stay short.
+    if ((pTable->count + 1) * 4 > pTable->capacity * 3)
     {
-        // Found it at the current node.
-        if (pAlreadyExists != NULL)
+        if (gdrive_cnode_table_grow(pTable) != 0)
         {
-            *pAlreadyExists = true;
+            // Memory error
+            return NULL;
         }
-        return pNode;
+        slot = gdrive_cnode_table_find_slot(pTable, fileId, hash);
     }
-    else if (cmp < 0)
+    
+    Gdrive_Cache_Node* pNode = gdrive_cnode_create();
+    if (pNode == NULL)
     {
-        // fileId is less than the current node. Look for it on the left.
-        return gdrive_cnode_get(pNode, &(pNode->pLeft), fileId, 
-                                      addIfDoesntExist, pAlreadyExists
-                );
+        // Memory error
+        return NULL;
     }
-    else
+    // Fill in the file ID. The rest of the file information is left empty 
+    // (with a last update time of 0) for the caller to fill in, so that we 
+    // never wait on the network while the cache is locked.
+    pNode->fileinfo.id = malloc(strlen(fileId) + 1);
+    if (pNode->fileinfo.id == NULL)
     {
-        // fileId is greater than the current node. Look for it on the right.
-        return gdrive_cnode_get(pNode, &(pNode->pRight), fileId, 
-                                      addIfDoesntExist, pAlreadyExists
-                );
+        // Memory error
+        gdrive_cnode_free(pNode);
+        return NULL;
     }
+    strcpy(pNode->fileinfo.id, fileId);
+    
+    pTable->pEntries[slot].hash = hash;
+    pTable->pEntries[slot].pNode = pNode;
+    pTable->count++;
+    
+    return pNode;
 }
 
-
-void gdrive_cnode_delete(Gdrive_Cache_Node* pNode, 
-                         Gdrive_Cache_Node** ppToRoot)
+void gdrive_cnode_delete(Gdrive_Cache_Node* pNode, Gdrive_Cnode_Table* pTable)
 {
-    // The address of the pointer aimed at this node. If this is the root node,
-    // then it will be a pointer passed in from outside. Otherwise, it is the
-    // pLeft or pRight member of the parent.
-    Gdrive_Cache_Node** ppFromParent;
-    if (pNode->pParent == NULL)
-    {
-        // This is the root. Take the pointer that was passed in.
-        ppFromParent = ppToRoot;
-    }
-    else
-    {
-        // Not the root. Find whether the node hangs from the left or right side
-        // of its parent.
-        assert(pNode->pParent->pLeft == pNode || 
-                pNode->pParent->pRight == pNode);
-        ppFromParent = (pNode->pParent->pLeft == pNode) ? 
-            &(pNode->pParent->pLeft) : &(pNode->pParent->pRight);
-        
-    }
-    
-    // Simplest special case. pNode has no descendents.  Just delete it, and
-    // set the pointer from the parent to NULL.
-    if (pNode->pLeft == NULL && pNode->pRight == NULL)
-    {
-        *ppFromParent = NULL;
-        gdrive_cnode_free(pNode);
-        return;
-    }
-    
-    // Second special case. pNode has one side empty. Promote the descendent on
-    // the other side into pNode's place.
-    if (pNode->pLeft == NULL)
-    {
-        *ppFromParent = pNode->pRight;
-        pNode->pRight->pParent = pNode->pParent;
-        gdrive_cnode_free(pNode);
-        return;
-    }
-    if (pNode->pRight == NULL)
+    // Find the slot holding the node.
+    size_t mask = pTable->capacity - 1;
+    size_t hole = gdrive_string_hash(pNode->fileinfo.id) & mask;
+    while (pTable->pEntries[hole].pNode != pNode)
     {
-        *ppFromParent = pNode->pLeft;
-        pNode->pLeft->pParent = pNode->pParent;
-        gdrive_cnode_free(pNode);
-        return;
+        assert(pTable->pEntries[hole].pNode != NULL && 
+                "gdrive_cnode_delete(): Node is not in the table"
+            );
+        hole = (hole + 1) & mask;
     }
     
-    // General case with descendents on both sides. Find the node with the 
-    // closest value to pNode in one of its subtrees (leftmost node of the right
-    // subtree, or rightmost node of the left subtree), and switch places with
-    // pNode.  Which side we use doesn't really matter.  We'll rather 
-    // arbitrarily decide to use the same side subtree as the side from which
-    // pNode hangs off its parent (if pNode is on the right side of its parent,
-    // find the leftmost node of the right subtree), and treat the case where
-    // pNode is the root the same as if it were on the left side of its parent.
-    Gdrive_Cache_Node* pSwap = NULL;
-    Gdrive_Cache_Node** ppToSwap = NULL;
-    if (pNode->pParent != NULL && pNode->pParent->pRight == pNode)
+    // Empty the slot, then shift back any following entries that would no 
+    // longer be reachable from their home slots. This keeps every probe 
+    // sequence unbroken without needing tombstones.
+    size_t next = hole;
+    while (true)
     {
-        // Find the leftmost node of the right subtree.
-        pSwap = pNode->pRight;
-        ppToSwap = &(pNode->pRight);
-        while (pSwap->pLeft != NULL)
+        next = (next + 1) & mask;
+        if (pTable->pEntries[next].pNode == NULL)
         {
-            ppToSwap = &(pSwap->pLeft);
-            pSwap = pSwap->pLeft;
+            break;
         }
-    }
-    else
-    {
-        // Find the rightmost node of the left subtree.
-        pSwap = pNode->pLeft;
-        ppToSwap = &(pNode->pLeft);
-        while (pSwap->pRight != NULL)
+        size_t home = pTable->pEntries[next].hash & mask;
+        // The entry can stay where it is if its home slot lies cyclically 
+        // within (hole, next].
+        bool canStay = (hole < next) ? 
+            (home > hole && home <= next) : 
+            (home > hole || home <= next);
+        if (!canStay)
         {
-            ppToSwap = &(pSwap->pRight);
-            pSwap = pSwap->pRight;
+            pTable->pEntries[hole] = pTable->pEntries[next];
+            hole = next;
         }
     }
+    pTable->pEntries[hole].pNode = NULL;
+    pTable->pEntries[hole].hash = 0;
+    pTable->count--;
     
-    // Swap the nodes
-    gdrive_cnode_swap(ppFromParent, pNode, ppToSwap, pSwap);
-    
-    // Now delete the node from its new position.
-    gdrive_cnode_delete(pNode, ppToRoot);
+    gdrive_cnode_free(pNode);
 }
 
 void gdrive_cnode_mark_deleted(Gdrive_Cache_Node* pNode, 
-                               Gdrive_Cache_Node** ppToRoot
+                               Gdrive_Cnode_Table* pTable
 )
 {
+    if (pNode->deleted)
+    {
+        // Already marked, and will be (or already has been) deleted by 
+        // somebody else.
+        return;
+    }
     pNode->deleted = true;
     if (pNode->openCount == 0)
     {
-        gdrive_cnode_delete(pNode, ppToRoot);
+        gdrive_cnode_delete(pNode, pTable);
     }
 }
 
-void gdrive_cnode_free_all(Gdrive_Cache_Node* pRoot)
+void gdrive_cnode_table_free(Gdrive_Cnode_Table* pTable)
 {
-    if (pRoot == NULL)
+    if (pTable == NULL)
     {
         // Nothing to do.
         return;
     }
     
-    // Free all the descendents first.
-    gdrive_cnode_free_all(pRoot->pLeft);
-    gdrive_cnode_free_all(pRoot->pRight);
+    // Free all the nodes first.
+    for (size_t i = 0; i < pTable->capacity; i++)
+    {
+        if (pTable->pEntries[i].pNode != NULL)
+        {
+            gdrive_cnode_free(pTable->pEntries[i].pNode);
+        }
+    }
     
-    // Free the root node
-    gdrive_cnode_free(pRoot);
+    free(pTable->pEntries);
+    free(pTable);
 }
 
 
@@ -341,48 +698,183 @@ void gdrive_cnode_delete_file_contents(Gdrive_Cache_Node* pNode,
                                 Gdrive_File_Contents* pContents
 )
 {
-    gdrive_fcontents_delete(pContents, &(pNode->pContents));
+    gdrive_fcontents_delete(pContents, &(pNode->contents));
 }
 
-bool gdrive_cnode_is_dirty(const Gdrive_Cache_Node* pNode)
+void gdrive_cnode_invalidate(Gdrive_Cache_Node* pNode)
 {
-    return pNode->dirty;
+    pNode->lastUpdateTime = (time_t) 0;
 }
 
-bool gdrive_cnode_isdeleted(const Gdrive_Cache_Node* pNode)
+bool gdrive_cnode_is_dirty(const Gdrive_Cache_Node* pNode)
 {
-    assert(pNode != NULL);
-    return pNode->deleted;
+    return pNode->dirty || pNode->fileinfo.dirtyMetainfo;
 }
 
-
-/*************************************************************************
- * Public functions to support Gdrive_File usage
- *************************************************************************/
-
-Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError)
+void gdrive_cnode_discard_stale_contents(Gdrive_Cache_Node* pNode)
 {
-    assert(fileId != NULL && pError != NULL);
-    
-    // Get the cache node from the cache if it exists.  If it doesn't exist,
-    // don't make a node with an empty Gdrive_Fileinfo.  Instead, use 
-    // gdrive_file_info_from_id() to create the node and fill out the struct, 
-    // then try again to get the node.
-    Gdrive_Cache_Node* pNode;
-    while ((pNode = gdrive_cache_get_node(fileId, false, NULL)) == NULL)
+    if (gdrive_fcontents_get_count(&(pNode->contents)) == 0 || 
+            pNode->dirty || pNode->openCount > 0)
     {
-        if (gdrive_finfo_get_by_id(fileId) == NULL)
-        {
-            // Problem getting the file info.  Return failure.
-            *pError = ENOENT;
-            return NULL;
-        }
+        // Nothing to discard, or somebody is using the file
+        return;
     }
     
-    // If the file is deleted, existing filehandles will still work, but nobody
-    // new can open it.
-    if (gdrive_cnode_isdeleted(pNode))
+    // The caller holds the cache lock, so only try for the node lock.
+    if (pthread_mutex_trylock(&pNode->mutex) != 0)
     {
+        return;
+    }
+    if (!gdrive_cnode_contents_current(pNode))
+    {
+        gdrive_fcontents_free_all(&(pNode->contents));
+    }
+    pthread_mutex_unlock(&pNode->mutex);
+}
+
+void gdrive_cnode_table_keep_contents(Gdrive_Cnode_Table* pTable, 
+                                      FILE* indexFile
+)
+{
+    for (size_t i = 0; i < pTable->capacity; i++)
+    {
+        Gdrive_Cache_Node* pNode = pTable->pEntries[i].pNode;
+        
+        // Only keep contents that match a known version of the file. If we
+        // know the file has a different checksum now, the contents are stale.
+        if (pNode == NULL || pNode->dirty || pNode->contentsMd5 == NULL || 
+                (pNode->fileinfo.md5Checksum != NULL && 
+                strcmp(pNode->fileinfo.md5Checksum, pNode->contentsMd5) != 0)
+                )
+        {
+            continue;
+        }
+        
+        size_t count = gdrive_fcontents_get_count(&(pNode->contents));
+        for (size_t position = 0; position < count; position++)
+        {
+            Gdrive_File_Contents* pContents = 
+                    gdrive_fcontents_get_chunk(&(pNode->contents), position);
+            if (gdrive_fcontents_keep(pContents, pNode->contentsMd5) == 0)
+            {
+                fprintf(indexFile, "%s %zu %s %lld %lld\n", 
+                        pNode->fileinfo.id, pNode->contentsSize, 
+                        pNode->contentsMd5, 
+                        (long long) gdrive_fcontents_get_start(pContents), 
+                        (long long) gdrive_fcontents_get_end(pContents)
+                );
+            }
+        }
+    }
+}
+
+int gdrive_cnode_table_load_contents(Gdrive_Cnode_Table* pTable, 
+                                     FILE* indexFile
+)
+{
+    char fileId[GDRIVE_CNODE_MAX_ID_LENGTH + 1];
+    char md5[GDRIVE_CNODE_MD5_LENGTH + 1];
+    size_t fileSize;
+    long long start;
+    long long end;
+    while (fscanf(indexFile, "%255s %zu %32s %lld %lld\n", 
+                  fileId, &fileSize, md5, &start, &end) == 5)
+    {
+        Gdrive_Cache_Node* pNode = gdrive_cnode_get(pTable, fileId, true, NULL);
+        if (pNode == NULL)
+        {
+            // Memory error
+            return -1;
+        }
+        
+        if (gdrive_fcontents_get_count(&(pNode->contents)) == 0)
+        {
+            // First chunk for this file. Remember which version it holds.
+            free(pNode->contentsMd5);
+            pNode->contentsMd5 = malloc(strlen(md5) + 1);
+            if (pNode->contentsMd5 == NULL)
+            {
+                // Memory error
+                return -1;
+            }
+            strcpy(pNode->contentsMd5, md5);
+            pNode->contentsSize = fileSize;
+        }
+        else if (pNode->contentsMd5 == NULL || 
+                strcmp(pNode->contentsMd5, md5) != 0)
+        {
+            // A chunk from a different version of the same file
+            continue;
+        }
+        
+        // If the chunk is gone (or overlaps one we already have), just skip
+        // it.
+        gdrive_fcontents_add_kept(&(pNode->contents), pNode, md5, start, end);
+    }
+    return 0;
+}
+
+bool gdrive_cnode_isdeleted(const Gdrive_Cache_Node* pNode)
+{
+    assert(pNode != NULL);
+    return pNode->deleted;
+}
+
+void gdrive_cnode_upload_cleanup(void)
+{
+    Gdrive_Cnode_Upload_Queue* pQueue = gdrive_cnode_get_upload_queue();
+    pthread_mutex_lock(&pQueue->mutex);
+    if (!pQueue->running)
+    {
+        // Nothing to do
+        pthread_mutex_unlock(&pQueue->mutex);
+        return;
+    }
+    pQueue->stopping = true;
+    pthread_cond_broadcast(&pQueue->queuedCond);
+    pthread_mutex_unlock(&pQueue->mutex);
+    
+    // The workers empty the queue before they stop.
+    for (int i = 0; i < GDRIVE_CNODE_UPLOAD_WORKERS; i++)
+    {
+        pthread_join(pQueue->workers[i], NULL);
+    }
+    
+    pthread_mutex_lock(&pQueue->mutex);
+    pQueue->running = false;
+    pQueue->stopping = false;
+    pthread_cond_broadcast(&pQueue->doneCond);
+    pthread_mutex_unlock(&pQueue->mutex);
+}
+
+
+/*************************************************************************
+ * Public functions to support Gdrive_File usage
+ *************************************************************************/
+
+Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError)
+{
+    assert(fileId != NULL && pError != NULL);
+    
+    // Make sure the file's information is in the cache (this creates the 
+    // cache node and fills out the struct if needed).
+    if (gdrive_finfo_get_by_id(fileId) == NULL)
+    {
+        // Problem getting the file info.  Return failure.
+        *pError = ENOENT;
+        return NULL;
+    }
+    
+    // Hold the cache lock so the node can't be removed out from under us 
+    // before the open count is incremented.
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = gdrive_cache_get_node(fileId, false, NULL);
+    
+    // If the file is deleted, existing filehandles will still work, but nobody
+    // new can open it.
+    if (pNode == NULL || gdrive_cnode_isdeleted(pNode))
+    {
+        gdrive_cache_unlock();
         *pError = ENOENT;
         return NULL;
     }
@@ -391,6 +883,7 @@ Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError)
     if (pNode->fileinfo.type == GDRIVE_FILETYPE_FOLDER)
     {
         // Return failure
+        gdrive_cache_unlock();
         *pError = EISDIR;
         return NULL;
     }
@@ -399,10 +892,20 @@ Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError)
     if (!gdrive_file_check_perm(pNode, flags))
     {
         // Access error
+        gdrive_cache_unlock();
         *pError = EACCES;
         return NULL;
     }
     
+    // Report a background upload that gave up, once.
+    if (pNode->uploadError != 0)
+    {
+        *pError = -pNode->uploadError;
+        pNode->uploadError = 0;
+        gdrive_cache_unlock();
+        return NULL;
+    }
+    
     
     // Increment the open counter
     pNode->openCount++;
@@ -412,6 +915,20 @@ Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError)
         // Open for writing
         pNode->openWrites++;
     }
+    gdrive_cache_unlock();
+    
+    // Contents kept from an earlier open can only be reused if the file hasn't
+    // changed since they were downloaded.
+    pthread_mutex_lock(&pNode->mutex);
+    gdrive_cache_lock();
+    bool stale = (gdrive_fcontents_get_count(&(pNode->contents)) > 0 && 
+            !pNode->dirty && !gdrive_cnode_contents_current(pNode));
+    gdrive_cache_unlock();
+    if (stale)
+    {
+        gdrive_fcontents_free_all(&(pNode->contents));
+    }
+    pthread_mutex_unlock(&pNode->mutex);
     
     // Return a pointer to the cache node (which is typedef'ed to 
     // Gdrive_Filehandle)
@@ -432,33 +949,70 @@ void gdrive_file_close(Gdrive_File* pFile, int flags)
     {
         // Was opened for writing
         
-        // Upload any changes back to Google Drive
+        // Upload any changes back to Google Drive. If the upload workers take
+        // the file, they finish closing it once it's uploaded.
+        gdrive_cache_lock();
+        bool dirty = gdrive_cnode_is_dirty(pNode);
+        gdrive_cache_unlock();
+        if (dirty && gdrive_cnode_queue_upload(pNode, flags) == 0)
+        {
+            return;
+        }
+        
+        pthread_mutex_lock(&pNode->mutex);
         gdrive_file_sync(pFile);
         gdrive_file_sync_metadata(pFile);
-        
-        // Close the file
-        pNode->openWrites--;
+        pthread_mutex_unlock(&pNode->mutex);
     }
     
-    // Decrement open file counts.
-    pNode->openCount--;
+    gdrive_cnode_release(pNode, flags);
+}
+
+int gdrive_file_read(Gdrive_File* fh, char* buf, size_t size, off_t offset)
+{
+    assert(fh != NULL && offset >= (off_t) 0);
+    
+    // Make sure we have at least read access for the file.
+    if (!gdrive_file_check_perm(fh, O_RDONLY))
+    {
+        // Access error
+        return -EACCES;
+    }
     
+    pthread_mutex_lock(&fh->mutex);
     
-    // Get rid of any downloaded temp files if they aren't needed.
-    // TODO: Consider keeping some closed files around in case they're reopened
-    if (pNode->openCount == 0)
+    // Starting offset must be within the file
+    size_t fileSize = gdrive_cnode_get_size(fh);
+    if (offset >= (off_t) fileSize)
     {
-        gdrive_fcontents_free_all(&(pNode->pContents));
-        if (gdrive_cnode_isdeleted(pNode))
-        {
-            gdrive_cache_delete_node(pNode);
-        }
+        pthread_mutex_unlock(&fh->mutex);
+        return 0;
+    }
+    
+    // Don't read past the current file size
+    size_t realSize = (size + offset <= fileSize) ? 
+        size : fileSize - offset;
+    
+    // Reads without a buffer only load chunks for writing or truncating, so
+    // leave them out of sequential read detection.
+    if (buf != NULL)
+    {
+        gdrive_cnode_read_ahead(fh, offset, realSize);
     }
+    
+    int returnVal = gdrive_file_read_chunks(fh, buf, realSize, offset);
+    
+    pthread_mutex_unlock(&fh->mutex);
+    return returnVal;
 }
 
-int gdrive_file_read(Gdrive_File* fh, char* buf, size_t size, off_t offset)
+int gdrive_file_read_fd(Gdrive_File* fh, size_t size, off_t offset, 
+                        int* pFd, off_t* pFdOffset, char** pBuf)
 {
-    assert(fh != NULL && offset >= (off_t) 0);
+    assert(fh != NULL && offset >= (off_t) 0 && 
+            pFd != NULL && pFdOffset != NULL && pBuf != NULL);
+    *pFd = -1;
+    *pBuf = NULL;
     
     // Make sure we have at least read access for the file.
     if (!gdrive_file_check_perm(fh, O_RDONLY))
@@ -467,46 +1021,63 @@ int gdrive_file_read(Gdrive_File* fh, char* buf, size_t size, off_t offset)
         return -EACCES;
     }
     
-    off_t nextOffset = offset;
-    off_t bufferOffset = 0;
+    pthread_mutex_lock(&fh->mutex);
     
     // Starting offset must be within the file
-    if (offset >= (off_t) fh->fileinfo.size)
+    size_t fileSize = gdrive_cnode_get_size(fh);
+    if (offset >= (off_t) fileSize)
     {
+        pthread_mutex_unlock(&fh->mutex);
         return 0;
     }
     
     // Don't read past the current file size
-    size_t realSize = (size + offset <= fh->fileinfo.size) ? 
-        size : fh->fileinfo.size - offset;
+    size_t realSize = (size + offset <= fileSize) ? 
+        size : fileSize - offset;
     
-    size_t bytesRemaining = realSize;
-    while (bytesRemaining > 0)
+    gdrive_cnode_read_ahead(fh, offset, realSize);
+    
+    // Make sure the whole range is cached.
+    int returnVal = gdrive_file_read_chunks(fh, NULL, realSize, offset);
+    if (returnVal < 0)
     {
-        // Read into the current position if we're given a real buffer, or pass
-        // in NULL otherwise
-        char* bufPos = (buf != NULL) ? buf + bufferOffset : NULL;
-        off_t bytesRead = gdrive_file_read_next_chunk(fh, 
-                                                      bufPos,
-                                                      nextOffset, 
-                                                      bytesRemaining
-                );
-        if (bytesRead < 0)
-        {
-            // Read error.  bytesRead is the negative error number
-            return bytesRead;
-        }
-        if (bytesRead == 0)
-        {
-            // EOF. Return the total number of bytes actually read.
-            return realSize - bytesRemaining;
-        }
-        nextOffset += bytesRead;
-        bufferOffset += bytesRead;
-        bytesRemaining -= bytesRead;
+        // Read error
+        pthread_mutex_unlock(&fh->mutex);
+        return returnVal;
+    }
+    
+    Gdrive_File_Contents* pChunk = gdrive_cnode_find_chunk(fh, offset);
+    if (pChunk != NULL && 
+            offset + (off_t) realSize - 1 <= gdrive_fcontents_get_end(pChunk))
+    {
+        // Everything is in one chunk, so the caller can read it from there.
+        *pFd = gdrive_fcontents_dup_fd(pChunk);
+        *pFdOffset = offset - gdrive_fcontents_get_start(pChunk);
+    }
+    if (*pFd >= 0)
+    {
+        pthread_mutex_unlock(&fh->mutex);
+        return realSize;
     }
     
-    return realSize;
+    // The range spans chunks (or the descriptor couldn't be duplicated), so
+    // read it into memory instead.
+    *pBuf = malloc(realSize);
+    if (*pBuf == NULL)
+    {
+        // Memory error
+        pthread_mutex_unlock(&fh->mutex);
+        return -ENOMEM;
+    }
+    returnVal = gdrive_file_read_chunks(fh, *pBuf, realSize, offset);
+    if (returnVal < 0)
+    {
+        free(*pBuf);
+        *pBuf = NULL;
+    }
+    
+    pthread_mutex_unlock(&fh->mutex);
+    return returnVal;
 }
 
 int gdrive_file_write(Gdrive_File* fh, 
@@ -524,41 +1095,20 @@ int gdrive_file_write(Gdrive_File* fh,
         return -EACCES;
     }
     
-    // Read any needed chunks into the cache.
-    off_t readOffset = offset;
-    size_t readSize = size;
-    if (offset == (off_t) gdrive_file_get_info(fh)->size)
-    {
-        if (readOffset > 0)
-        {
-            readOffset--;
-        }
-        readSize++;
-    }
-    gdrive_file_read(fh, NULL, readSize, readOffset);
+    // Don't let writers get too far ahead of the background uploads.
+    gdrive_cnode_throttle_writes();
     
-    off_t nextOffset = offset;
-    off_t bufferOffset = 0;
-    size_t bytesRemaining = size;
+    pthread_mutex_lock(&fh->mutex);
     
-    while (bytesRemaining > 0)
-    {
-        off_t bytesWritten = gdrive_file_write_next_chunk(fh, 
-                                                          buf + bufferOffset,
-                                                          nextOffset, 
-                                                          bytesRemaining
-                );
-        if (bytesWritten < 0)
-        {
-            // Write error.  bytesWritten is the negative error number
-            return bytesWritten;
-        }
-        nextOffset += bytesWritten;
-        bufferOffset += bytesWritten;
-        bytesRemaining -= bytesWritten;
-    }
+    // Writes don't need the old contents of what they overwrite, so uncached
+    // parts of the file are usually written without downloading anything, 
+    // even when the write starts partway into a block. The rest of such a 
+    // block stays uncached and is downloaded by the first read that needs it.
+    // See gdrive_file_write_next_chunk() for the exception.
+    int returnVal = gdrive_file_write_chunks(fh, buf, size, offset);
     
-    return size;
+    pthread_mutex_unlock(&fh->mutex);
+    return (returnVal >= 0) ? (int) size : returnVal;
 }
 
 int gdrive_file_truncate(Gdrive_File* fh, off_t size)
@@ -580,18 +1130,22 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
         return -EACCES;
     }
     
+    pthread_mutex_lock(&fh->mutex);
+    size_t fileSize = gdrive_cnode_get_size(fh);
+    
     // Case A: Do nothing, return success.
-    if (fh->fileinfo.size == (size_t) size)
+    if (fileSize == (size_t) size)
     {
+        pthread_mutex_unlock(&fh->mutex);
         return 0;
     }
     
     // Case B: Delete all cached file contents, set the length to 0.
     if (size == 0)
     {
-        gdrive_fcontents_free_all(&(fh->pContents));
-        fh->fileinfo.size = 0;
-        fh->dirty = true;
+        gdrive_fcontents_free_all(&(fh->contents));
+        gdrive_cnode_set_size(fh, 0);
+        pthread_mutex_unlock(&fh->mutex);
         return 0;
     }
     
@@ -600,32 +1154,31 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
     // file's length.
     
     Gdrive_File_Contents* pFinalChunk = NULL;
-    if (fh->fileinfo.size < (size_t) size)
+    if (fileSize < (size_t) size)
     {
         // File is being lengthened. The current final chunk will remain final.
-        if (fh->fileinfo.size > 0)
+        if (fileSize > 0)
         {
             // If the file is non-zero length, read the last byte of the file to
             // cache it.
-            if (gdrive_file_read(fh, NULL, 1, fh->fileinfo.size - 1) < 0)
+            if (gdrive_file_read(fh, NULL, 1, fileSize - 1) < 0)
             {
                 // Read error
+                pthread_mutex_unlock(&fh->mutex);
                 return -EIO;
             }
             
             // Grab the final chunk
-            pFinalChunk = gdrive_fcontents_find_chunk(fh->pContents, 
-                                                      fh->fileinfo.size - 1
-                    );
+            pFinalChunk = gdrive_cnode_find_chunk(fh, fileSize - 1);
         }
         else
         {
             // The file is zero-length to begin with. If a chunk exists, use it,
             // but we'll probably need to create one.
-            if ((pFinalChunk = gdrive_fcontents_find_chunk(fh->pContents, 0))
-                    == NULL)
+            if ((pFinalChunk = gdrive_cnode_find_chunk(fh, 0)) == NULL)
             {
-                pFinalChunk = gdrive_cnode_create_chunk(fh, 0, size, false);
+                pFinalChunk = 
+                        gdrive_cnode_create_chunk(fh, 0, size, false, false);
             }
         }
     }
@@ -639,20 +1192,22 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
         if (gdrive_file_read(fh, NULL, 1, size - 1) < 0)
         {
             // Read error
+            pthread_mutex_unlock(&fh->mutex);
             return -EIO;
         }
         
         // Grab the final chunk
-        pFinalChunk = gdrive_fcontents_find_chunk(fh->pContents, size - 1);
+        pFinalChunk = gdrive_cnode_find_chunk(fh, size - 1);
         
         // Delete any chunks past the new EOF
-        gdrive_fcontents_delete_after_offset(&(fh->pContents), size - 1);
+        gdrive_fcontents_delete_after_offset(&(fh->contents), size - 1);
     }
     
     // Make sure we received the final chunk
     if (pFinalChunk == NULL)
     {
         // Error
+        pthread_mutex_unlock(&fh->mutex);
         return -EIO;
     }
     
@@ -661,10 +1216,10 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
     if (returnVal == 0)
     {
         // Successfully truncated the chunk. Update the file's size.
-        fh->fileinfo.size = size;
-        fh->dirty = true;
+        gdrive_cnode_set_size(fh, size);
     }
     
+    pthread_mutex_unlock(&fh->mutex);
     return returnVal;
 }
 
@@ -678,71 +1233,76 @@ int gdrive_file_sync(Gdrive_File* fh)
     
     Gdrive_Cache_Node* pNode = fh;
     
-    if (!pNode->dirty)
+    // Hold the node lock for the whole upload, so that nobody can write to the
+    // file while we're sending it.
+    pthread_mutex_lock(&pNode->mutex);
+    
+    // A background upload that gave up is reported here, once, even if this
+    // sync succeeds. The upload workers sync through this function too, so 
+    // they leave the error alone.
+    gdrive_cache_lock();
+    bool dirty = pNode->dirty;
+    int uploadError = 0;
+    if (!pNode->backgroundSync)
+    {
+        uploadError = pNode->uploadError;
+        pNode->uploadError = 0;
+    }
+    gdrive_cache_unlock();
+    if (!dirty)
     {
         // Nothing to do
-        return 0;
+        pthread_mutex_unlock(&pNode->mutex);
+        return uploadError;
     }
     
     // Check for write permissions
     if (!gdrive_file_check_perm(fh, O_RDWR))
     {
+        pthread_mutex_unlock(&pNode->mutex);
         return -EACCES;
     }
     
-    // Just using simple upload for now.
-    // TODO: Consider using resumable upload, possibly only for large files.
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    if (pTransfer == NULL)
-    {
-        // Memory error
-        return -ENOMEM;
-    }
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PUT);
-    
-    // Assemble the URL
-    size_t urlSize = strlen(GDRIVE_URL_UPLOAD) + strlen(pNode->fileinfo.id) + 2;
-    char* url = malloc(urlSize);
-    if (url == NULL)
-    {
-        // Memory error
-        gdrive_xfer_free(pTransfer);
-        return -ENOMEM;
-    }
-    strcpy(url, GDRIVE_URL_UPLOAD);
-    strcat(url, "/");
-    strcat(url, pNode->fileinfo.id);
-    if (gdrive_xfer_set_url(pTransfer, url) != 0)
-    {
-        // Error, probably memory
-        free(url);
-        gdrive_xfer_free(pTransfer);
-        return -ENOMEM;
-    }
-    free(url);
-    
-    // Add query parameter(s)
-    if (gdrive_xfer_add_query(pTransfer, "uploadType", "media") != 0)
-    {
-        // Error, probably memory
-        gdrive_xfer_free(pTransfer);
-        return -ENOMEM;
-    }
-    
-    // Set upload callback
-    gdrive_xfer_set_uploadcallback(pTransfer, gdrive_file_uploadcallback, fh);
-    
-    // Do the transfer
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
-    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400);
+    // Small files go up in a single request. Anything bigger than a chunk 
+    // uses a resumable upload session, so that a failure partway through only
+    // costs the piece that was being sent.
+    size_t fileSize = gdrive_cnode_get_size(pNode);
+    size_t chunkSize = gdrive_cnode_get_chunksize(pNode);
+    int returnVal = 0;
+    Gdrive_Cnode_Relay relay = {0};
+    Gdrive_Download_Buffer* pBuf = (fileSize > chunkSize) ? 
+        gdrive_cnode_sync_resumable(pNode, fileSize, chunkSize, &relay, 
+                                    &returnVal) : 
+        gdrive_cnode_sync_simple(pNode, fileSize, &relay, &returnVal);
+    gdrive_cnode_relay_cleanup(&relay);
+    gdrive_cache_lock();
+    pNode->syncDownloaded = relay.bytesDownloaded;
+    gdrive_cache_unlock();
     if (returnVal == 0)
     {
-        // Success. Clear the dirty flag
+        // Success. The response describes the uploaded file, so the cached
+        // contents can be tagged with its new checksum and reused on the next
+        // open.
+        Gdrive_Json_Object* pObj = 
+                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+        char* md5 = (pObj != NULL) ? 
+            gdrive_json_get_new_string(pObj, "md5Checksum", NULL) : NULL;
+        gdrive_json_kill(pObj);
+        
+        // Clear the dirty flag
+        gdrive_cache_lock();
         pNode->dirty = false;
+        if (md5 != NULL)
+        {
+            free(pNode->fileinfo.md5Checksum);
+            pNode->fileinfo.md5Checksum = md5;
+            gdrive_cnode_save_contents_version(pNode);
+        }
+        gdrive_cache_unlock();
     }
     gdrive_dlbuf_free(pBuf);
-    return returnVal;
+    pthread_mutex_unlock(&pNode->mutex);
+    return (returnVal == 0) ? uploadError : returnVal;
 }
 
 int gdrive_file_sync_metadata(Gdrive_File* fh)
@@ -751,7 +1311,10 @@ int gdrive_file_sync_metadata(Gdrive_File* fh)
     
     Gdrive_Cache_Node* pNode = fh;
     Gdrive_Fileinfo* pFileinfo = &(pNode->fileinfo);
-    if (!pFileinfo->dirtyMetainfo)
+    gdrive_cache_lock();
+    bool dirtyMetainfo = pFileinfo->dirtyMetainfo;
+    gdrive_cache_unlock();
+    if (!dirtyMetainfo)
     {
         // Nothing to sync, do nothing
         return 0;
@@ -765,9 +1328,7 @@ int gdrive_file_sync_metadata(Gdrive_File* fh)
     
     int error = 0;
     char* dummy = 
-        gdrive_file_sync_metadata_or_create(pFileinfo, NULL, NULL, 
-                                            (pFileinfo->type == 
-                                            GDRIVE_FILETYPE_FOLDER), 
+        gdrive_file_sync_metadata_or_create(pFileinfo, NULL, NULL, false, 
                                             &error
     );
     free(dummy);
@@ -786,7 +1347,9 @@ int gdrive_file_set_atime(Gdrive_File* fh, const struct timespec* ts)
         return -EACCES;
     }
 
+    gdrive_cache_lock();
     gdrive_finfo_set_atime(&(pNode->fileinfo), ts);
+    gdrive_cache_unlock();
     return 0;
 }
 
@@ -802,7 +1365,9 @@ int gdrive_file_set_mtime(Gdrive_File* fh, const struct timespec* ts)
         return -EACCES;
     }
 
+    gdrive_cache_lock();
     gdrive_finfo_set_mtime(&(pNode->fileinfo), ts);
+    gdrive_cache_unlock();
     return 0;
 }
 
@@ -847,20 +1412,23 @@ char* gdrive_file_new(const char* path, bool createFolder, int* pError)
         gdrive_path_free(pGpath);
         return NULL;
     }
-    Gdrive_Cache_Node* pFolderNode = 
-            gdrive_cache_get_node(parentId, true, NULL);
-    if (pFolderNode == NULL)
+    if (gdrive_finfo_get_by_id(parentId) == NULL)
     {
-        // Couldn't get a node for the parent folder
+        // Couldn't get information for the parent folder
         *pError = EIO;
         gdrive_path_free(pGpath);
         free(parentId);
         return NULL;
     }
-    const Gdrive_Fileinfo* pFolderinfo = gdrive_cnode_get_fileinfo(pFolderNode);
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pFolderNode = 
+            gdrive_cache_get_node(parentId, false, NULL);
+    const Gdrive_Fileinfo* pFolderinfo = (pFolderNode != NULL) ? 
+        gdrive_cnode_get_fileinfo(pFolderNode) : NULL;
     if (pFolderinfo == NULL || pFolderinfo->type != GDRIVE_FILETYPE_FOLDER)
     {
         // Not an actual folder
+        gdrive_cache_unlock();
         *pError = ENOTDIR;
         gdrive_path_free(pGpath);
         free(parentId);
@@ -871,15 +1439,22 @@ char* gdrive_file_new(const char* path, bool createFolder, int* pError)
     if (!gdrive_file_check_perm(pFolderNode, O_WRONLY))
     {
         // Don't have the needed permission
+        gdrive_cache_unlock();
         *pError = EACCES;
         gdrive_path_free(pGpath);
         free(parentId);
         return NULL;
     }
+    gdrive_cache_unlock();
     
     
     char* fileId = gdrive_file_sync_metadata_or_create(NULL, parentId, filename,
                                                        createFolder, pError);
+    if (fileId != NULL)
+    {
+        // The folder has one more child.
+        gdrive_cache_adjust_childcount(parentId, 1);
+    }
     gdrive_path_free(pGpath);
     free(parentId);
     
@@ -914,10 +1489,33 @@ Gdrive_Fileinfo* gdrive_file_get_info(Gdrive_File* fh)
     return gdrive_cnode_get_fileinfo(pNode);
 }
 
+int gdrive_file_get_info_copy(Gdrive_File* fh, Gdrive_Fileinfo* pDest)
+{
+    assert(fh != NULL && pDest != NULL);
+    
+    Gdrive_Cache_Node* pNode = fh;
+    gdrive_cache_lock();
+    int result = gdrive_finfo_copy(pDest, &(pNode->fileinfo));
+    gdrive_cache_unlock();
+    return result;
+}
+
 unsigned int gdrive_file_get_perms(const Gdrive_File* fh)
 {
     const Gdrive_Cache_Node* pNode = fh;
-    return gdrive_finfo_real_perms(&(pNode->fileinfo));
+    gdrive_cache_lock();
+    unsigned int perms = gdrive_finfo_real_perms(&(pNode->fileinfo));
+    gdrive_cache_unlock();
+    return perms;
+}
+
+size_t gdrive_file_get_syncdownloaded(const Gdrive_File* fh)
+{
+    const Gdrive_Cache_Node* pNode = fh;
+    gdrive_cache_lock();
+    size_t bytes = pNode->syncDownloaded;
+    gdrive_cache_unlock();
+    return bytes;
 }
 
 
@@ -925,323 +1523,1531 @@ unsigned int gdrive_file_get_perms(const Gdrive_File* fh)
  * Implementations of private functions for use within this file
  *************************************************************************/
 
-/*
- * Set pParent to NULL for the root node of the tree (the node that has no
- * parent).
- */
-static Gdrive_Cache_Node* gdrive_cnode_create(Gdrive_Cache_Node* pParent)
+static Gdrive_Cache_Node* gdrive_cnode_create(void)
+{
+    Gdrive_Cache_Node* result = malloc(sizeof(Gdrive_Cache_Node));
+    if (result != NULL)
+    {
+        memset(result, 0, sizeof(Gdrive_Cache_Node));
+        
+        // Recursive, because gdrive_file_sync() reads the file (through the 
+        // upload callback) while holding the lock.
+        pthread_mutexattr_t attr;
+        if (pthread_mutexattr_init(&attr) != 0)
+        {
+            free(result);
+            return NULL;
+        }
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        int error = pthread_mutex_init(&result->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        if (error != 0)
+        {
+            free(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+static size_t gdrive_cnode_table_find_slot(const Gdrive_Cnode_Table* pTable, 
+                                           const char* fileId, size_t hash)
+{
+    size_t mask = pTable->capacity - 1;
+    size_t slot = hash & mask;
+    while (pTable->pEntries[slot].pNode != NULL)
+    {
+        if (pTable->pEntries[slot].hash == hash && 
+                strcmp(pTable->pEntries[slot].pNode->fileinfo.id, fileId) == 0
+                )
+        {
+            // Found it.
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int gdrive_cnode_table_grow(Gdrive_Cnode_Table* pTable)
+{
+    size_t newCapacity = pTable->capacity * 2;
+    Gdrive_Cnode_Table_Entry* pNewEntries = 
+            calloc(newCapacity, sizeof(Gdrive_Cnode_Table_Entry));
+    if (pNewEntries == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    
+    // Reinsert every entry. The stored hashes mean we don't need to look at 
+    // the nodes themselves.
+    size_t mask = newCapacity - 1;
+    for (size_t i = 0; i < pTable->capacity; i++)
+    {
+        if (pTable->pEntries[i].pNode == NULL)
+        {
+            continue;
+        }
+        size_t slot = pTable->pEntries[i].hash & mask;
+        while (pNewEntries[slot].pNode != NULL)
+        {
+            slot = (slot + 1) & mask;
+        }
+        pNewEntries[slot] = pTable->pEntries[i];
+    }
+    
+    free(pTable->pEntries);
+    pTable->pEntries = pNewEntries;
+    pTable->capacity = newCapacity;
+    return 0;
+}
+
+/*
+ * NOT RECURSIVE.  FREES ONLY THE SINGLE NODE.
+ */
+static void gdrive_cnode_free(Gdrive_Cache_Node* pNode)
+{
+    gdrive_finfo_cleanup(&(pNode->fileinfo));
+    gdrive_fcontents_free_all(&(pNode->contents));
+    free(pNode->contentsMd5);
+    free(pNode->uploadSession);
+    pthread_mutex_destroy(&pNode->mutex);
+    free(pNode);
+}
+
+/*
+ * Retrieves the file size while holding the cache lock.
+ */
+static size_t gdrive_cnode_get_size(Gdrive_Cache_Node* pNode)
+{
+    gdrive_cache_lock();
+    size_t size = pNode->fileinfo.size;
+    gdrive_cache_unlock();
+    return size;
+}
+
+/*
+ * Sets the file size and marks the file as dirty, while holding the cache lock.
+ * Must be called while holding the node lock.
+ */
+static void gdrive_cnode_set_size(Gdrive_Cache_Node* pNode, size_t size)
+{
+    gdrive_cache_lock();
+    pNode->fileinfo.size = size;
+    pNode->dirty = true;
+    gdrive_cache_unlock();
+    
+    // An unfinished upload of the old contents can't be resumed with the new
+    // ones.
+    free(pNode->uploadSession);
+    pNode->uploadSession = NULL;
+}
+
+static Gdrive_File_Contents* 
+gdrive_cnode_add_contents(Gdrive_Cache_Node* pNode, off_t start)
+{
+    // Create the actual Gdrive_File_Contents struct, and add it to the index.
+    Gdrive_File_Contents* pContents = 
+            gdrive_fcontents_add(&(pNode->contents), pNode, start);
+    if (pContents == NULL)
+    {
+        // Memory or file creation error
+        return NULL;
+    }
+    
+    // If this is the first chunk, remember which version of the file it 
+    // holds.
+    if (gdrive_fcontents_get_count(&(pNode->contents)) == 1)
+    {
+        gdrive_cache_lock();
+        gdrive_cnode_save_contents_version(pNode);
+        gdrive_cache_unlock();
+    }
+    
+    
+    return pContents;
+}
+
+static void gdrive_cnode_save_contents_version(Gdrive_Cache_Node* pNode)
+{
+    free(pNode->contentsMd5);
+    pNode->contentsMd5 = NULL;
+    if (pNode->fileinfo.md5Checksum != NULL)
+    {
+        pNode->contentsMd5 = malloc(strlen(pNode->fileinfo.md5Checksum) + 1);
+        if (pNode->contentsMd5 != NULL)
+        {
+            strcpy(pNode->contentsMd5, pNode->fileinfo.md5Checksum);
+        }
+        // else memory error, the contents just won't be reused
+    }
+    pNode->contentsModTime = pNode->fileinfo.modificationTime;
+    pNode->contentsSize = pNode->fileinfo.size;
+}
+
+static bool gdrive_cnode_contents_current(const Gdrive_Cache_Node* pNode)
+{
+    const Gdrive_Fileinfo* pFileinfo = &(pNode->fileinfo);
+    if (pNode->contentsSize != pFileinfo->size)
+    {
+        return false;
+    }
+    
+    // Google Drive gives a checksum for any file with binary contents, which
+    // (unlike the modification time) doesn't change when only metadata does.
+    if (pNode->contentsMd5 != NULL || pFileinfo->md5Checksum != NULL)
+    {
+        return pNode->contentsMd5 != NULL && pFileinfo->md5Checksum != NULL && 
+                strcmp(pNode->contentsMd5, pFileinfo->md5Checksum) == 0;
+    }
+    return pNode->contentsModTime.tv_sec == 
+            pFileinfo->modificationTime.tv_sec && 
+            pNode->contentsModTime.tv_nsec == 
+            pFileinfo->modificationTime.tv_nsec;
+}
+
+static void gdrive_cnode_trim_contents(Gdrive_Cache_Node* pKeep)
+{
+    size_t maxBytes = gdrive_get_contentcachesize();
+    
+    gdrive_cache_lock();
+    Gdrive_File_Contents* pContents = gdrive_fcontents_get_oldest();
+    while (pContents != NULL && gdrive_fcontents_get_totalbytes() > maxBytes)
+    {
+        // Find the next candidate before this chunk is (possibly) deleted.
+        Gdrive_File_Contents* pNewer = gdrive_fcontents_get_newer(pContents);
+        Gdrive_Cache_Node* pOwner = gdrive_fcontents_get_owner(pContents);
+        
+        // The node lock should be taken before the cache lock, so only try
+        // for it. If somebody else holds it, they may be using the chunk.
+        // Chunks still being downloaded don't count toward the total yet.
+        if (pOwner != pKeep && !pOwner->dirty && 
+                !gdrive_fcontents_is_filling(pContents) && 
+                pthread_mutex_trylock(&pOwner->mutex) == 0)
+        {
+            gdrive_fcontents_delete(pContents, &(pOwner->contents));
+            pthread_mutex_unlock(&pOwner->mutex);
+        }
+        pContents = pNewer;
+    }
+    gdrive_cache_unlock();
+}
+
+static void gdrive_cnode_release(Gdrive_Cache_Node* pNode, int flags)
+{
+    pthread_mutex_lock(&pNode->mutex);
+    
+    gdrive_cache_lock();
+    if ((flags & O_WRONLY) || (flags & O_RDWR))
+    {
+        // Close the file
+        pNode->openWrites--;
+    }
+    
+    // Decrement open file counts.
+    pNode->openCount--;
+    
+    
+    bool deleteNode = false;
+    if (pNode->openCount == 0)
+    {
+        deleteNode = gdrive_cnode_isdeleted(pNode);
+    }
+    bool lastClose = (pNode->openCount == 0);
+    gdrive_cache_unlock();
+    
+    // Don't leave read-ahead downloads running once nobody has the file open.
+    if (lastClose)
+    {
+        gdrive_cnode_finish_fills(pNode);
+    }
+    
+    // Downloaded contents stay around in case the file is reopened, but make
+    // sure they fit in the content cache now that this file may no longer be
+    // in use.
+    if (!deleteNode)
+    {
+        gdrive_cnode_trim_contents(NULL);
+    }
+    pthread_mutex_unlock(&pNode->mutex);
+    
+    // The node can't be opened again once it's marked deleted, so nobody else
+    // can be using it now.
+    if (deleteNode)
+    {
+        gdrive_cache_delete_node(pNode);
+    }
+}
+
+static size_t gdrive_cnode_get_chunksize(Gdrive_Cache_Node* pNode)
+{
+    // The normal chunk size is the smallest multiple of minChunkSize that 
+    // results in maxChunks or fewer chunks. Avoid creating a chunk of size 0
+    // by forcing fileSize to be at least 1.
+    size_t fileSize = gdrive_cnode_get_size(pNode);
+    if (fileSize == 0)
+    {
+        fileSize = 1;
+    }
+    int maxChunks = gdrive_get_maxchunks();
+    size_t minChunkSize = gdrive_get_minchunksize();
+
+    size_t perfectChunkSize = gdrive_divide_round_up(fileSize, maxChunks);
+    return gdrive_divide_round_up(perfectChunkSize, minChunkSize) * 
+            minChunkSize;
+}
+
+static void gdrive_cnode_get_fetch(Gdrive_Cache_Node* pNode, 
+                                   Gdrive_Cnode_Fetch* pFetch)
+{
+    static const gdrive_cnode_fetch_policy policies[] = 
+    {
+        [GDRIVE_FETCH_FIXED] = gdrive_cnode_fetch_fixed, 
+        [GDRIVE_FETCH_ADAPTIVE] = gdrive_cnode_fetch_adaptive
+    };
+    
+    enum Gdrive_Fetch_Policy policy = gdrive_get_fetchpolicy();
+    if ((size_t) policy >= sizeof(policies) / sizeof(policies[0]))
+    {
+        policy = GDRIVE_FETCH_FIXED;
+    }
+    memset(pFetch, 0, sizeof(Gdrive_Cnode_Fetch));
+    policies[policy](&(pNode->access), gdrive_cnode_get_size(pNode), 
+                     gdrive_cnode_get_chunksize(pNode), pFetch);
+}
+
+static size_t gdrive_cnode_get_fillsize(Gdrive_Cache_Node* pNode)
+{
+    Gdrive_Cnode_Fetch fetch;
+    gdrive_cnode_get_fetch(pNode, &fetch);
+    return fetch.fillSize;
+}
+
+static void gdrive_cnode_fetch_fixed(const Gdrive_Cnode_Access* pAccess, 
+                                     size_t fileSize, size_t chunkSize, 
+                                     Gdrive_Cnode_Fetch* pFetch)
+{
+    (void) fileSize;
+    
+    if (pAccess->sequentialReads == 0)
+    {
+        // Reading at random. Only fetch the blocks that are actually touched.
+        size_t blockSize = gdrive_get_blocksize();
+        pFetch->fillSize = (blockSize > 0 && blockSize < chunkSize) ? 
+            blockSize : chunkSize;
+        return;
+    }
+    
+    // Reading sequentially, so large downloads pay off. Open up the 
+    // read-ahead window by doubling it with each sequential read, starting 
+    // with the chunk after the one holding the end of this read.
+    pFetch->fillSize = chunkSize;
+    pFetch->aheadCount = GDRIVE_CNODE_MAX_READAHEAD;
+    if (pAccess->sequentialReads < 16 && 
+            1 << (pAccess->sequentialReads - 1) < GDRIVE_CNODE_MAX_READAHEAD
+            )
+    {
+        pFetch->aheadCount = 1 << (pAccess->sequentialReads - 1);
+    }
+    off_t readEnd = pAccess->lastOffset + pAccess->lastSize;
+    pFetch->aheadStart = ((readEnd - 1) / chunkSize + 1) * chunkSize;
+    pFetch->aheadSize = chunkSize;
+    pFetch->aheadStep = chunkSize;
+}
+
+static void gdrive_cnode_fetch_adaptive(const Gdrive_Cnode_Access* pAccess, 
+                                        size_t fileSize, size_t chunkSize, 
+                                        Gdrive_Cnode_Fetch* pFetch)
+{
+    // Reads that aren't sequential fetch the smallest power of 2 multiple of
+    // GDRIVE_CNODE_MIN_FETCH that holds the last read, but no more than a 
+    // block (see gdrive_get_blocksize()).
+    size_t blockSize = gdrive_get_blocksize();
+    if (blockSize == 0 || blockSize > chunkSize)
+    {
+        blockSize = chunkSize;
+    }
+    size_t fetchSize = GDRIVE_CNODE_MIN_FETCH;
+    while (fetchSize < pAccess->lastSize && fetchSize < blockSize)
+    {
+        fetchSize *= 2;
+    }
+    if (fetchSize > blockSize)
+    {
+        fetchSize = blockSize;
+    }
+    pFetch->fillSize = fetchSize;
+    
+    if (pAccess->sequentialReads > 0)
+    {
+        // Streaming. Keep doubling the download size until it's about half
+        // of what has been read so far. That grows quickly for a long read 
+        // but doesn't bet much on a short one. The file size doesn't matter,
+        // except that there's no point in downloads bigger than the file. 
+        // Keep enough room in the content cache for the read-ahead window.
+        size_t maxFetch = gdrive_get_contentcachesize() / 
+                (2 * GDRIVE_CNODE_MAX_ADAPTIVE_READAHEAD);
+        if (maxFetch > GDRIVE_CNODE_MAX_FETCH)
+        {
+            maxFetch = GDRIVE_CNODE_MAX_FETCH;
+        }
+        while (fetchSize < pAccess->sequentialBytes / 2 && 
+                fetchSize < fileSize && 
+                fetchSize * 2 <= maxFetch
+                )
+        {
+            fetchSize *= 2;
+        }
+        pFetch->fillSize = fetchSize;
+        
+        // Read ahead from the end of this read. Any part that's already 
+        // cached is skipped, so there's no need to line up with the chunks.
+        pFetch->aheadCount = 
+                (pAccess->sequentialReads < 
+                GDRIVE_CNODE_MAX_ADAPTIVE_READAHEAD) ? 
+                pAccess->sequentialReads : GDRIVE_CNODE_MAX_ADAPTIVE_READAHEAD;
+        pFetch->aheadStart = pAccess->lastOffset + pAccess->lastSize;
+        pFetch->aheadSize = fetchSize;
+        pFetch->aheadStep = fetchSize;
+    }
+    else if (pAccess->stridedReads > 0 && 
+            (pAccess->stride >= (off_t) fetchSize || 
+            -pAccess->stride >= (off_t) fetchSize)
+            )
+    {
+        // Reads at a steady stride, too far apart for one download to hold 
+        // more than one of them. Fetch the next few in the background.
+        pFetch->aheadCount = 
+                (pAccess->stridedReads < GDRIVE_CNODE_MAX_READAHEAD) ? 
+                pAccess->stridedReads : GDRIVE_CNODE_MAX_READAHEAD;
+        pFetch->aheadStart = pAccess->lastOffset + pAccess->stride;
+        pFetch->aheadSize = pAccess->lastSize;
+        pFetch->aheadStep = pAccess->stride;
+    }
+    // else reading at random, nothing to read ahead
+}
+
+static Gdrive_File_Contents* 
+gdrive_cnode_create_chunk(Gdrive_Cache_Node* pNode, off_t offset, size_t size, 
+                          bool fillChunk, bool inBackground)
+{
+    size_t chunkSize = gdrive_cnode_get_fillsize(pNode);
+    
+    // The actual chunk may be a multiple of chunkSize.  A read that starts at
+    // "offset" and is "size" bytes long should be within this single chunk, 
+    // so any missing blocks it touches are fetched with one request.
+    off_t chunkStart = (offset / chunkSize) * chunkSize;
+    off_t chunkOffset = offset % chunkSize;
+    off_t endChunkOffset = chunkOffset + size - 1;
+    size_t realChunkSize = (endChunkOffset / chunkSize + 1) * chunkSize;
+    
+    // Chunks can't overlap, so cut the new chunk down to the gap around 
+    // offset if some of its range is already cached.
+    off_t chunkEnd = chunkStart + realChunkSize - 1;
+    off_t gapStart = chunkStart;
+    off_t gapEnd = chunkEnd;
+    bool foundGap = gdrive_fcontents_find_missing(&(pNode->contents), 
+                                                  gapStart, chunkEnd, 
+                                                  &gapStart, &gapEnd);
+    while (foundGap && gapEnd < offset)
+    {
+        // This gap is before offset, look at the next one.
+        foundGap = gdrive_fcontents_find_missing(&(pNode->contents), 
+                                                 gapEnd + 1, chunkEnd, 
+                                                 &gapStart, &gapEnd);
+    }
+    if (!foundGap || gapStart > offset)
+    {
+        // offset is already cached
+        return NULL;
+    }
+    chunkStart = gapStart;
+    realChunkSize = gapEnd - gapStart + 1;
+    
+    Gdrive_File_Contents* pContents = 
+            gdrive_cnode_add_contents(pNode, chunkStart);
+    if (pContents == NULL)
+    {
+        // Memory or file creation error
+        return NULL;
+    }
+    
+    if (fillChunk)
+    {
+        // Copy the file ID so we don't need the cache lock while downloading
+        gdrive_cache_lock();
+        char* fileId = malloc(strlen(pNode->fileinfo.id) + 1);
+        if (fileId != NULL)
+        {
+            strcpy(fileId, pNode->fileinfo.id);
+        }
+        gdrive_cache_unlock();
+        int success;
+        if (fileId == NULL)
+        {
+            // Memory error
+            success = -1;
+        }
+        else if (inBackground)
+        {
+            success = gdrive_fcontents_start_fill(pContents, fileId, 
+                                                  realChunkSize);
+        }
+        else
+        {
+            success = gdrive_fcontents_fill_chunk(pContents, fileId, 
+                                                  realChunkSize);
+        }
+        free(fileId);
+        if (success != 0)
+        {
+            // Didn't write the file.  Clean up the new Gdrive_File_Contents 
+            // struct
+            gdrive_cnode_delete_file_contents(pNode, pContents);
+            return NULL;
+        }
+        
+        // Make room for the new chunk in the content cache (a background 
+        // chunk takes up room once it's finished).
+        if (!inBackground)
+        {
+            gdrive_cnode_trim_contents(pNode);
+        }
+    }
+    // else we're not filling the chunk, do nothing
+    
+    // Success
+    return pContents;
+}
+
+static Gdrive_File_Contents* 
+gdrive_cnode_find_chunk(Gdrive_Cache_Node* pNode, off_t offset)
+{
+    Gdrive_File_Contents* pContents = 
+            gdrive_fcontents_find_chunk(&(pNode->contents), offset);
+    if (pContents == NULL || !gdrive_fcontents_is_filling(pContents))
+    {
+        // No chunk, or it's ready to use
+        return pContents;
+    }
+    
+    if (gdrive_fcontents_finish_fill(pContents) != 0)
+    {
+        // The download failed. Get rid of the chunk.
+        gdrive_cnode_delete_file_contents(pNode, pContents);
+        return NULL;
+    }
+    
+    // Make room for the new chunk in the content cache.
+    gdrive_cnode_trim_contents(pNode);
+    return pContents;
+}
+
+static void gdrive_cnode_finish_fills(Gdrive_Cache_Node* pNode)
+{
+    // Go backwards, so that deleting a chunk doesn't move the ones still to
+    // be checked.
+    size_t position = gdrive_fcontents_get_count(&(pNode->contents));
+    while (position > 0)
+    {
+        position--;
+        Gdrive_File_Contents* pContents = 
+                gdrive_fcontents_get_chunk(&(pNode->contents), position);
+        if (gdrive_fcontents_is_filling(pContents) && 
+                gdrive_fcontents_finish_fill(pContents) != 0)
+        {
+            gdrive_cnode_delete_file_contents(pNode, pContents);
+        }
+    }
+    gdrive_cnode_trim_contents(pNode);
+}
+
+static void gdrive_cnode_read_ahead(Gdrive_Cache_Node* pNode, off_t offset, 
+                                    size_t size)
+{
+    // Record the read.
+    Gdrive_Cnode_Access* pAccess = &(pNode->access);
+    if (offset == pAccess->lastOffset + (off_t) pAccess->lastSize && 
+            offset > 0)
+    {
+        if (pAccess->sequentialReads < INT_MAX)
+        {
+            pAccess->sequentialReads++;
+        }
+        pAccess->sequentialBytes += size;
+    }
+    else
+    {
+        pAccess->sequentialReads = 0;
+        pAccess->sequentialBytes = size;
+    }
+    off_t stride = offset - pAccess->lastOffset;
+    if (stride == pAccess->stride && stride != 0)
+    {
+        if (pAccess->stridedReads < INT_MAX)
+        {
+            pAccess->stridedReads++;
+        }
+    }
+    else
+    {
+        pAccess->stride = stride;
+        pAccess->stridedReads = 0;
+    }
+    pAccess->lastOffset = offset;
+    pAccess->lastSize = size;
+    
+    Gdrive_Cnode_Fetch fetch;
+    gdrive_cnode_get_fetch(pNode, &fetch);
+    gdrive_cache_lock();
+    bool dirty = pNode->dirty;
+    gdrive_cache_unlock();
+    if (fetch.aheadCount == 0 || fetch.aheadSize == 0 || dirty || size == 0)
+    {
+        // Nothing to read ahead, or the cached contents are being changed
+        return;
+    }
+    
+    // Don't read ahead more than half the content cache can hold, or the 
+    // chunks would push each other (or the chunk being read) out of the cache.
+    size_t cacheRanges = gdrive_get_contentcachesize() / fetch.aheadSize / 2;
+    int nRanges = ((size_t) fetch.aheadCount < cacheRanges) ? 
+        fetch.aheadCount : (int) cacheRanges;
+    
+    // Start downloads for whatever parts of each range aren't cached yet.
+    off_t fileSize = gdrive_cnode_get_size(pNode);
+    for (int i = 0; i < nRanges; i++)
+    {
+        off_t rangeStart = fetch.aheadStart + i * fetch.aheadStep;
+        off_t rangeEnd = rangeStart + fetch.aheadSize - 1;
+        if (rangeStart < 0 || rangeStart >= fileSize)
+        {
+            // Off either end of the file
+            break;
+        }
+        if (rangeEnd >= fileSize)
+        {
+            rangeEnd = fileSize - 1;
+        }
+        
+        off_t missingStart;
+        off_t missingEnd;
+        while (rangeStart <= rangeEnd && 
+                gdrive_fcontents_find_missing(&(pNode->contents), 
+                                              rangeStart, rangeEnd, 
+                                              &missingStart, &missingEnd)
+                )
+        {
+            Gdrive_File_Contents* pContents = 
+                    gdrive_cnode_create_chunk(pNode, missingStart, 
+                                              missingEnd - missingStart + 1, 
+                                              true, true);
+            if (pContents == NULL)
+            {
+                // Couldn't start the download. The reader will fetch the 
+                // range itself if it gets there.
+                return;
+            }
+            rangeStart = gdrive_fcontents_get_end(pContents) + 1;
+        }
+    }
+}
+
+static int gdrive_file_read_chunks(Gdrive_File* fh, char* buf, size_t size, 
+                                   off_t offset)
+{
+    off_t nextOffset = offset;
+    off_t bufferOffset = 0;
+    size_t bytesRemaining = size;
+    while (bytesRemaining > 0)
+    {
+        // Read into the current position if we're given a real buffer, or pass
+        // in NULL otherwise
+        char* bufPos = (buf != NULL) ? buf + bufferOffset : NULL;
+        off_t bytesRead = gdrive_file_read_next_chunk(fh, 
+                                                      bufPos,
+                                                      nextOffset, 
+                                                      bytesRemaining
+                );
+        if (bytesRead < 0)
+        {
+            // Read error.  bytesRead is the negative error number
+            return bytesRead;
+        }
+        if (bytesRead == 0)
+        {
+            // EOF. Return the total number of bytes actually read.
+            return size - bytesRemaining;
+        }
+        nextOffset += bytesRead;
+        bufferOffset += bytesRead;
+        bytesRemaining -= bytesRead;
+    }
+    
+    return size;
+}
+
+static size_t gdrive_file_read_next_chunk(Gdrive_File* pFile, char* destBuf, 
+                                          off_t offset, size_t size)
+{
+    // Gdrive_Filehandle and Gdrive_Cache_Node are the same thing, but it's 
+    // easier to think of the filehandle as just a token used to refer to a 
+    // file, whereas a cache node has internal structure to act upon.
+    Gdrive_Cache_Node* pNode = pFile;
+    
+    // Do we already have a chunk that includes the starting point?
+    Gdrive_File_Contents* pChunkContents = 
+            gdrive_cnode_find_chunk(pNode, offset);
+    
+    if (pChunkContents == NULL)
+    {
+        // Chunk doesn't exist, need to create and download it.
+        pChunkContents = 
+                gdrive_cnode_create_chunk(pNode, offset, size, true, false);
+        
+        if (pChunkContents == NULL)
+        {
+            // Error creating the chunk
+            // TODO: size_t is (or should be) unsigned. Rather than returning
+            // a negative value for error, we should probably return 0 and add
+            // a parameter for a pointer to an error value.
+            return -EIO;
+        }
+    }
+    
+    // Actually read to the buffer and return the number of bytes read (which
+    // may be less than size if we hit the end of the chunk), or return any 
+    // error up to the caller.
+    return gdrive_fcontents_read(pChunkContents, destBuf, offset, size);
+}
+
+static int gdrive_file_write_chunks(Gdrive_File* fh, const char* buf, 
+                                    size_t size, off_t offset)
+{
+    off_t nextOffset = offset;
+    off_t bufferOffset = 0;
+    size_t bytesRemaining = size;
+    
+    while (bytesRemaining > 0)
+    {
+        off_t bytesWritten = gdrive_file_write_next_chunk(fh, 
+                                                          buf + bufferOffset,
+                                                          nextOffset, 
+                                                          bytesRemaining
+                );
+        if (bytesWritten < 0)
+        {
+            // Write error.  bytesWritten is the negative error number
+            return bytesWritten;
+        }
+        if (bytesWritten == 0)
+        {
+            // No chunk accepted any data, don't loop forever
+            return -EIO;
+        }
+        nextOffset += bytesWritten;
+        bufferOffset += bytesWritten;
+        bytesRemaining -= bytesWritten;
+    }
+    
+    return size;
+}
+
+static off_t gdrive_file_write_next_chunk(Gdrive_File* pFile, const char* buf, 
+                                          off_t offset, size_t size)
+{
+    // Gdrive_Filehandle and Gdrive_Cache_Node are the same thing, but it's 
+    // easier to think of the filehandle as just a token used to refer to a 
+    // file, whereas a cache node has internal structure to act upon.
+    Gdrive_Cache_Node* pNode = pFile;
+    
+    size_t fileSize = gdrive_cnode_get_size(pNode);
+    if (offset > (off_t) fileSize)
+    {
+        // Writing past the end of the file would leave a hole, which isn't 
+        // supported.
+        // TODO: size_t is (or should be) unsigned. Rather than returning
+        // a negative value for error, we should probably return 0 and add
+        // a parameter for a pointer to an error value.
+        return -EINVAL;
+    }
+    
+    // If the starting point is cached, write to the end of its chunk and 
+    // stop.
+    bool extendChunk = false;
+    Gdrive_File_Contents* pChunkContents = 
+            gdrive_cnode_find_chunk(pNode, offset);
+    if (pChunkContents == NULL)
+    {
+        // The starting point isn't cached. Since it's about to be overwritten,
+        // there's usually no need to download it. Write up to the next chunk,
+        // extending the chunk that ends just before the starting point, or 
+        // starting a new chunk if there isn't one (or if it's still being
+        // downloaded).
+        off_t missingStart;
+        off_t missingEnd;
+        if (gdrive_fcontents_find_missing(&(pNode->contents), offset, 
+                                          offset + size - 1, 
+                                          &missingStart, &missingEnd) && 
+                missingEnd < (off_t) (offset + size - 1)
+                )
+        {
+            size = missingEnd - offset + 1;
+        }
+        pChunkContents = (offset > 0) ? 
+            gdrive_fcontents_find_chunk(&(pNode->contents), offset - 1) : NULL;
+        extendChunk = true;
+        if (pChunkContents == NULL || 
+                gdrive_fcontents_is_filling(pChunkContents)
+                )
+        {
+            pChunkContents = NULL;
+            if (offset < (off_t) fileSize && 
+                    gdrive_fcontents_get_count(&(pNode->contents)) >= 
+                    GDRIVE_CNODE_MAX_WRITE_CHUNKS
+                    )
+            {
+                // Scattered small writes would each start their own chunk.
+                // Once there are too many, download the uncached part of the
+                // block around the starting point instead, so that later 
+                // writes to the same block land in the same chunk.
+                pChunkContents = 
+                        gdrive_cnode_create_chunk(pNode, offset, 1, true, false);
+                extendChunk = (pChunkContents == NULL);
+            }
+            if (pChunkContents == NULL)
+            {
+                // Start a new chunk (also if the download failed, since the 
+                // write doesn't need it).
+                pChunkContents = gdrive_cnode_add_contents(pNode, offset);
+            }
+        }
+    }
+    if (pChunkContents == NULL)
+    {
+        // Couldn't create a chunk
+        return -EIO;
+    }
+    
+    // Actually write to the buffer and return the number of bytes read (which
+    // may be less than size if we hit the end of the chunk), or return any 
+    // error up to the caller.
+    off_t bytesWritten = gdrive_fcontents_write(pChunkContents, 
+                                                 buf, 
+                                                 offset, 
+                                                 size, 
+                                                 extendChunk
+            );
+    
+    if (bytesWritten > 0)
+    {
+        // Mark the file as having been written, and update the file size if
+        // needed.
+        gdrive_cnode_set_size(pNode, 
+                              ((size_t)(offset + bytesWritten) > fileSize) ? 
+                              (size_t)(offset + bytesWritten) : fileSize
+        );
+    }
+    
+    return bytesWritten;
+}
+
+static bool gdrive_file_check_perm(const Gdrive_Cache_Node* pNode, 
+                                   int accessFlags)
+{
+    // What permissions do we have?
+    gdrive_cache_lock();
+    unsigned int perms = gdrive_finfo_real_perms(&(pNode->fileinfo));
+    gdrive_cache_unlock();
+    
+    // What permissions do we need?
+    unsigned int neededPerms = 0;
+    // At least on my system, O_RDONLY is 0, which prevents testing for the
+    // individual bit flag. On systems like mine, just assume we always need
+    // read access. If there are other systems that have a different O_RDONLY
+    // value, we'll test for the flag on those systems.
+    if ((O_RDONLY == 0) || (accessFlags & O_RDONLY) || (accessFlags & O_RDWR))
+    {
+        neededPerms = neededPerms | S_IROTH;
+    }
+    if ((accessFlags & O_WRONLY) || (accessFlags & O_RDWR))
+    {
+        neededPerms = neededPerms | S_IWOTH;
+    }
+    
+    // If there is anything we need but don't have, return false.
+    return !(neededPerms & ~perms);
+    
+}
+
+static Gdrive_Cnode_Upload_Queue* gdrive_cnode_get_upload_queue(void)
+{
+    static Gdrive_Cnode_Upload_Queue queue = {
+        .mutex = PTHREAD_MUTEX_INITIALIZER, 
+        .queuedCond = PTHREAD_COND_INITIALIZER, 
+        .doneCond = PTHREAD_COND_INITIALIZER
+    };
+    return &queue;
+}
+
+static int gdrive_cnode_queue_upload(Gdrive_Cache_Node* pNode, int flags)
+{
+    if (gdrive_get_dirtylimit() == 0)
+    {
+        // Background uploads are turned off
+        return -1;
+    }
+    
+    Gdrive_Cnode_Upload* pUpload = malloc(sizeof(Gdrive_Cnode_Upload));
+    if (pUpload == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    pUpload->pNode = pNode;
+    pUpload->flags = flags;
+    // Only changed contents count toward the dirty limit, not metadata.
+    gdrive_cache_lock();
+    pUpload->size = pNode->dirty ? pNode->fileinfo.size : 0;
+    gdrive_cache_unlock();
+    pUpload->tryNum = 0;
+    pUpload->retryTime = 0;
+    pUpload->pNext = NULL;
+    
+    Gdrive_Cnode_Upload_Queue* pQueue = gdrive_cnode_get_upload_queue();
+    pthread_mutex_lock(&pQueue->mutex);
+    if (pQueue->stopping || 
+            (!pQueue->running && gdrive_cnode_upload_start(pQueue) != 0))
+    {
+        // Shutting down, or couldn't start the workers
+        pthread_mutex_unlock(&pQueue->mutex);
+        free(pUpload);
+        return -1;
+    }
+    if (pQueue->pLast != NULL)
+    {
+        pQueue->pLast->pNext = pUpload;
+    }
+    else
+    {
+        pQueue->pFirst = pUpload;
+    }
+    pQueue->pLast = pUpload;
+    pQueue->queuedBytes += pUpload->size;
+    pthread_cond_signal(&pQueue->queuedCond);
+    pthread_mutex_unlock(&pQueue->mutex);
+    return 0;
+}
+
+static int gdrive_cnode_upload_start(Gdrive_Cnode_Upload_Queue* pQueue)
+{
+    pQueue->stopping = false;
+    for (int i = 0; i < GDRIVE_CNODE_UPLOAD_WORKERS; i++)
+    {
+        if (pthread_create(&pQueue->workers[i], NULL, 
+                           gdrive_cnode_upload_loop, pQueue) != 0
+                )
+        {
+            // Couldn't create the thread. Stop the ones that did start (there
+            // is nothing queued yet, so they exit right away).
+            pQueue->stopping = true;
+            pthread_cond_broadcast(&pQueue->queuedCond);
+            pthread_mutex_unlock(&pQueue->mutex);
+            for (int j = 0; j < i; j++)
+            {
+                pthread_join(pQueue->workers[j], NULL);
+            }
+            pthread_mutex_lock(&pQueue->mutex);
+            pQueue->stopping = false;
+            return -1;
+        }
+    }
+    pQueue->running = true;
+    return 0;
+}
+
+static void* gdrive_cnode_upload_loop(void* arg)
+{
+    Gdrive_Cnode_Upload_Queue* pQueue = (Gdrive_Cnode_Upload_Queue*) arg;
+    
+    pthread_mutex_lock(&pQueue->mutex);
+    while (true)
+    {
+        while (pQueue->pFirst == NULL && !pQueue->stopping)
+        {
+            pthread_cond_wait(&pQueue->queuedCond, &pQueue->mutex);
+        }
+        if (pQueue->pFirst == NULL)
+        {
+            // Stopping, and there's nothing left to upload.
+            break;
+        }
+        
+        // Take the first upload that isn't waiting to be retried.
+        time_t now = time(NULL);
+        time_t nextRetry = 0;
+        Gdrive_Cnode_Upload* pPrev = NULL;
+        Gdrive_Cnode_Upload* pUpload = pQueue->pFirst;
+        while (pUpload != NULL && pUpload->retryTime > now)
+        {
+            if (nextRetry == 0 || pUpload->retryTime < nextRetry)
+            {
+                nextRetry = pUpload->retryTime;
+            }
+            pPrev = pUpload;
+            pUpload = pUpload->pNext;
+        }
+        if (pUpload == NULL)
+        {
+            // Everything is waiting. Sleep until the earliest retry, or until
+            // something new is queued.
+            struct timespec wakeTime = {.tv_sec = nextRetry, .tv_nsec = 0};
+            pthread_cond_timedwait(&pQueue->queuedCond, &pQueue->mutex, 
+                                   &wakeTime);
+            continue;
+        }
+        if (pPrev != NULL)
+        {
+            pPrev->pNext = pUpload->pNext;
+        }
+        else
+        {
+            pQueue->pFirst = pUpload->pNext;
+        }
+        if (pQueue->pLast == pUpload)
+        {
+            pQueue->pLast = pPrev;
+        }
+        pUpload->pNext = NULL;
+        pthread_mutex_unlock(&pQueue->mutex);
+        
+        bool finished = gdrive_cnode_upload(pUpload);
+        
+        pthread_mutex_lock(&pQueue->mutex);
+        if (finished)
+        {
+            pQueue->queuedBytes -= pUpload->size;
+            free(pUpload);
+            pthread_cond_broadcast(&pQueue->doneCond);
+        }
+        else
+        {
+            // Put it back at the end of the queue to try again later.
+            pUpload->retryTime = time(NULL) + 
+                    (GDRIVE_CNODE_UPLOAD_RETRY_DELAY << (pUpload->tryNum - 1));
+            if (pQueue->pLast != NULL)
+            {
+                pQueue->pLast->pNext = pUpload;
+            }
+            else
+            {
+                pQueue->pFirst = pUpload;
+            }
+            pQueue->pLast = pUpload;
+        }
+    }
+    pthread_mutex_unlock(&pQueue->mutex);
+    return NULL;
+}
+
+static bool gdrive_cnode_upload(Gdrive_Cnode_Upload* pUpload)
+{
+    Gdrive_Cache_Node* pNode = pUpload->pNode;
+    
+    // Hold the node lock so that the data and the metadata go up together.
+    pthread_mutex_lock(&pNode->mutex);
+    gdrive_cache_lock();
+    bool deleted = gdrive_cnode_isdeleted(pNode);
+    gdrive_cache_unlock();
+    int result = 0;
+    if (!deleted)
+    {
+        pNode->backgroundSync = true;
+        result = gdrive_file_sync(pNode);
+        pNode->backgroundSync = false;
+        if (result == 0)
+        {
+            result = gdrive_file_sync_metadata(pNode);
+        }
+    }
+    // else the file is gone from Google Drive, so there's nothing to upload to
+    pthread_mutex_unlock(&pNode->mutex);
+    
+    pUpload->tryNum++;
+    if (result != 0 && pUpload->tryNum < GDRIVE_CNODE_UPLOAD_TRIES)
+    {
+        // Failed, but try again.
+        return false;
+    }
+    if (result != 0)
+    {
+        // Giving up. The changes are still cached (the node stays dirty), but
+        // whoever next syncs or opens the file needs to know they didn't make
+        // it to Google Drive.
+        gdrive_cache_lock();
+        pNode->uploadError = -EIO;
+        gdrive_cache_unlock();
+    }
+    
+    gdrive_cnode_release(pNode, pUpload->flags);
+    return true;
+}
+
+static void gdrive_cnode_throttle_writes(void)
+{
+    size_t dirtyLimit = gdrive_get_dirtylimit();
+    Gdrive_Cnode_Upload_Queue* pQueue = gdrive_cnode_get_upload_queue();
+    pthread_mutex_lock(&pQueue->mutex);
+    while (dirtyLimit > 0 && pQueue->running && 
+            pQueue->queuedBytes > dirtyLimit)
+    {
+        pthread_cond_wait(&pQueue->doneCond, &pQueue->mutex);
+    }
+    pthread_mutex_unlock(&pQueue->mutex);
+}
+
+static size_t gdrive_file_uploadcallback(char* buffer, off_t offset, 
+                                         size_t size, 
+                                         void* userdata)
+{
+    Gdrive_Cnode_Upload_Range* pRange = (Gdrive_Cnode_Upload_Range*) userdata;
+    if (offset >= (off_t) pRange->length)
+    {
+        // Everything has been sent.
+        return 0;
+    }
+    if (size > pRange->length - offset)
+    {
+        size = pRange->length - offset;
+    }
+    
+    // Relay any uncached part straight from Google Drive. Otherwise, read from
+    // the cache, stopping short of the next uncached part. This bypasses 
+    // gdrive_file_read(), whose read-ahead would download the uncached parts 
+    // into the cache.
+    Gdrive_Cache_Node* pNode = pRange->pNode;
+    off_t fileOffset = pRange->start + offset;
+    off_t missingStart;
+    off_t missingEnd;
+    if (gdrive_fcontents_find_missing(&(pNode->contents), fileOffset, 
+                                      fileOffset + size - 1, 
+                                      &missingStart, &missingEnd)
+            )
+    {
+        if (missingStart == fileOffset)
+        {
+            return gdrive_cnode_relay_read(pNode, pRange->pRelay, buffer, 
+                                           fileOffset, size, missingEnd
+                    );
+        }
+        size = missingStart - fileOffset;
+    }
+    int returnVal = gdrive_file_read_chunks(pNode, buffer, size, fileOffset);
+    return (returnVal >= 0) ? (size_t) returnVal: (size_t)(-1);
+}
+
+static char* gdrive_cnode_get_upload_url(Gdrive_Cache_Node* pNode)
 {
-    Gdrive_Cache_Node* result = malloc(sizeof(Gdrive_Cache_Node));
-    if (result != NULL)
+    gdrive_cache_lock();
+    size_t urlSize = strlen(GDRIVE_URL_UPLOAD) + strlen(pNode->fileinfo.id) + 2;
+    char* url = malloc(urlSize);
+    if (url != NULL)
     {
-        memset(result, 0, sizeof(Gdrive_Cache_Node));
-        result->pParent = pParent;
+        strcpy(url, GDRIVE_URL_UPLOAD);
+        strcat(url, "/");
+        strcat(url, pNode->fileinfo.id);
     }
-    return result;
+    gdrive_cache_unlock();
+    return url;
 }
 
-/*
- * pNodeTwo must be a descendent of pNodeOne, or neither node is descended from
- * the other.
- */
-static void gdrive_cnode_swap(Gdrive_Cache_Node** ppFromParentOne, 
-                              Gdrive_Cache_Node* pNodeOne, 
-                              Gdrive_Cache_Node** ppFromParentTwo, 
-                              Gdrive_Cache_Node* pNodeTwo)
+static Gdrive_Download_Buffer* 
+gdrive_cnode_sync_simple(Gdrive_Cache_Node* pNode, size_t fileSize, 
+                         Gdrive_Cnode_Relay* pRelay, int* pError)
 {
-    // Make sure pNodeOne is not a descendent of pNodeTwo
-    Gdrive_Cache_Node* pParent = pNodeOne->pParent;
-    while (pParent != NULL)
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
     {
-        assert(pParent != pNodeTwo && 
-                "gdrive_cnode_swap(): pNodeOne is a descendent of pNodeTwo"
-            );
-        pParent = pParent->pParent;
+        // Memory error
+        *pError = -ENOMEM;
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PUT);
+    gdrive_xfer_set_priority(pTransfer, gdrive_cnode_sync_priority(pNode));
+    
+    // Assemble the URL and add query parameter(s)
+    char* url = gdrive_cnode_get_upload_url(pNode);
+    if (url == NULL || gdrive_xfer_set_url(pTransfer, url) != 0 || 
+            gdrive_xfer_add_query(pTransfer, "uploadType", "media") != 0
+            )
+    {
+        // Error, probably memory
+        free(url);
+        gdrive_xfer_free(pTransfer);
+        *pError = -ENOMEM;
+        return NULL;
     }
+    free(url);
+    
+    // Set upload callback
+    Gdrive_Cnode_Upload_Range range = {pNode, 0, fileSize, pRelay};
+    gdrive_xfer_set_uploadcallback(pTransfer, gdrive_file_uploadcallback, 
+                                   &range
+            );
+    gdrive_xfer_set_uploadsize(pTransfer, fileSize);
     
-    Gdrive_Cache_Node* pTempParent = pNodeOne->pParent;
-    Gdrive_Cache_Node* pTempLeft = pNodeOne->pLeft;
-    Gdrive_Cache_Node* pTempRight = pNodeOne->pRight;
+    // Do the transfer
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    {
+        gdrive_dlbuf_free(pBuf);
+        *pError = -EIO;
+        return NULL;
+    }
+    return pBuf;
+}
+
+static Gdrive_Download_Buffer* 
+gdrive_cnode_sync_resumable(Gdrive_Cache_Node* pNode, size_t fileSize, 
+                            size_t chunkSize, Gdrive_Cnode_Relay* pRelay, 
+                            int* pError)
+{
+    // Any session left from an earlier attempt is for the current contents, 
+    // since changing them would have discarded it. Ask how much it has before
+    // sending anything.
+    bool askReceived = (pNode->uploadSession != NULL);
+    off_t offset = 0;
+    int failures = 0;
     
-    if (pNodeOne->pLeft == pNodeTwo || pNodeOne->pRight == pNodeTwo)
+    while (failures < GDRIVE_CNODE_UPLOAD_TRIES)
     {
-        // Node Two is a direct child of Node One
+        if (pNode->uploadSession == NULL)
+        {
+            if (gdrive_cnode_session_start(pNode, fileSize) != 0)
+            {
+                // Couldn't start a session
+                *pError = -EIO;
+                return NULL;
+            }
+            askReceived = false;
+            offset = 0;
+        }
+        
+        // Send the next piece, or find out where to pick up after a failure.
+        // Every piece but the last is a whole chunk, which keeps them 
+        // multiples of GDRIVE_BASE_CHUNK_SIZE as the server requires.
+        size_t length = askReceived ? 0 : 
+            ((fileSize - offset < chunkSize) ? fileSize - offset : chunkSize);
+        Gdrive_Download_Buffer* pBuf = gdrive_cnode_session_put(pNode, offset, 
+                                                                length, 
+                                                                fileSize, 
+                                                                pRelay
+                );
+        long httpResp = (pBuf != NULL) ? gdrive_dlbuf_get_httpresp(pBuf) : 0;
         
-        pNodeOne->pLeft = pNodeTwo->pLeft;
-        pNodeOne->pRight = pNodeTwo->pRight;
+        if (httpResp == 200 || httpResp == 201)
+        {
+            // The server has the whole file.
+            free(pNode->uploadSession);
+            pNode->uploadSession = NULL;
+            return pBuf;
+        }
         
-        if (pTempLeft == pNodeTwo)
+        if (httpResp == 308)
+        {
+            // Resume Incomplete. Carry on from the first byte the server 
+            // doesn't have, which might not be the end of what was just sent.
+            off_t received = gdrive_cnode_session_received(pBuf);
+            if (received > offset)
+            {
+                failures = 0;
+            }
+            else if (!askReceived)
+            {
+                // Nothing that was sent was kept.
+                failures++;
+            }
+            offset = received;
+            askReceived = false;
+        }
+        else if (httpResp == 404 || httpResp == 410)
         {
-            pNodeTwo->pLeft = pNodeOne;
-            pNodeTwo->pRight = pTempRight;
+            // The session expired, so start over with a new one.
+            free(pNode->uploadSession);
+            pNode->uploadSession = NULL;
+            failures++;
         }
         else
         {
-            pNodeTwo->pLeft = pTempLeft;
-            pNodeTwo->pRight = pNodeOne;
+            // Connection error, or an error response that the transfer already
+            // retried. The server may have kept part of what was sent, so ask
+            // before sending any more.
+            askReceived = true;
+            failures++;
         }
-        
-        // Don't touch *ppFromParentTwo - it's either pNodeOne->pLeft 
-        // or pNodeOne->pRight.
-    }
-    else
-    {
-        // Not direct parent/child
-        
-        pNodeOne->pParent = pNodeTwo->pParent;
-        pNodeOne->pLeft = pNodeTwo->pLeft;
-        pNodeOne->pRight = pNodeTwo->pRight;
-        
-        pNodeTwo->pLeft = pTempLeft;
-        pNodeTwo->pRight = pTempRight;
-        
-        *ppFromParentTwo = pNodeOne;
+        gdrive_dlbuf_free(pBuf);
     }
     
-    pNodeTwo->pParent = pTempParent;
-    *ppFromParentOne = pNodeTwo;
-    
-    // Fix the pParent pointers in each of the descendents. If pNodeTwo was
-    // originally a direct child of pNodeOne, this also updates pNodeOne's
-    // pParent.
-    if (pNodeOne->pLeft)
-    {
-        pNodeOne->pLeft->pParent = pNodeOne;
-    }
-    if (pNodeOne->pRight)
+    // Keep the session, so the next attempt can resume it.
+    *pError = -EIO;
+    return NULL;
+}
+
+static int gdrive_cnode_session_start(Gdrive_Cache_Node* pNode, 
+                                      size_t fileSize)
+{
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
     {
-        pNodeOne->pRight->pParent = pNodeOne;
+        // Memory error
+        return -1;
     }
-    if (pNodeTwo->pLeft)
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PUT);
+    gdrive_xfer_set_priority(pTransfer, gdrive_cnode_sync_priority(pNode));
+    
+    char lengthHeader[64];
+    snprintf(lengthHeader, sizeof(lengthHeader), 
+             "X-Upload-Content-Length: %lu", (unsigned long) fileSize
+            );
+    char* url = gdrive_cnode_get_upload_url(pNode);
+    if (url == NULL || gdrive_xfer_set_url(pTransfer, url) != 0 || 
+            gdrive_xfer_add_query(pTransfer, "uploadType", "resumable") != 0 || 
+            gdrive_xfer_add_header(pTransfer, lengthHeader) != 0
+            )
     {
-        pNodeTwo->pLeft->pParent = pNodeTwo;
+        // Error, probably memory
+        free(url);
+        gdrive_xfer_free(pTransfer);
+        return -1;
     }
-    if (pNodeTwo->pRight)
+    free(url);
+    
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    
+    // The session URI comes back in the Location header.
+    char* session = (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400) ? 
+        gdrive_dlbuf_get_header(pBuf, "Location") : NULL;
+    gdrive_dlbuf_free(pBuf);
+    if (session == NULL)
     {
-        pNodeTwo->pRight->pParent = pNodeTwo; 
+        // Request failed, or no session was returned
+        return -1;
     }
+    free(pNode->uploadSession);
+    pNode->uploadSession = session;
+    return 0;
 }
 
-/*
- * NOT RECURSIVE.  FREES ONLY THE SINGLE NODE.
- */
-static void gdrive_cnode_free(Gdrive_Cache_Node* pNode)
-{
-    gdrive_finfo_cleanup(&(pNode->fileinfo));
-    gdrive_fcontents_free_all(&(pNode->pContents));
-    pNode->pContents = NULL;
-    pNode->pLeft = NULL;
-    pNode->pRight = NULL;
-    free(pNode);
-}
-
-static Gdrive_File_Contents* gdrive_cnode_add_contents(Gdrive_Cache_Node* pNode)
+static Gdrive_Download_Buffer* 
+gdrive_cnode_session_put(Gdrive_Cache_Node* pNode, off_t start, size_t length,
+                         size_t fileSize, Gdrive_Cnode_Relay* pRelay)
 {
-    // Create the actual Gdrive_File_Contents struct, and add it to the existing
-    // chain if there is one.
-    Gdrive_File_Contents* pContents = gdrive_fcontents_add(pNode->pContents);
-    if (pContents == NULL)
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
     {
-        // Memory or file creation error
+        // Memory error
         return NULL;
     }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PUT);
+    gdrive_xfer_set_priority(pTransfer, gdrive_cnode_sync_priority(pNode));
     
-    // If there is no existing chain, point to the new struct as the start of a
-    // new chain.
-    if (pNode->pContents == NULL)
+    // Describe the piece being sent, or (with no piece) ask about the whole 
+    // file. The longest header, with three 20-digit numbers, needs 84 bytes.
+    char rangeHeader[96];
+    if (length > 0)
     {
-        pNode->pContents = pContents;
+        snprintf(rangeHeader, sizeof(rangeHeader), 
+                 "Content-Range: bytes %ld-%ld/%lu", 
+                 start, start + (off_t) length - 1, (unsigned long) fileSize
+                );
     }
-    
-    
-    return pContents;
-}
-
-static Gdrive_File_Contents* 
-gdrive_cnode_create_chunk(Gdrive_Cache_Node* pNode, off_t offset, size_t size, 
-                          bool fillChunk)
-{
-    // Get the normal chunk size for this file, the smallest multiple of
-    // minChunkSize that results in maxChunks or fewer chunks. Avoid creating
-    // a chunk of size 0 by forcing fileSize to be at least 1.
-    size_t fileSize = (pNode->fileinfo.size > 0) ? pNode->fileinfo.size : 1;
-    int maxChunks = gdrive_get_maxchunks();
-    size_t minChunkSize = gdrive_get_minchunksize();
-
-    size_t perfectChunkSize = gdrive_divide_round_up(fileSize, maxChunks);
-    size_t chunkSize = gdrive_divide_round_up(perfectChunkSize, minChunkSize) * 
-            minChunkSize;
-    
-    // The actual chunk may be a multiple of chunkSize.  A read that starts at
-    // "offset" and is "size" bytes long should be within this single chunk.
-    off_t chunkStart = (offset / chunkSize) * chunkSize;
-    off_t chunkOffset = offset % chunkSize;
-    off_t endChunkOffset = chunkOffset + size - 1;
-    size_t realChunkSize = gdrive_divide_round_up(endChunkOffset, chunkSize) * 
-            chunkSize;
-    
-    Gdrive_File_Contents* pContents = gdrive_cnode_add_contents(pNode);
-    if (pContents == NULL)
+    else
     {
-        // Memory or file creation error
+        snprintf(rangeHeader, sizeof(rangeHeader), 
+                 "Content-Range: bytes */%lu", (unsigned long) fileSize
+                );
+    }
+    if (gdrive_xfer_set_url(pTransfer, pNode->uploadSession) != 0 || 
+            gdrive_xfer_add_header(pTransfer, rangeHeader) != 0
+            )
+    {
+        // Memory error
+        gdrive_xfer_free(pTransfer);
         return NULL;
     }
     
-    if (fillChunk)
+    Gdrive_Cnode_Upload_Range range = {pNode, start, length, pRelay};
+    if (length > 0)
     {
-        int success = gdrive_fcontents_fill_chunk(pContents,
-                                                  pNode->fileinfo.id, 
-                                                  chunkStart, realChunkSize
-        );
-        if (success != 0)
-        {
-            // Didn't write the file.  Clean up the new Gdrive_File_Contents 
-            // struct
-            gdrive_cnode_delete_file_contents(pNode, pContents);
-            return NULL;
-        }
+        gdrive_xfer_set_uploadcallback(pTransfer, gdrive_file_uploadcallback, 
+                                       &range
+                );
+        gdrive_xfer_set_uploadsize(pTransfer, length);
     }
-    // else we're not filling the chunk, do nothing
     
-    // Success
-    return pContents;
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    return pBuf;
 }
 
-static size_t gdrive_file_read_next_chunk(Gdrive_File* pFile, char* destBuf, 
-                                          off_t offset, size_t size)
+static off_t gdrive_cnode_session_received(Gdrive_Download_Buffer* pBuf)
 {
-    // Gdrive_Filehandle and Gdrive_Cache_Node are the same thing, but it's 
-    // easier to think of the filehandle as just a token used to refer to a 
-    // file, whereas a cache node has internal structure to act upon.
-    Gdrive_Cache_Node* pNode = pFile;
-    
-    // Do we already have a chunk that includes the starting point?
-    Gdrive_File_Contents* pChunkContents = 
-            gdrive_fcontents_find_chunk(pNode->pContents, offset);
-    
-    if (pChunkContents == NULL)
-    {
-        // Chunk doesn't exist, need to create and download it.
-        pChunkContents = gdrive_cnode_create_chunk(pNode, offset, size, true);
-        
-        if (pChunkContents == NULL)
+    // The Range header (for example, "bytes=0-1048575") gives the last byte
+    // received. Without one, nothing has been received yet.
+    char* range = gdrive_dlbuf_get_header(pBuf, "Range");
+    off_t received = 0;
+    if (range != NULL)
+    {
+        const char* lastByte = strchr(range, '-');
+        if (lastByte != NULL)
         {
-            // Error creating the chunk
-            // TODO: size_t is (or should be) unsigned. Rather than returning
-            // a negative value for error, we should probably return 0 and add
-            // a parameter for a pointer to an error value.
-            return -EIO;
+            received = strtoll(lastByte + 1, NULL, 10) + 1;
         }
+        free(range);
     }
-    
-    // Actually read to the buffer and return the number of bytes read (which
-    // may be less than size if we hit the end of the chunk), or return any 
-    // error up to the caller.
-    return gdrive_fcontents_read(pChunkContents, destBuf, offset, size);
+    return received;
 }
 
-static off_t gdrive_file_write_next_chunk(Gdrive_File* pFile, const char* buf, 
-                                          off_t offset, size_t size)
+static size_t gdrive_cnode_relay_read(Gdrive_Cache_Node* pNode, 
+                                      Gdrive_Cnode_Relay* pRelay, char* buffer,
+                                      off_t offset, size_t size, off_t end)
 {
-    // Gdrive_Filehandle and Gdrive_Cache_Node are the same thing, but it's 
-    // easier to think of the filehandle as just a token used to refer to a 
-    // file, whereas a cache node has internal structure to act upon.
-    Gdrive_Cache_Node* pNode = pFile;
-    
-    // If the starting point is 1 byte past the end of the file, we'll extend 
-    // the final chunk. Otherwise, we'll write to the end of the chunk and stop.
-    bool extendChunk = (offset == (off_t) pNode->fileinfo.size);
-    
-    // Find the chunk that includes the starting point, or the last chunk if
-    // the starting point is 1 byte past the end.
-    off_t searchOffset = (extendChunk && offset > 0) ? offset - 1 : offset;
-    Gdrive_File_Contents* pChunkContents = 
-            gdrive_fcontents_find_chunk(pNode->pContents, searchOffset);
-    
-    if (pChunkContents == NULL)
-    {
-        // Chunk doesn't exist. This is an error unless the file size is 0.
-        if (pNode->fileinfo.size == 0)
+    size_t relaySize = (pRelay->pBuf != NULL) ? 
+        gdrive_dlbuf_get_size(pRelay->pBuf) : 0;
+    if (offset < pRelay->start || offset >= pRelay->start + (off_t) relaySize)
+    {
+        // The current piece doesn't have what we need. Use the one being 
+        // downloaded in the background if it does, or else download it now.
+        gdrive_dlbuf_free(pRelay->pBuf);
+        pRelay->pBuf = NULL;
+        if (pRelay->pNext != NULL)
         {
-            // File size is 0, and there is no existing chunk. Create one and 
-            // try again.
-            gdrive_cnode_create_chunk(pNode, 0, 1, false);
-            pChunkContents = 
-                    gdrive_fcontents_find_chunk(pNode->pContents, searchOffset);
+            pRelay->pBuf = gdrive_xfer_wait(pRelay->pNext);
+            gdrive_xfer_free(pRelay->pNext);
+            pRelay->pNext = NULL;
+            pRelay->start = pRelay->nextStart;
+            if (pRelay->pBuf != NULL)
+            {
+                pRelay->bytesDownloaded += gdrive_dlbuf_get_size(pRelay->pBuf);
+            }
+            if (offset < pRelay->nextStart || 
+                    offset >= pRelay->nextStart + (off_t) pRelay->nextLength
+                    )
+            {
+                gdrive_dlbuf_free(pRelay->pBuf);
+                pRelay->pBuf = NULL;
+            }
+        }
+        if (pRelay->pBuf == NULL)
+        {
+            size_t length = (end - offset + 1 < GDRIVE_CNODE_RELAY_SIZE) ? 
+                end - offset + 1 : GDRIVE_CNODE_RELAY_SIZE;
+            Gdrive_Transfer* pTransfer = 
+                    gdrive_cnode_relay_transfer(pNode, offset, length);
+            pRelay->pBuf = (pTransfer != NULL) ? 
+                gdrive_xfer_execute(pTransfer) : NULL;
+            gdrive_xfer_free(pTransfer);
+            pRelay->start = offset;
+            if (pRelay->pBuf != NULL)
+            {
+                pRelay->bytesDownloaded += gdrive_dlbuf_get_size(pRelay->pBuf);
+            }
+        }
+        
+        // Anything other than the requested range (206 Partial Content) is an
+        // error, unless the range started at the beginning of the file.
+        long httpResp = (pRelay->pBuf != NULL) ? 
+            gdrive_dlbuf_get_httpresp(pRelay->pBuf) : 0;
+        relaySize = (pRelay->pBuf != NULL) ? 
+            gdrive_dlbuf_get_size(pRelay->pBuf) : 0;
+        if ((httpResp != 206 && (httpResp != 200 || pRelay->start != 0)) || 
+                offset >= pRelay->start + (off_t) relaySize
+                )
+        {
+            gdrive_dlbuf_free(pRelay->pBuf);
+            pRelay->pBuf = NULL;
+            return (size_t)(-1);
         }
-    }
-    if (pChunkContents == NULL)
-    {
-        // Chunk still doesn't exist, return error.
-        // TODO: size_t is (or should be) unsigned. Rather than returning
-        // a negative value for error, we should probably return 0 and add
-        // a parameter for a pointer to an error value.
-        return -EINVAL;
-    }
-    
-    // Actually write to the buffer and return the number of bytes read (which
-    // may be less than size if we hit the end of the chunk), or return any 
-    // error up to the caller.
-    off_t bytesWritten = gdrive_fcontents_write(pChunkContents, 
-                                                 buf, 
-                                                 offset, 
-                                                 size, 
-                                                 extendChunk
-            );
-    
-    if (bytesWritten > 0)
-    {
-        // Mark the file as having been written
-        pNode->dirty = true;
         
-        if ((size_t)(offset + bytesWritten) > pNode->fileinfo.size)
+        // Start on the next uncached piece while this one is sent.
+        off_t nextOffset = pRelay->start + relaySize;
+        off_t fileEnd = gdrive_cnode_get_size(pNode) - 1;
+        off_t missingStart;
+        off_t missingEnd;
+        if (nextOffset <= fileEnd && 
+                gdrive_fcontents_find_missing(&(pNode->contents), nextOffset, 
+                                              fileEnd, &missingStart, 
+                                              &missingEnd)
+                )
         {
-            // Update the file size
-            pNode->fileinfo.size = offset + bytesWritten;
+            size_t length = 
+                    (missingEnd - missingStart + 1 < GDRIVE_CNODE_RELAY_SIZE) ? 
+                    missingEnd - missingStart + 1 : GDRIVE_CNODE_RELAY_SIZE;
+            pRelay->pNext = 
+                    gdrive_cnode_relay_transfer(pNode, missingStart, length);
+            if (pRelay->pNext != NULL && 
+                    gdrive_xfer_submit(pRelay->pNext, NULL, NULL) != 0
+                    )
+            {
+                // Couldn't start it. It will be downloaded when it's needed.
+                gdrive_xfer_free(pRelay->pNext);
+                pRelay->pNext = NULL;
+            }
+            pRelay->nextStart = missingStart;
+            pRelay->nextLength = length;
         }
     }
     
-    return bytesWritten;
+    // Copy as much as we can from the current piece.
+    off_t available = pRelay->start + (off_t) relaySize - offset;
+    if (available > end - offset + 1)
+    {
+        available = end - offset + 1;
+    }
+    if ((off_t) size > available)
+    {
+        size = available;
+    }
+    memcpy(buffer, gdrive_dlbuf_get_data(pRelay->pBuf) + 
+           (offset - pRelay->start), size
+            );
+    return size;
 }
 
-static bool gdrive_file_check_perm(const Gdrive_Cache_Node* pNode, 
-                                   int accessFlags)
+static Gdrive_Transfer* gdrive_cnode_relay_transfer(Gdrive_Cache_Node* pNode, 
+                                                    off_t start, size_t size)
 {
-    // What permissions do we have?
-    unsigned int perms = gdrive_finfo_real_perms(&(pNode->fileinfo));
-    
-    // What permissions do we need?
-    unsigned int neededPerms = 0;
-    // At least on my system, O_RDONLY is 0, which prevents testing for the
-    // individual bit flag. On systems like mine, just assume we always need
-    // read access. If there are other systems that have a different O_RDONLY
-    // value, we'll test for the flag on those systems.
-    if ((O_RDONLY == 0) || (accessFlags & O_RDONLY) || (accessFlags & O_RDWR))
-    {
-        neededPerms = neededPerms | S_IROTH;
-    }
-    if ((accessFlags & O_WRONLY) || (accessFlags & O_RDWR))
+    gdrive_cache_lock();
+    Gdrive_Transfer* pTransfer = 
+            gdrive_fcontents_range_transfer(pNode->fileinfo.id, start, size);
+    gdrive_cache_unlock();
+    if (pTransfer != NULL)
     {
-        neededPerms = neededPerms | S_IWOTH;
+        gdrive_xfer_set_priority(pTransfer, gdrive_cnode_sync_priority(pNode));
     }
-    
-    // If there is anything we need but don't have, return false.
-    return !(neededPerms & ~perms);
-    
+    return pTransfer;
 }
 
-static size_t gdrive_file_uploadcallback(char* buffer, off_t offset, 
-                                         size_t size, 
-                                         void* userdata)
+static enum Gdrive_Xfer_Priority 
+gdrive_cnode_sync_priority(const Gdrive_Cache_Node* pNode)
 {
-    // All we need to do is read from a Gdrive_File* file handle into a buffer.
-    // We already know how to do exactly that.
-    int returnVal = gdrive_file_read((Gdrive_File*) userdata, 
-                                     buffer, 
-                                     size, 
-                                     offset
-    );
-    return (returnVal >= 0) ? (size_t) returnVal: (size_t)(-1);
+    return pNode->backgroundSync ? 
+        GDRIVE_XFER_PRIORITY_BACKGROUND : GDRIVE_XFER_PRIORITY_INTERACTIVE;
+}
+
+static void gdrive_cnode_relay_cleanup(Gdrive_Cnode_Relay* pRelay)
+{
+    if (pRelay->pNext != NULL)
+    {
+        gdrive_dlbuf_free(gdrive_xfer_wait(pRelay->pNext));
+        gdrive_xfer_free(pRelay->pNext);
+        pRelay->pNext = NULL;
+    }
+    gdrive_dlbuf_free(pRelay->pBuf);
+    pRelay->pBuf = NULL;
 }
 
 static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo, 
@@ -1255,6 +3061,10 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
     
     Gdrive_Fileinfo myFileinfo = {0};
     Gdrive_Fileinfo* pMyFileinfo;
+    
+    // An existing file's information lives in the cache, so hold the cache
+    // lock until we're done reading from it.
+    gdrive_cache_lock();
     if (pFileinfo != NULL)
     {
         pMyFileinfo = pFileinfo;
@@ -1285,6 +3095,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
     if (uploadResourceJson == NULL)
     {
         *pError = ENOMEM;
+        gdrive_cache_unlock();
         return NULL;
     }
     gdrive_json_add_string(uploadResourceJson, "title", pMyFileinfo->filename);
@@ -1297,6 +3108,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         {
             *pError = ENOMEM;
             gdrive_json_kill(uploadResourceJson);
+            gdrive_cache_unlock();
             return NULL;
         }
         Gdrive_Json_Object* parentIdObj = gdrive_json_new();
@@ -1315,6 +3127,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         // Memory error
         gdrive_json_kill(uploadResourceJson);
         *pError = ENOMEM;
+        gdrive_cache_unlock();
         return NULL;
     }
     // Reuse the same timeString for atime and mtime. Can't change ctime.
@@ -1345,6 +3158,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
     if (uploadResourceStr == NULL)
     {
         *pError = ENOMEM;
+        gdrive_cache_unlock();
         return NULL;
     }
     
@@ -1360,6 +3174,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         if (url == NULL)
         {
             *pError = ENOMEM;
+            gdrive_cache_unlock();
             return NULL;
         }
         strncpy(url, GDRIVE_URL_FILES, urlSize);
@@ -1373,6 +3188,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         if (url == NULL)
         {
             *pError = ENOMEM;
+            gdrive_cache_unlock();
             return NULL;
         }
         strncpy(url, GDRIVE_URL_FILES, baseUrlLength);
@@ -1380,6 +3196,8 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         strncpy(url + baseUrlLength + 1, pMyFileinfo->id, fileIdLength + 1);
     }
     
+    gdrive_cache_unlock();
+    
     // Set up the network request
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
     if (pTransfer == NULL)
@@ -1445,7 +3263,9 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         return NULL;
     }
     
+    gdrive_cache_lock();
     pMyFileinfo->dirtyMetainfo = false;
+    gdrive_cache_unlock();
     return fileId;
 }
 
@@ -7,7 +7,8 @@
  * Gdrive_File).
  * 
  * A struct and related functions to work with cached data for an individual
- * file.
+ * file. Unless otherwise noted, these functions should only be called while
+ * holding the cache lock (see gdrive_cache_lock()).
  * 
  * This header is used internally by Gdrive code and should not be included 
  * outside of Gdrive code.
@@ -26,23 +27,31 @@ extern "C" {
 
     
 typedef struct Gdrive_Cache_Node Gdrive_Cache_Node;
+typedef struct Gdrive_Cnode_Table Gdrive_Cnode_Table;
 
 /*************************************************************************
  * Constructors, factory methods, destructors and similar
  *************************************************************************/
 
+/*
+ * gdrive_cnode_table_create(): Creates an empty table of cache nodes, indexed
+ *                              by file ID.
+ * Return value (Gdrive_Cnode_Table*):
+ *      On success, a pointer to the new table. On failure, NULL. When no longer
+ *      needed, the table should be passed to gdrive_cnode_table_free().
+ */
+Gdrive_Cnode_Table* gdrive_cnode_table_create(void);
+
 /*
  * gdrive_cnode_get():  Finds the cache node with the given fileId, optionally
  *                      creating it if it doesn't exist. (This is listed as a
  *                      constructor because it's the only public way to create
  *                      a new Gdrive_Cache_Node struct).
  * Parameters:
- *      pParent (Gdrive_Cache_Node*):
- *              Reserved for internal use. Must be NULL.
- *      ppNode (Gdrive_Cache_Node**):
- *              The address of a pointer to the root node. If the requested
- *              cache node doesn't already exist and addIfDoesntExist is true,
- *              this pointer may be changed.
+ *      pTable (Gdrive_Cnode_Table*):
+ *              The table of cache nodes to search. If the requested cache node
+ *              doesn't already exist and addIfDoesntExist is true, the new node
+ *              is added to this table.
  *      fileId (const char*):
  *              The Google Drive file ID to search for.
  *      addIfDoesntExist (bool):
@@ -60,24 +69,25 @@ typedef struct Gdrive_Cache_Node Gdrive_Cache_Node;
  *      On success, returns a pointer to a Gdrive_Cache_Node for the given
  *      Google Drive file ID. On failure, or if the given file ID doesn't 
  *      already have a cache node and addIfDoesntExist is false, returns NULL.
+ *      A newly created node has only its file ID filled in, and a last update
+ *      time of 0. Use gdrive_cnode_update_from_json() to fill in the rest.
+ *      The node's address does not change as other nodes are added to or 
+ *      removed from the table.
  */
-Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent, 
-                                    Gdrive_Cache_Node** ppNode, 
+Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cnode_Table* pTable, 
                                     const char* fileId, bool addIfDoesntExist, 
                                     bool* pAlreadyExists);
 
 /*
- *  gdrive_cnode_delete():  Deletes a node and safely frees its memory, 
- *                          preserving the structure of the remaining nodes.
+ *  gdrive_cnode_delete():  Removes a node from the table and safely frees its
+ *                          memory.
  * Parameters:
  *      pNode (Gdrive_Cache_Node*):
  *              A pointer to the node to delete.
- *      ppToRoot (Gdrive_Cache_Node**):
- *              The address of a pointer to the root node. In some cases, this
- *              pointer may change.
+ *      pTable (Gdrive_Cnode_Table*):
+ *              The table holding the node.
  */
-void gdrive_cnode_delete(Gdrive_Cache_Node* pNode, 
-                         Gdrive_Cache_Node** ppToRoot);
+void gdrive_cnode_delete(Gdrive_Cache_Node* pNode, Gdrive_Cnode_Table* pTable);
 
 /*
  * gdrive_cnode_mark_deleted(): Mark a node for deletion. If there are any open
@@ -87,21 +97,20 @@ void gdrive_cnode_delete(Gdrive_Cache_Node* pNode,
  * Parameters:
  *      pNode (Gdrive_Cache_Node*):
  *              A pointer to the node to mark for deletion.
- *      ppToRoot (Gdrive_Cache_Node**):
- *              The address of a pointer to the root node. The pointer at this
- *              location may be changed to point to a different memory location.
+ *      pTable (Gdrive_Cnode_Table*):
+ *              The table holding the node.
  */
 void gdrive_cnode_mark_deleted(Gdrive_Cache_Node* pNode, 
-                               Gdrive_Cache_Node** ppToRoot);
+                               Gdrive_Cnode_Table* pTable);
 
 /*
- * gdrive_cnode_free_all(): Safely frees the memory associated with all cache
- *                          nodes in the tree.
+ * gdrive_cnode_table_free():   Safely frees the memory associated with a table
+ *                              and all the cache nodes in it.
  * Parameters:
- *      pRoot (Gdrive_Cache_Node*):
- *              A pointer to the root cache node.
+ *      pTable (Gdrive_Cnode_Table*):
+ *              A pointer to the table. It is safe to pass a NULL pointer.
  */
-void gdrive_cnode_free_all(Gdrive_Cache_Node* pRoot);
+void gdrive_cnode_table_free(Gdrive_Cnode_Table* pTable);
 
 
 /*************************************************************************
@@ -169,8 +178,9 @@ void gdrive_cnode_update_from_json(Gdrive_Cache_Node* pNode,
 
 /*
  * gdrive_cnode_delete_file_contents(): Removes a single Gdrive_File_Contents
- *                                      struct (describing and holding a FILE*
- *                                      handle for a single portion of the file)
+ *                                      struct (describing and holding a file
+ *                                      descriptor for a single portion of the 
+ *                                      file)
  *                                      from a cache node and safely frees its
  *                                      memory.
  * Parameters:
@@ -183,9 +193,20 @@ void gdrive_cnode_delete_file_contents(Gdrive_Cache_Node* pNode,
                                 Gdrive_File_Contents* pContents);
 
 /*
- * gdrive_cnode_is_dirty(): Determine whether a node has "dirty" data written
- *                          to the on-disk or in-memory cache, which has not
- *                          been sent to Google Drive.
+ * gdrive_cnode_invalidate():   Marks the information stored in a cache node as
+ *                              out of date by setting its last updated time to
+ *                              0. The node itself (and any open file handles
+ *                              using it) remain valid.
+ * Parameters:
+ *      pNode (Gdrive_Cache_Node*):
+ *              A pointer to the cache node.
+ */
+void gdrive_cnode_invalidate(Gdrive_Cache_Node* pNode);
+
+/*
+ * gdrive_cnode_is_dirty(): Determine whether a node has "dirty" data or 
+ *                          metadata written to the on-disk or in-memory cache,
+ *                          which has not been sent to Google Drive.
  * Parameters:
  *      pNode (Gdrive_Cache_Node*):
  *              A pointer to the node to check for dirty data.
@@ -194,6 +215,65 @@ void gdrive_cnode_delete_file_contents(Gdrive_Cache_Node* pNode,
  */
 bool gdrive_cnode_is_dirty(const Gdrive_Cache_Node* pNode);
 
+/*
+ * gdrive_cnode_discard_stale_contents():   Discards a node's cached file 
+ *                                          contents if they no longer match
+ *                                          the file information stored in the
+ *                                          node. Contents of files that are 
+ *                                          open or have dirty data are left 
+ *                                          alone (they are checked again when
+ *                                          the file is next opened).
+ * Parameters:
+ *      pNode (Gdrive_Cache_Node*):
+ *              A pointer to the cache node.
+ */
+void gdrive_cnode_discard_stale_contents(Gdrive_Cache_Node* pNode);
+
+/*
+ * gdrive_cnode_table_keep_contents():  Keeps the cached contents of every 
+ *                                      node whose contents match a known 
+ *                                      version of the file (see 
+ *                                      gdrive_fcontents_keep()), and lists 
+ *                                      them in an index file.
+ * Parameters:
+ *      pTable (Gdrive_Cnode_Table*):
+ *              The table of cache nodes.
+ *      indexFile (FILE*):
+ *              An open file to which to write the index, one line per chunk.
+ */
+void gdrive_cnode_table_keep_contents(Gdrive_Cnode_Table* pTable, 
+                                      FILE* indexFile);
+
+/*
+ * gdrive_cnode_table_load_contents():  Picks up the chunks listed in an index
+ *                                      written by 
+ *                                      gdrive_cnode_table_keep_contents(), 
+ *                                      creating cache nodes as needed. The new
+ *                                      nodes have only their file ID filled
+ *                                      in, as with gdrive_cnode_get(). Chunks
+ *                                      that can't be found are skipped.
+ * Parameters:
+ *      pTable (Gdrive_Cnode_Table*):
+ *              The table of cache nodes.
+ *      indexFile (FILE*):
+ *              An open file from which to read the index, positioned at the
+ *              first line.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_cnode_table_load_contents(Gdrive_Cnode_Table* pTable, 
+                                     FILE* indexFile);
+
+/*
+ * gdrive_cnode_upload_cleanup():   Waits for all files queued for background 
+ *                                  upload (see gdrive_file_close()) to be 
+ *                                  uploaded, then stops the upload worker 
+ *                                  threads. Does not need the cache lock, and
+ *                                  must not be called while holding it. It is
+ *                                  safe to queue uploads again afterward.
+ */
+void gdrive_cnode_upload_cleanup(void);
+
 
 #ifdef	__cplusplus
 }
@@ -3,6 +3,15 @@
 
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+// Name of the index of kept file contents within the cache directory, and the
+// text it starts with (followed by the next change ID at the time it was 
+// written).
+#define GDRIVE_CACHE_INDEX_NAME "index"
+#define GDRIVE_CACHE_INDEX_HEADER "gdrive-cache-index-1 "
 
 
 
@@ -16,13 +25,31 @@ typedef struct Gdrive_Cache
     time_t cacheTTL;
     time_t lastUpdateTime;
     int64_t nextChangeId;
-    Gdrive_Cache_Node* pCacheHead;
-    Gdrive_Fileid_Cache_Node* pFileIdCacheHead; 
+    Gdrive_Cnode_Table* pCacheTable;
+    Gdrive_Fidnode_Table* pFileIdTable;
+    // Number of lookups answered, or not answered, by the negative entries
+    // (paths known not to exist) in pFileIdTable
+    unsigned long missingHits;
+    unsigned long missingMisses;
+    // mutex protects everything above, as well as the metadata stored in each
+    // cache node. updateMutex makes sure only one thread at a time fetches
+    // the list of changes from Google Drive.
+    pthread_mutex_t mutex;
+    pthread_mutex_t updateMutex;
 } Gdrive_Cache;
 
 static Gdrive_Cache* gdrive_cache_get_internal(void);
 
-static void gdrive_cache_remove_id(const char* fileId);
+/*
+ * Returns the path of the index file in the cache directory, followed by 
+ * suffix, in newly allocated memory. Returns NULL on failure.
+ */
+static char* gdrive_cache_index_path(const char* suffix);
+
+/*
+ * Writes the index of file contents to keep in the cache directory.
+ */
+static void gdrive_cache_save_contents(void);
 
 
 /*************************************************************************
@@ -47,7 +74,32 @@ int gdrive_cache_init(time_t cacheTTL)
     }
     // else not initialized yet
     
+    // The cache lock is recursive so that cache functions can call each other
+    // (and callers holding the lock can call cache functions) freely.
+    pthread_mutexattr_t attr;
+    if (pthread_mutexattr_init(&attr) != 0)
+    {
+        return -1;
+    }
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int result = pthread_mutex_init(&pCache->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (result != 0 || pthread_mutex_init(&pCache->updateMutex, NULL) != 0)
+    {
+        return -1;
+    }
+    
+    pCache->pCacheTable = gdrive_cnode_table_create();
+    pCache->pFileIdTable = gdrive_fidnode_table_create();
+    if (pCache->pCacheTable == NULL || pCache->pFileIdTable == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    
     pCache->cacheTTL = cacheTTL;
+    pCache->missingHits = 0;
+    pCache->missingMisses = 0;
     
     // Prepare and send the network request
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
@@ -98,6 +150,63 @@ int gdrive_cache_init(time_t cacheTTL)
     }
 }
 
+int gdrive_cache_load_contents(void)
+{
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    
+    // Anything that was in use when an earlier session stopped without 
+    // cleaning up may have been changed, so it can't be trusted.
+    gdrive_fcontents_remove_unused(false);
+    
+    char* indexPath = gdrive_cache_index_path("");
+    if (indexPath == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    
+    int returnVal = 0;
+    bool loaded = false;
+    FILE* indexFile = fopen(indexPath, "r");
+    if (indexFile != NULL)
+    {
+        long long nextChangeId = 0;
+        if (fscanf(indexFile, GDRIVE_CACHE_INDEX_HEADER "%lld\n", 
+                   &nextChangeId) == 1)
+        {
+            gdrive_cache_lock();
+            returnVal = gdrive_cnode_table_load_contents(pCache->pCacheTable, 
+                                                         indexFile);
+            
+            // Start the next update from where the earlier session left off,
+            // so that we hear about everything that changed in between.
+            pCache->nextChangeId = nextChangeId;
+            loaded = true;
+            gdrive_cache_unlock();
+        }
+        fclose(indexFile);
+        
+        // The picked up contents may change from now on. A new index is 
+        // written when the cache is cleaned up.
+        unlink(indexPath);
+    }
+    free(indexPath);
+    
+    // Kept contents that weren't in the index (or that couldn't be picked up)
+    // aren't needed.
+    gdrive_fcontents_remove_unused(true);
+    
+    if (loaded)
+    {
+        // Catch up on changes. This discards the contents of any files that
+        // have changed. If it fails, opening a file will still notice that
+        // it's changed.
+        gdrive_cache_update();
+    }
+    
+    return returnVal;
+}
+
 const Gdrive_Cache* gdrive_cache_get(void)
 {
     return gdrive_cache_get_internal();
@@ -106,10 +215,17 @@ const Gdrive_Cache* gdrive_cache_get(void)
 void gdrive_cache_cleanup(void)
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
-    gdrive_fidnode_clear_all(pCache->pFileIdCacheHead);
-    pCache->pFileIdCacheHead = NULL;
-    gdrive_cnode_free_all(pCache->pCacheHead);
-    pCache->pCacheHead = NULL;
+    if (gdrive_get_cachedir() != NULL && pCache->pCacheTable != NULL)
+    {
+        gdrive_cache_save_contents();
+    }
+
+    gdrive_fidnode_table_free(pCache->pFileIdTable);
+    pCache->pFileIdTable = NULL;
+    gdrive_cnode_table_free(pCache->pCacheTable);
+    pCache->pCacheTable = NULL;
+    pthread_mutex_destroy(&pCache->updateMutex);
+    pthread_mutex_destroy(&pCache->mutex);
 }
 
 
@@ -117,9 +233,9 @@ void gdrive_cache_cleanup(void)
  * Getter and setter functions
  ******************/
 
-Gdrive_Fileid_Cache_Node* gdrive_cache_get_fileidcachehead()
+Gdrive_Fidnode_Table* gdrive_cache_get_fileidtable()
 {
-    return gdrive_cache_get()->pFileIdCacheHead;
+    return gdrive_cache_get_internal()->pFileIdTable;
 }
 
 time_t gdrive_cache_get_ttl()
@@ -129,12 +245,28 @@ time_t gdrive_cache_get_ttl()
 
 time_t gdrive_cache_get_lastupdatetime()
 {
-    return gdrive_cache_get()->lastUpdateTime;
+    gdrive_cache_lock();
+    time_t lastUpdateTime = gdrive_cache_get()->lastUpdateTime;
+    gdrive_cache_unlock();
+    return lastUpdateTime;
+}
+
+void gdrive_cache_get_missing_stats(unsigned long* pHits, 
+                                    unsigned long* pMisses)
+{
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    gdrive_cache_lock();
+    *pHits = pCache->missingHits;
+    *pMisses = pCache->missingMisses;
+    gdrive_cache_unlock();
 }
 
 int64_t gdrive_cache_get_nextchangeid()
 {
-    return gdrive_cache_get()->nextChangeId;
+    gdrive_cache_lock();
+    int64_t nextChangeId = gdrive_cache_get()->nextChangeId;
+    gdrive_cache_unlock();
+    return nextChangeId;
 }
 
 
@@ -142,12 +274,25 @@ int64_t gdrive_cache_get_nextchangeid()
  * Other accessible functions
  ******************/
 
+void gdrive_cache_lock(void)
+{
+    pthread_mutex_lock(&gdrive_cache_get_internal()->mutex);
+}
+
+void gdrive_cache_unlock(void)
+{
+    pthread_mutex_unlock(&gdrive_cache_get_internal()->mutex);
+}
+
 int gdrive_cache_update_if_stale()
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
-    if (pCache->lastUpdateTime + pCache->cacheTTL < time(NULL))
+    gdrive_cache_lock();
+    bool stale = (pCache->lastUpdateTime + pCache->cacheTTL < time(NULL));
+    gdrive_cache_unlock();
+    if (stale)
     {
-        return gdrive_cache_update(pCache);
+        return gdrive_cache_update();
     }
     
     return 0;
@@ -157,18 +302,36 @@ int gdrive_cache_update()
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
     
+    // Only one thread needs to ask Google Drive for changes. If somebody else
+    // finished an update while we were waiting our turn, there's nothing left
+    // to do.
+    gdrive_cache_lock();
+    time_t lastUpdateTime = pCache->lastUpdateTime;
+    gdrive_cache_unlock();
+    pthread_mutex_lock(&pCache->updateMutex);
+    gdrive_cache_lock();
+    if (pCache->lastUpdateTime != lastUpdateTime)
+    {
+        gdrive_cache_unlock();
+        pthread_mutex_unlock(&pCache->updateMutex);
+        return 0;
+    }
+    int64_t nextChangeId = pCache->nextChangeId;
+    
+    // Don't hold the cache lock while waiting on the network.
+    gdrive_cache_unlock();
+    
     // Convert the numeric largest change ID into a string
     char* changeIdString = NULL;
-    size_t changeIdStringLen = snprintf(NULL, 0, "%lu", pCache->nextChangeId);
+    size_t changeIdStringLen = snprintf(NULL, 0, "%lu", nextChangeId);
     changeIdString = malloc(changeIdStringLen + 1);
     if (changeIdString == NULL)
     {
         // Memory error
+        pthread_mutex_unlock(&pCache->updateMutex);
         return -1;
     }
-    snprintf(changeIdString, changeIdStringLen + 1, "%lu", 
-            pCache->nextChangeId
-            );
+    snprintf(changeIdString, changeIdStringLen + 1, "%lu", nextChangeId);
     
     // Prepare the request, using the string change ID, and send it
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
@@ -176,6 +339,7 @@ int gdrive_cache_update()
     {
         // Memory error
         free(changeIdString);
+        pthread_mutex_unlock(&pCache->updateMutex);
         return -1;
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
@@ -189,6 +353,8 @@ int gdrive_cache_update()
         // Error
         free(changeIdString);
         gdrive_xfer_free(pTransfer);
+        pthread_mutex_unlock(&pCache->updateMutex);
+        return -1;
     }
     free(changeIdString);
     Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
@@ -196,106 +362,114 @@ int gdrive_cache_update()
     
     
     int returnVal = -1;
+    Gdrive_Json_Object* pObj = NULL;
     if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
     {
         // Response was good, try extracting the data.
-        Gdrive_Json_Object* pObj = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        if (pObj != NULL)
+        pObj = gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    }
+    gdrive_dlbuf_free(pBuf);
+    
+    gdrive_cache_lock();
+    if (pObj != NULL)
+    {
+        // Update or remove cached data for each item in the "items" array.
+        Gdrive_Json_Object* pChangeArray = 
+                gdrive_json_get_nested_object(pObj, "items");
+        int arraySize = gdrive_json_array_length(pChangeArray, NULL);
+        if (arraySize > 0)
+        {
+            // Any change could make a missing path exist.
+            gdrive_fidnode_remove_negative(pCache->pFileIdTable);
+        }
+        for (int i = 0; i < arraySize; i++)
         {
-            // Update or remove cached data for each item in the "items" array.
-            Gdrive_Json_Object* pChangeArray = 
-                    gdrive_json_get_nested_object(pObj, "items");
-            int arraySize = gdrive_json_array_length(pChangeArray, NULL);
-            for (int i = 0; i < arraySize; i++)
+            Gdrive_Json_Object* pItem = 
+                    gdrive_json_array_get(pChangeArray, NULL, i);
+            if (pItem == NULL)
             {
-                Gdrive_Json_Object* pItem = 
-                        gdrive_json_array_get(pChangeArray, NULL, i);
-                if (pItem == NULL)
-                {
-                    // Couldn't get this item, skip to the next one.
-                    continue;
-                }
-                char* fileId = 
-                        gdrive_json_get_new_string(pItem, "fileId", NULL);
-                if (fileId == NULL)
-                {
-                    // Couldn't get an ID for the changed file, skip to the
-                    // next one.
-                    continue;
-                }
-                
-                // We don't know whether the file has been renamed or moved,
-                // so remove it from the fileId cache.
-                gdrive_fidnode_remove_by_id(&pCache->pFileIdCacheHead, fileId);
-                
-                // Update the file metadata cache, but only if the file is not
-                // opened for writing with dirty data.
-                Gdrive_Cache_Node* pCacheNode = 
-                        gdrive_cnode_get(NULL,
-                                               &(pCache->pCacheHead), 
-                                               fileId, 
-                                               false, 
-                                               NULL
+                // Couldn't get this item, skip to the next one.
+                continue;
+            }
+            char* fileId = 
+                    gdrive_json_get_new_string(pItem, "fileId", NULL);
+            if (fileId == NULL)
+            {
+                // Couldn't get an ID for the changed file, skip to the
+                // next one.
+                continue;
+            }
+
+            // We don't know whether the file has been renamed or moved,
+            // so remove it from the fileId cache.
+            gdrive_fidnode_remove_by_id(pCache->pFileIdTable, fileId);
+
+            // Update the file metadata cache, but only if the file is not
+            // opened for writing with dirty data.
+            Gdrive_Cache_Node* pCacheNode = 
+                    gdrive_cnode_get(pCache->pCacheTable, fileId, false, 
+                                     NULL
+                    );
+            if (pCacheNode != NULL && !gdrive_cnode_is_dirty(pCacheNode))
+            {
+                // If this file was in the cache, update its information
+                gdrive_cnode_update_from_json(
+                        pCacheNode, 
+                        gdrive_json_get_nested_object(pItem, "file")
                         );
-                if (pCacheNode != NULL && !gdrive_cnode_is_dirty(pCacheNode))
+                gdrive_cnode_discard_stale_contents(pCacheNode);
+            }
+            // else either not in the cache, or there is dirty data we don't
+            // want to overwrite.
+
+
+            // The file's parents may now have a different number of 
+            // children.  Make sure they're counted again.
+            int numParents = 
+                    gdrive_json_array_length(pItem, "file/parents");
+            for (int nParent = 0; nParent < numParents; nParent++)
+            {
+                // Get the fileId of the current parent in the array.
+                char* parentId = NULL;
+                Gdrive_Json_Object* pParentObj = 
+                        gdrive_json_array_get(pItem, "file/parents", 
+                                              nParent);
+                if (pParentObj != NULL)
                 {
-                    // If this file was in the cache, update its information
-                    gdrive_cnode_update_from_json(
-                            pCacheNode, 
-                            gdrive_json_get_nested_object(pItem, "file")
-                            );
+                    parentId = gdrive_json_get_new_string(pParentObj, 
+                                                            "id", 
+                                                            NULL);
                 }
-                // else either not in the cache, or there is dirty data we don't
-                // want to overwrite.
-                
-                
-                // The file's parents may now have a different number of 
-                // children.  Remove the parents from the cache.
-                int numParents = 
-                        gdrive_json_array_length(pItem, "file/parents");
-                for (int nParent = 0; nParent < numParents; nParent++)
+                // Reset the parent's child count, if present.
+                if (parentId != NULL)
                 {
-                    // Get the fileId of the current parent in the array.
-                    char* parentId = NULL;
-                    Gdrive_Json_Object* pParentObj = 
-                            gdrive_json_array_get(pItem, "file/parents", 
-                                                  nParent);
-                    if (pParentObj != NULL)
-                    {
-                        parentId = gdrive_json_get_new_string(pParentObj, 
-                                                                "id", 
-                                                                NULL);
-                    }
-                    // Remove the parent from the cache, if present.
-                    if (parentId != NULL)
-                    {
-                        gdrive_cache_remove_id(parentId);
-                    }
-                    free(parentId);
+                    gdrive_cache_set_childcount(parentId, 
+                                                GDRIVE_FINFO_CHILDREN_UNKNOWN);
                 }
-                
-                free(fileId);
-            }
-            
-            bool success = false;
-            int64_t nextChangeId = gdrive_json_get_int64(pObj, 
-                                                         "largestChangeId", 
-                                                         true, &success
-                    ) + 1;
-            if (success)
-            {
-                pCache->nextChangeId = nextChangeId;
+                free(parentId);
             }
-            returnVal = success ? 0 : -1;
-            gdrive_json_kill(pObj);
+
+            free(fileId);
+        }
+
+        bool success = false;
+        int64_t largestChangeId = gdrive_json_get_int64(pObj, 
+                                                        "largestChangeId", 
+                                                        true, &success
+                );
+        if (success)
+        {
+            pCache->nextChangeId = largestChangeId + 1;
         }
+        returnVal = success ? 0 : -1;
+        gdrive_json_kill(pObj);
     }
     
     // Reset the last updated time
     pCache->lastUpdateTime = time(NULL);
     
-    gdrive_dlbuf_free(pBuf);
+    gdrive_cache_unlock();
+    pthread_mutex_unlock(&pCache->updateMutex);
     return returnVal;
 }
 
@@ -305,9 +479,10 @@ Gdrive_Fileinfo* gdrive_cache_get_item(const char* fileId,
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
     
+    gdrive_cache_lock();
+    
     // Get the existing node (or a new one) from the cache.
-    Gdrive_Cache_Node* pNode = gdrive_cnode_get(NULL,
-                                                &(pCache->pCacheHead),
+    Gdrive_Cache_Node* pNode = gdrive_cnode_get(pCache->pCacheTable,
                                                 fileId, 
                                                 addIfDoesntExist, 
                                                 pAlreadyExists
@@ -316,41 +491,55 @@ Gdrive_Fileinfo* gdrive_cache_get_item(const char* fileId,
     {
         // There was an error, or the node doesn't exist and we aren't allowed
         // to create a new one.
+        gdrive_cache_unlock();
         return NULL;
     }
     
+    // If the node's update time is 0, it is either brand new or its 
+    // information has been invalidated. Either way, the caller needs to fill
+    // it in.
+    time_t nodeUpdated = gdrive_cnode_get_update_time(pNode);
+    if (nodeUpdated == (time_t) 0)
+    {
+        if (pAlreadyExists != NULL)
+        {
+            *pAlreadyExists = false;
+        }
+        Gdrive_Fileinfo* pFileinfo = addIfDoesntExist ? 
+            gdrive_cnode_get_fileinfo(pNode) : NULL;
+        gdrive_cache_unlock();
+        return pFileinfo;
+    }
+    
     // Test whether the cached information is too old.  Use last updated time
     // for either the individual node or the entire cache, whichever is newer.
-    // If the node's update time is 0, always update it.
     time_t cacheUpdated = pCache->lastUpdateTime;
-    time_t nodeUpdated = gdrive_cnode_get_update_time(pNode);
     time_t expireTime = (nodeUpdated > cacheUpdated ? 
         nodeUpdated : cacheUpdated) + pCache->cacheTTL;
-    if (expireTime < time(NULL) || nodeUpdated == (time_t) 0)
+    if (expireTime < time(NULL))
     {
-        // Update the cache and try again.
-        
-        // Folder nodes may be deleted by cache updates, but regular file nodes
-        // are safe.
-        bool isFolder = (gdrive_cnode_get_filetype(pNode) == 
-                GDRIVE_FILETYPE_FOLDER);
-        
+        // Update the cache and try again. The node may have been invalidated
+        // or deleted by the update (or by another thread in the meantime), so
+        // look it up again from scratch.
+        gdrive_cache_unlock();
         gdrive_cache_update();
-        
-        return (isFolder ? 
-                gdrive_cache_get_item(fileId, addIfDoesntExist, 
-                                      pAlreadyExists) :
-                gdrive_cnode_get_fileinfo(pNode));
+        return gdrive_cache_get_item(fileId, addIfDoesntExist, 
+                                     pAlreadyExists);
     }
     
     // We have a good node that's not too old.
-    return gdrive_cnode_get_fileinfo(pNode);
+    Gdrive_Fileinfo* pFileinfo = gdrive_cnode_get_fileinfo(pNode);
+    gdrive_cache_unlock();
+    return pFileinfo;
 }
 
 int gdrive_cache_add_fileid(const char* path, const char* fileId)
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
-    return gdrive_fidnode_add(&(pCache->pFileIdCacheHead), path, fileId);
+    gdrive_cache_lock();
+    int returnVal = gdrive_fidnode_add(pCache->pFileIdTable, path, fileId);
+    gdrive_cache_unlock();
+    return returnVal;
 }
 
 Gdrive_Cache_Node* gdrive_cache_get_node(const char* fileId, 
@@ -359,40 +548,102 @@ Gdrive_Cache_Node* gdrive_cache_get_node(const char* fileId,
 )
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
-    return gdrive_cnode_get(NULL, &(pCache->pCacheHead), fileId,
-                                  addIfDoesntExist, pAlreadyExists
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = gdrive_cnode_get(pCache->pCacheTable, 
+                                                fileId, addIfDoesntExist, 
+                                                pAlreadyExists
             );
+    gdrive_cache_unlock();
+    return pNode;
 }
 
 char* gdrive_cache_get_fileid(const char* path)
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
     
+    gdrive_cache_lock();
+    
     // Get the cached node if it exists.  If it doesn't exist, fail.
-    Gdrive_Fileid_Cache_Node* pHeadNode = pCache->pFileIdCacheHead;
-    Gdrive_Fileid_Cache_Node* pNode = gdrive_fidnode_get_node(pHeadNode, path);
-    if (pNode == NULL)
+    Gdrive_Fileid_Cache_Node* pNode = 
+            gdrive_fidnode_get_node(pCache->pFileIdTable, path);
+    if (pNode == NULL || gdrive_fidnode_is_negative(pNode))
     {
-        // The path isn't cached.  Return null.
+        // The path isn't cached (or is known not to exist, which the caller
+        // can check with gdrive_cache_is_missing()).  Return null.
+        gdrive_cache_unlock();
         return NULL;
     }
     
     // We have the cached item.  Test whether it's too old.  Use the last update
     // either of the entire cache, or of the individual item, whichever is
     // newer.
-    time_t cacheUpdateTime = gdrive_cache_get_lastupdatetime(pCache);
+    time_t cacheUpdateTime = pCache->lastUpdateTime;
     time_t nodeUpdateTime = gdrive_fidnode_get_lastupdatetime(pNode);
-    time_t cacheTTL = gdrive_cache_get_ttl(pCache);
+    time_t cacheTTL = pCache->cacheTTL;
     time_t expireTime = ((nodeUpdateTime > cacheUpdateTime) ? 
         nodeUpdateTime : cacheUpdateTime) + cacheTTL;
     if (time(NULL) > expireTime)
     {
         // Item is expired.  Check for updates and try again.
-        gdrive_cache_update(pCache);
+        gdrive_cache_unlock();
+        gdrive_cache_update();
         return gdrive_cache_get_fileid(path);
     }
     
-    return gdrive_fidnode_get_fileid(pNode);
+    char* fileId = gdrive_fidnode_get_fileid(pNode);
+    gdrive_cache_unlock();
+    return fileId;
+}
+
+int gdrive_cache_add_missing(const char* path)
+{
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    gdrive_cache_lock();
+    int returnVal = gdrive_fidnode_add_negative(pCache->pFileIdTable, path);
+    gdrive_cache_unlock();
+    return returnVal;
+}
+
+bool gdrive_cache_is_missing(const char* path)
+{
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    
+    gdrive_cache_lock();
+    
+    Gdrive_Fileid_Cache_Node* pNode = 
+            gdrive_fidnode_get_node(pCache->pFileIdTable, path);
+    if (pNode == NULL || !gdrive_fidnode_is_negative(pNode))
+    {
+        // Not known to be missing.
+        pCache->missingMisses++;
+        gdrive_cache_unlock();
+        return false;
+    }
+    
+    // Negative entries are cleared whenever Google Drive reports any changes,
+    // but they still expire after cacheTTL seconds so that a missing path 
+    // doesn't stay missing forever if something goes wrong.
+    if (time(NULL) > gdrive_fidnode_get_lastupdatetime(pNode) + 
+            pCache->cacheTTL)
+    {
+        // Expired. Get rid of it.
+        gdrive_fidnode_remove_node(pCache->pFileIdTable, pNode);
+        pCache->missingMisses++;
+        gdrive_cache_unlock();
+        return false;
+    }
+    
+    pCache->missingHits++;
+    gdrive_cache_unlock();
+    return true;
+}
+
+void gdrive_cache_clear_missing(void)
+{
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    gdrive_cache_lock();
+    gdrive_fidnode_remove_negative(pCache->pFileIdTable);
+    gdrive_cache_unlock();
 }
 
 void gdrive_cache_delete_id(const char* fileId)
@@ -400,29 +651,95 @@ void gdrive_cache_delete_id(const char* fileId)
     assert(fileId != NULL);
     
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    
+    gdrive_cache_lock();
 
     // Remove the ID from the file Id cache
-    gdrive_fidnode_remove_by_id(&pCache->pFileIdCacheHead, fileId);
+    gdrive_fidnode_remove_by_id(pCache->pFileIdTable, fileId);
     
     // If the file isn't opened by anybody, delete it from the cache 
     // immediately. Otherwise, mark it for delete on close.
             
     // Find the node we want to remove.
     Gdrive_Cache_Node* pNode = 
-            gdrive_cnode_get(NULL, &(pCache->pCacheHead), fileId, 
-                                   false, NULL);
-    if (pNode == NULL)
+            gdrive_cnode_get(pCache->pCacheTable, fileId, false, NULL);
+    if (pNode != NULL)
     {
-        // Didn't find it.  Do nothing.
-        return;
+        gdrive_cnode_mark_deleted(pNode, pCache->pCacheTable);
+    }
+    // else didn't find it.  Do nothing.
+    
+    gdrive_cache_unlock();
+}
+
+void gdrive_cache_invalidate_id(const char* fileId)
+{
+    assert(fileId != NULL);
+    
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = 
+            gdrive_cnode_get(pCache->pCacheTable, fileId, false, NULL);
+    if (pNode != NULL)
+    {
+        gdrive_cnode_invalidate(pNode);
     }
-    gdrive_cnode_mark_deleted(pNode, &pCache->pCacheHead);
+    // else didn't find it.  Do nothing.
+    gdrive_cache_unlock();
+}
+
+void gdrive_cache_set_childcount(const char* folderId, int nChildren)
+{
+    assert(folderId != NULL);
+    
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = 
+            gdrive_cnode_get(pCache->pCacheTable, folderId, false, NULL);
+    if (pNode != NULL && 
+            gdrive_cnode_get_filetype(pNode) == GDRIVE_FILETYPE_FOLDER)
+    {
+        gdrive_cnode_get_fileinfo(pNode)->nChildren = nChildren;
+    }
+    // else not a cached folder.  Do nothing.
+    gdrive_cache_unlock();
+}
+
+void gdrive_cache_adjust_childcount(const char* folderId, int change)
+{
+    assert(folderId != NULL);
+    
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = 
+            gdrive_cnode_get(pCache->pCacheTable, folderId, false, NULL);
+    if (pNode != NULL && 
+            gdrive_cnode_get_filetype(pNode) == GDRIVE_FILETYPE_FOLDER)
+    {
+        Gdrive_Fileinfo* pFileinfo = gdrive_cnode_get_fileinfo(pNode);
+        if (pFileinfo->nChildren != GDRIVE_FINFO_CHILDREN_UNKNOWN)
+        {
+            pFileinfo->nChildren += change;
+            if (pFileinfo->nChildren < 0)
+            {
+                // The count was wrong. Start over next time.
+                pFileinfo->nChildren = GDRIVE_FINFO_CHILDREN_UNKNOWN;
+            }
+        }
+    }
+    // else not a cached folder.  Do nothing.
+    gdrive_cache_unlock();
 }
 
 void gdrive_cache_delete_node(Gdrive_Cache_Node* pNode)
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
-    gdrive_cnode_delete(pNode, &pCache->pCacheHead);
+    gdrive_cache_lock();
+    gdrive_cnode_delete(pNode, pCache->pCacheTable);
+    gdrive_cache_unlock();
 }
 
 
@@ -436,22 +753,55 @@ static Gdrive_Cache* gdrive_cache_get_internal(void)
     return &cache;
 }
 
-static void gdrive_cache_remove_id(const char* fileId)
+static char* gdrive_cache_index_path(const char* suffix)
+{
+    const char* cacheDir = gdrive_get_cachedir();
+    char* path = malloc(strlen(cacheDir) + strlen(GDRIVE_CACHE_INDEX_NAME) + 
+                        strlen(suffix) + 2
+    );
+    if (path == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(path, cacheDir);
+    strcat(path, "/" GDRIVE_CACHE_INDEX_NAME);
+    strcat(path, suffix);
+    return path;
+}
+
+static void gdrive_cache_save_contents(void)
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
-    // Find the node we want to remove.
-    Gdrive_Cache_Node* pNode = 
-            gdrive_cnode_get(NULL, &(pCache->pCacheHead), fileId, 
-                                   false, NULL);
-    if (pNode == NULL)
+    
+    // Write to a temporary file and rename it when finished, so that a partly
+    // written index is never used.
+    char* tempPath = gdrive_cache_index_path(".new");
+    char* indexPath = gdrive_cache_index_path("");
+    FILE* indexFile = (tempPath != NULL && indexPath != NULL) ? 
+        fopen(tempPath, "w") : NULL;
+    if (indexFile == NULL)
     {
-        // Didn't find it.  Do nothing.
+        // Memory or file error. Without an index, any contents left in the 
+        // directory will be cleaned up next time.
+        free(tempPath);
+        free(indexPath);
         return;
     }
     
-
-    gdrive_cnode_delete(pNode, &(pCache->pCacheHead));
+    gdrive_cache_lock();
+    fprintf(indexFile, GDRIVE_CACHE_INDEX_HEADER "%lld\n", 
+            (long long) pCache->nextChangeId);
+    gdrive_cnode_table_keep_contents(pCache->pCacheTable, indexFile);
+    gdrive_cache_unlock();
+    
+    if (fclose(indexFile) != 0 || rename(tempPath, indexPath) != 0)
+    {
+        // File error
+        unlink(tempPath);
+    }
+    free(tempPath);
+    free(indexPath);
 }
 
 
-
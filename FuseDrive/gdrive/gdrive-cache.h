@@ -9,6 +9,11 @@
  * access time (along with information about any open files and their on-disk
  * cached contents).
  * 
+ * All cache functions are safe to call from multiple threads. Callers that 
+ * work directly with a Gdrive_Cache_Node (or read or modify the fields of a
+ * Gdrive_Fileinfo struct stored in the cache) should hold the cache lock while
+ * doing so. See gdrive_cache_lock().
+ * 
  * This header is used internally by Gdrive code and should not be included 
  * outside of Gdrive code.
  *
@@ -48,6 +53,21 @@ typedef struct Gdrive_Cache Gdrive_Cache;
  */
 int gdrive_cache_init(time_t cacheTTL);
 
+/*
+ * gdrive_cache_load_contents():    Picks up file contents kept in the cache 
+ *                                  directory (see gdrive_set_cachedir()) by an
+ *                                  earlier session, and discards any that 
+ *                                  belong to files changed on Google Drive
+ *                                  since then. Anything else found in the 
+ *                                  cache directory is deleted. Should be called
+ *                                  only once, after gdrive_cache_init() and
+ *                                  before any files are opened.
+ * Return value (int):
+ *      0 on success, other on failure. Not finding any kept contents is not a
+ *      failure.
+ */
+int gdrive_cache_load_contents(void);
+
 /*
  * gdrive_cache_get():  Retrieves a pointer to the cache.
  * Return value (const Gdrive_Cache*):
@@ -57,7 +77,9 @@ const Gdrive_Cache* gdrive_cache_get(void);
 
 /*
  * gdrive_cache_cleanup():  Safely frees memory and files associated with the 
- *                          cache.
+ *                          cache. If there is a cache directory, contents of
+ *                          unchanged files are left there to be picked up by
+ *                          gdrive_cache_load_contents().
  */
 void gdrive_cache_cleanup(void);
 
@@ -67,12 +89,13 @@ void gdrive_cache_cleanup(void);
  *************************************************************************/
 
 /*
- * gdrive_cache_get_fileidcachehead():  Retrieves the first item in the 
- *                                      file ID cache.
- * Return value (Gdrive_Fileid_Cache_Node*):
- *      A pointer to the first item in the file ID cache.
+ * gdrive_cache_get_fileidtable():  Retrieves the table holding the file ID 
+ *                                  cache.
+ * Return value (Gdrive_Fidnode_Table*):
+ *      A pointer to the file ID cache table. The cache lock should be held 
+ *      while using it.
  */
-Gdrive_Fileid_Cache_Node* gdrive_cache_get_fileidcachehead();
+Gdrive_Fidnode_Table* gdrive_cache_get_fileidtable();
 
 /*
  * gdrive_cache_get_ttl():  Returns the number of seconds for which cached data
@@ -101,11 +124,46 @@ time_t gdrive_cache_get_lastupdatetime();
  */
 int64_t gdrive_cache_get_nextchangeid();
 
+/*
+ * gdrive_cache_get_missing_stats():    Retrieves counts of how often 
+ *                                      gdrive_cache_is_missing() has been able
+ *                                      to answer a lookup from the cache.
+ * Parameters:
+ *      pHits (unsigned long*):
+ *              The location to store the number of lookups for paths known not
+ *              to exist.
+ *      pMisses (unsigned long*):
+ *              The location to store the number of lookups for paths not known
+ *              to be missing, which had to be looked up on Google Drive.
+ */
+void gdrive_cache_get_missing_stats(unsigned long* pHits, 
+                                    unsigned long* pMisses);
+
 
 /*************************************************************************
  * Other accessible functions
  *************************************************************************/
 
+/*
+ * gdrive_cache_lock(): Acquires the cache lock, which protects the cache's 
+ *                      internal structure as well as the file information
+ *                      stored in each cache node. The lock is recursive, so
+ *                      cache functions can be called while holding it. It 
+ *                      must not be held while calling anything that may 
+ *                      update the cache from Google Drive (such as 
+ *                      gdrive_cache_update() or gdrive_finfo_get_by_id()), 
+ *                      and it should never be held while waiting on the 
+ *                      network. Each call must be matched by a call to 
+ *                      gdrive_cache_unlock().
+ */
+void gdrive_cache_lock(void);
+
+/*
+ * gdrive_cache_unlock():   Releases the cache lock acquired with 
+ *                          gdrive_cache_lock().
+ */
+void gdrive_cache_unlock(void);
+
 /*
  * gdrive_cache_update_if_stale():  If the cache has not been updated within
  *                                  cacheTTL seconds, updates by getting a list
@@ -143,8 +201,12 @@ int gdrive_cache_update();
  *              otherwise. Can be NULL.
  * Return value:
  *      A pointer to a Gdrive_Fileinfo struct on success, or NULL on failure.
- *      Any modifications made to this struct will be reflected in the cache.
- *      The pointed-to memory should NOT be freed.
+ *      If the file ID was not found (or its cached information has been 
+ *      invalidated), the returned struct is empty and must be filled in by the
+ *      caller, and NULL is returned if addIfDoesntExist is false.
+ *      Any modifications made to this struct will be reflected in the cache,
+ *      and should be made while holding the cache lock. The pointed-to memory
+ *      should NOT be freed.
  */
 Gdrive_Fileinfo* gdrive_cache_get_item(const char* fileId, 
                                        bool addIfDoesntExist, 
@@ -198,8 +260,9 @@ int gdrive_cache_add_fileid(const char* path, const char* fileId);
  *              value stored at this memory location is undefined if 
  *              addIfDoesntExist was false.
  * Return value (Gdrive_Cache_Node*):
- *      If the file ID given by the fileId parameter already exists in the 
- *      cache, returns a pointer to the cache node describing the specified 
+ *      The caller should hold the cache lock for as long as it uses the 
+ *      returned node. If the file ID given by the fileId parameter already 
+ *      exists in the cache, returns a pointer to the cache node describing the specified 
  *      file. If the file ID is not in the cache, then returns a pointer to a
  *      newly created cache node with the file ID filled in if addIfDoesntExist
  *      was true, or NULL if addIfDoesntExist was false. The returned cache node
@@ -225,6 +288,45 @@ Gdrive_Cache_Node* gdrive_cache_get_node(const char* fileId,
  */
 char* gdrive_cache_get_fileid(const char* path);
 
+/*
+ * gdrive_cache_add_missing():  Records in the file ID cache that a path does
+ *                              not exist, so that looking it up again doesn't
+ *                              need to ask Google Drive. The record is removed
+ *                              when a file is created at the path, when Google
+ *                              Drive reports any changes, when 
+ *                              gdrive_cache_clear_missing() is called, or 
+ *                              after cacheTTL seconds.
+ * Parameters:
+ *      path (const char*):
+ *              The full pathname that doesn't exist. See 
+ *              gdrive_cache_add_fileid().
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_cache_add_missing(const char* path);
+
+/*
+ * gdrive_cache_is_missing():   Determines whether a path is known not to 
+ *                              exist. Should be called after 
+ *                              gdrive_cache_get_fileid() fails to find the 
+ *                              path.
+ * Parameters:
+ *      path (const char*):
+ *              The full pathname to check.
+ * Return value (bool):
+ *      True if the path was recorded with gdrive_cache_add_missing() and the
+ *      record is still valid. False if the path might exist.
+ */
+bool gdrive_cache_is_missing(const char* path);
+
+/*
+ * gdrive_cache_clear_missing():    Forgets every path recorded with 
+ *                                  gdrive_cache_add_missing(). Used after 
+ *                                  changes (such as renaming) that could make 
+ *                                  any missing path exist.
+ */
+void gdrive_cache_clear_missing(void);
+
 /*
  * gdrive_cache_delete_id():    Remove a file ID from the file ID cache, and 
  *                              mark the file ID for removal from the main 
@@ -236,6 +338,49 @@ char* gdrive_cache_get_fileid(const char* path);
  */
 void gdrive_cache_delete_id(const char* fileId);
 
+/*
+ * gdrive_cache_invalidate_id():    Marks the cached information for a file ID 
+ *                                  as out of date, so that it will be fetched
+ *                                  again from Google Drive the next time it is
+ *                                  needed. Unlike gdrive_cache_delete_id(), 
+ *                                  this never frees the cache node.
+ * Parameters:
+ *      fileId (const char*):
+ *              The Google Drive file ID to invalidate.
+ */
+void gdrive_cache_invalidate_id(const char* fileId);
+
+/*
+ * gdrive_cache_set_childcount():   Stores the number of children of a cached 
+ *                                  folder, such as after listing the folder.
+ *                                  Does nothing if the folder isn't in the 
+ *                                  cache.
+ * Parameters:
+ *      folderId (const char*):
+ *              The Google Drive file ID of the folder.
+ *      nChildren (int):
+ *              The number of children, or GDRIVE_FINFO_CHILDREN_UNKNOWN to
+ *              force the children to be counted again the next time the count
+ *              is needed.
+ */
+void gdrive_cache_set_childcount(const char* folderId, int nChildren);
+
+/*
+ * gdrive_cache_adjust_childcount():    Adds to or subtracts from the cached
+ *                                      number of children of a folder, after
+ *                                      a child has been added or removed. Does
+ *                                      nothing if the folder isn't in the 
+ *                                      cache or its children haven't been 
+ *                                      counted.
+ * Parameters:
+ *      folderId (const char*):
+ *              The Google Drive file ID of the folder.
+ *      change (int):
+ *              The number of children added (if positive) or removed (if 
+ *              negative).
+ */
+void gdrive_cache_adjust_childcount(const char* folderId, int change);
+
 /*
  * gdrive_cache_delete_node():  Remove the specified node from the main cache,
  *                              and free any resources associated with it.
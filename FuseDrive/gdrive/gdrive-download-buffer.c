@@ -2,6 +2,9 @@
 #include "gdrive-info.h"
 
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
 
 
 
@@ -12,6 +15,10 @@
 #define GDRIVE_403_RATELIMIT "rateLimitExceeded"
 #define GDRIVE_403_USERRATELIMIT "userRateLimitExceeded"
 
+// Longest delay (in milliseconds) accepted from a Retry-After header, so that
+// a bogus value can't hold up a transfer indefinitely
+#define GDRIVE_DLBUF_MAX_RETRY_AFTER 60000
+
 
 /*************************************************************************
  * Private struct and declarations of private functions for use within 
@@ -28,11 +35,19 @@ typedef struct Gdrive_Download_Buffer
     char* pReturnedHeaders;
     size_t returnedHeaderSize;
     FILE* fh;
+    // If fd is not -1, data is written to this descriptor starting at 
+    // fdOffset instead of to fh or the in-memory buffer.
+    int fd;
+    off_t fdOffset;
 } Gdrive_Download_Buffer;
 
 static size_t 
 gdrive_dlbuf_callback(char *newData, size_t size, size_t nmemb, void *userdata);
 
+static size_t 
+gdrive_dlbuf_fd_callback(char *newData, size_t size, size_t nmemb, 
+                         void *userdata);
+
 static size_t
 gdrive_dlbuf_header_callback(char* buffer, size_t size, size_t nitems, 
                              void* userdata);
@@ -40,7 +55,11 @@ gdrive_dlbuf_header_callback(char* buffer, size_t size, size_t nitems,
 static enum Gdrive_Retry_Method 
 gdrive_dlbuf_retry_on_error(Gdrive_Download_Buffer* pBuf, long httpResp);
 
-static void gdrive_exponential_wait(int tryNum);
+/*
+ * Returns the number of milliseconds the server asked us to wait with a 
+ * Retry-After header, or -1 if there was no usable Retry-After header.
+ */
+static long gdrive_dlbuf_get_retry_after(Gdrive_Download_Buffer* pBuf);
 
 
 /*************************************************************************
@@ -68,6 +87,8 @@ Gdrive_Download_Buffer* gdrive_dlbuf_create(size_t initialSize, FILE* fh)
     pBuf->pReturnedHeaders[0] = '\0';
     pBuf->returnedHeaderSize = 1;
     pBuf->fh = fh;
+    pBuf->fd = -1;
+    pBuf->fdOffset = 0;
     if (initialSize != 0)
     {
         if ((pBuf->data = malloc(initialSize)) == NULL)
@@ -122,11 +143,82 @@ const char* gdrive_dlbuf_get_data(Gdrive_Download_Buffer* pBuf)
     return pBuf->data;
 }
 
+size_t gdrive_dlbuf_get_size(Gdrive_Download_Buffer* pBuf)
+{
+    return pBuf->usedSize;
+}
+
+void gdrive_dlbuf_set_destfd(Gdrive_Download_Buffer* pBuf, int fd, 
+                             off_t offset)
+{
+    pBuf->fd = fd;
+    pBuf->fdOffset = offset;
+}
+
 bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf)
 {
     return (pBuf->resultCode == CURLE_OK);
 }
 
+char* gdrive_dlbuf_get_header(Gdrive_Download_Buffer* pBuf, const char* name)
+{
+    size_t nameLength = strlen(name);
+    const char* value = NULL;
+    size_t valueLength = 0;
+    
+    // Each returned header is on its own line, so look for lines starting with
+    // the name followed by a colon.
+    const char* line = pBuf->pReturnedHeaders;
+    while (line != NULL && *line != '\0')
+    {
+        const char* lineEnd = strchr(line, '\n');
+        if (lineEnd == NULL)
+        {
+            lineEnd = line + strlen(line);
+        }
+        
+        if (strncasecmp(line, name, nameLength) == 0 && 
+                line[nameLength] == ':'
+                )
+        {
+            // Trim whitespace (including the '\r' from the header's line 
+            // ending) from both ends of the value.
+            const char* start = line + nameLength + 1;
+            const char* end = lineEnd;
+            while (start < end && (*start == ' ' || *start == '\t'))
+            {
+                start++;
+            }
+            while (end > start && 
+                    (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')
+                    )
+            {
+                end--;
+            }
+            value = start;
+            valueLength = end - start;
+        }
+        
+        line = (*lineEnd == '\n') ? lineEnd + 1 : lineEnd;
+    }
+    
+    if (value == NULL)
+    {
+        // Header not found
+        return NULL;
+    }
+    
+    char* returnVal = malloc(valueLength + 1);
+    if (returnVal == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memcpy(returnVal, value, valueLength);
+    returnVal[valueLength] = '\0';
+    return returnVal;
+}
+
 
 /******************
  * Other accessible functions
@@ -134,12 +226,37 @@ bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf)
 
 CURLcode gdrive_dlbuf_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle)
 {
-    // Make sure data gets written at the start of the buffer.
+    gdrive_dlbuf_prepare(pBuf, curlHandle);
+    
+    // Do the transfer.
+    gdrive_dlbuf_set_result(pBuf, curlHandle, curl_easy_perform(curlHandle));
+    
+    return pBuf->resultCode;
+}
+
+void gdrive_dlbuf_prepare(Gdrive_Download_Buffer* pBuf, CURL* curlHandle)
+{
+    // Make sure data gets written at the start of the buffer, and forget any
+    // headers from an earlier attempt.
     pBuf->usedSize = 0;
+    if (pBuf->pReturnedHeaders != NULL)
+    {
+        pBuf->pReturnedHeaders[0] = '\0';
+        pBuf->returnedHeaderSize = 1;
+    }
     
-    // Set the destination - either our own callback function to fill the
-    // in-memory buffer, or the default libcurl function to write to a FILE*.
-    if (pBuf->fh == NULL)
+    // Set the destination - either our own callback functions to fill the
+    // in-memory buffer or write to a descriptor, or the default libcurl 
+    // function to write to a FILE*.
+    if (pBuf->fd >= 0)
+    {
+        curl_easy_setopt(curlHandle, 
+                         CURLOPT_WRITEFUNCTION, 
+                         gdrive_dlbuf_fd_callback
+                );
+        curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, pBuf);
+    }
+    else if (pBuf->fh == NULL)
     {
         curl_easy_setopt(curlHandle, 
                          CURLOPT_WRITEFUNCTION, 
@@ -159,88 +276,49 @@ CURLcode gdrive_dlbuf_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle)
                      gdrive_dlbuf_header_callback
             );
     curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, pBuf);
-    
-    // Do the transfer.
-    pBuf->resultCode = curl_easy_perform(curlHandle);
+}
+
+void gdrive_dlbuf_set_result(Gdrive_Download_Buffer* pBuf, CURL* curlHandle, 
+                             CURLcode result)
+{
+    pBuf->resultCode = result;
     
     // Get the HTTP response
     curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &(pBuf->httpResp));
-    
-    return pBuf->resultCode;
 }
 
-int gdrive_dlbuf_download_with_retry(Gdrive_Download_Buffer* pBuf, 
-                                     CURL* curlHandle, bool retryOnAuthError, 
-                                     int tryNum, int maxTries)
+enum Gdrive_Retry_Method 
+gdrive_dlbuf_get_retry_method(Gdrive_Download_Buffer* pBuf)
 {
-    CURLcode curlResult = gdrive_dlbuf_download(pBuf, curlHandle);
+    if (pBuf->resultCode != CURLE_OK || pBuf->httpResp < 400)
+    {
+        // Either a connection error or a good response. Neither is retried.
+        return GDRIVE_RETRY_NORETRY;
+    }
+    return gdrive_dlbuf_retry_on_error(pBuf, pBuf->httpResp);
+}
 
-    
-    if (curlResult != CURLE_OK)
+long gdrive_dlbuf_get_retry_delay(Gdrive_Download_Buffer* pBuf, int tryNum, 
+                                  unsigned int* pSeed)
+{
+    // Number of milliseconds to wait before retrying
+    long waitTime;
+    int i;
+    // Start with 2^tryNum seconds.
+    for (i = 0, waitTime = 1000; i < tryNum; i++, waitTime *= 2)
     {
-        // Download error
-        return -1;
+        // Empty loop
     }
-    if (gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    // If the server asked for a longer wait, wait that long instead.
+    long retryAfter = (pBuf != NULL) ? gdrive_dlbuf_get_retry_after(pBuf) : -1;
+    if (retryAfter > waitTime)
     {
-        // Handle HTTP error responses.  Normal error handling - 5xx gets 
-        // retried, 403 gets retried if it's due to rate limits, 401 gets
-        // retried after refreshing auth.  If retryOnAuthError is false, 
-        // suppress the normal behavior for 401 and don't retry.
-        
-        // See whether we've already used our maximum attempts.
-        if (tryNum == maxTries)
-        {
-            return -1;
-        }
-        
-        bool retry = false;
-        switch (gdrive_dlbuf_retry_on_error(pBuf, 
-                                            gdrive_dlbuf_get_httpresp(pBuf)))
-        {
-            case GDRIVE_RETRY_RETRY:
-                // Normal retry, use exponential backoff.
-                gdrive_exponential_wait(tryNum);
-                retry = true;
-                break;
-
-            case GDRIVE_RETRY_RENEWAUTH:
-                // Authentication error, probably expired access token.
-                // If retryOnAuthError is true, refresh auth and retry (unless 
-                // auth fails).
-                if (retryOnAuthError)
-                {
-                    retry = (gdrive_auth() == 0);
-                    break;
-                }
-                // else fall through
-
-            case GDRIVE_RETRY_NORETRY:
-                // Fall through
-                default:
-                {
-                    retry = false;
-                    break;
-                }
-        }
-        
-        if (retry)
-        {
-            return gdrive_dlbuf_download_with_retry(pBuf, 
-                                                    curlHandle,
-                                                    retryOnAuthError,
-                                                    tryNum + 1,
-                                                    maxTries
-                    );
-        }
-        else
-        {
-            return -1;
-        }
+        waitTime = retryAfter;
     }
-    
-    // If we're here, we have a good response.  Return success.
-    return 0;
+    // Randomly add up to 1 second more, so that transfers that failed at the
+    // same time don't all retry at the same time.
+    waitTime += (rand_r(pSeed) % 1000) + 1;
+    return waitTime;
 }
 
 
@@ -292,6 +370,33 @@ static size_t gdrive_dlbuf_callback(char *newData, size_t size, size_t nmemb,
     return dataSize;
 }
 
+static size_t gdrive_dlbuf_fd_callback(char *newData, size_t size, 
+                                       size_t nmemb, void *userdata)
+{
+    Gdrive_Download_Buffer* pBuffer = (Gdrive_Download_Buffer*) userdata;
+    
+    // Write everything at the current position. usedSize counts the bytes
+    // written so far, so it's also the distance from fdOffset.
+    size_t dataSize = size * nmemb;
+    size_t bytesWritten = 0;
+    while (bytesWritten < dataSize)
+    {
+        ssize_t result = pwrite(pBuffer->fd, newData + bytesWritten, 
+                                dataSize - bytesWritten, 
+                                pBuffer->fdOffset + pBuffer->usedSize
+                );
+        if (result <= 0)
+        {
+            // Write error. Returning a short count makes libcurl give up.
+            return bytesWritten;
+        }
+        bytesWritten += result;
+        pBuffer->usedSize += result;
+    }
+    
+    return dataSize;
+}
+
 static size_t gdrive_dlbuf_header_callback(char* buffer, size_t size, 
                                            size_t nitems, void* userdata)
 {
@@ -328,14 +433,15 @@ static enum Gdrive_Retry_Method gdrive_dlbuf_retry_on_error(
           
     
     /* Most transfers should retry:
-     * A. After HTTP 5xx errors, using exponential backoff
+     * A. After HTTP 5xx and 429 errors, using exponential backoff or the 
+     *    delay given by a Retry-After header
      * B. After HTTP 403 errors with a reason of "rateLimitExceeded" or 
      *    "userRateLimitExceeded", using exponential backoff
      * C. After HTTP 401, after refreshing credentials
      * If not one of the above cases, should not retry.
      */
     
-    if (httpResp >= 500)
+    if (httpResp >= 500 || httpResp == 429)
     {
         // Always retry these
         return GDRIVE_RETRY_RETRY;
@@ -379,7 +485,8 @@ static enum Gdrive_Retry_Method gdrive_dlbuf_retry_on_error(
         free(reason);
         if (retry)
         {
-            return GDRIVE_RETRY_RENEWAUTH;
+            // The credentials are fine, so just back off.
+            return GDRIVE_RETRY_RETRY;
         }
     }
     
@@ -387,24 +494,41 @@ static enum Gdrive_Retry_Method gdrive_dlbuf_retry_on_error(
     return GDRIVE_RETRY_NORETRY;
 }
 
-static void gdrive_exponential_wait(int tryNum)
+static long gdrive_dlbuf_get_retry_after(Gdrive_Download_Buffer* pBuf)
 {
-    // Number of milliseconds to wait before retrying
-    long waitTime;
-    int i;
-    // Start with 2^tryNum seconds.
-    for (i = 0, waitTime = 1000; i < tryNum; i++, waitTime *= 2)
+    char* value = gdrive_dlbuf_get_header(pBuf, "Retry-After");
+    if (value == NULL)
     {
-        // Empty loop
+        // No header (or memory error)
+        return -1;
+    }
+    
+    // The value is either a number of seconds or an HTTP date.
+    long waitTime = -1;
+    char* end = NULL;
+    long seconds = strtol(value, &end, 10);
+    if (end != value && *end == '\0')
+    {
+        waitTime = (seconds > 0) ? seconds : 0;
+    }
+    else
+    {
+        time_t retryDate = curl_getdate(value, NULL);
+        if (retryDate != -1)
+        {
+            time_t now = time(NULL);
+            waitTime = (retryDate > now) ? (long) (retryDate - now) : 0;
+        }
+    }
+    free(value);
+    
+    if (waitTime < 0)
+    {
+        // Unrecognized value
+        return -1;
     }
-    // Randomly add up to 1 second more.
-    waitTime += (rand() % 1000) + 1;
-    // Convert waitTime to a timespec for use with nanosleep.
-    struct timespec waitTimeNano;
-    // Intentional integer division:
-    waitTimeNano.tv_sec = waitTime / 1000;
-    waitTimeNano.tv_nsec = (waitTime % 1000) * 1000000L;
-    nanosleep(&waitTimeNano, NULL);
+    return (waitTime < GDRIVE_DLBUF_MAX_RETRY_AFTER / 1000) ? 
+        waitTime * 1000 : GDRIVE_DLBUF_MAX_RETRY_AFTER;
 }
 
 
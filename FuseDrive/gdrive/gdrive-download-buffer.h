@@ -110,6 +110,43 @@ long gdrive_dlbuf_get_httpresp(Gdrive_Download_Buffer* pBuf);
  */
 const char* gdrive_dlbuf_get_data(Gdrive_Download_Buffer* pBuf);
 
+/*
+ * gdrive_dlbuf_get_size(): Retrieves the number of bytes received by the last
+ *                          download using the specified download buffer, as
+ *                          long as an in-memory buffer was used.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ * Return value (size_t):
+ *      The number of bytes held in the buffer returned by 
+ *      gdrive_dlbuf_get_data(), not counting the null terminator that follows
+ *      them. If the transfer used a FILE* stream, the return value is 
+ *      undefined.
+ */
+size_t gdrive_dlbuf_get_size(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_dlbuf_set_destfd():   Sends the downloaded data to a file descriptor,
+ *                              at a fixed position, instead of to the 
+ *                              destination given to gdrive_dlbuf_create(). 
+ *                              The data is written with pwrite(), so the 
+ *                              descriptor's file position is not used or 
+ *                              changed, and several downloads can write to 
+ *                              different parts of the same file at once.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer, which should have been created with an
+ *              initialSize of 0 and a NULL fh.
+ *      fd (int):
+ *              A descriptor open for writing. It is not closed by 
+ *              gdrive_dlbuf_free().
+ *      offset (off_t):
+ *              The position in the file at which to write the first byte. 
+ *              gdrive_dlbuf_get_size() returns the number of bytes written.
+ */
+void gdrive_dlbuf_set_destfd(Gdrive_Download_Buffer* pBuf, int fd, 
+                             off_t offset);
+
 /*
  * gdrive_dlbuf_get_success():  Returns true if the transfer successfully 
  *                              received a response from the server, false
@@ -127,6 +164,24 @@ const char* gdrive_dlbuf_get_data(Gdrive_Download_Buffer* pBuf);
  */
 bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf);
 
+/*
+ * gdrive_dlbuf_get_header():   Retrieves the value of a header returned by the
+ *                              server in the last transfer using the specified
+ *                              download buffer.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ *      name (const char*):
+ *              The name of the header, without the colon. Case is ignored.
+ * Return value (char*):
+ *      A null-terminated string holding the header's value, without any 
+ *      surrounding whitespace. If the header was returned more than once, the
+ *      last value is used. If the header wasn't returned, or on memory error,
+ *      returns NULL. The caller is responsible for freeing the returned 
+ *      string.
+ */
+char* gdrive_dlbuf_get_header(Gdrive_Download_Buffer* pBuf, const char* name);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -150,28 +205,73 @@ bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf);
 CURLcode gdrive_dlbuf_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle);
 
 /*
- * gdrive_dlbuf_download_with_retry():  Perform a download, retrying on any 
- *                                      HTTP 5xx errors or rate limit exceeded
- *                                      errors. Optionally, refreshes auth
- *                                      credentials and retries on 
- *                                      authentication errors.
+ * gdrive_dlbuf_prepare():  Set up a curl easy handle to store the results of a
+ *                          transfer in a download buffer, without performing
+ *                          the transfer. Used along with 
+ *                          gdrive_dlbuf_set_result() when the transfer is
+ *                          performed by some other means, such as a curl multi
+ *                          handle. gdrive_dlbuf_download() does both steps.
  * Parameters:
  *      pBuf (Gdrive_Download_Buffer*):
- *              A pointer to a Gdrive_Download_Buffer struct that will be used
- *              to store the results of the download.
- *      retryOnAuthError (bool):
- *              Determines whether to renew authorization and retry on
- *              authentication failure.
+ *              The download buffer to use for storing the results of the 
+ *              transfer. Any data already in the buffer will be overwritten.
+ *      curlHandle (CURL*):
+ *              The curl easy handle that will perform the transfer.
+ */
+void gdrive_dlbuf_prepare(Gdrive_Download_Buffer* pBuf, CURL* curlHandle);
+
+/*
+ * gdrive_dlbuf_set_result():   Record the outcome of a transfer that was set up
+ *                              with gdrive_dlbuf_prepare().
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer passed to gdrive_dlbuf_prepare().
+ *      curlHandle (CURL*):
+ *              The curl easy handle that performed the transfer. Used to get
+ *              the HTTP response code.
+ *      result (CURLcode):
+ *              The result of the transfer, as reported by curl.
+ */
+void gdrive_dlbuf_set_result(Gdrive_Download_Buffer* pBuf, CURL* curlHandle, 
+                             CURLcode result);
+
+/*
+ * gdrive_dlbuf_get_retry_method(): Determine whether and how a completed 
+ *                                  transfer should be retried, based on its
+ *                                  HTTP response.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A download buffer holding the results of a completed transfer.
+ * Return value (enum Gdrive_Retry_Method):
+ *      GDRIVE_RETRY_NORETRY if the transfer succeeded or should not be 
+ *      retried, GDRIVE_RETRY_RETRY if it should be retried after a delay (see
+ *      gdrive_dlbuf_get_retry_delay()), or GDRIVE_RETRY_RENEWAUTH if it should
+ *      be retried after refreshing authentication.
+ */
+enum Gdrive_Retry_Method 
+gdrive_dlbuf_get_retry_method(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_dlbuf_get_retry_delay():  Get the time to wait before retrying a 
+ *                                  failed transfer, using exponential backoff
+ *                                  with a random component. If the server sent
+ *                                  a Retry-After header asking for a longer
+ *                                  wait (up to a minute), that wait is used 
+ *                                  instead.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A download buffer holding the results of the failed transfer,
+ *              or NULL to ignore any Retry-After header.
  *      tryNum (int):
- *              Reserved for internal use. Must be 0.
- *      maxTries (int):
- *              Maximum number of attempts before finally failing.
- * Return value (int):
- *      0 on success, other on failure.
+ *              The number of attempts already retried (0 for the first retry).
+ *      pSeed (unsigned int*):
+ *              State for rand_r(), used for the random component. Each thread
+ *              that calls this function needs its own.
+ * Return value (long):
+ *      The number of milliseconds to wait.
  */
-int gdrive_dlbuf_download_with_retry(Gdrive_Download_Buffer* pBuf, 
-                                     CURL* curlHandle, bool retryOnAuthError, 
-                                     int tryNum, int maxTries);
+long gdrive_dlbuf_get_retry_delay(Gdrive_Download_Buffer* pBuf, int tryNum, 
+                                  unsigned int* pSeed);
 
 
 #ifdef	__cplusplus
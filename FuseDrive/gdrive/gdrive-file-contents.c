@@ -1,9 +1,24 @@
 
 #include "gdrive-file-contents.h"
+#include "gdrive-cache.h"
 
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+
+// Names of on-disk blocks in the cache directory. Blocks still in use are 
+// named with GDRIVE_FCONTENTS_TEMP_PREFIX followed by random characters. Blocks
+// kept for later are named "<prefix><md5>-<start>-<end>", after the checksum of
+// the file they came from and the part of the file they hold.
+#define GDRIVE_FCONTENTS_TEMP_PREFIX "partial-"
+#define GDRIVE_FCONTENTS_KEPT_PREFIX "block-"
+
+// Smallest range downloaded on its own connection when a chunk is split
+#define GDRIVE_FCONTENTS_MIN_RANGE (4 * GDRIVE_BASE_CHUNK_SIZE)
 
 
 
@@ -16,12 +31,118 @@ typedef struct Gdrive_File_Contents
 {
     off_t start;
     off_t end;
-    FILE* fh;
-    struct Gdrive_File_Contents* pNext;
+    // Descriptor of the file holding the chunk's data, or -1. All access goes
+    // through pread() and pwrite(), so the file position is never used.
+    int fd;
+    // Path of the file behind fd if it is in the cache directory, or NULL for
+    // an anonymous temporary file. If kept is true, the file is left on disk
+    // when the struct is freed.
+    char* blockPath;
+    bool kept;
+    // The downloads filling the chunk, one for each range it was split into
+    // (see gdrive_get_fetchconnections()). fillCount is 0 unless a fill has 
+    // been started and not yet finished.
+    Gdrive_Transfer* pFills[GDRIVE_MAX_FETCH_CONNECTIONS];
+    int fillCount;
+    // Everything below is protected by the cache lock. pOwner identifies the
+    // index the chunk belongs to, cachedBytes is the amount of data in the 
+    // temporary file, and pOlder and pNewer link the chunk into the list of 
+    // all chunks ordered by last use.
+    void* pOwner;
+    size_t cachedBytes;
+    struct Gdrive_File_Contents* pOlder;
+    struct Gdrive_File_Contents* pNewer;
 } Gdrive_File_Contents;
 
+/*
+ * Every chunk of every file, from least to most recently used, along with the
+ * total number of bytes they hold. Protected by the cache lock.
+ */
+typedef struct Gdrive_Fcontents_Lru
+{
+    Gdrive_File_Contents* pOldest;
+    Gdrive_File_Contents* pNewest;
+    size_t totalBytes;
+} Gdrive_Fcontents_Lru;
+
 static Gdrive_File_Contents* gdrive_fcontents_create();
 
+/*
+ * Starts the downloads that fill the first size bytes of the chunk, splitting
+ * the range among several connections if it's large enough. Returns 0 on 
+ * success, other on failure.
+ */
+static int gdrive_fcontents_fill_submit(Gdrive_File_Contents* pContents, 
+                                        const char* fileId, size_t size, 
+                                        enum Gdrive_Xfer_Priority priority);
+
+/*
+ * Waits for the downloads started by gdrive_fcontents_fill_submit() and 
+ * records the result. Returns 0 on success, other on failure.
+ */
+static int gdrive_fcontents_fill_done(Gdrive_File_Contents* pContents, 
+                                      size_t size);
+
+/*
+ * Waits for any downloads started by gdrive_fcontents_fill_submit() and 
+ * discards them.
+ */
+static void gdrive_fcontents_fill_cancel(Gdrive_File_Contents* pContents);
+
+/*
+ * Closes the chunk's file, deleting it unless it has been kept, and frees the
+ * struct.
+ */
+static void gdrive_fcontents_close(Gdrive_File_Contents* pContents);
+
+/*
+ * Returns the number of chunks in the index that start at or before offset,
+ * which is also the position of the first chunk that starts after it.
+ */
+static size_t 
+gdrive_fcontents_index_search(const Gdrive_Fcontents_Index* pIndex, 
+                              off_t offset);
+
+/*
+ * Adds a chunk to the index in order of its starting offset. Returns 0 on 
+ * success, other on failure.
+ */
+static int gdrive_fcontents_index_insert(Gdrive_Fcontents_Index* pIndex, 
+                                         Gdrive_File_Contents* pContents);
+
+/*
+ * Takes a chunk out of the index, if it's there.
+ */
+static void gdrive_fcontents_index_remove(Gdrive_Fcontents_Index* pIndex, 
+                                          Gdrive_File_Contents* pContents);
+
+/*
+ * Returns "<cache directory>/<prefix><md5>-<start>-<end>" in newly allocated
+ * memory, or NULL on failure.
+ */
+static char* gdrive_fcontents_kept_path(const char* md5, off_t start, 
+                                        off_t end);
+
+/*
+ * Creates a new file in the cache directory with a unique temporary name, and
+ * returns its path in newly allocated memory. If pFd is non-NULL, the file is
+ * left open and the descriptor is stored there. Returns NULL on failure.
+ */
+static char* gdrive_fcontents_temp_path(int* pFd);
+
+static Gdrive_Fcontents_Lru* gdrive_fcontents_get_lru(void);
+
+static void gdrive_fcontents_lru_unlink(Gdrive_File_Contents* pContents);
+
+/*
+ * Moves the chunk to the most recently used end of the list, adding it to the
+ * list if it isn't already there.
+ */
+static void gdrive_fcontents_lru_touch(Gdrive_File_Contents* pContents);
+
+static void gdrive_fcontents_set_cachedbytes(Gdrive_File_Contents* pContents, 
+                                             size_t cachedBytes);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -31,123 +152,148 @@ static Gdrive_File_Contents* gdrive_fcontents_create();
  * Constructors, factory methods, destructors and similar
  ******************/
 
-Gdrive_File_Contents* gdrive_fcontents_add(Gdrive_File_Contents* pHead)
+Gdrive_File_Contents* gdrive_fcontents_add(Gdrive_Fcontents_Index* pIndex, 
+                                           void* pOwner, off_t start)
 {
     // Create the actual file contents struct.
     Gdrive_File_Contents* pNew = gdrive_fcontents_create();
+    if (pNew == NULL)
+    {
+        // Memory or file creation error
+        return NULL;
+    }
     
-    // Find the last entry in the file contents list, and add the new one to
-    // the end.
-    Gdrive_File_Contents* pContents = pHead;
-    if (pHead != NULL)
+    // The chunk starts out empty.
+    pNew->start = start;
+    pNew->end = start - 1;
+    if (gdrive_fcontents_index_insert(pIndex, pNew) != 0)
     {
-        while (pContents->pNext != NULL)
-        {
-            pContents = pContents->pNext;
-        }
-        pContents->pNext = pNew;
+        // Memory error
+        gdrive_fcontents_close(pNew);
+        return NULL;
     }
-    // else we weren't given a list to append to, do nothing.
+    pNew->pOwner = pOwner;
+    gdrive_fcontents_lru_touch(pNew);
     
     return pNew;
 }
 
-void gdrive_fcontents_delete(Gdrive_File_Contents* pContents, 
-                             Gdrive_File_Contents** ppHead
-)
+Gdrive_File_Contents* gdrive_fcontents_add_kept(Gdrive_Fcontents_Index* pIndex,
+                                                void* pOwner, const char* md5, 
+                                                off_t start, off_t end)
 {
-    // Find the pointer leading to pContents.
-    Gdrive_File_Contents** ppContents = ppHead;
-    while (*ppContents != NULL && *ppContents != pContents)
+    // The whole range has to be free.
+    off_t missingStart;
+    off_t missingEnd;
+    if (end < start || 
+            !gdrive_fcontents_find_missing(pIndex, start, end, 
+                                           &missingStart, &missingEnd) || 
+            missingStart != start || missingEnd != end)
     {
-        ppContents = &((*ppContents)->pNext);
+        // Overlaps another chunk, or not a valid range
+        return NULL;
     }
     
-    // Take pContents out of the chain
-    if (*ppContents != NULL)
+    char* keptPath = gdrive_fcontents_kept_path(md5, start, end);
+    if (keptPath == NULL)
     {
-        *ppContents = pContents->pNext;
+        // Memory error, or no cache directory
+        return NULL;
     }
     
-    // Close the temp file
-    if (pContents->fh != NULL)
+    // Give the block a temporary name while it's in use, so that changes to
+    // it can't be mistaken for the kept contents if we don't shut down 
+    // cleanly. This also means that if two files try to take the same block,
+    // only the first one gets it.
+    char* tempPath = gdrive_fcontents_temp_path(NULL);
+    if (tempPath == NULL || rename(keptPath, tempPath) != 0)
     {
-        fclose(pContents->fh);
-        pContents->fh = NULL;
+        // No such block, or some other error
+        if (tempPath != NULL)
+        {
+            unlink(tempPath);
+        }
+        free(tempPath);
+        free(keptPath);
+        return NULL;
     }
+    free(keptPath);
     
-    free(pContents);
-}
-
-void gdrive_fcontents_delete_after_offset(Gdrive_File_Contents** ppHead, 
-                                          off_t offset
-)
-{
-    if (*ppHead == NULL)
+    Gdrive_File_Contents* pNew = malloc(sizeof(Gdrive_File_Contents));
+    if (pNew == NULL)
     {
-        // Nothing to do
-        return;
+        // Memory error
+        unlink(tempPath);
+        free(tempPath);
+        return NULL;
     }
-    
-    // Array to store pointers to the chunks that need deleted
-    int maxChunks = gdrive_get_maxchunks();
-    Gdrive_File_Contents* deleteArray[maxChunks];
-    
-    // Walk through the list of chunks and find the ones to delete
-    Gdrive_File_Contents* pContents = *ppHead;
-    int index = 0;
-    while (pContents != NULL)
+    memset(pNew, 0, sizeof(Gdrive_File_Contents));
+    pNew->blockPath = tempPath;
+    pNew->fd = open(tempPath, O_RDWR);
+    struct stat st;
+    if (pNew->fd < 0 || fstat(pNew->fd, &st) != 0)
     {
-        if (pContents->start > offset)
-        {
-            deleteArray[index++] = pContents;
-        }
-        pContents = pContents->pNext;
+        // File error
+        gdrive_fcontents_close(pNew);
+        return NULL;
     }
-    
-    // Delete each of the chunks. This can't be the most efficient way to do
-    // this (we just walked through the whole list to find which chunks to 
-    // delete, and now each call to gdrive_fcontents_delete() will walk through
-    // the beginning of the list again). Doing it this way means we don't need
-    // to worry about how to delete multiple consecutive chunks (how to make 
-    // sure we're never stuck with just a pointer to a deleted node or without 
-    // any valid pointers, unless all the chunks are deleted). There will never
-    // be a very large number of chunks to go through (no more than 
-    // gdrive_get_maxchunks()), and network delays should dwarf any processing
-    // inefficiency.
-    for (int i = 0; i < index; i++)
+    pNew->start = start;
+    pNew->end = end;
+    if (gdrive_fcontents_index_insert(pIndex, pNew) != 0)
     {
-        gdrive_fcontents_delete(deleteArray[i], ppHead);
+        // Memory error
+        gdrive_fcontents_close(pNew);
+        return NULL;
     }
+    pNew->pOwner = pOwner;
+    gdrive_fcontents_lru_touch(pNew);
+    gdrive_fcontents_set_cachedbytes(pNew, st.st_size);
     
+    return pNew;
+}
+
+void gdrive_fcontents_delete(Gdrive_File_Contents* pContents, 
+                             Gdrive_Fcontents_Index* pIndex
+)
+{
+    gdrive_fcontents_index_remove(pIndex, pContents);
+    gdrive_fcontents_lru_unlink(pContents);
+    
+    // Close the temp file and free the struct
+    gdrive_fcontents_close(pContents);
+}
+
+void gdrive_fcontents_delete_after_offset(Gdrive_Fcontents_Index* pIndex, 
+                                          off_t offset
+)
+{
+    // The chunks are sorted by starting offset, so the ones to delete are all
+    // at the end.
+    while (pIndex->count > 0 && 
+            pIndex->ppChunks[pIndex->count - 1]->start > offset)
+    {
+        gdrive_fcontents_delete(pIndex->ppChunks[pIndex->count - 1], pIndex);
+    }
 }
 
-void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents)
+void gdrive_fcontents_free_all(Gdrive_Fcontents_Index* pIndex)
 {
-    if (ppContents == NULL || *ppContents == NULL)
+    if (pIndex == NULL)
     {
         // Nothing to do
         return;
     }
     
-    // Convenience assignment
-    Gdrive_File_Contents* pContents = *ppContents;
-    
-    // Free the rest of the list after the current item.
-    gdrive_fcontents_free_all(&(pContents->pNext));
-    
-    // Close the temp file, which will automatically delete it.
-    if (pContents->fh != NULL)
+    for (size_t i = 0; i < pIndex->count; i++)
     {
-        fclose(pContents->fh);
-        pContents->fh = NULL;
+        // Close the temp file (which deletes it unless it's been kept) and 
+        // free the memory associated with the item
+        gdrive_fcontents_lru_unlink(pIndex->ppChunks[i]);
+        gdrive_fcontents_close(pIndex->ppChunks[i]);
     }
     
-    // Free the memory associated with the item
-    free(pContents);
-    
-    // Clear the pointer to the item
-    *ppContents = NULL;
+    free(pIndex->ppChunks);
+    memset(pIndex, 0, sizeof(Gdrive_Fcontents_Index));
 }
 
 
@@ -155,46 +301,183 @@ void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents)
  * Getter and setter functions
  ******************/
 
-// No getter or setter functions
+bool gdrive_fcontents_is_filling(const Gdrive_File_Contents* pContents)
+{
+    return pContents->fillCount > 0;
+}
+
+Gdrive_File_Contents* gdrive_fcontents_get_oldest(void)
+{
+    return gdrive_fcontents_get_lru()->pOldest;
+}
+
+Gdrive_File_Contents* 
+gdrive_fcontents_get_newer(const Gdrive_File_Contents* pContents)
+{
+    return pContents->pNewer;
+}
+
+void* gdrive_fcontents_get_owner(const Gdrive_File_Contents* pContents)
+{
+    return pContents->pOwner;
+}
+
+size_t gdrive_fcontents_get_totalbytes(void)
+{
+    return gdrive_fcontents_get_lru()->totalBytes;
+}
+
+size_t gdrive_fcontents_get_count(const Gdrive_Fcontents_Index* pIndex)
+{
+    return pIndex->count;
+}
+
+Gdrive_File_Contents* 
+gdrive_fcontents_get_chunk(const Gdrive_Fcontents_Index* pIndex, 
+                           size_t position)
+{
+    return pIndex->ppChunks[position];
+}
+
+off_t gdrive_fcontents_get_start(const Gdrive_File_Contents* pContents)
+{
+    return pContents->start;
+}
+
+off_t gdrive_fcontents_get_end(const Gdrive_File_Contents* pContents)
+{
+    return pContents->end;
+}
 
 
 /******************
  * Other accessible functions
  ******************/
 
-Gdrive_File_Contents* gdrive_fcontents_find_chunk(Gdrive_File_Contents* pHead, 
-                                                  off_t offset)
+Gdrive_File_Contents* 
+gdrive_fcontents_find_chunk(const Gdrive_Fcontents_Index* pIndex, off_t offset)
 {
-    if (pHead == NULL || pHead->fh == NULL)
+    // Only the last chunk starting at or before offset can contain it.
+    size_t position = gdrive_fcontents_index_search(pIndex, offset);
+    if (position == 0)
     {
         // Nothing here, return failure.
         return NULL;
     }
+    Gdrive_File_Contents* pContents = pIndex->ppChunks[position - 1];
     
-    if (offset >= pHead->start && offset <= pHead->end)
+    if (offset <= pContents->end)
     {
         // Found it!
-        return pHead;
+        return pContents;
     }
     
-    if (offset == pHead->start && pHead->end < pHead->start)
+    if (offset == pContents->start && pContents->end < pContents->start)
     {
         // Found it in a zero-length chunk (probably a zero-length file)
-        return pHead;
+        return pContents;
+    }
+    
+    // Not in any chunk
+    return NULL;
+}
+
+bool gdrive_fcontents_find_missing(const Gdrive_Fcontents_Index* pIndex, 
+                                   off_t start, off_t end, 
+                                   off_t* pMissingStart, off_t* pMissingEnd)
+{
+    // Skip past the chunk holding start (if any) and any chunks that follow 
+    // on directly from it.
+    off_t missingStart = start;
+    size_t position = gdrive_fcontents_index_search(pIndex, start);
+    if (position > 0 && pIndex->ppChunks[position - 1]->end >= missingStart)
+    {
+        missingStart = pIndex->ppChunks[position - 1]->end + 1;
+    }
+    while (position < pIndex->count && 
+            pIndex->ppChunks[position]->start <= missingStart)
+    {
+        if (pIndex->ppChunks[position]->end >= missingStart)
+        {
+            missingStart = pIndex->ppChunks[position]->end + 1;
+        }
+        position++;
+    }
+    if (missingStart > end)
+    {
+        // Everything is covered
+        return false;
     }
     
-    // It's not at this node.  Try the next one.
-    return gdrive_fcontents_find_chunk(pHead->pNext, offset);
+    // The gap runs until the next chunk or the end of the range.
+    *pMissingStart = missingStart;
+    *pMissingEnd = (position < pIndex->count && 
+            pIndex->ppChunks[position]->start <= end) ? 
+        pIndex->ppChunks[position]->start - 1 : end;
+    return true;
 }
 
 int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents, 
-                                const char* fileId, off_t start, size_t size)
+                                const char* fileId, size_t size)
+{
+    // Start the transfers and wait for them, so that the ranges of a split 
+    // chunk are downloaded at the same time.
+    if (gdrive_fcontents_fill_submit(pContents, fileId, size, 
+                                     GDRIVE_XFER_PRIORITY_INTERACTIVE) != 0)
+    {
+        // Error
+        return -1;
+    }
+    
+    return gdrive_fcontents_fill_done(pContents, size);
+}
+
+int gdrive_fcontents_start_fill(Gdrive_File_Contents* pContents, 
+                                const char* fileId, size_t size)
+{
+    // Nobody needs the data yet. If somebody does before it arrives, 
+    // gdrive_fcontents_finish_fill() moves it up.
+    if (gdrive_fcontents_fill_submit(pContents, fileId, size, 
+                                     GDRIVE_XFER_PRIORITY_BACKGROUND) != 0)
+    {
+        // Error
+        return -1;
+    }
+    
+    // Claim the range now so that gdrive_fcontents_find_chunk() finds this
+    // chunk and nobody downloads the same range again.
+    pContents->end = pContents->start + size - 1;
+    return 0;
+}
+
+int gdrive_fcontents_finish_fill(Gdrive_File_Contents* pContents)
+{
+    if (pContents->fillCount == 0)
+    {
+        // Nothing to wait for
+        return 0;
+    }
+    
+    // Somebody is waiting for the data now, so don't let it sit behind other
+    // background work.
+    for (int i = 0; i < pContents->fillCount; i++)
+    {
+        gdrive_xfer_set_priority(pContents->pFills[i], 
+                                 GDRIVE_XFER_PRIORITY_INTERACTIVE);
+    }
+    
+    return gdrive_fcontents_fill_done(pContents, 
+                                      pContents->end - pContents->start + 1);
+}
+
+Gdrive_Transfer* gdrive_fcontents_range_transfer(const char* fileId, 
+                                                 off_t start, size_t size)
 {
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
     if (pTransfer == NULL)
     {
         // Memory error
-        return -1;
+        return NULL;
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
     
@@ -206,7 +489,7 @@ int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents,
     {
         // Memory error
         gdrive_xfer_free(pTransfer);
-        return -1;
+        return NULL;
     }
     strcpy(fileUrl, GDRIVE_URL_FILES);
     strcat(fileUrl, "/");
@@ -216,7 +499,7 @@ int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents,
         // Error
         free(fileUrl);
         gdrive_xfer_free(pTransfer);
-        return -1;
+        return NULL;
     }
     free(fileUrl);
     
@@ -228,7 +511,7 @@ int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents,
     {
         // Error
         gdrive_xfer_free(pTransfer);
-        return -1;
+        return NULL;
     }
     
     // Add the Range header.  Per 
@@ -242,7 +525,7 @@ int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents,
     {
         // Memory error
         gdrive_xfer_free(pTransfer);
-        return -1;
+        return NULL;
     }
     snprintf(rangeHeader, rangeSize, "Range: bytes=%ld-%ld", start, end);
     if (gdrive_xfer_add_header(pTransfer, rangeHeader) != 0)
@@ -250,59 +533,37 @@ int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents,
         // Error
         free(rangeHeader);
         gdrive_xfer_free(pTransfer);
-        return -1;
+        return NULL;
     }
     free(rangeHeader);
     
-    // Set the destination file to the current chunk's handle
-    gdrive_xfer_set_destfile(pTransfer, pContents->fh);
-    
-    // Make sure the file position is at the start and any stream errors are
-    // cleared (this should be redundant, since we should normally have a newly
-    // created and opened temporary file).
-    rewind(pContents->fh);
-    
-    // Perform the transfer
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
-    
-    bool success = (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400);
-    gdrive_dlbuf_free(pBuf);
-    if (success)
-    {
-        pContents->start = start;
-        pContents->end = start + size - 1;
-        return 0;
-    }
-    // else failed
-    return -1;
+    return pTransfer;
 }
 
 size_t gdrive_fcontents_read(Gdrive_File_Contents* pContents, char* destBuf, 
                              off_t offset, size_t size)
 {
+    // Don't read past the end of the chunk, where the next chunk takes over.
+    size_t maxSize = pContents->end - offset + 1;
+    size_t realSize = (size > maxSize) ? maxSize : size;
+    
     // If given a NULL buffer pointer, just return the number of bytes that 
     // would have been read upon success.
     if (destBuf == NULL)
     {
-        size_t maxSize = pContents->end - offset + 1;
-        return (size > maxSize) ? maxSize : size;
+        return realSize;
     }
     
+    gdrive_fcontents_lru_touch(pContents);
+    
     // Read the data into the supplied buffer.
-    FILE* chunkFile = pContents->fh;
-    fseek(chunkFile, offset - pContents->start, SEEK_SET);
-    size_t bytesRead = fread(destBuf, 1, size, chunkFile);
+    ssize_t bytesRead = pread(pContents->fd, destBuf, realSize, 
+                              offset - pContents->start);
     
     // If an error occurred, return negative.
-    if (bytesRead < size)
+    if (bytesRead < 0)
     {
-        int err = ferror(chunkFile);
-        if (err != 0)
-        {
-            rewind(chunkFile);
-            return -err;
-        }
+        return -errno;
     }
     
     // Return the number of bytes read (which may be less than size if we hit
@@ -313,14 +574,20 @@ size_t gdrive_fcontents_read(Gdrive_File_Contents* pContents, char* destBuf,
 off_t gdrive_fcontents_write(Gdrive_File_Contents* pContents, const char* buf, 
                              off_t offset, size_t size, bool extendChunk)
 {
-    // Only write to the end of the chunk, unless extendChunk is true
-    size_t maxSize = pContents->end - offset;
+    // Only write to the end of the chunk, unless extendChunk is true. Going
+    // further would overlap the next chunk.
+    size_t maxSize = (offset <= pContents->end) ? 
+        (size_t) (pContents->end - offset + 1) : 0;
     size_t realSize = (extendChunk || size <= maxSize) ? size : maxSize;
     
     // Write the data from the supplied buffer.
-    FILE* chunkFile = pContents->fh;
-    fseek(chunkFile, offset - pContents->start, SEEK_SET);
-    size_t bytesWritten = fwrite(buf, 1, size, chunkFile);
+    ssize_t bytesWritten = pwrite(pContents->fd, buf, realSize, 
+                                  offset - pContents->start);
+    if (bytesWritten < 0)
+    {
+        // An error occurred, return negative.
+        return -errno;
+    }
     
     // Extend the chunk's ending offset if needed
     if ((off_t) (offset + bytesWritten - 1) > pContents->end)
@@ -328,27 +595,87 @@ off_t gdrive_fcontents_write(Gdrive_File_Contents* pContents, const char* buf,
         pContents->end = offset + bytesWritten - 1;
     }
     
-    // If an error occurred, return negative.
-    if (bytesWritten < realSize)
+    // The temporary file may have grown
+    size_t writtenEnd = offset - pContents->start + bytesWritten;
+    if (writtenEnd > pContents->cachedBytes)
     {
-        int err = ferror(chunkFile);
-        if (err != 0)
-        {
-            rewind(chunkFile);
-            return -err;
-        }
+        gdrive_fcontents_set_cachedbytes(pContents, writtenEnd);
     }
+    gdrive_fcontents_lru_touch(pContents);
     
     // Return the number of bytes read (which may be less than size if we hit
     // end of chunk).
     return bytesWritten;
 }
 
+int gdrive_fcontents_dup_fd(Gdrive_File_Contents* pContents)
+{
+    gdrive_fcontents_lru_touch(pContents);
+    return dup(pContents->fd);
+}
+
+int gdrive_fcontents_keep(Gdrive_File_Contents* pContents, const char* md5)
+{
+    if (pContents->blockPath == NULL || pContents->fd < 0)
+    {
+        // Not stored in the cache directory
+        return -1;
+    }
+    
+    char* keptPath = gdrive_fcontents_kept_path(md5, pContents->start, 
+                                                pContents->end);
+    if (keptPath == NULL || rename(pContents->blockPath, keptPath) != 0)
+    {
+        // Memory or file error
+        free(keptPath);
+        return -1;
+    }
+    free(pContents->blockPath);
+    pContents->blockPath = keptPath;
+    pContents->kept = true;
+    return 0;
+}
+
+void gdrive_fcontents_remove_unused(bool kept)
+{
+    const char* cacheDir = gdrive_get_cachedir();
+    DIR* pDir = (cacheDir != NULL) ? opendir(cacheDir) : NULL;
+    if (pDir == NULL)
+    {
+        // Nothing to clean up
+        return;
+    }
+    
+    const char* prefix = kept ? 
+        GDRIVE_FCONTENTS_KEPT_PREFIX : GDRIVE_FCONTENTS_TEMP_PREFIX;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDir)) != NULL)
+    {
+        if (strncmp(pEntry->d_name, prefix, strlen(prefix)) != 0)
+        {
+            // Not one of ours, or not the kind we're removing
+            continue;
+        }
+        char* path = malloc(strlen(cacheDir) + strlen(pEntry->d_name) + 2);
+        if (path == NULL)
+        {
+            // Memory error
+            break;
+        }
+        strcpy(path, cacheDir);
+        strcat(path, "/");
+        strcat(path, pEntry->d_name);
+        unlink(path);
+        free(path);
+    }
+    closedir(pDir);
+}
+
 int gdrive_fcontents_truncate(Gdrive_File_Contents* pContents, size_t size)
 {
     size_t newSize = size - pContents->start;
     // Truncate the underlying file
-    if (ftruncate(fileno(pContents->fh), size - pContents->start) != 0)
+    if (ftruncate(pContents->fd, size - pContents->start) != 0)
     {
         // An error occurred.
         return -errno;
@@ -360,6 +687,7 @@ int gdrive_fcontents_truncate(Gdrive_File_Contents* pContents, size_t size)
     {
         pContents->end = pContents->start + newSize - 1;
     }
+    gdrive_fcontents_set_cachedbytes(pContents, newSize);
     
     // Return success
     return 0;
@@ -380,11 +708,32 @@ static Gdrive_File_Contents* gdrive_fcontents_create()
     }
     memset(pContents, 0, sizeof(Gdrive_File_Contents));
         
+    if (gdrive_get_cachedir() != NULL)
+    {
+        // Create a file in the cache directory, so that the contents can be
+        // kept after unmounting.
+        pContents->fd = -1;
+        pContents->blockPath = gdrive_fcontents_temp_path(&pContents->fd);
+        if (pContents->fd < 0)
+        {
+            // File creation error
+            gdrive_fcontents_close(pContents);
+            return NULL;
+        }
+        return pContents;
+    }
+    
     // Create a temporary file on disk.  This will automatically be deleted
     // when the file is closed or when this program terminates, so no 
-    // cleanup is needed.
-    pContents->fh = tmpfile();
-    if (pContents->fh == NULL)
+    // cleanup is needed. Only the descriptor is kept, so duplicate it before
+    // closing the stream.
+    FILE* tempFile = tmpfile();
+    pContents->fd = (tempFile != NULL) ? dup(fileno(tempFile)) : -1;
+    if (tempFile != NULL)
+    {
+        fclose(tempFile);
+    }
+    if (pContents->fd < 0)
     {
         // File creation error
         free(pContents);
@@ -393,3 +742,332 @@ static Gdrive_File_Contents* gdrive_fcontents_create()
     
     return pContents;
 }
+
+static int gdrive_fcontents_fill_submit(Gdrive_File_Contents* pContents, 
+                                        const char* fileId, size_t size, 
+                                        enum Gdrive_Xfer_Priority priority)
+{
+    // Split a large chunk into one range per connection, but don't bother 
+    // with ranges smaller than GDRIVE_FCONTENTS_MIN_RANGE.
+    size_t nRanges = gdrive_get_fetchconnections();
+    if (nRanges > size / GDRIVE_FCONTENTS_MIN_RANGE)
+    {
+        nRanges = size / GDRIVE_FCONTENTS_MIN_RANGE;
+    }
+    if (nRanges == 0)
+    {
+        nRanges = 1;
+    }
+    size_t rangeSize = (size + nRanges - 1) / nRanges;
+    
+    // Each range is written straight into its place in the chunk's file.
+    pContents->fillCount = 0;
+    for (size_t rangeStart = 0; rangeStart < size; rangeStart += rangeSize)
+    {
+        size_t length = (size - rangeStart < rangeSize) ? 
+            size - rangeStart : rangeSize;
+        Gdrive_Transfer* pTransfer = 
+                gdrive_fcontents_range_transfer(fileId, 
+                                                pContents->start + rangeStart, 
+                                                length);
+        if (pTransfer != NULL)
+        {
+            gdrive_xfer_set_destfd(pTransfer, pContents->fd, rangeStart);
+            gdrive_xfer_set_ownconnection(pTransfer, nRanges > 1);
+            gdrive_xfer_set_priority(pTransfer, priority);
+        }
+        if (pTransfer == NULL || 
+                gdrive_xfer_submit(pTransfer, NULL, NULL) != 0)
+        {
+            // Error. Don't leave the ranges that were started writing to the
+            // file.
+            gdrive_xfer_free(pTransfer);
+            gdrive_fcontents_fill_cancel(pContents);
+            return -1;
+        }
+        pContents->pFills[pContents->fillCount++] = pTransfer;
+    }
+    
+    return 0;
+}
+
+static int gdrive_fcontents_fill_done(Gdrive_File_Contents* pContents, 
+                                      size_t size)
+{
+    // Each range should get a partial content response. A range that starts
+    // past the end of the file gets 416 (Range Not Satisfiable), which only 
+    // means there's nothing there. If the chunk wasn't split, accept any 
+    // success, as before ranges were split.
+    bool success = true;
+    bool pastEnd = false;
+    size_t bytesDownloaded = 0;
+    for (int i = 0; i < pContents->fillCount; i++)
+    {
+        Gdrive_Download_Buffer* pBuf = gdrive_xfer_wait(pContents->pFills[i]);
+        long httpResp = (pBuf != NULL) ? gdrive_dlbuf_get_httpresp(pBuf) : 0;
+        if (httpResp == 206 || 
+                (httpResp > 0 && httpResp < 400 && pContents->fillCount == 1)
+                )
+        {
+            bytesDownloaded += gdrive_dlbuf_get_size(pBuf);
+        }
+        else if (httpResp == 416 && i > 0)
+        {
+            pastEnd = true;
+        }
+        else
+        {
+            success = false;
+        }
+        gdrive_dlbuf_free(pBuf);
+        gdrive_xfer_free(pContents->pFills[i]);
+        pContents->pFills[i] = NULL;
+    }
+    pContents->fillCount = 0;
+    
+    if (success && pastEnd && 
+            ftruncate(pContents->fd, bytesDownloaded) != 0)
+    {
+        // The error bodies of the ranges past the end of the file were 
+        // written after the real data, and they couldn't be removed.
+        success = false;
+    }
+    if (success)
+    {
+        // The amount downloaded may be short of size at the end of the file.
+        pContents->end = pContents->start + size - 1;
+        gdrive_fcontents_set_cachedbytes(pContents, bytesDownloaded);
+        return 0;
+    }
+    // else failed
+    return -1;
+}
+
+static void gdrive_fcontents_fill_cancel(Gdrive_File_Contents* pContents)
+{
+    // The downloads are still writing to the file, so let them finish and 
+    // throw away the results.
+    for (int i = 0; i < pContents->fillCount; i++)
+    {
+        gdrive_dlbuf_free(gdrive_xfer_wait(pContents->pFills[i]));
+        gdrive_xfer_free(pContents->pFills[i]);
+        pContents->pFills[i] = NULL;
+    }
+    pContents->fillCount = 0;
+}
+
+static void gdrive_fcontents_close(Gdrive_File_Contents* pContents)
+{
+    gdrive_fcontents_fill_cancel(pContents);
+    if (pContents->fd >= 0)
+    {
+        close(pContents->fd);
+        pContents->fd = -1;
+    }
+    if (pContents->blockPath != NULL && !pContents->kept)
+    {
+        unlink(pContents->blockPath);
+    }
+    free(pContents->blockPath);
+    free(pContents);
+}
+
+static size_t 
+gdrive_fcontents_index_search(const Gdrive_Fcontents_Index* pIndex, 
+                              off_t offset)
+{
+    size_t low = 0;
+    size_t high = pIndex->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (pIndex->ppChunks[middle]->start <= offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int gdrive_fcontents_index_insert(Gdrive_Fcontents_Index* pIndex, 
+                                         Gdrive_File_Contents* pContents)
+{
+    if (pIndex->count == pIndex->capacity)
+    {
+        // Make room
+        size_t newCapacity = (pIndex->capacity == 0) ? 
+            8 : pIndex->capacity * 2;
+        Gdrive_File_Contents** ppNewChunks = 
+                realloc(pIndex->ppChunks, 
+                        newCapacity * sizeof(Gdrive_File_Contents*)
+                );
+        if (ppNewChunks == NULL)
+        {
+            // Memory error
+            return -1;
+        }
+        pIndex->ppChunks = ppNewChunks;
+        pIndex->capacity = newCapacity;
+    }
+    
+    size_t position = gdrive_fcontents_index_search(pIndex, pContents->start);
+    memmove(&pIndex->ppChunks[position + 1], &pIndex->ppChunks[position], 
+            (pIndex->count - position) * sizeof(Gdrive_File_Contents*)
+    );
+    pIndex->ppChunks[position] = pContents;
+    pIndex->count++;
+    return 0;
+}
+
+static void gdrive_fcontents_index_remove(Gdrive_Fcontents_Index* pIndex, 
+                                          Gdrive_File_Contents* pContents)
+{
+    // No two chunks start at the same offset, so the chunk (if it's here) is
+    // the last one starting at or before its own start.
+    size_t position = gdrive_fcontents_index_search(pIndex, pContents->start);
+    if (position == 0 || pIndex->ppChunks[position - 1] != pContents)
+    {
+        // Not in the index
+        return;
+    }
+    position--;
+    memmove(&pIndex->ppChunks[position], &pIndex->ppChunks[position + 1], 
+            (pIndex->count - position - 1) * sizeof(Gdrive_File_Contents*)
+    );
+    pIndex->count--;
+}
+
+static char* gdrive_fcontents_kept_path(const char* md5, off_t start, 
+                                        off_t end)
+{
+    const char* cacheDir = gdrive_get_cachedir();
+    if (cacheDir == NULL)
+    {
+        return NULL;
+    }
+    
+    const char* fmtStr = "%s/" GDRIVE_FCONTENTS_KEPT_PREFIX "%s-%lld-%lld";
+    int pathSize = snprintf(NULL, 0, fmtStr, cacheDir, md5, 
+                            (long long) start, (long long) end) + 1;
+    char* path = malloc(pathSize);
+    if (path == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    snprintf(path, pathSize, fmtStr, cacheDir, md5, 
+             (long long) start, (long long) end);
+    return path;
+}
+
+static char* gdrive_fcontents_temp_path(int* pFd)
+{
+    const char* cacheDir = gdrive_get_cachedir();
+    if (cacheDir == NULL)
+    {
+        return NULL;
+    }
+    
+    char* path = malloc(strlen(cacheDir) + 
+                        strlen("/" GDRIVE_FCONTENTS_TEMP_PREFIX "XXXXXX") + 1
+    );
+    if (path == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(path, cacheDir);
+    strcat(path, "/" GDRIVE_FCONTENTS_TEMP_PREFIX "XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        // File creation error
+        free(path);
+        return NULL;
+    }
+    
+    if (pFd != NULL)
+    {
+        *pFd = fd;
+    }
+    else
+    {
+        close(fd);
+    }
+    return path;
+}
+
+static Gdrive_Fcontents_Lru* gdrive_fcontents_get_lru(void)
+{
+    static Gdrive_Fcontents_Lru lru;
+    return &lru;
+}
+
+static void gdrive_fcontents_lru_unlink(Gdrive_File_Contents* pContents)
+{
+    gdrive_cache_lock();
+    Gdrive_Fcontents_Lru* pLru = gdrive_fcontents_get_lru();
+    if (pContents->pOlder != NULL)
+    {
+        pContents->pOlder->pNewer = pContents->pNewer;
+    }
+    else if (pLru->pOldest == pContents)
+    {
+        pLru->pOldest = pContents->pNewer;
+    }
+    if (pContents->pNewer != NULL)
+    {
+        pContents->pNewer->pOlder = pContents->pOlder;
+    }
+    else if (pLru->pNewest == pContents)
+    {
+        pLru->pNewest = pContents->pOlder;
+    }
+    pContents->pOlder = NULL;
+    pContents->pNewer = NULL;
+    
+    // The chunk's data no longer counts against the cache size.
+    pLru->totalBytes -= pContents->cachedBytes;
+    pContents->cachedBytes = 0;
+    gdrive_cache_unlock();
+}
+
+static void gdrive_fcontents_lru_touch(Gdrive_File_Contents* pContents)
+{
+    gdrive_cache_lock();
+    Gdrive_Fcontents_Lru* pLru = gdrive_fcontents_get_lru();
+    if (pLru->pNewest != pContents)
+    {
+        // Unlink without losing the byte count, then add to the newest end.
+        size_t cachedBytes = pContents->cachedBytes;
+        gdrive_fcontents_lru_unlink(pContents);
+        pContents->cachedBytes = cachedBytes;
+        pLru->totalBytes += cachedBytes;
+        
+        pContents->pOlder = pLru->pNewest;
+        if (pLru->pNewest != NULL)
+        {
+            pLru->pNewest->pNewer = pContents;
+        }
+        pLru->pNewest = pContents;
+        if (pLru->pOldest == NULL)
+        {
+            pLru->pOldest = pContents;
+        }
+    }
+    gdrive_cache_unlock();
+}
+
+static void gdrive_fcontents_set_cachedbytes(Gdrive_File_Contents* pContents, 
+                                             size_t cachedBytes)
+{
+    gdrive_cache_lock();
+    Gdrive_Fcontents_Lru* pLru = gdrive_fcontents_get_lru();
+    pLru->totalBytes = pLru->totalBytes - pContents->cachedBytes + cachedBytes;
+    pContents->cachedBytes = cachedBytes;
+    gdrive_cache_unlock();
+}
@@ -6,6 +6,20 @@
  * a Google Drive file and saving the contents of the chunk to a temporary
  * on-disk file.
  * 
+ * The chunks of each file are kept in a Gdrive_Fcontents_Index, sorted by 
+ * starting offset and never overlapping, so that the chunk holding a given
+ * offset can be found with a binary search.
+ * 
+ * Besides the per-file indexes, every chunk is kept in a single list ordered
+ * by last use, so that the least recently used chunks can be found and 
+ * discarded when the total size of all chunks grows too large. Functions that
+ * walk this list should be called while holding the cache lock (see 
+ * gdrive_cache_lock()).
+ * 
+ * If a cache directory has been set (see gdrive_set_cachedir()), chunks are
+ * stored there rather than in anonymous temporary files, and can be kept on
+ * disk to be picked up again the next time.
+ * 
  * This header is used internally by Gdrive code and should not be included 
  * outside of Gdrive code.
  *
@@ -24,92 +38,225 @@ extern "C" {
     
 typedef struct Gdrive_File_Contents Gdrive_File_Contents;
 
+/*
+ * The chunks of a single file, sorted by starting offset. The fields should
+ * only be used by the functions below. A zero-filled struct is an empty index,
+ * so it can be embedded in other structs without any setup.
+ */
+typedef struct Gdrive_Fcontents_Index
+{
+    Gdrive_File_Contents** ppChunks;
+    size_t count;
+    size_t capacity;
+} Gdrive_Fcontents_Index;
+
 /*************************************************************************
  * Constructors, factory methods, destructors and similar
  *************************************************************************/
 
 /*
- * gdrive_fcontents_add():  Creates a new Gdrive_File_Contents struct and any
- *                          required temporary files. Optionally adds the new
- *                          struct to an existing list of Gdrive_File_Contents
- *                          structs.
+ * gdrive_fcontents_add():  Creates a new, empty Gdrive_File_Contents struct 
+ *                          and any required temporary files, and adds it to an
+ *                          index.
  * Parameters:
- *      pHead (Gdrive_File_Contents*):
- *              If non-NULL, a pointer to the head of an existing list to which
- *              to add the newly created struct.
+ *      pIndex (Gdrive_Fcontents_Index*):
+ *              The index to which to add the newly created struct.
+ *      pOwner (void*):
+ *              An opaque pointer identifying the owner of the index, which can
+ *              later be retrieved with gdrive_fcontents_get_owner().
+ *      start (off_t):
+ *              The offset within the file at which the chunk starts. This must
+ *              not be inside any chunk already in the index, and the chunk 
+ *              must not later grow into the next chunk (see 
+ *              gdrive_fcontents_find_missing()).
+ * Return value (Gdrive_File_Contents*):
+ *      A pointer to the newly created struct, or NULL on failure. The struct
+ *      is freed by gdrive_fcontents_delete() or gdrive_fcontents_free_all().
+ */
+Gdrive_File_Contents* gdrive_fcontents_add(Gdrive_Fcontents_Index* pIndex, 
+                                           void* pOwner, off_t start);
+
+/*
+ * gdrive_fcontents_add_kept(): Creates a new Gdrive_File_Contents struct for
+ *                              a chunk that was previously saved in the cache
+ *                              directory with gdrive_fcontents_keep(), and
+ *                              adds it to an index. A kept chunk can only be
+ *                              added once.
+ * Parameters:
+ *      pIndex (Gdrive_Fcontents_Index*):
+ *              The index to which to add the newly created struct.
+ *      pOwner (void*):
+ *              An opaque pointer identifying the owner of the index, which can
+ *              later be retrieved with gdrive_fcontents_get_owner().
+ *      md5 (const char*):
+ *              The checksum that was passed to gdrive_fcontents_keep().
+ *      start (off_t):
+ *              The starting offset of the chunk within the file.
+ *      end (off_t):
+ *              The ending offset of the chunk within the file.
  * Return value (Gdrive_File_Contents*):
- *      A pointer to the newly created struct. IF AND ONLY IF pHead was NULL,
- *      the caller is responsible for passing the address of this pointer (or 
- *      of a copy of the pointer) to any subsequent gdrive_fcontents_delete()
- *      calls, and also for passing the address of this pointer (or of a copy)
- *      to gdrive_fcontents_free_all().
+ *      A pointer to the newly created struct, or NULL if there is no such kept
+ *      chunk, if it would overlap a chunk already in the index, or on other 
+ *      failure. The same notes apply as for the return value of 
+ *      gdrive_fcontents_add().
  */
-Gdrive_File_Contents* gdrive_fcontents_add(Gdrive_File_Contents* pHead);
+Gdrive_File_Contents* gdrive_fcontents_add_kept(Gdrive_Fcontents_Index* pIndex,
+                                                void* pOwner, const char* md5, 
+                                                off_t start, off_t end);
 
 /*
- * gdrive_fcontents_delete():   Removes a Gdrive_File_Contents struct from a
- *                              list of such structs, safely freeing its memory
- *                              and closing and deleting any associated 
- *                              temporary files.
+ * gdrive_fcontents_delete():   Removes a Gdrive_File_Contents struct from an
+ *                              index, safely freeing its memory and closing 
+ *                              and deleting any associated temporary files.
  * Parameters:
  *      pContents (Gdrive_File_Contents*):
  *              A pointer to the struct to delete. The memory at the pointed-to
  *              location should no longer be used after this function returns.
- *      ppHead (Gdrive_File_Contents**):
- *              The address of a pointer to the head struct in the list. This
- *              pointer may be changed to point to a different memory location
- *              after this function returns. The new pointer should be passed to
- *              any subsequent gdrive_fcontents_delete() calls and eventually to
- *              gdrive_fcontents_free_all(). Any copies of the old pointer, if 
- *              different from the new one, should be discarded and should no
- *              longer be used or freed.
+ *      pIndex (Gdrive_Fcontents_Index*):
+ *              The index holding the struct. Positions of other chunks in the
+ *              index (see gdrive_fcontents_get_chunk()) may change.
  */
 void gdrive_fcontents_delete(Gdrive_File_Contents* pContents, 
-                             Gdrive_File_Contents** ppHead);
+                             Gdrive_Fcontents_Index* pIndex);
 
 /*
  * gdrive_fcontents_delete_after_offset():  Safely removes and deletes select 
  *                                          Gdrive_File_Contents structs from
- *                                          a list of such structs. The structs
- *                                          selected for deletion are the ones
- *                                          whose starting offset is strictly
- *                                          greater than the given offset.
- * Parameters:
- *      ppHead (Gdrive_File_Contents**):
- *              The address of a pointer to the head struct in the list. This
- *              pointer may be changed to point to a different memory location
- *              after this function returns. The new pointer should be passed to
- *              any subsequent gdrive_fcontents_delete() calls and eventually to
- *              gdrive_fcontents_free_all(). Any copies of the old pointer, if 
- *              different from the new one, should be discarded and should no
- *              longer be used or freed.
+ *                                          an index. The structs selected for
+ *                                          deletion are the ones whose 
+ *                                          starting offset is strictly greater
+ *                                          than the given offset.
+ * Parameters:
+ *      pIndex (Gdrive_Fcontents_Index*):
+ *              The index holding the structs.
  *      offset (off_t):
  *              Any Gdrive_File_Contents structs whose starting offset is 
  *              strictly greater than this argument will be deleted.
  */
-void gdrive_fcontents_delete_after_offset(Gdrive_File_Contents** ppHead, 
+void gdrive_fcontents_delete_after_offset(Gdrive_Fcontents_Index* pIndex, 
                                           off_t offset);
 
 /*
- * gdrive_fcontents_free_all(): Safely frees the memory associated with an 
- *                              entire list of Gdrive_File_Contents structs and
+ * gdrive_fcontents_free_all(): Safely frees the memory associated with all the
+ *                              Gdrive_File_Contents structs in an index and 
  *                              closes and deletes any associated temporary 
  *                              files.
  * Parameters:
- *      ppContents (Gdrive_File_Contents**):
- *              The address of a pointer to the head struct in the list to be
- *              freed. The pointer at this memory location will be NULL after
- *              this function returns. If the caller has kept any copies of the
- *              old pointer, these should no longer be used.
+ *      pIndex (Gdrive_Fcontents_Index*):
+ *              The index to empty. It is left as a valid, empty index, and 
+ *              any memory held by the index itself is freed.
  */
-void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents);
+void gdrive_fcontents_free_all(Gdrive_Fcontents_Index* pIndex);
 
 
 /*************************************************************************
  * Getter and setter functions
  *************************************************************************/
 
-// No getters or setters
+/*
+ * gdrive_fcontents_is_filling():   Determines whether a chunk is still being
+ *                                  downloaded in the background.
+ * Parameters:
+ *      pContents (const Gdrive_File_Contents*):
+ *              A pointer to the chunk.
+ * Return value (bool):
+ *      True if a download started with gdrive_fcontents_start_fill() has not
+ *      yet been passed to gdrive_fcontents_finish_fill(), false otherwise.
+ */
+bool gdrive_fcontents_is_filling(const Gdrive_File_Contents* pContents);
+
+/*
+ * gdrive_fcontents_get_oldest():   Retrieves the least recently used chunk of
+ *                                  any file.
+ * Return value (Gdrive_File_Contents*):
+ *      A pointer to the least recently read or written Gdrive_File_Contents
+ *      struct, or NULL if there are none.
+ */
+Gdrive_File_Contents* gdrive_fcontents_get_oldest(void);
+
+/*
+ * gdrive_fcontents_get_newer():    Retrieves the chunk that was used next 
+ *                                  after a given chunk.
+ * Parameters:
+ *      pContents (const Gdrive_File_Contents*):
+ *              A pointer to a Gdrive_File_Contents struct.
+ * Return value (Gdrive_File_Contents*):
+ *      A pointer to the next more recently used Gdrive_File_Contents struct
+ *      (which may belong to a different file), or NULL if pContents is the most
+ *      recently used.
+ */
+Gdrive_File_Contents* 
+gdrive_fcontents_get_newer(const Gdrive_File_Contents* pContents);
+
+/*
+ * gdrive_fcontents_get_owner():    Retrieves the owner of the index a chunk
+ *                                  belongs to.
+ * Parameters:
+ *      pContents (const Gdrive_File_Contents*):
+ *              A pointer to a Gdrive_File_Contents struct.
+ * Return value (void*):
+ *      The pOwner pointer that was passed to gdrive_fcontents_add() when the
+ *      struct was created.
+ */
+void* gdrive_fcontents_get_owner(const Gdrive_File_Contents* pContents);
+
+/*
+ * gdrive_fcontents_get_totalbytes():   Retrieves the total amount of data held
+ *                                      in the temporary files of all chunks.
+ * Return value (size_t):
+ *      The number of bytes of file contents stored on disk.
+ */
+size_t gdrive_fcontents_get_totalbytes(void);
+
+/*
+ * gdrive_fcontents_get_count():    Retrieves the number of chunks in an index.
+ * Parameters:
+ *      pIndex (const Gdrive_Fcontents_Index*):
+ *              The index.
+ * Return value (size_t):
+ *      The number of chunks.
+ */
+size_t gdrive_fcontents_get_count(const Gdrive_Fcontents_Index* pIndex);
+
+/*
+ * gdrive_fcontents_get_chunk():    Retrieves a chunk by its position in an 
+ *                                  index.
+ * Parameters:
+ *      pIndex (const Gdrive_Fcontents_Index*):
+ *              The index.
+ *      position (size_t):
+ *              The position of the chunk, which must be less than 
+ *              gdrive_fcontents_get_count(pIndex). Chunks are in order of 
+ *              starting offset.
+ * Return value (Gdrive_File_Contents*):
+ *      A pointer to the chunk.
+ */
+Gdrive_File_Contents* 
+gdrive_fcontents_get_chunk(const Gdrive_Fcontents_Index* pIndex, 
+                           size_t position);
+
+/*
+ * gdrive_fcontents_get_start():    Retrieves the offset within the entire file
+ *                                  at which a chunk starts.
+ * Parameters:
+ *      pContents (const Gdrive_File_Contents*):
+ *              A pointer to a Gdrive_File_Contents struct.
+ * Return value (off_t):
+ *      The zero-based offset of the first byte of the chunk.
+ */
+off_t gdrive_fcontents_get_start(const Gdrive_File_Contents* pContents);
+
+/*
+ * gdrive_fcontents_get_end():  Retrieves the offset within the entire file at
+ *                              which a chunk ends.
+ * Parameters:
+ *      pContents (const Gdrive_File_Contents*):
+ *              A pointer to a Gdrive_File_Contents struct.
+ * Return value (off_t):
+ *      The zero-based offset of the last byte of the chunk. This may be past
+ *      the end of the file.
+ */
+off_t gdrive_fcontents_get_end(const Gdrive_File_Contents* pContents);
 
 
 /*************************************************************************
@@ -122,8 +269,8 @@ void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents);
  *                                  offset from the start of the entire file,
  *                                  if it already exists.
  * Parameters:
- *      pHead (Gdrive_File_Contents*):
- *              A pointer to the head struct in the list to search.
+ *      pIndex (const Gdrive_Fcontents_Index*):
+ *              The index to search.
  *      offset (off_t):
  *              The file offset to search for.
  * Return value (Gdrive_File_Contents*):
@@ -131,8 +278,34 @@ void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents);
  *      the specified offset, if such a Gdrive_File_Contents already exists.
  *      Otherwise, NULL.
  */
-Gdrive_File_Contents* gdrive_fcontents_find_chunk(Gdrive_File_Contents* pHead, 
-                                                  off_t offset);
+Gdrive_File_Contents* 
+gdrive_fcontents_find_chunk(const Gdrive_Fcontents_Index* pIndex, off_t offset);
+
+/*
+ * gdrive_fcontents_find_missing(): Finds the first part of a range that isn't
+ *                                  covered by any chunk in an index. Adjacent
+ *                                  chunks are treated as one continuous 
+ *                                  range.
+ * Parameters:
+ *      pIndex (const Gdrive_Fcontents_Index*):
+ *              The index to search.
+ *      start (off_t):
+ *              The first offset of the range.
+ *      end (off_t):
+ *              The last offset of the range (inclusive).
+ *      pMissingStart (off_t*):
+ *              If part of the range is missing, holds the first offset of the
+ *              first missing part.
+ *      pMissingEnd (off_t*):
+ *              If part of the range is missing, holds the last offset 
+ *              (inclusive, and no greater than end) of the first missing part.
+ * Return value (bool):
+ *      True if some part of the range is missing, false if the whole range is
+ *      covered.
+ */
+bool gdrive_fcontents_find_missing(const Gdrive_Fcontents_Index* pIndex, 
+                                   off_t start, off_t end, 
+                                   off_t* pMissingStart, off_t* pMissingEnd);
 
 /*
  * gdrive_fcontents_fill_chunk():   Download a chunk of a Google Drive file to
@@ -145,18 +318,79 @@ Gdrive_File_Contents* gdrive_fcontents_find_chunk(Gdrive_File_Contents* pHead,
  *      fileId (const char*):
  *              The Google Drive file ID of the file from which to download a
  *              chunk.
- *      start (off_t):
- *              The file offset (zero-based, inclusive, in bytes) at which to
- *              start the chunk within the entire Google Drive file.
  *      size (size_t):
- *              The number of bytes the chunk will hold. If start + size is 
- *              greater then the length of the file, only the actual file length
- *              will be stored.
+ *              The number of bytes the chunk will hold, starting at the offset
+ *              given to gdrive_fcontents_add(). If this goes past the end of 
+ *              the file, only the actual file length will be stored.
  * Return value (int):
  *      0 on success, other on failure.
  */
 int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents, 
-                                const char* fileId, off_t start, size_t size);
+                                const char* fileId, size_t size);
+
+/*
+ * gdrive_fcontents_start_fill():   Starts downloading a chunk of a Google 
+ *                                  Drive file in the background. The chunk 
+ *                                  covers the requested range as soon as this
+ *                                  function returns (so it will be found by
+ *                                  gdrive_fcontents_find_chunk()), but it must
+ *                                  not be read, written or truncated until it
+ *                                  has been passed to 
+ *                                  gdrive_fcontents_finish_fill(). It is safe
+ *                                  to delete or free the chunk at any time. 
+ *                                  The download has background priority (see
+ *                                  gdrive_xfer_set_priority()).
+ * Parameters:
+ *      pContents (Gdrive_File_Contents*):
+ *              A pointer to the file contents struct that will hold the chunk.
+ *      fileId (const char*):
+ *              The Google Drive file ID of the file from which to download a
+ *              chunk.
+ *      size (size_t):
+ *              The number of bytes the chunk will hold, as with 
+ *              gdrive_fcontents_fill_chunk().
+ * Return value (int):
+ *      0 if the download was started, other on failure.
+ */
+int gdrive_fcontents_start_fill(Gdrive_File_Contents* pContents, 
+                                const char* fileId, size_t size);
+
+/*
+ * gdrive_fcontents_finish_fill():  Waits for a download started with 
+ *                                  gdrive_fcontents_start_fill() to complete,
+ *                                  raising it to interactive priority first.
+ *                                  Should not be called while holding the 
+ *                                  cache lock.
+ * Parameters:
+ *      pContents (Gdrive_File_Contents*):
+ *              A pointer to the chunk. If no download is pending for it, this
+ *              function returns immediately.
+ * Return value (int):
+ *      0 on success, other if the download failed. On failure, the chunk's
+ *      contents are not valid and it should be deleted.
+ */
+int gdrive_fcontents_finish_fill(Gdrive_File_Contents* pContents);
+
+/*
+ * gdrive_fcontents_range_transfer():   Creates a transfer that downloads part
+ *                                      of a Google Drive file, without 
+ *                                      storing it in any chunk.
+ * Parameters:
+ *      fileId (const char*):
+ *              The Google Drive file ID of the file from which to download.
+ *      start (off_t):
+ *              The offset of the first byte to download.
+ *      size (size_t):
+ *              The number of bytes to download. If this goes past the end of 
+ *              the file, only the bytes up to the end are returned.
+ * Return value (Gdrive_Transfer*):
+ *      On success, a transfer that is ready to be executed or submitted, and
+ *      that downloads to memory unless a destination file is set on it. On 
+ *      failure, NULL. The caller is responsible for passing the transfer to
+ *      gdrive_xfer_free().
+ */
+Gdrive_Transfer* gdrive_fcontents_range_transfer(const char* fileId, 
+                                                 off_t start, size_t size);
 
 /*
  * gdrive_fcontents_read(): Reads from a file chunk's on-disk temporary file
@@ -219,6 +453,54 @@ size_t gdrive_fcontents_read(Gdrive_File_Contents* pContents, char* destBuf,
 off_t gdrive_fcontents_write(Gdrive_File_Contents* pContents, const char* buf, 
                              off_t offset, size_t size, bool extendChunk);
 
+/*
+ * gdrive_fcontents_dup_fd():   Duplicates the descriptor of the file holding a
+ *                              chunk's data, so that the data can be read 
+ *                              straight from the file. Counts as a read of the
+ *                              chunk.
+ * Parameters:
+ *      pContents (Gdrive_File_Contents*):
+ *              The chunk. The byte at file offset n is at offset 
+ *              n - gdrive_fcontents_get_start(pContents) within the file.
+ * Return value (int):
+ *      A new file descriptor that stays valid after the chunk is freed, or -1
+ *      on failure. The caller is responsible for closing it.
+ */
+int gdrive_fcontents_dup_fd(Gdrive_File_Contents* pContents);
+
+/*
+ * gdrive_fcontents_keep(): Gives a chunk stored in the cache directory a name
+ *                          based on the file's checksum and the chunk's 
+ *                          position, so that it can be found again with 
+ *                          gdrive_fcontents_add_kept() after this program 
+ *                          restarts. The chunk's file will no longer be 
+ *                          deleted when the struct is freed.
+ * Parameters:
+ *      pContents (Gdrive_File_Contents*):
+ *              The Gdrive_File_Contents struct describing the chunk to keep.
+ *      md5 (const char*):
+ *              The MD5 checksum of the file the chunk belongs to.
+ * Return value (int):
+ *      0 on success, other on failure (including if the chunk isn't stored in
+ *      the cache directory).
+ */
+int gdrive_fcontents_keep(Gdrive_File_Contents* pContents, const char* md5);
+
+/*
+ * gdrive_fcontents_remove_unused():    Deletes chunk files from the cache 
+ *                                      directory that aren't attached to any
+ *                                      Gdrive_File_Contents struct.
+ * Parameters:
+ *      kept (bool):
+ *              If true, deletes every chunk that was saved with 
+ *              gdrive_fcontents_keep() and hasn't been picked up again with
+ *              gdrive_fcontents_add_kept(). If false, deletes every file that 
+ *              was left in use by an earlier run that didn't shut down 
+ *              cleanly. Should only be called with false before any chunks are
+ *              created.
+ */
+void gdrive_fcontents_remove_unused(bool kept);
+
 /*
  * gdrive_fcontents_truncate(): Truncate a file chunk to a specified size.
  * Parameters:
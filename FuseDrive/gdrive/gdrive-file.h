@@ -41,7 +41,9 @@ typedef struct Gdrive_Cache_Node Gdrive_File;
  * Return value (Gdrive_File*):
  *      A file handle that can be used for operations such as reading the file's
  *      contents, or NULL on error. This handle must be passed to 
- *      gdrive_file_close() when the file is no longer needed.
+ *      gdrive_file_close() when the file is no longer needed. If a background
+ *      upload of the file gave up since the last time that was reported (see
+ *      gdrive_file_close()), this fails once with EIO.
  * NOTE:
  *      This function can be called multiple times for the same file, as long
  *      as each call is eventually balanced by a call to gdrive_file_close()
@@ -51,7 +53,17 @@ Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError);
 
 /*
  * gdrive_file_close(): Closes an open file, releasing any unnecessary 
- *                      resources.
+ *                      resources. If the file was written to, it is queued to
+ *                      be uploaded in the background, and the file stays in 
+ *                      the cache until the upload is done (unless 
+ *                      gdrive_get_dirtylimit() is 0, in which case the upload
+ *                      happens before this function returns). Use 
+ *                      gdrive_file_sync() before closing to make sure changes
+ *                      have reached Google Drive. A failed background upload 
+ *                      is retried a few times, after increasing delays. If it
+ *                      still fails, the changes stay in the cache and the 
+ *                      failure is reported by the next call to 
+ *                      gdrive_file_sync() or gdrive_file_open() for the file.
  * Parameters:
  *      pFile (Gdrive_File*):
  *              A file handle returned by a prior call to gdrive_file_open().
@@ -85,6 +97,41 @@ void gdrive_file_close(Gdrive_File* pFile, int flags);
  */
 int gdrive_file_read(Gdrive_File* fh, char* buf, size_t size, off_t offset);
 
+/*
+ * gdrive_file_read_fd():   Like gdrive_file_read(), but when the requested 
+ *                          range is cached in a single place on disk, gives 
+ *                          back a file descriptor to read it from instead of
+ *                          copying it into memory.
+ * Parameters:
+ *      pFile (Gdrive_File*):
+ *              A file handle returned by a prior call to gdrive_file_open().
+ *      size (size_t):
+ *              The number of bytes to read.
+ *      offset (off_t):
+ *              The offset (zero-based, in bytes) from the start of the file at 
+ *              which to start reading. 
+ *      pFd (int*):
+ *              On success, holds a new file descriptor from which the data can
+ *              be read, or -1 if the data was read into *pBuf instead. The 
+ *              caller is responsible for closing the descriptor. It stays 
+ *              valid even if the cached contents are later discarded, but it
+ *              refers to the cached file itself, so later writes to the file
+ *              may show through. Read from it promptly.
+ *      pFdOffset (off_t*):
+ *              If *pFd is a valid descriptor, holds the offset within it at 
+ *              which the data starts.
+ *      pBuf (char**):
+ *              On success, holds NULL if the data is available through *pFd, or
+ *              a buffer allocated with malloc() holding the data otherwise. The
+ *              caller is responsible for freeing the buffer.
+ * Return value (int):
+ *      On success, the number of bytes available (which may be less than the 
+ *      size argument if the end of the file was reached). On error, a negative
+ *      error number.
+ */
+int gdrive_file_read_fd(Gdrive_File* fh, size_t size, off_t offset, 
+                        int* pFd, off_t* pFdOffset, char** pBuf);
+
 /*
  * gdrive_file_write(): Write to the cached contents of an open file.
  * Parameters:
@@ -145,12 +192,17 @@ char* gdrive_file_new(const char* path, bool createFolder, int* pError);
 /*
  * gdrive_file_sync():  Sync a file with Google Drive. In particular, if the 
  *                      file has been written to, then the modified file is
- *                      uploaded to Google Drive.
+ *                      uploaded to Google Drive. When this returns 
+ *                      successfully, any writes made before it was called 
+ *                      (including writes waiting in the background upload 
+ *                      queue) have been uploaded.
  * Parameters:
  *      fh (Gdrive_File*):
  *              The file handle for an open file to sync.
  * Return value:
- *      0 on success, a negative error number on failure.
+ *      0 on success, a negative error number on failure. Returns -EIO if a 
+ *      background upload of the file gave up since the last time that was 
+ *      reported, even if everything has been uploaded now.
  */
 int gdrive_file_sync(Gdrive_File* fh);
 
@@ -202,6 +254,22 @@ int gdrive_file_set_mtime(Gdrive_File* fh, const struct timespec* ts);
  */
 Gdrive_Fileinfo* gdrive_file_get_info(Gdrive_File* fh);
 
+/*
+ * gdrive_file_get_info_copy(): Copy the file information for an open file 
+ *                              while holding the cache lock, so that the copy
+ *                              isn't changed by other threads.
+ * Parameters:
+ *      fh (Gdrive_File*):
+ *              A file handle returned by a prior call to gdrive_file_open().
+ *      pDest (Gdrive_Fileinfo*):
+ *              The struct to fill in, as with gdrive_finfo_copy(). On success,
+ *              the caller is responsible for passing it to 
+ *              gdrive_finfo_cleanup().
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_file_get_info_copy(Gdrive_File* fh, Gdrive_Fileinfo* pDest);
+
 /*
  * gdrive_file_get_perms(): Retrieve the effective file permissions of an open
  *                          file.
@@ -218,6 +286,24 @@ Gdrive_Fileinfo* gdrive_file_get_info(Gdrive_File* fh);
  */
 unsigned int gdrive_file_get_perms(const Gdrive_File* fh);
 
+/*
+ * gdrive_file_get_syncdownloaded():    Retrieve the number of bytes that the
+ *                                      last gdrive_file_sync() of a file had
+ *                                      to download from Google Drive. Parts of
+ *                                      the file that weren't cached are 
+ *                                      relayed from Google Drive during the 
+ *                                      upload, without being stored in the 
+ *                                      cache, and this is how much was 
+ *                                      relayed.
+ * Parameters:
+ *      fh (Gdrive_File*):
+ *              A file handle returned by a prior call to gdrive_file_open().
+ * Return value (size_t):
+ *      The number of bytes downloaded, or 0 if the file hasn't been synced
+ *      since it was cached.
+ */
+size_t gdrive_file_get_syncdownloaded(const Gdrive_File* fh);
+
 
 #ifdef	__cplusplus
 }
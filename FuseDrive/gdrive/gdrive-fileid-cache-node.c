@@ -1,14 +1,21 @@
 
+
 #include "gdrive-fileid-cache-node.h"
+#include "gdrive-util.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <assert.h>
+
 
+// Number of slots in each index of a newly created table. Must be a power of
+// 2.
+#define GDRIVE_FIDNODE_TABLE_INITIAL_SIZE 256
 
 
 /*************************************************************************
- * Private struct and declarations of private functions for use within 
+ * Private struct and declarations of private functions for use within
  * this file
  *************************************************************************/
 
@@ -17,17 +24,117 @@ typedef struct Gdrive_Fileid_Cache_Node
     time_t lastUpdateTime;
     char* path;
     char* fileId;
-    struct Gdrive_Fileid_Cache_Node* pNext;
+    size_t pathHash;
+    size_t idHash;
+    // All the nodes with the same file ID are kept in a doubly linked list, so
+    // that they can be found and removed together. Negative nodes (with a NULL
+    // fileId) are instead kept in the table's list of negative nodes.
+    struct Gdrive_Fileid_Cache_Node* pPrevSameId;
+    struct Gdrive_Fileid_Cache_Node* pNextSameId;
 } Gdrive_Fileid_Cache_Node;
 
+/*
+ * One slot in a Gdrive_Fidnode_Index. The hash of the key is stored alongside
+ * the node pointer so that probing rarely needs to look at the node itself. A
+ * slot with a NULL pNode is empty.
+ */
+typedef struct Gdrive_Fidnode_Index_Entry
+{
+    size_t hash;
+    Gdrive_Fileid_Cache_Node* pNode;
+} Gdrive_Fidnode_Index_Entry;
+
+/*
+ * An open addressing hash table (with linear probing) of file ID nodes. The
+ * capacity is always a power of 2. Each index is keyed either by path or by
+ * file ID. In an index keyed by file ID, each slot points to the first node in
+ * the list of nodes sharing that ID.
+ */
+typedef struct Gdrive_Fidnode_Index
+{
+    Gdrive_Fidnode_Index_Entry* pEntries;
+    size_t capacity;
+    size_t count;
+    bool byId;
+} Gdrive_Fidnode_Index;
+
+typedef struct Gdrive_Fidnode_Table
+{
+    Gdrive_Fidnode_Index pathIndex;
+    Gdrive_Fidnode_Index idIndex;
+    // Negative nodes record paths that are known not to exist. They are only
+    // in the path index.
+    Gdrive_Fileid_Cache_Node* pNegativeHead;
+} Gdrive_Fidnode_Table;
+
 static Gdrive_Fileid_Cache_Node* gdrive_fidnode_create(const char* filename, 
                                                        const char* fileId);
 
-static int gdrive_fidnode_update_item(Gdrive_Fileid_Cache_Node* pNode, 
+static int gdrive_fidnode_update_item(Gdrive_Fidnode_Table* pTable, 
+                                      Gdrive_Fileid_Cache_Node* pNode, 
                                       const char* fileId);
 
 static void gdrive_fidnode_free(Gdrive_Fileid_Cache_Node* pNode);
 
+/*
+ * Adds a node to the list of nodes sharing its file ID, adding the file ID to
+ * the ID index if needed. Returns 0 on success, other on failure.
+ */
+static int gdrive_fidnode_link_id(Gdrive_Fidnode_Table* pTable, 
+                                  Gdrive_Fileid_Cache_Node* pNode);
+
+/*
+ * Removes a node from the list of nodes sharing its file ID, removing the
+ * file ID from the ID index if no other nodes share it.
+ */
+static void gdrive_fidnode_unlink_id(Gdrive_Fidnode_Table* pTable, 
+                                     Gdrive_Fileid_Cache_Node* pNode);
+
+/*
+ * Adds a node without a file ID to the front of the list of negative nodes.
+ */
+static void gdrive_fidnode_link_negative(Gdrive_Fidnode_Table* pTable, 
+                                         Gdrive_Fileid_Cache_Node* pNode);
+
+/*
+ * Removes a node from the list of negative nodes.
+ */
+static void gdrive_fidnode_unlink_negative(Gdrive_Fidnode_Table* pTable, 
+                                           Gdrive_Fileid_Cache_Node* pNode);
+
+/*
+ * Removes a node from both the path index and whichever list it's in, then
+ * frees it.
+ */
+static void gdrive_fidnode_remove(Gdrive_Fidnode_Table* pTable, 
+                                  Gdrive_Fileid_Cache_Node* pNode);
+
+/*
+ * Returns 0 on success, other on failure.
+ */
+static int gdrive_fidnode_index_init(Gdrive_Fidnode_Index* pIndex, bool byId);
+
+/*
+ * Returns the index of the slot holding key, or of the empty slot where it
+ * would be inserted. The index must have at least one empty slot.
+ */
+static size_t 
+gdrive_fidnode_index_find_slot(const Gdrive_Fidnode_Index* pIndex, 
+                               const char* key, size_t hash);
+
+/*
+ * Makes sure there is room to insert one more item while keeping the load
+ * factor at or below 3/4. Returns 0 on success, other on failure.
+ */
+static int gdrive_fidnode_index_reserve(Gdrive_Fidnode_Index* pIndex);
+
+/*
+ * Empties the given slot, preserving the probe sequences of any following
+ * entries.
+ */
+static void gdrive_fidnode_index_remove_slot(Gdrive_Fidnode_Index* pIndex, 
+                                             size_t slot);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -37,99 +144,186 @@ static void gdrive_fidnode_free(Gdrive_Fileid_Cache_Node* pNode);
  * Constructors, factory methods, destructors and similar
  ******************/
 
-int gdrive_fidnode_add(Gdrive_Fileid_Cache_Node** ppHead, const char* path, 
+Gdrive_Fidnode_Table* gdrive_fidnode_table_create(void)
+{
+    Gdrive_Fidnode_Table* pTable = malloc(sizeof(Gdrive_Fidnode_Table));
+    if (pTable == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    if (gdrive_fidnode_index_init(&pTable->pathIndex, false) != 0)
+    {
+        // Memory error
+        free(pTable);
+        return NULL;
+    }
+    if (gdrive_fidnode_index_init(&pTable->idIndex, true) != 0)
+    {
+        // Memory error
+        free(pTable->pathIndex.pEntries);
+        free(pTable);
+        return NULL;
+    }
+    pTable->pNegativeHead = NULL;
+    return pTable;
+}
+
+int gdrive_fidnode_add(Gdrive_Fidnode_Table* pTable, const char* path, 
                        const char* fileId)
 {
-    if (*ppHead == NULL)
+    Gdrive_Fidnode_Index* pIndex = &pTable->pathIndex;
+    size_t hash = gdrive_string_hash(path);
+    size_t slot = gdrive_fidnode_index_find_slot(pIndex, path, hash);
+    if (pIndex->pEntries[slot].pNode != NULL)
     {
-        // Add the current element as the first one in the list.
-        *ppHead = gdrive_fidnode_create(path, fileId);
-        if (*ppHead == NULL)
-        {
-            // Error, probably memory
-            return -1;
-        }
-        // else return success
-        return 0;
+        // Item already exists, update it.
+        return gdrive_fidnode_update_item(pTable, pIndex->pEntries[slot].pNode, 
+                                          fileId
+                );
     }
     
+    // Item doesn't exist yet. Make room for it, and find the slot again in
+    // case the index grew.
+    if (gdrive_fidnode_index_reserve(pIndex) != 0)
+    {
+        // Memory error
+        return -1;
+    }
+    slot = gdrive_fidnode_index_find_slot(pIndex, path, hash);
     
-    Gdrive_Fileid_Cache_Node** ppFromPrev = ppHead;
-    Gdrive_Fileid_Cache_Node* pNext = *ppFromPrev;
-
+    Gdrive_Fileid_Cache_Node* pNew = gdrive_fidnode_create(path, fileId);
+    if (pNew == NULL)
+    {
+        // Error, most likely memory.
+        return -1;
+    }
+    pNew->pathHash = hash;
+    if (gdrive_fidnode_link_id(pTable, pNew) != 0)
+    {
+        // Memory error
+        gdrive_fidnode_free(pNew);
+        return -1;
+    }
     
-    while (true)
+    pIndex->pEntries[slot].hash = hash;
+    pIndex->pEntries[slot].pNode = pNew;
+    pIndex->count++;
+    return 0;
+}
+
+int gdrive_fidnode_add_negative(Gdrive_Fidnode_Table* pTable, 
+                                const char* path)
+{
+    Gdrive_Fidnode_Index* pIndex = &pTable->pathIndex;
+    size_t hash = gdrive_string_hash(path);
+    size_t slot = gdrive_fidnode_index_find_slot(pIndex, path, hash);
+    Gdrive_Fileid_Cache_Node* pNode = pIndex->pEntries[slot].pNode;
+    if (pNode != NULL)
     {
-        // Find the string comparison.  If pNext is NULL, pretend pNext->path
-        // is greater than path (we insert after pPrev in both cases).
-        int cmp = (pNext != NULL) ? strcmp(path, pNext->path) : -1;
-        
-        if (cmp == 0)
-        {
-            // Item already exists, update it.
-            return gdrive_fidnode_update_item(pNext, fileId);
-        }
-        else if (cmp < 0)
+        // Item already exists. Make it negative (if it isn't already) and 
+        // update the time.
+        if (pNode->fileId != NULL)
         {
-            // Item doesn't exist yet, insert it between pPrev and pNext.
-            Gdrive_Fileid_Cache_Node* pNew = 
-                    gdrive_fidnode_create(path, fileId);
-            if (pNew == NULL)
-            {
-                // Error, most likely memory.
-                return -1;
-            }
-            *ppFromPrev = pNew;
-            pNew->pNext = pNext;
-            return 0;
+            gdrive_fidnode_unlink_id(pTable, pNode);
+            free(pNode->fileId);
+            pNode->fileId = NULL;
+            gdrive_fidnode_link_negative(pTable, pNode);
         }
-        // else keep searching
-        ppFromPrev = &((*ppFromPrev)->pNext);
-        pNext = *ppFromPrev;
+        pNode->lastUpdateTime = time(NULL);
+        return 0;
+    }
+    
+    // Item doesn't exist yet. Make room for it, and find the slot again in
+    // case the index grew.
+    if (gdrive_fidnode_index_reserve(pIndex) != 0)
+    {
+        // Memory error
+        return -1;
+    }
+    slot = gdrive_fidnode_index_find_slot(pIndex, path, hash);
+    
+    Gdrive_Fileid_Cache_Node* pNew = gdrive_fidnode_create(path, NULL);
+    if (pNew == NULL)
+    {
+        // Error, most likely memory.
+        return -1;
     }
+    pNew->pathHash = hash;
+    gdrive_fidnode_link_negative(pTable, pNew);
+    
+    pIndex->pEntries[slot].hash = hash;
+    pIndex->pEntries[slot].pNode = pNew;
+    pIndex->count++;
+    return 0;
 }
 
-void gdrive_fidnode_remove_by_id(Gdrive_Fileid_Cache_Node** ppHead, 
+void gdrive_fidnode_remove_by_id(Gdrive_Fidnode_Table* pTable, 
                                  const char* fileId)
 {
-    // Need to walk through the whole list, since it's not keyed by fileId.
-    Gdrive_Fileid_Cache_Node** ppFromPrev = ppHead;
-    Gdrive_Fileid_Cache_Node* pNext = *ppHead;
+    Gdrive_Fidnode_Index* pIdIndex = &pTable->idIndex;
+    size_t idSlot = gdrive_fidnode_index_find_slot(pIdIndex, fileId, 
+                                                   gdrive_string_hash(fileId)
+            );
+    Gdrive_Fileid_Cache_Node* pNode = pIdIndex->pEntries[idSlot].pNode;
+    if (pNode == NULL)
+    {
+        // No paths have this file ID.
+        return;
+    }
+    gdrive_fidnode_index_remove_slot(pIdIndex, idSlot);
     
-    while (pNext != NULL)
+    // Remove every node in the list from the path index. One file ID can
+    // correspond to many paths.
+    Gdrive_Fidnode_Index* pPathIndex = &pTable->pathIndex;
+    while (pNode != NULL)
     {
-        
-        // Compare the given fileId to the current one.
-        int cmp = strcmp(fileId, pNext->fileId);
-        
-        if (cmp == 0)
-        {
-            // Found it!
-            *ppFromPrev = pNext->pNext;
-            gdrive_fidnode_free(pNext);
-            
-            // Don't exit here. Still need to keep searching, since one file ID 
-            // can correspond to many paths.
-        }
-        else
-        {
-            // Move on to the next one
-            ppFromPrev = &(*ppFromPrev)->pNext;
-        }
-        pNext = *ppFromPrev;
+        Gdrive_Fileid_Cache_Node* pNext = pNode->pNextSameId;
+        size_t pathSlot = gdrive_fidnode_index_find_slot(pPathIndex, 
+                                                         pNode->path, 
+                                                         pNode->pathHash
+                );
+        assert(pPathIndex->pEntries[pathSlot].pNode == pNode);
+        gdrive_fidnode_index_remove_slot(pPathIndex, pathSlot);
+        gdrive_fidnode_free(pNode);
+        pNode = pNext;
     }
 }
 
-void gdrive_fidnode_clear_all(Gdrive_Fileid_Cache_Node* pHead)
+void gdrive_fidnode_remove_negative(Gdrive_Fidnode_Table* pTable)
 {
-    // Free the rest of the chain.
-    if (pHead->pNext != NULL)
+    while (pTable->pNegativeHead != NULL)
     {
-        gdrive_fidnode_clear_all(pHead->pNext);
+        gdrive_fidnode_remove(pTable, pTable->pNegativeHead);
+    }
+}
+
+void gdrive_fidnode_remove_node(Gdrive_Fidnode_Table* pTable, 
+                                Gdrive_Fileid_Cache_Node* pNode)
+{
+    gdrive_fidnode_remove(pTable, pNode);
+}
+
+void gdrive_fidnode_table_free(Gdrive_Fidnode_Table* pTable)
+{
+    if (pTable == NULL)
+    {
+        // Nothing to do.
+        return;
     }
     
-    // Free the head node.
-    gdrive_fidnode_free(pHead);
+    // Every node is in the path index exactly once.
+    for (size_t i = 0; i < pTable->pathIndex.capacity; i++)
+    {
+        if (pTable->pathIndex.pEntries[i].pNode != NULL)
+        {
+            gdrive_fidnode_free(pTable->pathIndex.pEntries[i].pNode);
+        }
+    }
+    
+    free(pTable->pathIndex.pEntries);
+    free(pTable->idIndex.pEntries);
+    free(pTable);
 }
 
 
@@ -144,6 +338,11 @@ time_t gdrive_fidnode_get_lastupdatetime(Gdrive_Fileid_Cache_Node* pNode)
 
 char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode)
 {
+    if (pNode->fileId == NULL)
+    {
+        // Negative node
+        return NULL;
+    }
     char* result = malloc(strlen(pNode->fileId) + 1);
     if (result)
     {
@@ -153,39 +352,26 @@ char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode)
 }
 
 
+bool gdrive_fidnode_is_negative(const Gdrive_Fileid_Cache_Node* pNode)
+{
+    return pNode->fileId == NULL;
+}
+
+
 /******************
  * Other accessible functions
  ******************/
 
 Gdrive_Fileid_Cache_Node* 
-gdrive_fidnode_get_node(Gdrive_Fileid_Cache_Node* pHead, const char* path)
+gdrive_fidnode_get_node(const Gdrive_Fidnode_Table* pTable, const char* path)
 {
-    if (pHead == NULL)
-    {
-        // No nodes to get.
-        return NULL;
-    }
-    Gdrive_Fileid_Cache_Node* pNode = pHead;
-    
-    while (pNode != NULL)
-    {
-        int cmp = strcmp(path, pNode->path);
-        if (cmp == 0)
-        {
-            // Found it!
-            return pNode;
-        }
-        else if (cmp < 0)
-        {
-            // We've gone too far.  It's not here.
-            return NULL;
-        }
-        // else keep searching
-        pNode = pNode->pNext;
-    }
+    const Gdrive_Fidnode_Index* pIndex = &pTable->pathIndex;
+    size_t slot = gdrive_fidnode_index_find_slot(pIndex, path, 
+                                                 gdrive_string_hash(path)
+            );
     
-    // We've hit the end of the list without finding path.
-    return NULL;
+    // If path wasn't found, this is an empty slot and pNode is NULL.
+    return pIndex->pEntries[slot].pNode;
 }
 
 
@@ -234,7 +420,8 @@ static Gdrive_Fileid_Cache_Node* gdrive_fidnode_create(const char* filename,
     return pResult;
 }
 
-static int gdrive_fidnode_update_item(Gdrive_Fileid_Cache_Node* pNode, 
+static int gdrive_fidnode_update_item(Gdrive_Fidnode_Table* pTable, 
+                                      Gdrive_Fileid_Cache_Node* pNode, 
                                       const char* fileId)
 {
     // Update the time.
@@ -244,22 +431,34 @@ static int gdrive_fidnode_update_item(Gdrive_Fileid_Cache_Node* pNode,
     {
         // pNode doesn't have a fileId or the IDs don't match. Copy the new
         // fileId in.
-        free(pNode->fileId);
-        pNode->fileId = malloc(strlen(fileId) + 1);
-        if (pNode->fileId == NULL)
+        char* newFileId = malloc(strlen(fileId) + 1);
+        if (newFileId == NULL)
         {
             // Memory error.
             return -1;
         }
-        strcpy(pNode->fileId, fileId);
-        return 0;
+        strcpy(newFileId, fileId);
+        
+        // Move the node to the list for its new file ID.
+        if (pNode->fileId == NULL)
+        {
+            // The path used to be known not to exist.
+            gdrive_fidnode_unlink_negative(pTable, pNode);
+        }
+        else
+        {
+            gdrive_fidnode_unlink_id(pTable, pNode);
+        }
+        free(pNode->fileId);
+        pNode->fileId = newFileId;
+        return gdrive_fidnode_link_id(pTable, pNode);
     }
     // else the IDs already match.
     return 0;
 }
 
 /*
- * DOES NOT REMOVE FROM LIST.  FREES ONLY THE SINGLE NODE.
+ * DOES NOT REMOVE FROM THE TABLE.  FREES ONLY THE SINGLE NODE.
  */
 static void gdrive_fidnode_free(Gdrive_Fileid_Cache_Node* pNode)
 {
@@ -267,10 +466,243 @@ static void gdrive_fidnode_free(Gdrive_Fileid_Cache_Node* pNode)
     pNode->fileId = NULL;
     free(pNode->path);
     pNode->path = NULL;
-    pNode->pNext = NULL;
+    pNode->pPrevSameId = NULL;
+    pNode->pNextSameId = NULL;
     memset(pNode, 0xFF, sizeof(Gdrive_Fileid_Cache_Node));
     free(pNode);
 }
 
+static int gdrive_fidnode_link_id(Gdrive_Fidnode_Table* pTable, 
+                                  Gdrive_Fileid_Cache_Node* pNode)
+{
+    Gdrive_Fidnode_Index* pIndex = &pTable->idIndex;
+    pNode->idHash = gdrive_string_hash(pNode->fileId);
+    pNode->pPrevSameId = NULL;
+    
+    size_t slot = gdrive_fidnode_index_find_slot(pIndex, pNode->fileId, 
+                                                 pNode->idHash
+            );
+    if (pIndex->pEntries[slot].pNode == NULL)
+    {
+        // First node with this file ID.
+        if (gdrive_fidnode_index_reserve(pIndex) != 0)
+        {
+            // Memory error
+            pNode->pNextSameId = NULL;
+            return -1;
+        }
+        slot = gdrive_fidnode_index_find_slot(pIndex, pNode->fileId, 
+                                              pNode->idHash
+                );
+        pIndex->pEntries[slot].hash = pNode->idHash;
+        pIndex->count++;
+    }
+    
+    // Add to the front of the list.
+    pNode->pNextSameId = pIndex->pEntries[slot].pNode;
+    if (pNode->pNextSameId != NULL)
+    {
+        pNode->pNextSameId->pPrevSameId = pNode;
+    }
+    pIndex->pEntries[slot].pNode = pNode;
+    return 0;
+}
+
+static void gdrive_fidnode_unlink_id(Gdrive_Fidnode_Table* pTable, 
+                                     Gdrive_Fileid_Cache_Node* pNode)
+{
+    if (pNode->pNextSameId != NULL)
+    {
+        pNode->pNextSameId->pPrevSameId = pNode->pPrevSameId;
+    }
+    if (pNode->pPrevSameId != NULL)
+    {
+        // Not the first node in the list, so the index doesn't change.
+        pNode->pPrevSameId->pNextSameId = pNode->pNextSameId;
+    }
+    else
+    {
+        // First node in the list (if it's in the list at all). Point the
+        // index at the next one, or remove the ID from the index if there
+        // isn't a next one.
+        Gdrive_Fidnode_Index* pIndex = &pTable->idIndex;
+        size_t slot = gdrive_fidnode_index_find_slot(pIndex, pNode->fileId, 
+                                                     pNode->idHash
+                );
+        if (pIndex->pEntries[slot].pNode == pNode)
+        {
+            if (pNode->pNextSameId != NULL)
+            {
+                pIndex->pEntries[slot].pNode = pNode->pNextSameId;
+            }
+            else
+            {
+                gdrive_fidnode_index_remove_slot(pIndex, slot);
+            }
+        }
+    }
+    pNode->pPrevSameId = NULL;
+    pNode->pNextSameId = NULL;
+}
+
+static void gdrive_fidnode_link_negative(Gdrive_Fidnode_Table* pTable, 
+                                         Gdrive_Fileid_Cache_Node* pNode)
+{
+    pNode->pPrevSameId = NULL;
+    pNode->pNextSameId = pTable->pNegativeHead;
+    if (pNode->pNextSameId != NULL)
+    {
+        pNode->pNextSameId->pPrevSameId = pNode;
+    }
+    pTable->pNegativeHead = pNode;
+}
+
+static void gdrive_fidnode_unlink_negative(Gdrive_Fidnode_Table* pTable, 
+                                           Gdrive_Fileid_Cache_Node* pNode)
+{
+    if (pNode->pNextSameId != NULL)
+    {
+        pNode->pNextSameId->pPrevSameId = pNode->pPrevSameId;
+    }
+    if (pNode->pPrevSameId != NULL)
+    {
+        pNode->pPrevSameId->pNextSameId = pNode->pNextSameId;
+    }
+    else
+    {
+        pTable->pNegativeHead = pNode->pNextSameId;
+    }
+    pNode->pPrevSameId = NULL;
+    pNode->pNextSameId = NULL;
+}
+
+static void gdrive_fidnode_remove(Gdrive_Fidnode_Table* pTable, 
+                                  Gdrive_Fileid_Cache_Node* pNode)
+{
+    if (pNode->fileId == NULL)
+    {
+        gdrive_fidnode_unlink_negative(pTable, pNode);
+    }
+    else
+    {
+        gdrive_fidnode_unlink_id(pTable, pNode);
+    }
+    
+    Gdrive_Fidnode_Index* pPathIndex = &pTable->pathIndex;
+    size_t pathSlot = gdrive_fidnode_index_find_slot(pPathIndex, pNode->path, 
+                                                     pNode->pathHash
+            );
+    assert(pPathIndex->pEntries[pathSlot].pNode == pNode);
+    gdrive_fidnode_index_remove_slot(pPathIndex, pathSlot);
+    gdrive_fidnode_free(pNode);
+}
+
+static int gdrive_fidnode_index_init(Gdrive_Fidnode_Index* pIndex, bool byId)
+{
+    pIndex->capacity = GDRIVE_FIDNODE_TABLE_INITIAL_SIZE;
+    pIndex->count = 0;
+    pIndex->byId = byId;
+    pIndex->pEntries = calloc(pIndex->capacity, 
+                              sizeof(Gdrive_Fidnode_Index_Entry)
+            );
+    return (pIndex->pEntries == NULL);
+}
+
+static size_t 
+gdrive_fidnode_index_find_slot(const Gdrive_Fidnode_Index* pIndex, 
+                               const char* key, size_t hash)
+{
+    size_t mask = pIndex->capacity - 1;
+    size_t slot = hash & mask;
+    while (pIndex->pEntries[slot].pNode != NULL)
+    {
+        if (pIndex->pEntries[slot].hash == hash)
+        {
+            const Gdrive_Fileid_Cache_Node* pNode = 
+                    pIndex->pEntries[slot].pNode;
+            const char* slotKey = pIndex->byId ? pNode->fileId : pNode->path;
+            if (strcmp(slotKey, key) == 0)
+            {
+                // Found it.
+                break;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int gdrive_fidnode_index_reserve(Gdrive_Fidnode_Index* pIndex)
+{
+    if ((pIndex->count + 1) * 4 <= pIndex->capacity * 3)
+    {
+        // Already enough room.
+        return 0;
+    }
+    
+    size_t newCapacity = pIndex->capacity * 2;
+    Gdrive_Fidnode_Index_Entry* pNewEntries = 
+            calloc(newCapacity, sizeof(Gdrive_Fidnode_Index_Entry));
+    if (pNewEntries == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    
+    // Reinsert every entry. The stored hashes mean we don't need to look at
+    // the nodes themselves.
+    size_t mask = newCapacity - 1;
+    for (size_t i = 0; i < pIndex->capacity; i++)
+    {
+        if (pIndex->pEntries[i].pNode == NULL)
+        {
+            continue;
+        }
+        size_t slot = pIndex->pEntries[i].hash & mask;
+        while (pNewEntries[slot].pNode != NULL)
+        {
+            slot = (slot + 1) & mask;
+        }
+        pNewEntries[slot] = pIndex->pEntries[i];
+    }
+    
+    free(pIndex->pEntries);
+    pIndex->pEntries = pNewEntries;
+    pIndex->capacity = newCapacity;
+    return 0;
+}
+
+static void gdrive_fidnode_index_remove_slot(Gdrive_Fidnode_Index* pIndex, 
+                                             size_t slot)
+{
+    // Empty the slot, then shift back any following entries that would no
+    // longer be reachable from their home slots. This keeps every probe
+    // sequence unbroken without needing tombstones.
+    size_t mask = pIndex->capacity - 1;
+    size_t hole = slot;
+    size_t next = slot;
+    while (true)
+    {
+        next = (next + 1) & mask;
+        if (pIndex->pEntries[next].pNode == NULL)
+        {
+            break;
+        }
+        size_t home = pIndex->pEntries[next].hash & mask;
+        // The entry can stay where it is if its home slot lies cyclically
+        // within (hole, next].
+        bool canStay = (hole < next) ? 
+            (home > hole && home <= next) : 
+            (home > hole || home <= next);
+        if (!canStay)
+        {
+            pIndex->pEntries[hole] = pIndex->pEntries[next];
+            hole = next;
+        }
+    }
+    pIndex->pEntries[hole].pNode = NULL;
+    pIndex->pEntries[hole].hash = 0;
+    pIndex->count--;
+}
 
 
@@ -19,21 +19,32 @@ extern "C" {
 #endif
     
 #include <time.h>
+#include <stdbool.h>
     
 typedef struct Gdrive_Fileid_Cache_Node Gdrive_Fileid_Cache_Node;
+typedef struct Gdrive_Fidnode_Table Gdrive_Fidnode_Table;
 
 /*************************************************************************
  * Constructors, factory methods, destructors and similar
  *************************************************************************/
 
 /*
- * gdrive_fidnode_add():    Adds a file ID cache node to an existing tree if it
- *                          doesn't already exist in the tree, or update the
- *                          fileId if a node for the path already exists.
+ * gdrive_fidnode_table_create():   Creates an empty table of file ID nodes. 
+ *                                  The table is indexed both by path and by
+ *                                  file ID.
+ * Return value (Gdrive_Fidnode_Table*):
+ *      On success, a pointer to the new table. On failure, NULL. When no longer
+ *      needed, the table should be passed to gdrive_fidnode_table_free().
+ */
+Gdrive_Fidnode_Table* gdrive_fidnode_table_create(void);
+
+/*
+ * gdrive_fidnode_add():    Adds a file ID cache node to a table if it doesn't
+ *                          already exist in the table, or update the fileId if
+ *                          a node for the path already exists.
  * Parameters:
- *      pHead (Gdrive_Fileid_Cache_Node**):
- *              The address of a pointer to the root of the File ID cache node
- *              tree.
+ *      pTable (Gdrive_Fidnode_Table*):
+ *              The table of file ID nodes.
  *      path (const char*):
  *              The filepath of the node to add or update.
  *      fileId (const char*):
@@ -41,31 +52,76 @@ typedef struct Gdrive_Fileid_Cache_Node Gdrive_Fileid_Cache_Node;
  * Return value (int):
  *      0 on success, other on error.
  */
-int gdrive_fidnode_add(Gdrive_Fileid_Cache_Node** pHead, const char* path, 
+int gdrive_fidnode_add(Gdrive_Fidnode_Table* pTable, const char* path, 
                        const char* fileId);
 
+/*
+ * gdrive_fidnode_add_negative():   Records that a path is known not to exist,
+ *                                  by adding a negative node (one without a 
+ *                                  file ID) for the path. If a node for the 
+ *                                  path already exists, it becomes negative. 
+ *                                  A later call to gdrive_fidnode_add() for the
+ *                                  same path turns it back into a normal node.
+ * Parameters:
+ *      pTable (Gdrive_Fidnode_Table*):
+ *              The table of file ID nodes.
+ *      path (const char*):
+ *              The filepath that doesn't exist.
+ * Return value (int):
+ *      0 on success, other on error.
+ */
+int gdrive_fidnode_add_negative(Gdrive_Fidnode_Table* pTable, 
+                                const char* path);
+
 /*
  * gdrive_fidnode_remove_by_id():   Finds any file ID nodes containing a given
  *                                  Google Drive file ID, safely removes 
- *                                  them from the list of nodes, and safely
- *                                  frees any memory associated with them.
+ *                                  them from the table, and safely frees any 
+ *                                  memory associated with them. Takes time 
+ *                                  proportional to the number of paths with 
+ *                                  the given file ID, not to the size of the
+ *                                  table.
  * Parameters:
- *      pHead (Gdrive_Fileid_Cache_Node*):
- *              A pointer to the first node in the list.
+ *      pTable (Gdrive_Fidnode_Table*):
+ *              The table of file ID nodes.
  *      fileId (const char*):
  *              The Google Drive file ID to search for and remove.
  */
-void gdrive_fidnode_remove_by_id(Gdrive_Fileid_Cache_Node** ppHead, 
+void gdrive_fidnode_remove_by_id(Gdrive_Fidnode_Table* pTable, 
                                  const char* fileId);
 
 /*
- * gdrive_fidnode_clear_all():  Safely frees the memory associated with an 
- *                              entire list of file ID nodes.
+ * gdrive_fidnode_remove_negative():    Removes all negative nodes from the 
+ *                                      table and frees them. Takes time 
+ *                                      proportional to the number of negative
+ *                                      nodes.
+ * Parameters:
+ *      pTable (Gdrive_Fidnode_Table*):
+ *              The table of file ID nodes.
+ */
+void gdrive_fidnode_remove_negative(Gdrive_Fidnode_Table* pTable);
+
+/*
+ * gdrive_fidnode_remove_node():    Removes a single node from the table and 
+ *                                  frees it.
+ * Parameters:
+ *      pTable (Gdrive_Fidnode_Table*):
+ *              The table of file ID nodes.
+ *      pNode (Gdrive_Fileid_Cache_Node*):
+ *              The node to remove. It should not be used after this function
+ *              returns.
+ */
+void gdrive_fidnode_remove_node(Gdrive_Fidnode_Table* pTable, 
+                                Gdrive_Fileid_Cache_Node* pNode);
+
+/*
+ * gdrive_fidnode_table_free(): Safely frees the memory associated with a 
+ *                              table and all of the file ID nodes in it.
  * Parameters:
- *      pHead (Gdrive_Fileid_Cache_Node*):
- *              A pointer to the head node in the list to be freed.
+ *      pTable (Gdrive_Fidnode_Table*):
+ *              A pointer to the table. It is safe to pass a NULL pointer.
  */
-void gdrive_fidnode_clear_all(Gdrive_Fileid_Cache_Node* pHead);
+void gdrive_fidnode_table_free(Gdrive_Fidnode_Table* pTable);
 
 
 /*************************************************************************
@@ -92,11 +148,24 @@ time_t gdrive_fidnode_get_lastupdatetime(Gdrive_Fileid_Cache_Node* pNode);
  *      pNode (Gdrive_Fileid_Cache_Node*):
  *              A pointer to the node.
  * Return value (const char*):
- *      The stored Google Drive file ID as a null-terminated string. The caller
- *      is responsible for freeing the memory at the pointed-to location.
+ *      The stored Google Drive file ID as a null-terminated string, or NULL if
+ *      pNode is a negative node. The caller is responsible for freeing the 
+ *      memory at the pointed-to location.
  */
 char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode);
 
+/*
+ * gdrive_fidnode_is_negative():    Determine whether a file ID node is a 
+ *                                  negative node, recording a path that 
+ *                                  doesn't exist.
+ * Parameters:
+ *      pNode (const Gdrive_Fileid_Cache_Node*):
+ *              A pointer to the node.
+ * Return value (bool):
+ *      True if the node is negative, false if it holds a file ID.
+ */
+bool gdrive_fidnode_is_negative(const Gdrive_Fileid_Cache_Node* pNode);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -106,8 +175,8 @@ char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode);
  * gdrive_fidnode_get_node():   Find the file ID node holding the given 
  *                              filepath.
  * Parameters:
- *      pHead (Gdrive_Fileid_Cache_Node*):
- *              A pointer to the head node in the list of nodes to search.
+ *      pTable (const Gdrive_Fidnode_Table*):
+ *              The table of nodes to search.
  *      path (const char*):
  *              The filepath to search for.
  * Return value (Gdrive_Fileid_Cache_Node*):
@@ -115,7 +184,7 @@ char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode);
  *      exists. Otherwise, returns 0.
  */
 Gdrive_Fileid_Cache_Node* gdrive_fidnode_get_node(
-        Gdrive_Fileid_Cache_Node* pHead, const char* path);
+        const Gdrive_Fidnode_Table* pTable, const char* path);
 
 
 #ifdef	__cplusplus
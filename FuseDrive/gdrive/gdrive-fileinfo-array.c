@@ -63,10 +63,7 @@ void gdrive_finfoarray_free(Gdrive_Fileinfo_Array* pArray)
         gdrive_finfo_cleanup(pArray->pArray + i);
     }
     
-    if (pArray->nItems > 0)
-    {
-        free(pArray->pArray);
-    }
+    free(pArray->pArray);
     
     // Not really necessary, but doesn't harm anything
     pArray->nItems = 0;
@@ -95,7 +92,7 @@ gdrive_finfoarray_get_next(Gdrive_Fileinfo_Array* pArray,
         // Invalid arguments
         return NULL;
     }
-    const Gdrive_Fileinfo* pEnd = pArray->pArray + pArray->nMax;
+    const Gdrive_Fileinfo* pEnd = pArray->pArray + pArray->nItems;
     const Gdrive_Fileinfo* pNext = pPrev + 1;
     return (pNext < pEnd) ? pNext : NULL;
 }
@@ -41,6 +41,12 @@ static int gdrive_finfo_set_time(Gdrive_Fileinfo* pFileinfo,
                                  enum GDRIVE_FINFO_TIME whichTime, 
                                  const struct timespec* ts);
 
+/*
+ * Returns a newly allocated copy of str, or NULL if str is NULL or on a memory
+ * error.
+ */
+static char* gdrive_finfo_copy_string(const char* str);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -52,24 +58,15 @@ static int gdrive_finfo_set_time(Gdrive_Fileinfo* pFileinfo,
 
 const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
 {
-    // Get the information from the cache, or put it in the cache if it isn't
-    // already there.
-    bool alreadyCached = false;
-    
-    Gdrive_Fileinfo* pFileinfo = 
-            gdrive_cache_get_item(fileId, true, &alreadyCached);
-    if (pFileinfo == NULL)
-    {
-        // An error occurred, probably out of memory.
-        return NULL;
-    }
-    
-    if (alreadyCached)
+    // Get the information from the cache if it's there.
+    Gdrive_Fileinfo* pFileinfo = gdrive_cache_get_item(fileId, false, NULL);
+    if (pFileinfo != NULL)
     {
         // Don't need to do anything else.
         return pFileinfo;
     }
-    // else it wasn't cached, need to fill in the struct
+    // else it wasn't cached, need to fetch it and put it in the cache. Don't
+    // hold the cache lock while waiting on the network.
     
     // Prepare the request
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
@@ -104,9 +101,7 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
     
     // Add query parameters
     if (gdrive_xfer_add_query(pTransfer, "fields", 
-                              "title,id,mimeType,fileSize,createdDate,"
-                              "modifiedDate,lastViewedByMeDate,parents(id),"
-                              "userPermission") != 0)
+                              GDRIVE_FIELDS_FILEINFO) != 0)
     {
         // Error
         gdrive_xfer_free(pTransfer);
@@ -141,25 +136,82 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
     if (pObj == NULL)
     {
         // Couldn't convert to JSON object.
-        gdrive_dlbuf_free(pBuf);
         return NULL;
     }
     
-    gdrive_finfo_read_json(pFileinfo, pObj);
+    // Store the information in the cache. If another thread has dirty data 
+    // for the same file, leave it alone.
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = gdrive_cache_get_node(fileId, true, NULL);
+    if (pNode == NULL)
+    {
+        // Memory error
+        gdrive_cache_unlock();
+        gdrive_json_kill(pObj);
+        return NULL;
+    }
+    if (!gdrive_cnode_is_dirty(pNode))
+    {
+        gdrive_cnode_update_from_json(pNode, pObj);
+    }
+    pFileinfo = gdrive_cnode_get_fileinfo(pNode);
+    gdrive_cache_unlock();
     gdrive_json_kill(pObj);
     
-    // If it's a folder, get the number of children.
-    if (pFileinfo->type == GDRIVE_FILETYPE_FOLDER)
+    // A folder's children aren't counted until somebody needs the count. See
+    // gdrive_finfo_get_nchildren().
+    return pFileinfo;
+}
+
+int gdrive_finfo_get_by_id_copy(const char* fileId, Gdrive_Fileinfo* pDest)
+{
+    assert(fileId != NULL && pDest != NULL);
+    
+    // Make sure the information is cached, fetching it if needed.
+    if (gdrive_finfo_get_by_id(fileId) == NULL)
     {
-        Gdrive_Fileinfo_Array* pFileArray = gdrive_folder_list(fileId);
-        if (pFileArray != NULL)
-        {
-            
-            pFileinfo->nChildren = gdrive_finfoarray_get_count(pFileArray);
-        }
-        gdrive_finfoarray_free(pFileArray);
+        // Couldn't get the file information
+        memset(pDest, 0, sizeof(Gdrive_Fileinfo));
+        return -1;
     }
-    return pFileinfo;
+    
+    // The pointer from gdrive_finfo_get_by_id() can be freed by another thread
+    // as soon as it's returned, so look the node up again and copy it while 
+    // holding the cache lock.
+    gdrive_cache_lock();
+    Gdrive_Cache_Node* pNode = gdrive_cache_get_node(fileId, false, NULL);
+    int result = -1;
+    if (pNode != NULL)
+    {
+        result = gdrive_finfo_copy(pDest, gdrive_cnode_get_fileinfo(pNode));
+    }
+    else
+    {
+        // Removed from the cache in the meantime
+        memset(pDest, 0, sizeof(Gdrive_Fileinfo));
+    }
+    gdrive_cache_unlock();
+    return result;
+}
+
+int gdrive_finfo_copy(Gdrive_Fileinfo* pDest, const Gdrive_Fileinfo* pSource)
+{
+    assert(pDest != NULL && pSource != NULL);
+    
+    *pDest = *pSource;
+    pDest->id = gdrive_finfo_copy_string(pSource->id);
+    pDest->filename = gdrive_finfo_copy_string(pSource->filename);
+    pDest->md5Checksum = gdrive_finfo_copy_string(pSource->md5Checksum);
+    if ((pSource->id != NULL && pDest->id == NULL) || 
+            (pSource->filename != NULL && pDest->filename == NULL) || 
+            (pSource->md5Checksum != NULL && pDest->md5Checksum == NULL)
+            )
+    {
+        // Memory error
+        gdrive_finfo_cleanup(pDest);
+        return -1;
+    }
+    return 0;
 }
 
 void gdrive_finfo_cleanup(Gdrive_Fileinfo* pFileinfo)
@@ -168,6 +220,8 @@ void gdrive_finfo_cleanup(Gdrive_Fileinfo* pFileinfo)
     pFileinfo->id = NULL;
     free(pFileinfo->filename);
     pFileinfo->filename = NULL;
+    free(pFileinfo->md5Checksum);
+    pFileinfo->md5Checksum = NULL;
     pFileinfo->type = 0;
     pFileinfo->size = 0;
     memset(&(pFileinfo->creationTime), 0, sizeof(struct timespec));
@@ -333,8 +387,17 @@ void gdrive_finfo_read_json(Gdrive_Fileinfo* pFileinfo,
     }
     free(aTime);
     
+    free(pFileinfo->md5Checksum);
+    pFileinfo->md5Checksum = gdrive_json_get_new_string(pObj, "md5Checksum", 
+                                                        NULL
+    );
+    
     pFileinfo->nParents = gdrive_json_array_length(pObj, "parents");
     
+    // Children are counted separately, and only when needed.
+    pFileinfo->nChildren = (pFileinfo->type == GDRIVE_FILETYPE_FOLDER) ? 
+        GDRIVE_FINFO_CHILDREN_UNKNOWN : 0;
+    
     pFileinfo->dirtyMetainfo = false;
 }
 
@@ -348,6 +411,36 @@ unsigned int gdrive_finfo_real_perms(const Gdrive_Fileinfo* pFileinfo)
     return systemPerm & pFileinfo->basePermission;
 }
 
+int gdrive_finfo_get_nchildren(const char* fileId)
+{
+    Gdrive_Fileinfo fileinfo;
+    if (gdrive_finfo_get_by_id_copy(fileId, &fileinfo) != 0)
+    {
+        // Couldn't get the file information
+        return -1;
+    }
+    int nChildren = (fileinfo.type == GDRIVE_FILETYPE_FOLDER) ? 
+        fileinfo.nChildren : 0;
+    gdrive_finfo_cleanup(&fileinfo);
+    if (nChildren != GDRIVE_FINFO_CHILDREN_UNKNOWN)
+    {
+        // Already counted
+        return nChildren;
+    }
+    
+    // Not counted yet. Listing the folder stores the count in the cache for 
+    // next time.
+    Gdrive_Fileinfo_Array* pFileArray = gdrive_folder_list(fileId, NULL);
+    if (pFileArray == NULL)
+    {
+        // Error listing the folder
+        return -1;
+    }
+    nChildren = gdrive_finfoarray_get_count(pFileArray);
+    gdrive_finfoarray_free(pFileArray);
+    return nChildren;
+}
+
 
 /*************************************************************************
  * Implementations of private functions for use within this file
@@ -445,9 +538,15 @@ static size_t gdrive_epoch_timens_to_rfc3339(char* dest, size_t max,
     // If nanoseconds were greater than this number, they would be seconds.
     assert(ts->tv_nsec < 1000000000L);
     
-    // Get everything down to whole seconds
-    struct tm* pTime = gmtime(&(ts->tv_sec));
-    size_t baseLength = strftime(dest, max, "%Y-%m-%dT%H:%M:%S", pTime);
+    // Get everything down to whole seconds. Use gmtime_r() rather than 
+    // gmtime(), which returns a pointer to shared static memory.
+    struct tm brokenTime;
+    if (gmtime_r(&(ts->tv_sec), &brokenTime) == NULL)
+    {
+        // Error
+        return 0;
+    }
+    size_t baseLength = strftime(dest, max, "%Y-%m-%dT%H:%M:%S", &brokenTime);
     if (baseLength == 0)
     {
         // Error
@@ -510,4 +609,17 @@ static int gdrive_finfo_set_time(Gdrive_Fileinfo* pFileinfo,
     // of pFileinfo)/
     *pDest = *pTime;
     return 0;
-}
\ No newline at end of file
+}
+static char* gdrive_finfo_copy_string(const char* str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+    char* copy = malloc(strlen(str) + 1);
+    if (copy != NULL)
+    {
+        strcpy(copy, str);
+    }
+    return copy;
+}
@@ -27,6 +27,9 @@ typedef struct Gdrive_Fileinfo Gdrive_Fileinfo;
 
 #define GDRIVE_TIMESTRING_LENGTH 31
 
+// Value of nChildren for a folder whose children haven't been counted yet
+#define GDRIVE_FINFO_CHILDREN_UNKNOWN -1
+
     
 typedef struct Gdrive_Fileinfo
 {
@@ -43,9 +46,14 @@ typedef struct Gdrive_Fileinfo
     struct timespec creationTime;
     struct timespec modificationTime;
     struct timespec accessTime;
+    // md5Checksum: MD5 of the file's contents as reported by Google Drive, or
+    // NULL if not available (such as for folders)
+    char* md5Checksum;
     // nParents: Number of parent directories
     int nParents;
-    // nChildren: Number of children if type is GDRIVE_FILETYPE_FOLDER
+    // nChildren: Number of children if type is GDRIVE_FILETYPE_FOLDER, or
+    // GDRIVE_FINFO_CHILDREN_UNKNOWN if not yet counted. Use 
+    // gdrive_finfo_get_nchildren() rather than reading this directly.
     int nChildren;
     // dirtyMetainfo: Currently only tracks accessTime and modificationTime
     bool dirtyMetainfo;
@@ -70,6 +78,43 @@ typedef struct Gdrive_Fileinfo
  */
 const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId);
 
+/*
+ * gdrive_finfo_get_by_id_copy():   Like gdrive_finfo_get_by_id(), but copies
+ *                                  the information (including the strings it
+ *                                  points to) while holding the cache lock. 
+ *                                  Unlike the pointer returned by 
+ *                                  gdrive_finfo_get_by_id(), the copy stays 
+ *                                  valid while other threads update or remove
+ *                                  the cached file.
+ * Parameters:
+ *      fileId (const char*):
+ *              The Google Drive file ID of the file for which to get 
+ *              information.
+ *      pDest (Gdrive_Fileinfo*):
+ *              The struct to fill in. Its previous contents are overwritten 
+ *              without being freed. On success, the caller is responsible for
+ *              passing it to gdrive_finfo_cleanup().
+ * Return value (int):
+ *      0 on success, other on failure. On failure, pDest is cleared.
+ */
+int gdrive_finfo_get_by_id_copy(const char* fileId, Gdrive_Fileinfo* pDest);
+
+/*
+ * gdrive_finfo_copy(): Copies a Gdrive_Fileinfo struct, along with the strings
+ *                      it points to. If pSource is in the cache, the cache lock
+ *                      must be held.
+ * Parameters:
+ *      pDest (Gdrive_Fileinfo*):
+ *              The struct to fill in. Its previous contents are overwritten 
+ *              without being freed. On success, the caller is responsible for
+ *              passing it to gdrive_finfo_cleanup().
+ *      pSource (const Gdrive_Fileinfo*):
+ *              The struct to copy.
+ * Return value (int):
+ *      0 on success, other on failure. On failure, pDest is cleared.
+ */
+int gdrive_finfo_copy(Gdrive_Fileinfo* pDest, const Gdrive_Fileinfo* pSource);
+
 /*
  * gdrive_finfo_cleanup():  Safely frees any memory pointed to by members of a
  *                          Gdrive_Fileinfo struct, then sets all the members to
@@ -204,6 +249,21 @@ void gdrive_finfo_read_json(Gdrive_Fileinfo* pFileinfo,
  */
 unsigned int gdrive_finfo_real_perms(const Gdrive_Fileinfo* pFileinfo);
 
+/*
+ * gdrive_finfo_get_nchildren():    Retrieve the number of children of a 
+ *                                  folder. The count is kept in the cache, and
+ *                                  the folder is only listed if it hasn't been
+ *                                  counted since its information was last 
+ *                                  fetched.
+ * Parameters:
+ *      fileId (const char*):
+ *              The Google Drive file ID of the folder.
+ * Return value (int):
+ *      The number of files and folders directly inside the folder, or 0 if 
+ *      fileId refers to a regular file. On error, a negative number.
+ */
+int gdrive_finfo_get_nchildren(const char* fileId);
+
 
     
 
@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "gdrive-client-secret.h"
 
@@ -44,6 +45,9 @@
 
 #define GDRIVE_RETRY_LIMIT 5
 
+// Maximum number of idle curl easy handles kept around for reuse
+#define GDRIVE_CURL_POOL_SIZE 16
+
 
 #define GDRIVE_ACCESS_MODE_COUNT 4
 static const int GDRIVE_ACCESS_MODES[] = {GDRIVE_ACCESS_META,
@@ -68,6 +72,15 @@ typedef struct Gdrive_Info
     // Global, publicly accessible settings
     size_t minChunkSize;
     int maxChunks;
+    int listPageSize;
+    size_t contentCacheSize;
+    size_t blockSize;
+    enum Gdrive_Fetch_Policy fetchPolicy;
+    int fetchConnections;
+    int queryRate;
+    size_t byteRate;
+    size_t dirtyLimit;
+    char* cacheDir;
     
     // Members from here on are only for use within Gdrive code/header files.
     int mode;
@@ -83,7 +96,20 @@ typedef struct Gdrive_Info
     const char* clientSecret;
     const char* redirectUri;
     bool isCurlInitialized;
-    CURL* curlHandle;
+    // Idle easy handles ready for reuse. Each keeps its connections open.
+    CURL* curlPool[GDRIVE_CURL_POOL_SIZE];
+    int curlPoolCount;
+    // Shares the DNS cache, TLS sessions and connections among all handles.
+    CURLSH* curlShare;
+    pthread_mutex_t shareMutex[CURL_LOCK_DATA_LAST];
+    // Protects the handle pool.
+    pthread_mutex_t poolMutex;
+    // Protects the tokens. Only held while reading or replacing them, never 
+    // across a network request.
+    pthread_mutex_t mutex;
+    // Keeps more than one thread from refreshing authorization at the same 
+    // time. Held across the authorization requests.
+    pthread_mutex_t authMutex;
 } Gdrive_Info;
 
 
@@ -93,6 +119,8 @@ static int gdrive_read_auth_file(const char* filename);
 
 static void gdrive_info_cleanup(void);
 
+static int gdrive_auth_locked(void);
+
 static int 
 gdrive_refresh_auth_token(const char* grantType, const char* tokenString);
 
@@ -102,13 +130,47 @@ static int gdrive_check_scopes(void);
 
 static char* gdrive_get_root_folder_id(void);
 
+/*
+ * Looks up the file ID of the file with the given name inside the given 
+ * folder. Returns the ID (which the caller must free) on success. Returns NULL
+ * if there is no such file or on error. If pNotFound is not NULL, the bool
+ * stored there will be true only if Google Drive confirmed that there is no
+ * such file.
+ */
 static char* 
-gdrive_get_child_id_by_name(const char* parentId, const char* childName);
+gdrive_get_child_id_by_name(const char* parentId, const char* childName, 
+                            bool* pNotFound);
+
+/*
+ * Retrieves one page of the list of files in a folder. Set pageToken to NULL
+ * to get the first page. Returns the parsed response on success, or NULL on
+ * failure. The caller is responsible for passing the result to
+ * gdrive_json_kill().
+ */
+static Gdrive_Json_Object* 
+gdrive_folder_list_fetch_page(const char* folderId, const char* pageToken);
+
+/*
+ * Adds each file in a page returned by gdrive_folder_list_fetch_page() to
+ * pArray, and stores the file information in the cache.
+ */
+static void gdrive_folder_list_read_page(Gdrive_Json_Object* pObj, 
+                                         const char* folderPath, 
+                                         Gdrive_Fileinfo_Array* pArray);
+
+static void gdrive_folder_list_cache_child(const char* folderPath, 
+                                           Gdrive_Json_Object* pFile);
 
 static int gdrive_save_auth(void);
 
 void gdrive_curlhandle_setup(CURL* curlHandle);
 
+static void gdrive_curlshare_lock(CURL* curlHandle, curl_lock_data data, 
+                                  curl_lock_access access, void* userptr);
+
+static void gdrive_curlshare_unlock(CURL* curlHandle, curl_lock_data data, 
+                                    void* userptr);
+
 
 /*************************************************************************
  * Implementations of fully public functions intended for use outside of
@@ -173,6 +235,52 @@ int gdrive_init_nocurl(int access, const char* authFilename, time_t cacheTTL,
     // Assume curl_global_init() has already been called somewhere.
     pInfo->isCurlInitialized = true;
     
+    // Set up the locks. The info lock is recursive so that callers holding it
+    // can still use functions that take it.
+    pthread_mutexattr_t attr;
+    if (pthread_mutexattr_init(&attr) != 0)
+    {
+        return -1;
+    }
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int result = pthread_mutex_init(&pInfo->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (result != 0 || 
+            pthread_mutex_init(&pInfo->poolMutex, NULL) != 0 || 
+            pthread_mutex_init(&pInfo->authMutex, NULL) != 0
+            )
+    {
+        return -1;
+    }
+    
+    // Set up the share handle so that all requests can reuse the same DNS
+    // lookups, TLS sessions and connections.
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    {
+        if (pthread_mutex_init(&pInfo->shareMutex[i], NULL) != 0)
+        {
+            return -1;
+        }
+    }
+    pInfo->curlShare = curl_share_init();
+    if (pInfo->curlShare != NULL)
+    {
+        curl_share_setopt(pInfo->curlShare, CURLSHOPT_LOCKFUNC, 
+                          gdrive_curlshare_lock);
+        curl_share_setopt(pInfo->curlShare, CURLSHOPT_UNLOCKFUNC, 
+                          gdrive_curlshare_unlock);
+        curl_share_setopt(pInfo->curlShare, CURLSHOPT_SHARE, 
+                          CURL_LOCK_DATA_DNS);
+        curl_share_setopt(pInfo->curlShare, CURLSHOPT_SHARE, 
+                          CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        // Sharing the connection cache needs libcurl 7.57.0 or later.
+        curl_share_setopt(pInfo->curlShare, CURLSHOPT_SHARE, 
+                          CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+    // else no sharing, but each pooled handle still keeps its own connections
+    
     // Set up the Google Drive client ID and secret.
     pInfo->clientId = GDRIVE_CLIENT_ID;
     pInfo->clientSecret = GDRIVE_CLIENT_SECRET;
@@ -243,6 +351,13 @@ void gdrive_cleanup(void)
 
 void gdrive_cleanup_nocurl(void)
 {
+    // Finish any background uploads before anything else, since they need 
+    // the network and the cache.
+    gdrive_cnode_upload_cleanup();
+    
+    // Stop the transfer engine next, since it returns curl handles to the
+    // pool owned by the Gdrive_Info struct.
+    gdrive_xfer_engine_cleanup();
     gdrive_sysinfo_cleanup();
     gdrive_cache_cleanup();
     gdrive_info_cleanup();
@@ -263,6 +378,135 @@ int gdrive_get_maxchunks(void)
     return gdrive_get_info()->maxChunks;
 }
 
+void gdrive_set_listpagesize(int pageSize)
+{
+    if (pageSize < 0)
+    {
+        pageSize = 0;
+    }
+    else if (pageSize > GDRIVE_MAX_LIST_PAGE_SIZE)
+    {
+        pageSize = GDRIVE_MAX_LIST_PAGE_SIZE;
+    }
+    gdrive_get_info()->listPageSize = pageSize;
+}
+
+size_t gdrive_get_contentcachesize(void)
+{
+    return gdrive_get_info()->contentCacheSize;
+}
+
+void gdrive_set_contentcachesize(size_t cacheSize)
+{
+    gdrive_get_info()->contentCacheSize = cacheSize;
+}
+
+size_t gdrive_get_blocksize(void)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    return (pInfo->blockSize > 0) ? pInfo->blockSize : pInfo->minChunkSize;
+}
+
+void gdrive_set_blocksize(size_t blockSize)
+{
+    gdrive_get_info()->blockSize = blockSize;
+}
+
+enum Gdrive_Fetch_Policy gdrive_get_fetchpolicy(void)
+{
+    return gdrive_get_info()->fetchPolicy;
+}
+
+void gdrive_set_fetchpolicy(enum Gdrive_Fetch_Policy policy)
+{
+    gdrive_get_info()->fetchPolicy = policy;
+}
+
+int gdrive_get_fetchconnections(void)
+{
+    int connections = gdrive_get_info()->fetchConnections;
+    return (connections > 0) ? connections : 1;
+}
+
+void gdrive_set_fetchconnections(int connections)
+{
+    if (connections < 1)
+    {
+        connections = 1;
+    }
+    else if (connections > GDRIVE_MAX_FETCH_CONNECTIONS)
+    {
+        connections = GDRIVE_MAX_FETCH_CONNECTIONS;
+    }
+    gdrive_get_info()->fetchConnections = connections;
+}
+
+int gdrive_get_queryrate(void)
+{
+    return gdrive_get_info()->queryRate;
+}
+
+void gdrive_set_queryrate(int queryRate)
+{
+    gdrive_get_info()->queryRate = (queryRate > 0) ? queryRate : 0;
+}
+
+size_t gdrive_get_byterate(void)
+{
+    return gdrive_get_info()->byteRate;
+}
+
+void gdrive_set_byterate(size_t byteRate)
+{
+    gdrive_get_info()->byteRate = byteRate;
+}
+
+size_t gdrive_get_dirtylimit(void)
+{
+    return gdrive_get_info()->dirtyLimit;
+}
+
+void gdrive_set_dirtylimit(size_t dirtyLimit)
+{
+    gdrive_get_info()->dirtyLimit = dirtyLimit;
+}
+
+const char* gdrive_get_cachedir(void)
+{
+    return gdrive_get_info()->cacheDir;
+}
+
+int gdrive_set_cachedir(const char* path)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    assert(pInfo->cacheDir == NULL && path != NULL);
+    
+    // Create the directory if it doesn't exist yet. Only the user should be 
+    // able to read the cached contents.
+    if (mkdir(path, S_IRWXU) != 0 && errno != EEXIST)
+    {
+        // Couldn't create the directory
+        return -1;
+    }
+    
+    pInfo->cacheDir = malloc(strlen(path) + 1);
+    if (pInfo->cacheDir == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    strcpy(pInfo->cacheDir, path);
+    
+    // Pick up anything kept from the last time.
+    return gdrive_cache_load_contents();
+}
+
+void gdrive_get_missing_stats(unsigned long* pHits, unsigned long* pMisses)
+{
+    assert(pHits != NULL && pMisses != NULL);
+    gdrive_cache_get_missing_stats(pHits, pMisses);
+}
+
 int gdrive_get_filesystem_perms(enum Gdrive_Filetype type)
 {
     // Get the permissions for regular files.
@@ -314,6 +558,12 @@ char* gdrive_filepath_to_id(const char* path)
     }
     // else ID isn't in the cache yet
     
+    // Has the path already been looked up and found not to exist?
+    if (gdrive_cache_is_missing(path))
+    {
+        return NULL;
+    }
+    
     // Is this the root folder?
     char* result = NULL;
     if (strcmp(path, "/") == 0)
@@ -368,8 +618,17 @@ char* gdrive_filepath_to_id(const char* path)
         return NULL;
     }
     // Use the parent's ID to find the child's ID.
-    char* childId = gdrive_get_child_id_by_name(parentId, path + index + 1);
+    bool notFound = false;
+    char* childId = gdrive_get_child_id_by_name(parentId, path + index + 1, 
+                                                &notFound);
     free(parentId);
+    if (notFound)
+    {
+        // Remember that the path doesn't exist, so the next lookup doesn't 
+        // need to ask Google Drive again.
+        gdrive_cache_add_missing(path);
+        return NULL;
+    }
     
     // Add the ID to the fileId cache.
     if (childId != NULL)
@@ -392,92 +651,112 @@ char* gdrive_filepath_to_id(const char* path)
     return NULL;
 }
 
-Gdrive_Fileinfo_Array* gdrive_folder_list(const char* folderId)
+Gdrive_Fileinfo_Array* gdrive_folder_list(const char* folderId, 
+                                          const char* folderPath)
 {
-    // Allow for an initial quote character in addition to the terminating null
-    char* filter = malloc(strlen(folderId) + 
-                            strlen("' in parents and trashed=false") + 2);
-    if (filter == NULL)
+    // Fetch every page, keeping the parsed responses until we know how many
+    // files there are in total.
+    Gdrive_Json_Object** pPages = NULL;
+    int pageCount = 0;
+    int fileCount = 0;
+    char* pageToken = NULL;
+    bool success = true;
+    do
     {
-        return NULL;
-    }
-    strcpy(filter, "'");
-    strcat(filter, folderId);
-    strcat(filter, "' in parents and trashed=false");
+        Gdrive_Json_Object* pObj = 
+                gdrive_folder_list_fetch_page(folderId, pageToken);
+        free(pageToken);
+        pageToken = NULL;
+        if (pObj == NULL)
+        {
+            // Download or parse error
+            success = false;
+            break;
+        }
+        
+        Gdrive_Json_Object** pTemp = 
+                realloc(pPages, (pageCount + 1) * sizeof(Gdrive_Json_Object*));
+        if (pTemp == NULL)
+        {
+            // Memory error
+            gdrive_json_kill(pObj);
+            success = false;
+            break;
+        }
+        pPages = pTemp;
+        pPages[pageCount++] = pObj;
+        
+        int itemCount = gdrive_json_array_length(pObj, "items");
+        if (itemCount > 0)
+        {
+            fileCount += itemCount;
+        }
+        pageToken = gdrive_json_get_new_string(pObj, "nextPageToken", NULL);
+    } while (pageToken != NULL);
     
-    // Prepare the network request
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+    // Create an array of Gdrive_Fileinfo structs large enough to hold all the
+    // items (with room for at least one so that an empty folder still gets a
+    // valid array).
+    Gdrive_Fileinfo_Array* pArray = NULL;
+    if (success)
+    {
+        pArray = gdrive_finfoarray_create((fileCount > 0) ? fileCount : 1);
+    }
+    for (int i = 0; i < pageCount; i++)
+    {
+        if (pArray != NULL)
+        {
+            gdrive_folder_list_read_page(pPages[i], folderPath, pArray);
+        }
+        gdrive_json_kill(pPages[i]);
+    }
+    free(pPages);
     
-    if (
-            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_FILES) || 
-            gdrive_xfer_add_query(pTransfer, "q", filter) || 
-            gdrive_xfer_add_query(pTransfer, "fields", 
-                                  "items(title,id,mimeType)")
-        )
+    if (pArray != NULL)
     {
-        // Error
-        free(filter);
-        gdrive_xfer_free(pTransfer);
-        return NULL;
+        // Now that we have the whole list, remember the child count.
+        gdrive_cache_set_childcount(folderId, 
+                                    gdrive_finfoarray_get_count(pArray));
     }
-    free(filter);
     
-    // Send the network request
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
+    return pArray;
+}
+
+Gdrive_Fileinfo_Array* gdrive_folder_list_page(const char* folderId, 
+                                               const char* folderPath, 
+                                               const char* pageToken, 
+                                               char** pNextPageToken)
+{
+    *pNextPageToken = NULL;
     
+    Gdrive_Json_Object* pObj = 
+            gdrive_folder_list_fetch_page(folderId, pageToken);
+    if (pObj == NULL)
+    {
+        // Download or parse error
+        return NULL;
+    }
     
-    // TODO: Somehow unify this process with other ways to fill Gdrive_Fileinfo,
-    // reducing code duplication and taking advantage of the cache.
-    int fileCount = -1;
-    Gdrive_Fileinfo_Array* pArray = NULL;
-    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    // Leave room for at least one item so that an empty page still gets a
+    // valid array.
+    int fileCount = gdrive_json_array_length(pObj, "items");
+    Gdrive_Fileinfo_Array* pArray = 
+            gdrive_finfoarray_create((fileCount > 0) ? fileCount : 1);
+    if (pArray != NULL)
     {
-        // Transfer was successful.  Convert result to a JSON object and extract
-        // the file meta-info.
-        Gdrive_Json_Object* pObj = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        if (pObj != NULL)
+        gdrive_folder_list_read_page(pObj, folderPath, pArray);
+        *pNextPageToken = 
+                gdrive_json_get_new_string(pObj, "nextPageToken", NULL);
+        if (pageToken == NULL && *pNextPageToken == NULL)
         {
-            fileCount = gdrive_json_array_length(pObj, "items");
-            if (fileCount > 0)
-            {
-                // Create an array of Gdrive_Fileinfo structs large enough to
-                // hold all the items.
-                pArray = gdrive_finfoarray_create(fileCount);
-                if (pArray != NULL)
-                {
-                    // Extract the file info from each member of the array.
-                    for (int index = 0; index < fileCount; index++)
-                    {
-                        Gdrive_Json_Object* pFile = gdrive_json_array_get(
-                                pObj, 
-                                "items", 
-                                index
-                                );
-                        if (pFile != NULL)
-                        {
-                            gdrive_finfoarray_add_from_json(pArray, pFile);
-                        }
-                    }
-                }
-                else
-                {
-                    // Memory error.
-                    fileCount = -1;
-                }
-            }
-            // else either failure (return -1) or 0-length array (return 0),
-            // nothing special needs to be done.
-            
-            gdrive_json_kill(pObj);
+            // The only page has the whole list. Remember the child count.
+            gdrive_cache_set_childcount(folderId, 
+                                        gdrive_finfoarray_get_count(pArray));
         }
-        // else do nothing.  Already prepared to return error.
     }
+    // else memory error, return NULL.
     
-    gdrive_dlbuf_free(pBuf);
-
+    gdrive_json_kill(pObj);
     return pArray;
 }
 
@@ -531,6 +810,11 @@ int gdrive_remove_parent(const char* fileId, const char* parentId)
     int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
         -EIO : 0;
     gdrive_dlbuf_free(pBuf);
+    if (returnVal == 0)
+    {
+        // The old parent has one less child.
+        gdrive_cache_adjust_childcount(parentId, -1);
+    }
     return returnVal;
 }
 
@@ -591,9 +875,8 @@ int gdrive_delete(const char* fileId, const char* parentId)
         gdrive_cache_delete_id(fileId);
         if (parentId != NULL && strcmp(parentId, "/") != 0)
         {
-            // Remove the parent from the cache because the child count will be
-            // wrong.
-            gdrive_cache_delete_id(parentId);
+            // The parent has one less child.
+            gdrive_cache_adjust_childcount(parentId, -1);
         }
     }
     return returnVal;
@@ -679,11 +962,19 @@ int gdrive_add_parent(const char* fileId, const char* parentId)
         // before the cache expires. (For example, if there was only one parent
         // before, and the user deletes one of the links, we don't want to
         // delete the entire file because of a bad parent count).
+        gdrive_cache_lock();
         Gdrive_Fileinfo* pFileinfo = gdrive_cache_get_item(fileId, false, NULL);
         if (pFileinfo)
         {
             pFileinfo->nParents++;
         }
+        gdrive_cache_unlock();
+        
+        // The new parent has one more child.
+        gdrive_cache_adjust_childcount(parentId, 1);
+        
+        // The new path may have been known not to exist.
+        gdrive_cache_clear_missing();
     }
     return returnVal;
 }
@@ -760,6 +1051,11 @@ int gdrive_change_basename(const char* fileId, const char* newName)
     int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
         -EIO : 0;
     gdrive_dlbuf_free(pBuf);
+    if (returnVal == 0)
+    {
+        // The new name may have been known not to exist.
+        gdrive_cache_clear_missing();
+    }
     return returnVal;
     
 }
@@ -788,17 +1084,57 @@ Gdrive_Info* gdrive_get_info(void)
 CURL* gdrive_get_curlhandle(void)
 {
     Gdrive_Info* pInfo = gdrive_get_info();
-    if (pInfo->curlHandle == NULL)
+    
+    // Reuse an idle handle if there is one.
+    CURL* curlHandle = NULL;
+    pthread_mutex_lock(&pInfo->poolMutex);
+    if (pInfo->curlPoolCount > 0)
     {
-        pInfo->curlHandle = curl_easy_init();
-        if (pInfo->curlHandle == NULL)
+        curlHandle = pInfo->curlPool[--pInfo->curlPoolCount];
+    }
+    pthread_mutex_unlock(&pInfo->poolMutex);
+    
+    if (curlHandle != NULL)
+    {
+        // Clear out options from the last request. This keeps open 
+        // connections and the DNS and TLS session caches.
+        curl_easy_reset(curlHandle);
+    }
+    else
+    {
+        curlHandle = curl_easy_init();
+        if (curlHandle == NULL)
         {
             // Error
             return NULL;
         }
-        gdrive_curlhandle_setup(pInfo->curlHandle);
     }
-    return curl_easy_duphandle(pInfo->curlHandle);
+    gdrive_curlhandle_setup(curlHandle);
+    return curlHandle;
+}
+
+void gdrive_release_curlhandle(CURL* curlHandle)
+{
+    if (curlHandle == NULL)
+    {
+        // Nothing to do
+        return;
+    }
+    
+    Gdrive_Info* pInfo = gdrive_get_info();
+    pthread_mutex_lock(&pInfo->poolMutex);
+    if (pInfo->curlPoolCount < GDRIVE_CURL_POOL_SIZE)
+    {
+        pInfo->curlPool[pInfo->curlPoolCount++] = curlHandle;
+        curlHandle = NULL;
+    }
+    pthread_mutex_unlock(&pInfo->poolMutex);
+    
+    if (curlHandle != NULL)
+    {
+        // The pool is full, get rid of the handle.
+        curl_easy_cleanup(curlHandle);
+    }
 }
 
 const char* gdrive_get_access_token(void)
@@ -811,7 +1147,36 @@ const char* gdrive_get_access_token(void)
  * Other semi-public accessible functions
  ******************/
 
+void gdrive_info_lock(void)
+{
+    pthread_mutex_lock(&gdrive_get_info()->mutex);
+}
+
+void gdrive_info_unlock(void)
+{
+    pthread_mutex_unlock(&gdrive_get_info()->mutex);
+}
+
 int gdrive_auth(void)
+{
+    // Don't hold the info lock here. The event loop needs it to start other
+    // transfers, including the ones that authenticate.
+    Gdrive_Info* pInfo = gdrive_get_info();
+    pthread_mutex_lock(&pInfo->authMutex);
+    int returnVal = gdrive_auth_locked();
+    pthread_mutex_unlock(&pInfo->authMutex);
+    return returnVal;
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+/*
+ * Does the work of gdrive_auth(). The caller must hold the auth lock.
+ */
+static int gdrive_auth_locked(void)
 {
     Gdrive_Info* pInfo = gdrive_get_info();
     
@@ -852,11 +1217,6 @@ int gdrive_auth(void)
     return gdrive_prompt_for_auth();
 }
 
-
-/*************************************************************************
- * Implementations of private functions for use within this file
- *************************************************************************/
-
 static int gdrive_read_auth_file(const char* filename)
 {
     if (filename == NULL)
@@ -936,6 +1296,16 @@ static void gdrive_info_cleanup(void)
     
     pInfo->minChunkSize = 0;
     pInfo->maxChunks = 0;
+    pInfo->listPageSize = 0;
+    pInfo->contentCacheSize = 0;
+    pInfo->blockSize = 0;
+    pInfo->fetchPolicy = GDRIVE_FETCH_FIXED;
+    pInfo->fetchConnections = 0;
+    pInfo->queryRate = 0;
+    pInfo->byteRate = 0;
+    pInfo->dirtyLimit = 0;
+    free(pInfo->cacheDir);
+    pInfo->cacheDir = NULL;
     
     pInfo->mode = 0;
     pInfo->userInteractionAllowed = false;
@@ -956,11 +1326,28 @@ static void gdrive_info_cleanup(void)
     pInfo->redirectUri = NULL;
     
 
-    if (pInfo->curlHandle != NULL)
+    for (int i = 0; i < pInfo->curlPoolCount; i++)
+    {
+        curl_easy_cleanup(pInfo->curlPool[i]);
+        pInfo->curlPool[i] = NULL;
+    }
+    pInfo->curlPoolCount = 0;
+    
+    // The share handle can only be cleaned up after all the easy handles that
+    // use it.
+    if (pInfo->curlShare != NULL)
+    {
+        curl_share_cleanup(pInfo->curlShare);
+        pInfo->curlShare = NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
     {
-        curl_easy_cleanup(pInfo->curlHandle);
-        pInfo->curlHandle = NULL;
+        pthread_mutex_destroy(&pInfo->shareMutex[i]);
     }
+    
+    pthread_mutex_destroy(&pInfo->mutex);
+    pthread_mutex_destroy(&pInfo->poolMutex);
+    pthread_mutex_destroy(&pInfo->authMutex);
 }
 
 
@@ -1063,6 +1450,9 @@ static int gdrive_refresh_auth_token(const char* grantType,
         // response.  Return error.
         return -1;
     }
+    // Other threads read the tokens while building requests, so only replace
+    // them while holding the lock.
+    gdrive_info_lock();
     int returnVal = gdrive_json_realloc_string(
             pObj, 
             GDRIVE_FIELDNAME_ACCESSTOKEN,
@@ -1094,6 +1484,7 @@ static int gdrive_refresh_auth_token(const char* grantType,
                     );
         }
     }
+    gdrive_info_unlock();
     gdrive_json_kill(pObj);
     
     return returnVal;
@@ -1296,8 +1687,14 @@ static char* gdrive_get_root_folder_id(void)
 }
 
 static char* 
-gdrive_get_child_id_by_name(const char* parentId, const char* childName)
+gdrive_get_child_id_by_name(const char* parentId, const char* childName, 
+                            bool* pNotFound)
 {
+    if (pNotFound != NULL)
+    {
+        *pNotFound = false;
+    }
+    
     // Construct a filter in the form of 
     // "'<parentId>' in parents and title = '<childName>'"
     char* filter = 
@@ -1366,6 +1763,12 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     {
         childId = gdrive_json_get_new_string(pArrayItem, "id", NULL);
     }
+    else if (pNotFound != NULL && 
+            gdrive_json_array_length(pObj, "items") == 0)
+    {
+        // Good response with an empty list. The file doesn't exist.
+        *pNotFound = true;
+    }
     gdrive_json_kill(pObj);
     return childId;
 }
@@ -1411,4 +1814,187 @@ void gdrive_curlhandle_setup(CURL* curlHandle)
     
     // Automatically follow redirects
     curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1);
-}
\ No newline at end of file
+    
+    // Don't let libcurl use signals for timeouts, since we may be running in
+    // multiple threads.
+    curl_easy_setopt(curlHandle, CURLOPT_NOSIGNAL, 1L);
+    
+    // Keep idle connections alive so they can be reused.
+    curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPALIVE, 1L);
+    
+#if LIBCURL_VERSION_NUM >= 0x072F00
+    // Use HTTP/2 when the server supports it, which lets requests share one
+    // connection. CURL_HTTP_VERSION_2TLS needs libcurl 7.47.0 or later.
+    curl_easy_setopt(curlHandle, CURLOPT_HTTP_VERSION, 
+                     (long) CURL_HTTP_VERSION_2TLS);
+#endif
+    
+    // Reuse DNS lookups, TLS sessions and connections from other handles.
+    CURLSH* curlShare = gdrive_get_info()->curlShare;
+    if (curlShare != NULL)
+    {
+        curl_easy_setopt(curlHandle, CURLOPT_SHARE, curlShare);
+    }
+}
+
+static void gdrive_curlshare_lock(CURL* curlHandle, curl_lock_data data, 
+                                  curl_lock_access access, void* userptr)
+{
+    // Unused parameters
+    (void) curlHandle;
+    (void) access;
+    (void) userptr;
+    
+    pthread_mutex_lock(&gdrive_get_info()->shareMutex[data]);
+}
+
+static void gdrive_curlshare_unlock(CURL* curlHandle, curl_lock_data data, 
+                                    void* userptr)
+{
+    // Unused parameters
+    (void) curlHandle;
+    (void) userptr;
+    
+    pthread_mutex_unlock(&gdrive_get_info()->shareMutex[data]);
+}
+
+static Gdrive_Json_Object* 
+gdrive_folder_list_fetch_page(const char* folderId, const char* pageToken)
+{
+    // Allow for an initial quote character in addition to the terminating null
+    char* filter = malloc(strlen(folderId) + 
+                            strlen("' in parents and trashed=false") + 2);
+    if (filter == NULL)
+    {
+        return NULL;
+    }
+    strcpy(filter, "'");
+    strcat(filter, folderId);
+    strcat(filter, "' in parents and trashed=false");
+    
+    // Prepare the network request
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
+    {
+        // Memory error
+        free(filter);
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+    
+    if (
+            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_FILES) || 
+            gdrive_xfer_add_query(pTransfer, "q", filter) || 
+            gdrive_xfer_add_query(pTransfer, "fields", 
+                                  "nextPageToken,"
+                                  "items(" GDRIVE_FIELDS_FILEINFO ")") || 
+            (pageToken != NULL && 
+                gdrive_xfer_add_query(pTransfer, "pageToken", pageToken))
+        )
+    {
+        // Error
+        free(filter);
+        gdrive_xfer_free(pTransfer);
+        return NULL;
+    }
+    free(filter);
+    
+    // Without maxResults, Google Drive uses its own default page size.
+    int pageSize = gdrive_get_info()->listPageSize;
+    if (pageSize > 0)
+    {
+        char pageSizeString[12];
+        snprintf(pageSizeString, sizeof(pageSizeString), "%d", pageSize);
+        if (gdrive_xfer_add_query(pTransfer, "maxResults", pageSizeString))
+        {
+            // Error
+            gdrive_xfer_free(pTransfer);
+            return NULL;
+        }
+    }
+    
+    // Send the network request
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    
+    Gdrive_Json_Object* pObj = NULL;
+    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    {
+        // Transfer was successful.  Convert result to a JSON object.
+        pObj = gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    }
+    gdrive_dlbuf_free(pBuf);
+    
+    return pObj;
+}
+
+static void gdrive_folder_list_read_page(Gdrive_Json_Object* pObj, 
+                                         const char* folderPath, 
+                                         Gdrive_Fileinfo_Array* pArray)
+{
+    // Extract the file info from each member of the array.
+    int fileCount = gdrive_json_array_length(pObj, "items");
+    for (int index = 0; index < fileCount; index++)
+    {
+        Gdrive_Json_Object* pFile = 
+                gdrive_json_array_get(pObj, "items", index);
+        if (pFile != NULL)
+        {
+            gdrive_finfoarray_add_from_json(pArray, pFile);
+            gdrive_folder_list_cache_child(folderPath, pFile);
+        }
+    }
+}
+
+static void gdrive_folder_list_cache_child(const char* folderPath, 
+                                           Gdrive_Json_Object* pFile)
+{
+    Gdrive_Fileinfo childInfo;
+    memset(&childInfo, 0, sizeof(Gdrive_Fileinfo));
+    gdrive_finfo_read_json(&childInfo, pFile);
+    if (childInfo.id == NULL)
+    {
+        // Nothing we can cache without an ID
+        gdrive_finfo_cleanup(&childInfo);
+        return;
+    }
+    
+    gdrive_cache_lock();
+    
+    // Store the metadata, unless another thread has dirty data for the same
+    // file. The listing doesn't tell us how many children a folder has, so 
+    // folders are stored with GDRIVE_FINFO_CHILDREN_UNKNOWN and counted when
+    // the count is first needed.
+    Gdrive_Cache_Node* pNode = gdrive_cache_get_node(childInfo.id, true, NULL);
+    if (pNode != NULL && !gdrive_cnode_is_dirty(pNode))
+    {
+        gdrive_cnode_update_from_json(pNode, pFile);
+    }
+    
+    // Store the path, if we know the parent folder's path. Skip names with a 
+    // '/', which can't be represented in a path.
+    if (folderPath != NULL && childInfo.filename != NULL && 
+            strchr(childInfo.filename, '/') == NULL
+            )
+    {
+        bool isRoot = (strcmp(folderPath, "/") == 0);
+        char* childPath = malloc(strlen(folderPath) + 
+                                 strlen(childInfo.filename) + 2
+                );
+        if (childPath != NULL)
+        {
+            strcpy(childPath, folderPath);
+            if (!isRoot)
+            {
+                strcat(childPath, "/");
+            }
+            strcat(childPath, childInfo.filename);
+            gdrive_cache_add_fileid(childPath, childInfo.id);
+            free(childPath);
+        }
+        // else memory error, just don't cache the path
+    }
+    
+    gdrive_cache_unlock();
+    gdrive_finfo_cleanup(&childInfo);
+}
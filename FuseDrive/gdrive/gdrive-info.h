@@ -42,6 +42,12 @@ extern "C" {
 #define GDRIVE_URL_UPLOAD "https://www.googleapis.com/upload/drive/v2/files"
 #define GDRIVE_URL_ABOUT "https://www.googleapis.com/drive/v2/about"
 #define GDRIVE_URL_CHANGES "https://www.googleapis.com/drive/v2/changes"
+
+// The fields of a Files resource needed to fill in a Gdrive_Fileinfo struct,
+// for use with the "fields" query parameter.
+#define GDRIVE_FIELDS_FILEINFO "title,id,mimeType,fileSize,createdDate,"\
+                               "modifiedDate,lastViewedByMeDate,parents(id),"\
+                               "userPermission,md5Checksum"
     
 
 /******************
@@ -63,27 +69,40 @@ Gdrive_Info* gdrive_get_info(void);
  ******************/
     
 /*
- * gdrive_get_curlhandle(): Retrieves a duplicate of the curl easy handle 
- *                          currently stored in the Gdrive_Info struct.
+ * gdrive_get_curlhandle(): Retrieves a curl easy handle, with the standard 
+ *                          options set, from a pool of reusable handles.
  * Return value (CURL*):
- *      A curl easy handle. The caller is responsible for calling 
- *      curl_easy_cleanup() on this handle.
+ *      A curl easy handle, or NULL on error. When finished with the handle, 
+ *      the caller is responsible for passing it to 
+ *      gdrive_release_curlhandle() (NOT curl_easy_cleanup()).
  * NOTES:
- *      The Gdrive_Info struct stores a curl easy handle with several options
- *      pre-set. In order to maintain consistency and avoid corrupting the
- *      handle's options (as could happen if an option intended for one specific
- *      operation is not reset to the default after the operation finishes),
- *      this function returns a new copy of the handle, not a reference to the
- *      existing handle.
+ *      Handles are reset to the standard options before being handed out, so
+ *      options set for one request never leak into another. Resetting keeps
+ *      the handle's open connections, so later requests can skip the TCP and
+ *      TLS handshakes.
  */
 CURL* gdrive_get_curlhandle(void);
 
+/*
+ * gdrive_release_curlhandle(): Returns a curl easy handle retrieved from
+ *                              gdrive_get_curlhandle() to the pool so it can
+ *                              be reused. If the pool is full, the handle is
+ *                              cleaned up instead.
+ * Parameters:
+ *      curlHandle (CURL*):
+ *              The handle to return. It should not be used after this function
+ *              returns. It is safe to pass NULL.
+ */
+void gdrive_release_curlhandle(CURL* curlHandle);
+
 /*
  * gdrive_get_access_token():   Retrieve the current access token.
  * Return value (const char*):
  *      A pointer to a null-terminated string, or a NULL pointer if there is no
  *      current access token. The pointed-to memory should not be altered or
- *      freed.
+ *      freed. The pointer may become invalid when the token is refreshed, so
+ *      the caller should hold the info lock (see gdrive_info_lock()) while 
+ *      using it.
  */
 const char* gdrive_get_access_token(void);
 
@@ -92,13 +111,28 @@ const char* gdrive_get_access_token(void);
  * Other semi-public accessible functions
  ******************/
     
+/*
+ * gdrive_info_lock():  Acquires the lock protecting the authentication 
+ *                      tokens. The lock is recursive. Each call must be 
+ *                      matched by a call to gdrive_info_unlock(). Don't make
+ *                      network requests while holding it.
+ */
+void gdrive_info_lock(void);
+
+/*
+ * gdrive_info_unlock():    Releases the lock acquired with gdrive_info_lock().
+ */
+void gdrive_info_unlock(void);
+    
 /*
  * gdrive_auth():   Authenticate and obtain permissions from the user for Google
  *                  Drive.  If passed the address of a Gdrive_Info struct which 
  *                  has existing authentication information, will attempt to 
  *                  reuse this information first. The new credentials (if 
  *                  different from the credentials initially passed in) are
- *                  written back into the Gdrive_Info struct.
+ *                  written back into the Gdrive_Info struct. Only one
+ *                  thread at a time can authenticate; others calling this
+ *                  function will wait.
  * Returns:
  *      0 for success, other value on error.
  */
@@ -123,7 +123,7 @@ Gdrive_Query* gdrive_query_add(Gdrive_Query* pQuery,
     }
     pLast->field = curl_easy_escape(curlHandle, field, 0);
     pLast->value = curl_easy_escape(curlHandle, value, 0);
-    curl_easy_cleanup(curlHandle);
+    gdrive_release_curlhandle(curlHandle);
     
     if (pLast->field == NULL || pLast->value == NULL)
     {
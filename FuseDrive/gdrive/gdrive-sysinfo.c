@@ -6,6 +6,7 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
     
 
 typedef struct Gdrive_Sysinfo
@@ -27,6 +28,9 @@ typedef struct Gdrive_Sysinfo
  * this file
  *************************************************************************/
 
+// Protects the static Gdrive_Sysinfo struct in gdrive_sysinfo_get_or_clear().
+static pthread_mutex_t sysinfoMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static const Gdrive_Sysinfo* gdrive_sysinfo_get_or_clear(bool cleanup);
 
 static void gdrive_sysinfo_cleanup_internal(Gdrive_Sysinfo* pSysinfo);
@@ -51,7 +55,9 @@ static int gdrive_sysinfo_update(Gdrive_Sysinfo* pDest);
 
 void gdrive_sysinfo_cleanup()
 {
+    pthread_mutex_lock(&sysinfoMutex);
     gdrive_sysinfo_get_or_clear(true);
+    pthread_mutex_unlock(&sysinfoMutex);
 }
 
 
@@ -61,17 +67,29 @@ void gdrive_sysinfo_cleanup()
 
 int64_t gdrive_sysinfo_get_size(void)
 {
-    return gdrive_sysinfo_get_or_clear(false)->quotaBytesTotal;
+    pthread_mutex_lock(&sysinfoMutex);
+    int64_t size = gdrive_sysinfo_get_or_clear(false)->quotaBytesTotal;
+    pthread_mutex_unlock(&sysinfoMutex);
+    return size;
 }
 
 int64_t gdrive_sysinfo_get_used()
 {
-    return gdrive_sysinfo_get_or_clear(false)->quotaBytesUsed;
+    pthread_mutex_lock(&sysinfoMutex);
+    int64_t used = gdrive_sysinfo_get_or_clear(false)->quotaBytesUsed;
+    pthread_mutex_unlock(&sysinfoMutex);
+    return used;
 }
 
 const char* gdrive_sysinfo_get_rootid(void)
 {
-    return gdrive_sysinfo_get_or_clear(false)->rootId;
+    // The root folder ID never changes, and gdrive_sysinfo_update() keeps the
+    // same string when it refreshes, so the pointer stays valid after the lock
+    // is released.
+    pthread_mutex_lock(&sysinfoMutex);
+    const char* rootId = gdrive_sysinfo_get_or_clear(false)->rootId;
+    pthread_mutex_unlock(&sysinfoMutex);
+    return rootId;
 }
 
 
@@ -163,12 +181,6 @@ static int gdrive_sysinfo_fill_from_json(Gdrive_Sysinfo* pDest,
 
 static int gdrive_sysinfo_update(Gdrive_Sysinfo* pDest)
 {
-    if (pDest != NULL)
-    {
-        // Clean up the existing info.
-        gdrive_sysinfo_cleanup_internal(pDest);
-    }
-        
     const char* const fieldString = "quotaBytesTotal,quotaBytesUsed,"
             "largestChangeId,rootFolderId,importFormats,exportFormats";
     
@@ -196,6 +208,7 @@ static int gdrive_sysinfo_update(Gdrive_Sysinfo* pDest)
     gdrive_xfer_free(pTransfer);
     
     int returnVal = -1;
+    Gdrive_Sysinfo newInfo = {.nextChangeId = INT64_MIN};
     if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
     {
         // Response was good, try extracting the data.
@@ -203,13 +216,34 @@ static int gdrive_sysinfo_update(Gdrive_Sysinfo* pDest)
                 gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
         if (pObj != NULL)
         {
-            returnVal = gdrive_sysinfo_fill_from_json(pDest, pObj);
+            returnVal = gdrive_sysinfo_fill_from_json(&newInfo, pObj);
         }
         gdrive_json_kill(pObj);
     }
     
     gdrive_dlbuf_free(pBuf);
     
+    if (returnVal != 0)
+    {
+        // Keep the existing info, and try again next time.
+        gdrive_sysinfo_cleanup_internal(&newInfo);
+        return returnVal;
+    }
+    
+    // Replace the existing info, but keep the old root ID string if it hasn't
+    // changed (other threads may still be using it).
+    if (pDest->rootId != NULL && newInfo.rootId != NULL && 
+            strcmp(pDest->rootId, newInfo.rootId) == 0)
+    {
+        free(newInfo.rootId);
+        newInfo.rootId = pDest->rootId;
+    }
+    else
+    {
+        free(pDest->rootId);
+    }
+    *pDest = newInfo;
+    
     return returnVal;
 }
 
@@ -6,10 +6,29 @@
 #include "gdrive-info.h"
 
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 
 #define GDRIVE_RETRY_LIMIT 5
 
+// Longest time (in milliseconds) the transfer engine's event loop will sleep
+// before checking for new work, in case a wakeup is missed.
+#define GDRIVE_XFER_ENGINE_MAX_WAIT 1000
+
+// Without curl_multi_poll(), curl_multi_wait() returns immediately when there
+// is nothing to wait on, so the event loop sleeps for this many milliseconds 
+// instead.
+#define GDRIVE_XFER_ENGINE_IDLE_WAIT 50
+
+// Number of seconds' worth of queries or bytes that can build up in the rate
+// limiters' token buckets while idle, and then be used in a burst
+#define GDRIVE_XFER_ENGINE_BURST 1
+
+// Size of each of the two buffers used to hand upload data from the thread 
+// waiting for a transfer to the event loop
+#define GDRIVE_XFER_FEED_SIZE (256 * 1024)
+
 
 /*************************************************************************
  * Private struct and declarations of private functions for use within 
@@ -27,11 +46,107 @@ typedef struct Gdrive_Transfer
     const char* body;
     struct curl_slist* pHeaders;
     FILE* destFile;
+    // Descriptor and position to download to instead of destFile, if destFd
+    // is not -1
+    int destFd;
+    off_t destFdOffset;
+    // If true, don't share a connection with any other transfer in progress
+    bool ownConnection;
+    // Protected by the engine's mutex, since the event loop looks at it while
+    // the transfer is pending
+    enum Gdrive_Xfer_Priority priority;
     gdrive_xfer_upload_callback uploadCallback;
     void* userdata;
     off_t uploadOffset;
+    // Length of the body supplied by uploadCallback, or -1 if unknown
+    off_t uploadSize;
+    
+    // Upload data that the thread in gdrive_xfer_wait() gets from 
+    // uploadCallback and hands to the event loop. feedData is NULL if the 
+    // event loop calls uploadCallback itself. Protected by the engine's 
+    // mutex, except for feedSpare, which belongs to the waiting thread.
+    char* feedData;
+    char* feedSpare;
+    size_t feedPos;
+    size_t feedLength;
+    // Incremented whenever the upload starts over from the beginning
+    int feedGeneration;
+    bool feedEnd;
+    bool feedError;
+    // True while curl is paused waiting for feedData
+    bool feedPaused;
+    // Set when there is data for a paused transfer, so the event loop should
+    // unpause it. feedUnpause is the event loop's own copy.
+    bool feedResume;
+    bool feedUnpause;
+    
+    // The handle performing the transfer, while it is in progress
+    CURL* curlHandle;
+    
+    // Members used only by asynchronous transfers (see gdrive_xfer_submit())
+    Gdrive_Download_Buffer* pBuf;
+    gdrive_xfer_done_callback doneCallback;
+    void* doneUserdata;
+    int tryNum;
+    struct timespec retryTime;
+    off_t destFileStart;
+    bool done;
+    struct Gdrive_Transfer* pNext;
 } Gdrive_Transfer;
 
+/*
+ * The transfer engine runs asynchronous transfers on a single curl multi 
+ * handle, driven by one event loop thread that is started when the first 
+ * transfer is submitted. Refreshing the access token after an authentication
+ * error is left to a second thread, started the first time it's needed, so 
+ * that the event loop never waits for it. All members other than multiHandle
+ * are protected by mutex. multiHandle is used only by the event loop thread, 
+ * except for curl_multi_wakeup().
+ */
+typedef struct Gdrive_Xfer_Engine
+{
+    CURLM* multiHandle;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    // Transfers waiting to be added to the multi handle, either because they
+    // were just submitted or because they are waiting to be retried.
+    Gdrive_Transfer* pPending;
+    // Transfers in the multi handle. Only the event loop thread changes this
+    // list, so it can walk the list without holding the mutex.
+    Gdrive_Transfer* pRunning;
+    // Transfers waiting for the authorization thread to refresh the access 
+    // token
+    Gdrive_Transfer* pAuth;
+    // Transfers the authorization thread gave up on, which the event loop 
+    // needs to finish
+    Gdrive_Transfer* pFinished;
+    pthread_t authThread;
+    bool authRunning;
+    bool authStopping;
+    // Token buckets for the query and byte rate limits, refilled as time 
+    // passes. Starting a transfer takes one query token, and a finished 
+    // attempt takes as many byte tokens as it sent and received, which can 
+    // leave byteTokens negative until it's refilled.
+    double queryTokens;
+    double byteTokens;
+    struct timespec lastRefill;
+    // Number of transfers in the multi handle
+    int runningCount;
+    // State for the random part of the delay before a retry. Used only by the
+    // event loop thread.
+    unsigned int retrySeed;
+    pthread_mutex_t mutex;
+    // Signaled whenever a transfer without a callback finishes.
+    pthread_cond_t doneCond;
+    // Signaled when a transfer needs more upload data, starts its upload over,
+    // or finishes.
+    pthread_cond_t feedCond;
+    // Signaled when a transfer is added to pAuth, or when the authorization 
+    // thread should stop.
+    pthread_cond_t authCond;
+} Gdrive_Xfer_Engine;
+
 
 /*
  * Returns 0 on success, other on failure.
@@ -43,9 +158,157 @@ static size_t gdrive_xfer_upload_callback_internal(char* buffer, size_t size,
                                                    size_t nitems, 
                                                    void* instream);
 
+/*
+ * Used by gdrive_xfer_upload_callback_internal() on the event loop thread to 
+ * copy upload data supplied by gdrive_xfer_feed(). Pauses the transfer if 
+ * there isn't any yet.
+ */
+static size_t gdrive_xfer_feed_read(Gdrive_Transfer* pTransfer, char* buffer, 
+                                    size_t size);
+
+/*
+ * Called by gdrive_xfer_wait() with the engine's mutex held. Calls the upload
+ * callback on the waiting thread and hands the data to the event loop, until
+ * the transfer is finished.
+ */
+static void gdrive_xfer_feed(Gdrive_Xfer_Engine* pEngine, 
+                             Gdrive_Transfer* pTransfer);
+
 static struct curl_slist* 
 gdrive_get_authbearer_header(struct curl_slist* pHeaders);
 
+/*
+ * Replaces the Authorization header (which is always the first header) with 
+ * one using the current access token. Returns 0 on success, other on failure.
+ */
+static int gdrive_xfer_renew_authbearer_header(Gdrive_Transfer* pTransfer);
+
+/*
+ * Gets a curl handle and sets all the options needed to perform the transfer.
+ * Returns NULL on failure.
+ */
+static CURL* gdrive_xfer_prepare_curlhandle(Gdrive_Transfer* pTransfer);
+
+/*
+ * Creates a download buffer that sends the results wherever the transfer's
+ * destination is. Returns NULL on failure.
+ */
+static Gdrive_Download_Buffer* 
+gdrive_xfer_create_dlbuf(const Gdrive_Transfer* pTransfer);
+
+static Gdrive_Xfer_Engine* gdrive_xfer_get_engine(void);
+
+/*
+ * Returns true if called from the event loop thread, which must not wait for
+ * transfers that only the event loop itself could finish.
+ */
+static bool gdrive_xfer_engine_is_current_thread(void);
+
+/*
+ * Must be called with the engine's mutex held. Returns 0 on success, other on
+ * failure.
+ */
+static int gdrive_xfer_engine_start(Gdrive_Xfer_Engine* pEngine);
+
+static void* gdrive_xfer_engine_loop(void* arg);
+
+/*
+ * Refreshes the access token for the transfers in the engine's pAuth list and
+ * retries them.
+ */
+static void* gdrive_xfer_engine_auth_loop(void* arg);
+
+/*
+ * Called from the event loop when a transfer's curl handle finishes. Either 
+ * schedules a retry or completes the transfer.
+ */
+static void gdrive_xfer_engine_finish(Gdrive_Xfer_Engine* pEngine, 
+                                      Gdrive_Transfer* pTransfer, 
+                                      CURLcode result);
+
+/*
+ * Hands the results of a transfer that won't be retried to its callback or to
+ * whoever is waiting for it. Called only from the event loop thread, or after
+ * it has stopped.
+ */
+static void gdrive_xfer_engine_complete(Gdrive_Xfer_Engine* pEngine, 
+                                        Gdrive_Transfer* pTransfer);
+
+/*
+ * Fails a transfer that can't be finished because the engine is shutting 
+ * down. The transfer must not be in the multi handle or on any of the 
+ * engine's lists.
+ */
+static void gdrive_xfer_engine_abort(Gdrive_Xfer_Engine* pEngine, 
+                                     Gdrive_Transfer* pTransfer);
+
+/*
+ * Resets a transfer to start over from the beginning, and puts it back on the
+ * pending list to start after waitTime milliseconds.
+ */
+static void gdrive_xfer_engine_retry(Gdrive_Xfer_Engine* pEngine, 
+                                     Gdrive_Transfer* pTransfer, 
+                                     long waitTime);
+
+/*
+ * Hands a transfer that got an authentication error to the authorization 
+ * thread, starting the thread if needed. Called only from the event loop 
+ * thread. Returns 0 on success, other on failure.
+ */
+static int gdrive_xfer_engine_queue_auth(Gdrive_Xfer_Engine* pEngine, 
+                                         Gdrive_Transfer* pTransfer);
+
+/*
+ * Unpauses the running transfers that gdrive_xfer_feed() has supplied more 
+ * data for. Called only from the event loop thread, without the engine's 
+ * mutex held.
+ */
+static void gdrive_xfer_engine_unpause(Gdrive_Xfer_Engine* pEngine);
+
+/*
+ * Moves pending transfers that are due into the multi handle, interactive 
+ * transfers first, as far as the rate limits allow. Must be called with the 
+ * engine's mutex held. Returns the number of milliseconds until the next 
+ * pending transfer could be started, at most GDRIVE_XFER_ENGINE_MAX_WAIT.
+ */
+static long gdrive_xfer_engine_start_pending(Gdrive_Xfer_Engine* pEngine);
+
+/*
+ * Adds tokens to the rate limiters' buckets for the time since the last 
+ * refill. Must be called with the engine's mutex held. Returns the number of
+ * milliseconds until there are enough tokens to start another transfer, or 0
+ * if there already are.
+ */
+static long gdrive_xfer_engine_refill(Gdrive_Xfer_Engine* pEngine);
+
+/*
+ * Called when an attempt at a transfer has been removed from the multi handle.
+ * Takes it off the running list, and takes the bytes it sent and received out
+ * of the byte rate limiter's bucket.
+ */
+static void gdrive_xfer_engine_end_attempt(Gdrive_Xfer_Engine* pEngine, 
+                                           Gdrive_Transfer* pTransfer);
+
+/*
+ * Adds a transfer to the end of one of the engine's lists. Must be called 
+ * with the engine's mutex held.
+ */
+static void gdrive_xfer_list_append(Gdrive_Transfer** ppList, 
+                                    Gdrive_Transfer* pTransfer);
+
+/*
+ * Removes a transfer from one of the engine's lists, if it's there. Must be 
+ * called with the engine's mutex held.
+ */
+static void gdrive_xfer_list_remove(Gdrive_Transfer** ppList, 
+                                    Gdrive_Transfer* pTransfer);
+
+/*
+ * Returns the number of milliseconds from now until the given time (measured
+ * on CLOCK_MONOTONIC), which is zero or negative if the time has passed.
+ */
+static long gdrive_xfer_ms_until(const struct timespec* pTime);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -62,6 +325,8 @@ Gdrive_Transfer* gdrive_xfer_create()
     {
         memset(returnVal, 0, sizeof(Gdrive_Transfer));
         returnVal->retryOnAuthError = true;
+        returnVal->uploadSize = -1;
+        returnVal->destFd = -1;
         returnVal->pHeaders = gdrive_get_authbearer_header(NULL);
     }
     
@@ -84,6 +349,10 @@ void gdrive_xfer_free(Gdrive_Transfer* pTransfer)
     pTransfer->pQuery = NULL;
     gdrive_query_free(pTransfer->pPostData);
     pTransfer->pPostData = NULL;
+    free(pTransfer->feedData);
+    pTransfer->feedData = NULL;
+    free(pTransfer->feedSpare);
+    pTransfer->feedSpare = NULL;
     if (pTransfer->pHeaders != NULL)
     {
         curl_slist_free_all(pTransfer->pHeaders);
@@ -128,6 +397,28 @@ void gdrive_xfer_set_destfile(Gdrive_Transfer* pTransfer, FILE* destFile)
     pTransfer->destFile = destFile;
 }
 
+void gdrive_xfer_set_destfd(Gdrive_Transfer* pTransfer, int fd, off_t offset)
+{
+    pTransfer->destFd = fd;
+    pTransfer->destFdOffset = offset;
+}
+
+void gdrive_xfer_set_ownconnection(Gdrive_Transfer* pTransfer, 
+                                   bool ownConnection)
+{
+    pTransfer->ownConnection = ownConnection;
+}
+
+void gdrive_xfer_set_priority(Gdrive_Transfer* pTransfer, 
+                              enum Gdrive_Xfer_Priority priority)
+{
+    // The event loop looks at the priority while the transfer is pending.
+    Gdrive_Xfer_Engine* pEngine = gdrive_xfer_get_engine();
+    pthread_mutex_lock(&pEngine->mutex);
+    pTransfer->priority = priority;
+    pthread_mutex_unlock(&pEngine->mutex);
+}
+
 void gdrive_xfer_set_body(Gdrive_Transfer* pTransfer, const char* body)
 {
     pTransfer->body = body;
@@ -142,6 +433,11 @@ void gdrive_xfer_set_uploadcallback(Gdrive_Transfer* pTransfer,
     pTransfer->uploadCallback = callback;
 }
 
+void gdrive_xfer_set_uploadsize(Gdrive_Transfer* pTransfer, off_t size)
+{
+    pTransfer->uploadSize = size;
+}
+
 
 /******************
  * Other accessible functions
@@ -174,7 +470,243 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
         return NULL;
     }
     
+    if (gdrive_xfer_engine_is_current_thread())
+    {
+        // The event loop can't wait on itself. This would only happen if a 
+        // done callback tried to run a transfer.
+        return NULL;
+    }
+    
+    // Let the event loop run the transfer, so that waiting to retry after an
+    // error only holds up this caller rather than every other transfer. Any
+    // upload callback is called on this thread by gdrive_xfer_wait().
+    if (gdrive_xfer_submit(pTransfer, NULL, NULL) != 0)
+    {
+        // Error
+        return NULL;
+    }
+    return gdrive_xfer_wait(pTransfer);
+}
+
+int gdrive_xfer_submit(Gdrive_Transfer* pTransfer, 
+                       gdrive_xfer_done_callback callback, void* userdata)
+{
+    if (pTransfer->url == NULL)
+    {
+        // Invalid parameter, need at least a URL.
+        return -1;
+    }
+    
+    if (pTransfer->uploadCallback != NULL && callback == NULL && 
+            pTransfer->feedData == NULL
+            )
+    {
+        // Whoever waits for the transfer will supply the upload data (see
+        // gdrive_xfer_feed()).
+        pTransfer->feedData = malloc(GDRIVE_XFER_FEED_SIZE);
+        pTransfer->feedSpare = malloc(GDRIVE_XFER_FEED_SIZE);
+        if (pTransfer->feedData == NULL || pTransfer->feedSpare == NULL)
+        {
+            // Memory error
+            free(pTransfer->feedData);
+            pTransfer->feedData = NULL;
+            free(pTransfer->feedSpare);
+            pTransfer->feedSpare = NULL;
+            return -1;
+        }
+    }
+    pTransfer->feedPos = 0;
+    pTransfer->feedLength = 0;
+    pTransfer->feedGeneration = 0;
+    pTransfer->feedEnd = false;
+    pTransfer->feedError = false;
+    pTransfer->feedPaused = false;
+    pTransfer->feedResume = false;
+    pTransfer->feedUnpause = false;
+    
+    CURL* curlHandle = gdrive_xfer_prepare_curlhandle(pTransfer);
+    if (curlHandle == NULL)
+    {
+        // Error
+        return -1;
+    }
+    
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_create_dlbuf(pTransfer);
+    if (pBuf == NULL)
+    {
+        // Memory error.
+        gdrive_release_curlhandle(curlHandle);
+        return -1;
+    }
+    gdrive_dlbuf_prepare(pBuf, curlHandle);
+    
+    // Let the event loop find the transfer from the curl handle.
+    curl_easy_setopt(curlHandle, CURLOPT_PRIVATE, pTransfer);
+#if LIBCURL_VERSION_NUM >= 0x072B00
+    // Prefer waiting for an existing HTTP/2 connection over opening a new one,
+    // unless the point is to have a connection of our own. Only do this over
+    // HTTPS, which settles whether a connection can be shared as soon as it's
+    // made. Over plain HTTP, that isn't known until the first response, and
+    // an upload waiting for this transfer (see gdrive_xfer_feed()) might
+    // never get one.
+    if (!pTransfer->ownConnection &&
+            strncmp(pTransfer->url, "https:", strlen("https:")) == 0
+            )
+    {
+        curl_easy_setopt(curlHandle, CURLOPT_PIPEWAIT, 1L);
+    }
+#endif
+    
+    pTransfer->curlHandle = curlHandle;
+    pTransfer->pBuf = pBuf;
+    pTransfer->doneCallback = callback;
+    pTransfer->doneUserdata = userdata;
+    pTransfer->tryNum = 0;
+    pTransfer->retryTime.tv_sec = 0;
+    pTransfer->retryTime.tv_nsec = 0;
+    // Remember where the download started, so a retry can start over.
+    pTransfer->destFileStart = (pTransfer->destFile != NULL) ? 
+        ftello(pTransfer->destFile) : 0;
+    pTransfer->done = false;
+    pTransfer->pNext = NULL;
+    
+    Gdrive_Xfer_Engine* pEngine = gdrive_xfer_get_engine();
+    pthread_mutex_lock(&pEngine->mutex);
+    if (pEngine->stopping || 
+            (!pEngine->running && gdrive_xfer_engine_start(pEngine) != 0)
+            )
+    {
+        // Shutting down, or couldn't start the event loop
+        pthread_mutex_unlock(&pEngine->mutex);
+        pTransfer->curlHandle = NULL;
+        pTransfer->pBuf = NULL;
+        gdrive_dlbuf_free(pBuf);
+        gdrive_release_curlhandle(curlHandle);
+        return -1;
+    }
+    gdrive_xfer_list_append(&pEngine->pPending, pTransfer);
+    pthread_mutex_unlock(&pEngine->mutex);
+    
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(pEngine->multiHandle);
+#endif
+    
+    return 0;
+}
+
+Gdrive_Download_Buffer* gdrive_xfer_wait(Gdrive_Transfer* pTransfer)
+{
+    Gdrive_Xfer_Engine* pEngine = gdrive_xfer_get_engine();
+    pthread_mutex_lock(&pEngine->mutex);
+    if (pTransfer->feedData != NULL)
+    {
+        // The upload callback may block, or even wait for other transfers, so
+        // call it here rather than on the event loop thread.
+        gdrive_xfer_feed(pEngine, pTransfer);
+    }
+    while (!pTransfer->done)
+    {
+        pthread_cond_wait(&pEngine->doneCond, &pEngine->mutex);
+    }
+    pthread_mutex_unlock(&pEngine->mutex);
+    
+    free(pTransfer->feedData);
+    pTransfer->feedData = NULL;
+    free(pTransfer->feedSpare);
+    pTransfer->feedSpare = NULL;
+    
+    // Hand the buffer over to the caller.
+    Gdrive_Download_Buffer* pBuf = pTransfer->pBuf;
+    pTransfer->pBuf = NULL;
+    return pBuf;
+}
+
+void gdrive_xfer_engine_cleanup(void)
+{
+    Gdrive_Xfer_Engine* pEngine = gdrive_xfer_get_engine();
+    pthread_mutex_lock(&pEngine->mutex);
+    if (!pEngine->running)
+    {
+        // Nothing to do
+        pthread_mutex_unlock(&pEngine->mutex);
+        return;
+    }
+    
+    // Stop the authorization thread first. It may be waiting for the event 
+    // loop to finish its own requests.
+    bool authRunning = pEngine->authRunning;
+    pEngine->authStopping = true;
+    pthread_cond_broadcast(&pEngine->authCond);
+    pthread_mutex_unlock(&pEngine->mutex);
+    if (authRunning)
+    {
+        pthread_join(pEngine->authThread, NULL);
+    }
+    
+    pthread_mutex_lock(&pEngine->mutex);
+    pEngine->stopping = true;
+    pthread_mutex_unlock(&pEngine->mutex);
+    
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(pEngine->multiHandle);
+#endif
+    pthread_join(pEngine->thread, NULL);
+    
+    // Fail whatever didn't get to finish, whether it was in progress, waiting
+    // to start or be retried, or given up on by the authorization thread, so
+    // that nobody waits for it forever.
+    pthread_mutex_lock(&pEngine->mutex);
+    Gdrive_Transfer* pRunning = pEngine->pRunning;
+    pEngine->pRunning = NULL;
+    pEngine->runningCount = 0;
+    Gdrive_Transfer* pLeft = pEngine->pPending;
+    pEngine->pPending = NULL;
+    while (pEngine->pFinished != NULL)
+    {
+        Gdrive_Transfer* pTransfer = pEngine->pFinished;
+        pEngine->pFinished = pTransfer->pNext;
+        gdrive_xfer_list_append(&pLeft, pTransfer);
+    }
+    pthread_mutex_unlock(&pEngine->mutex);
+    while (pRunning != NULL)
+    {
+        Gdrive_Transfer* pNext = pRunning->pNext;
+        pRunning->pNext = NULL;
+        curl_multi_remove_handle(pEngine->multiHandle, pRunning->curlHandle);
+        gdrive_xfer_engine_abort(pEngine, pRunning);
+        pRunning = pNext;
+    }
+    while (pLeft != NULL)
+    {
+        Gdrive_Transfer* pNext = pLeft->pNext;
+        pLeft->pNext = NULL;
+        gdrive_xfer_engine_abort(pEngine, pLeft);
+        pLeft = pNext;
+    }
+    
+    curl_multi_cleanup(pEngine->multiHandle);
+    pthread_mutex_lock(&pEngine->mutex);
+    pEngine->multiHandle = NULL;
+    pEngine->running = false;
+    pEngine->stopping = false;
+    pEngine->authRunning = false;
+    pEngine->authStopping = false;
+    pthread_mutex_unlock(&pEngine->mutex);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static CURL* gdrive_xfer_prepare_curlhandle(Gdrive_Transfer* pTransfer)
+{
     CURL* curlHandle = gdrive_get_curlhandle();
+    if (curlHandle == NULL)
+    {
+        // Error
+        return NULL;
+    }
     
     bool needsBody = false;
     
@@ -208,7 +740,7 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
 
         default:
             // Unsupported request type.  
-            curl_easy_cleanup(curlHandle);
+            gdrive_release_curlhandle(curlHandle);
             return NULL;
     }
     
@@ -219,7 +751,7 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
     if (fullUrl == NULL)
     {
         // Memory error or invalid URL
-        curl_easy_cleanup(curlHandle);
+        gdrive_release_curlhandle(curlHandle);
         return NULL;
     }
     curl_easy_setopt(curlHandle, CURLOPT_URL, fullUrl);
@@ -233,8 +765,12 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
     {
         // A request type that normally has a body, but no body given. Need to
         // explicitly set the body length to 0, according to 
-        // http://curl.haxx.se/libcurl/c/CURLOPT_POSTFIELDS.html
+        // http://curl.haxx.se/libcurl/c/CURLOPT_POSTFIELDS.html (or for PUT,
+        // http://curl.haxx.se/libcurl/c/CURLOPT_INFILESIZE_LARGE.html).
         curl_easy_setopt(curlHandle, CURLOPT_POSTFIELDSIZE, 0L);
+        curl_easy_setopt(curlHandle, CURLOPT_INFILESIZE_LARGE, 
+                         (curl_off_t) 0
+                );
     }
     if (pTransfer->body != NULL)
     {
@@ -247,7 +783,7 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
         if (postData == NULL)
         {
             // Memory error or invalid query
-            curl_easy_cleanup(curlHandle);
+            gdrive_release_curlhandle(curlHandle);
             return NULL;
         }
         curl_easy_setopt(curlHandle, CURLOPT_POSTFIELDSIZE, -1L);
@@ -258,7 +794,16 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
     // Set upload data callback, if applicable
     if (pTransfer->uploadCallback != NULL)
     {
-        gdrive_xfer_add_header(pTransfer, "Transfer-Encoding: chunked");
+        if (pTransfer->uploadSize >= 0)
+        {
+            curl_easy_setopt(curlHandle, CURLOPT_INFILESIZE_LARGE, 
+                             (curl_off_t) pTransfer->uploadSize
+                    );
+        }
+        else
+        {
+            gdrive_xfer_add_header(pTransfer, "Transfer-Encoding: chunked");
+        }
         curl_easy_setopt(curlHandle, 
                          CURLOPT_READFUNCTION, 
                          gdrive_xfer_upload_callback_internal
@@ -266,47 +811,37 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
         curl_easy_setopt(curlHandle, CURLOPT_READDATA, pTransfer);
     }
     
-
-    
-    // Set headers
-    curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, pTransfer->pHeaders);
-    
-    
-    Gdrive_Download_Buffer* pBuf;
-    pBuf = gdrive_dlbuf_create((pTransfer->destFile == NULL) ? 512 : 0, 
-                               pTransfer->destFile
-            );
-    if (pBuf == NULL)
+#if LIBCURL_VERSION_NUM >= 0x072F00
+    if (pTransfer->ownConnection)
     {
-        // Memory error.
-        curl_easy_cleanup(curlHandle);
-        return NULL;
+        // HTTP/2 would put the transfer on the same connection as any others
+        // to the same server, so stick with HTTP/1.1, which can only carry 
+        // one request at a time.
+        curl_easy_setopt(curlHandle, CURLOPT_HTTP_VERSION, 
+                         (long) CURL_HTTP_VERSION_1_1);
     }
+#endif
     
-    gdrive_dlbuf_download_with_retry(pBuf, curlHandle, 
-                                     pTransfer->retryOnAuthError, 
-                                     0, GDRIVE_RETRY_LIMIT
-            );
-    curl_easy_cleanup(curlHandle);
+    // Set headers
+    curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, pTransfer->pHeaders);
     
-    if (!gdrive_dlbuf_get_success(pBuf))
+    return curlHandle;
+}
+
+static Gdrive_Download_Buffer* 
+gdrive_xfer_create_dlbuf(const Gdrive_Transfer* pTransfer)
+{
+    bool toMemory = (pTransfer->destFile == NULL && pTransfer->destFd < 0);
+    Gdrive_Download_Buffer* pBuf = 
+            gdrive_dlbuf_create(toMemory ? 512 : 0, pTransfer->destFile);
+    if (pBuf != NULL && pTransfer->destFd >= 0)
     {
-        // Download failure
-        gdrive_dlbuf_free(pBuf);
-        return NULL;
+        gdrive_dlbuf_set_destfd(pBuf, pTransfer->destFd, 
+                                pTransfer->destFdOffset);
     }
-    
-    // The HTTP Response may be success (e.g., 200) or failure (400 or higher),
-    // but the actual request succeeded as far as libcurl is concerned.  Return
-    // the buffer.
     return pBuf;
 }
 
-
-/*************************************************************************
- * Implementations of private functions for use within this file
- *************************************************************************/
-
 static int gdrive_xfer_add_query_or_post(Gdrive_Query** ppQuery, 
                                          const char* field, const char* value)
 {
@@ -320,6 +855,12 @@ static size_t gdrive_xfer_upload_callback_internal(char* buffer, size_t size,
 {
     // Get the transfer struct.
     Gdrive_Transfer* pTransfer = (Gdrive_Transfer*) instream;
+    if (pTransfer->feedData != NULL)
+    {
+        // The data comes from the thread waiting for the transfer.
+        return gdrive_xfer_feed_read(pTransfer, buffer, size * nitems);
+    }
+    
     size_t bytesTransferred = 
             pTransfer->uploadCallback(buffer, pTransfer->uploadOffset, 
                                       size * nitems, pTransfer->userdata
@@ -335,17 +876,141 @@ static size_t gdrive_xfer_upload_callback_internal(char* buffer, size_t size,
     return bytesTransferred;
 }
 
+static size_t gdrive_xfer_feed_read(Gdrive_Transfer* pTransfer, char* buffer, 
+                                    size_t size)
+{
+    Gdrive_Xfer_Engine* pEngine = gdrive_xfer_get_engine();
+    pthread_mutex_lock(&pEngine->mutex);
+    size_t returnVal;
+    if (pTransfer->feedLength > 0)
+    {
+        returnVal = (size < pTransfer->feedLength) ? 
+            size : pTransfer->feedLength;
+        memcpy(buffer, pTransfer->feedData + pTransfer->feedPos, returnVal);
+        pTransfer->feedPos += returnVal;
+        pTransfer->feedLength -= returnVal;
+        if (pTransfer->feedLength == 0)
+        {
+            // Ready for the next piece
+            pthread_cond_broadcast(&pEngine->feedCond);
+        }
+    }
+    else if (pTransfer->feedError)
+    {
+        returnVal = CURL_READFUNC_ABORT;
+    }
+    else if (pTransfer->feedEnd)
+    {
+        // Everything has been sent.
+        returnVal = 0;
+    }
+    else
+    {
+        // The next piece isn't ready yet. gdrive_xfer_feed() will have the 
+        // event loop unpause the transfer when it is.
+        pTransfer->feedPaused = true;
+        returnVal = CURL_READFUNC_PAUSE;
+    }
+    pthread_mutex_unlock(&pEngine->mutex);
+    return returnVal;
+}
+
+static void gdrive_xfer_feed(Gdrive_Xfer_Engine* pEngine, 
+                             Gdrive_Transfer* pTransfer)
+{
+    // While the event loop sends what's in feedData, fill feedSpare with the
+    // next piece, and swap the two once feedData is empty.
+    int generation = pTransfer->feedGeneration - 1;
+    off_t offset = 0;
+    size_t spareLength = 0;
+    bool finished = false;
+    while (!pTransfer->done)
+    {
+        if (generation != pTransfer->feedGeneration)
+        {
+            // Starting (or starting over) from the beginning
+            generation = pTransfer->feedGeneration;
+            offset = 0;
+            spareLength = 0;
+            finished = false;
+        }
+        
+        if (spareLength == 0 && !finished)
+        {
+            pthread_mutex_unlock(&pEngine->mutex);
+            size_t size = pTransfer->uploadCallback(pTransfer->feedSpare, 
+                                                    offset, 
+                                                    GDRIVE_XFER_FEED_SIZE, 
+                                                    pTransfer->userdata
+                    );
+            pthread_mutex_lock(&pEngine->mutex);
+            if (generation != pTransfer->feedGeneration || pTransfer->done)
+            {
+                // The upload started over or ended meanwhile, so this piece
+                // isn't needed.
+                continue;
+            }
+            if (size == (size_t)(-1))
+            {
+                pTransfer->feedError = true;
+                finished = true;
+            }
+            else if (size == 0)
+            {
+                pTransfer->feedEnd = true;
+                finished = true;
+            }
+            else
+            {
+                spareLength = size;
+                offset += size;
+            }
+        }
+        
+        if (spareLength > 0 && pTransfer->feedLength == 0)
+        {
+            char* pTemp = pTransfer->feedData;
+            pTransfer->feedData = pTransfer->feedSpare;
+            pTransfer->feedSpare = pTemp;
+            pTransfer->feedPos = 0;
+            pTransfer->feedLength = spareLength;
+            spareLength = 0;
+        }
+        
+        if (pTransfer->feedPaused && (pTransfer->feedLength > 0 || 
+                pTransfer->feedEnd || pTransfer->feedError)
+                )
+        {
+            pTransfer->feedPaused = false;
+            pTransfer->feedResume = true;
+#if LIBCURL_VERSION_NUM >= 0x074400
+            curl_multi_wakeup(pEngine->multiHandle);
+#endif
+        }
+        
+        if (spareLength > 0 || finished)
+        {
+            // Nothing to do until the event loop wants more, starts over, or
+            // finishes.
+            pthread_cond_wait(&pEngine->feedCond, &pEngine->mutex);
+        }
+    }
+}
+
 /*
  * pHeaders can be NULL, or an existing set of headers can be given.
  */
 static struct curl_slist* 
 gdrive_get_authbearer_header(struct curl_slist* pHeaders)
 {
+    // Another thread may refresh the token, so hold the lock while we use it.
+    gdrive_info_lock();
     const char* token = gdrive_get_access_token();
     
     // If we don't have any access token yet, do nothing
     if (!token)
     {
+        gdrive_info_unlock();
         return pHeaders;
     }
     
@@ -356,13 +1021,608 @@ gdrive_get_authbearer_header(struct curl_slist* pHeaders)
     if (!header)
     {
         // Memory error
+        gdrive_info_unlock();
         return NULL;
     }
     strcpy(header, "Authorization: Bearer ");
     strcat(header, token);
+    gdrive_info_unlock();
     
     // Copy the string into a curl_slist for use in headers.
     struct curl_slist* returnVal = curl_slist_append(pHeaders, header);
     free(header);
     return returnVal;
 }
+
+static int gdrive_xfer_renew_authbearer_header(Gdrive_Transfer* pTransfer)
+{
+    // The first header is always the Authorization header added by 
+    // gdrive_xfer_create() (unless there was no access token at the time), so
+    // build a new list with a new Authorization header followed by the rest of
+    // the old list.
+    struct curl_slist* pOldHeaders = pTransfer->pHeaders;
+    struct curl_slist* pItem = pOldHeaders;
+    if (pItem != NULL && 
+            strncmp(pItem->data, "Authorization:", strlen("Authorization:")) 
+            == 0
+            )
+    {
+        pItem = pItem->next;
+    }
+    
+    struct curl_slist* pNewHeaders = gdrive_get_authbearer_header(NULL);
+    if (pNewHeaders == NULL)
+    {
+        // Memory error, or no access token
+        return -1;
+    }
+    for (; pItem != NULL; pItem = pItem->next)
+    {
+        struct curl_slist* pTemp = curl_slist_append(pNewHeaders, pItem->data);
+        if (pTemp == NULL)
+        {
+            // Memory error
+            curl_slist_free_all(pNewHeaders);
+            return -1;
+        }
+        pNewHeaders = pTemp;
+    }
+    
+    // The curl handle still refers to the old list, so replace it there before
+    // freeing it.
+    curl_easy_setopt(pTransfer->curlHandle, CURLOPT_HTTPHEADER, pNewHeaders);
+    pTransfer->pHeaders = pNewHeaders;
+    curl_slist_free_all(pOldHeaders);
+    return 0;
+}
+
+static Gdrive_Xfer_Engine* gdrive_xfer_get_engine(void)
+{
+    static Gdrive_Xfer_Engine engine = {
+        .mutex = PTHREAD_MUTEX_INITIALIZER, 
+        .doneCond = PTHREAD_COND_INITIALIZER, 
+        .feedCond = PTHREAD_COND_INITIALIZER, 
+        .authCond = PTHREAD_COND_INITIALIZER
+    };
+    return &engine;
+}
+
+static bool gdrive_xfer_engine_is_current_thread(void)
+{
+    Gdrive_Xfer_Engine* pEngine = gdrive_xfer_get_engine();
+    pthread_mutex_lock(&pEngine->mutex);
+    bool returnVal = 
+            pEngine->running && pthread_equal(pEngine->thread, pthread_self());
+    pthread_mutex_unlock(&pEngine->mutex);
+    return returnVal;
+}
+
+static int gdrive_xfer_engine_start(Gdrive_Xfer_Engine* pEngine)
+{
+    pEngine->multiHandle = curl_multi_init();
+    if (pEngine->multiHandle == NULL)
+    {
+        // Error
+        return -1;
+    }
+#ifdef CURLPIPE_MULTIPLEX
+    // Run concurrent transfers over a shared HTTP/2 connection when possible.
+    curl_multi_setopt(pEngine->multiHandle, CURLMOPT_PIPELINING, 
+                      CURLPIPE_MULTIPLEX
+            );
+#endif
+    
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    pEngine->retrySeed = (unsigned int) (now.tv_sec ^ now.tv_nsec);
+    
+    pEngine->stopping = false;
+    if (pthread_create(&pEngine->thread, NULL, gdrive_xfer_engine_loop, 
+                       pEngine) != 0
+            )
+    {
+        // Couldn't create the thread
+        curl_multi_cleanup(pEngine->multiHandle);
+        pEngine->multiHandle = NULL;
+        return -1;
+    }
+    pEngine->running = true;
+    return 0;
+}
+
+static void* gdrive_xfer_engine_loop(void* arg)
+{
+    Gdrive_Xfer_Engine* pEngine = (Gdrive_Xfer_Engine*) arg;
+    
+    while (true)
+    {
+        // Move any pending transfers that are due into the multi handle, and
+        // figure out how long until the next one is due.
+        pthread_mutex_lock(&pEngine->mutex);
+        if (pEngine->stopping)
+        {
+            pthread_mutex_unlock(&pEngine->mutex);
+            break;
+        }
+        long timeout = gdrive_xfer_engine_start_pending(pEngine);
+        Gdrive_Transfer* pFinished = pEngine->pFinished;
+        pEngine->pFinished = NULL;
+        for (Gdrive_Transfer* pTransfer = pEngine->pRunning; 
+                pTransfer != NULL; pTransfer = pTransfer->pNext)
+        {
+            pTransfer->feedUnpause = pTransfer->feedResume;
+            pTransfer->feedResume = false;
+        }
+        pthread_mutex_unlock(&pEngine->mutex);
+        
+        // Finish any transfers the authorization thread gave up on, and 
+        // continue any uploads that have more data.
+        while (pFinished != NULL)
+        {
+            Gdrive_Transfer* pNext = pFinished->pNext;
+            pFinished->pNext = NULL;
+            gdrive_xfer_engine_complete(pEngine, pFinished);
+            pFinished = pNext;
+        }
+        gdrive_xfer_engine_unpause(pEngine);
+        
+        // Let curl do whatever work it can without blocking.
+        int stillRunning = 0;
+        curl_multi_perform(pEngine->multiHandle, &stillRunning);
+        
+        // Handle any finished transfers.
+        CURLMsg* pMsg;
+        int msgsLeft;
+        while ((pMsg = curl_multi_info_read(pEngine->multiHandle, &msgsLeft)) 
+                != NULL
+                )
+        {
+            if (pMsg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            // pMsg isn't valid after the handle is removed, so copy what we 
+            // need first.
+            CURL* curlHandle = pMsg->easy_handle;
+            CURLcode result = pMsg->data.result;
+            Gdrive_Transfer* pTransfer = NULL;
+            curl_easy_getinfo(curlHandle, CURLINFO_PRIVATE, 
+                              (char**) &pTransfer
+                    );
+            curl_multi_remove_handle(pEngine->multiHandle, curlHandle);
+            gdrive_xfer_engine_finish(pEngine, pTransfer, result);
+            // A retry may be due sooner than the current timeout.
+            timeout = 0;
+        }
+        
+        // Wait for network activity, a new submission, or the next retry.
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(pEngine->multiHandle, NULL, 0, timeout, NULL);
+#else
+        if (timeout > GDRIVE_XFER_ENGINE_IDLE_WAIT)
+        {
+            timeout = GDRIVE_XFER_ENGINE_IDLE_WAIT;
+        }
+        int numfds = 0;
+        curl_multi_wait(pEngine->multiHandle, NULL, 0, timeout, &numfds);
+        if (numfds == 0 && stillRunning == 0 && timeout > 0)
+        {
+            struct timespec idleTime;
+            idleTime.tv_sec = 0;
+            idleTime.tv_nsec = timeout * 1000000L;
+            nanosleep(&idleTime, NULL);
+        }
+#endif
+    }
+    
+    return NULL;
+}
+
+static void* gdrive_xfer_engine_auth_loop(void* arg)
+{
+    Gdrive_Xfer_Engine* pEngine = (Gdrive_Xfer_Engine*) arg;
+    
+    pthread_mutex_lock(&pEngine->mutex);
+    while (true)
+    {
+        while (pEngine->pAuth == NULL && !pEngine->authStopping)
+        {
+            pthread_cond_wait(&pEngine->authCond, &pEngine->mutex);
+        }
+        if (pEngine->pAuth == NULL)
+        {
+            // Stopping, and nothing is left waiting.
+            break;
+        }
+        
+        // One refresh covers every transfer that's waiting.
+        Gdrive_Transfer* pTransfer = pEngine->pAuth;
+        pEngine->pAuth = NULL;
+        pthread_mutex_unlock(&pEngine->mutex);
+        
+        bool authorized = (gdrive_auth() == 0);
+        while (pTransfer != NULL)
+        {
+            Gdrive_Transfer* pNext = pTransfer->pNext;
+            pTransfer->pNext = NULL;
+            if (authorized && 
+                    gdrive_xfer_renew_authbearer_header(pTransfer) == 0
+                    )
+            {
+                gdrive_xfer_engine_retry(pEngine, pTransfer, 0);
+            }
+            else
+            {
+                // Give up, and let the event loop finish the transfer with 
+                // the error response it got.
+                pthread_mutex_lock(&pEngine->mutex);
+                gdrive_xfer_list_append(&pEngine->pFinished, pTransfer);
+                pthread_mutex_unlock(&pEngine->mutex);
+#if LIBCURL_VERSION_NUM >= 0x074400
+                curl_multi_wakeup(pEngine->multiHandle);
+#endif
+            }
+            pTransfer = pNext;
+        }
+        
+        pthread_mutex_lock(&pEngine->mutex);
+    }
+    pthread_mutex_unlock(&pEngine->mutex);
+    
+    return NULL;
+}
+
+static void gdrive_xfer_engine_finish(Gdrive_Xfer_Engine* pEngine, 
+                                      Gdrive_Transfer* pTransfer, 
+                                      CURLcode result)
+{
+    gdrive_dlbuf_set_result(pTransfer->pBuf, pTransfer->curlHandle, result);
+    gdrive_xfer_engine_end_attempt(pEngine, pTransfer);
+    
+    // Decide whether to retry. Waiting to retry doesn't hold up the loop, 
+    // since the transfer just goes back on the pending list with the time it
+    // becomes due. Neither does refreshing the access token, which is left to
+    // the authorization thread.
+    if (pTransfer->tryNum < GDRIVE_RETRY_LIMIT)
+    {
+        switch (gdrive_dlbuf_get_retry_method(pTransfer->pBuf))
+        {
+            case GDRIVE_RETRY_RETRY:
+                gdrive_xfer_engine_retry(pEngine, pTransfer, 
+                                         gdrive_dlbuf_get_retry_delay(
+                                                 pTransfer->pBuf, 
+                                                 pTransfer->tryNum, 
+                                                 &pEngine->retrySeed)
+                        );
+                return;
+                
+            case GDRIVE_RETRY_RENEWAUTH:
+                if (pTransfer->retryOnAuthError && 
+                        gdrive_xfer_engine_queue_auth(pEngine, pTransfer) == 0
+                        )
+                {
+                    return;
+                }
+                break;
+                
+            case GDRIVE_RETRY_NORETRY:
+            default:
+                break;
+        }
+    }
+    
+    gdrive_xfer_engine_complete(pEngine, pTransfer);
+}
+
+static void gdrive_xfer_engine_complete(Gdrive_Xfer_Engine* pEngine, 
+                                        Gdrive_Transfer* pTransfer)
+{
+    gdrive_release_curlhandle(pTransfer->curlHandle);
+    pTransfer->curlHandle = NULL;
+    if (pTransfer->pBuf != NULL && !gdrive_dlbuf_get_success(pTransfer->pBuf))
+    {
+        // Download failure
+        gdrive_dlbuf_free(pTransfer->pBuf);
+        pTransfer->pBuf = NULL;
+    }
+    
+    if (pTransfer->doneCallback != NULL)
+    {
+        // The callback takes ownership of both the transfer and the buffer, so
+        // don't touch either one afterward.
+        Gdrive_Download_Buffer* pBuf = pTransfer->pBuf;
+        pTransfer->pBuf = NULL;
+        pTransfer->doneCallback(pTransfer, pBuf, pTransfer->doneUserdata);
+        return;
+    }
+    
+    pthread_mutex_lock(&pEngine->mutex);
+    pTransfer->done = true;
+    pthread_cond_broadcast(&pEngine->doneCond);
+    pthread_cond_broadcast(&pEngine->feedCond);
+    pthread_mutex_unlock(&pEngine->mutex);
+}
+
+static void gdrive_xfer_engine_abort(Gdrive_Xfer_Engine* pEngine, 
+                                     Gdrive_Transfer* pTransfer)
+{
+    gdrive_dlbuf_free(pTransfer->pBuf);
+    pTransfer->pBuf = NULL;
+    gdrive_xfer_engine_complete(pEngine, pTransfer);
+}
+
+static void gdrive_xfer_engine_retry(Gdrive_Xfer_Engine* pEngine, 
+                                     Gdrive_Transfer* pTransfer, 
+                                     long waitTime)
+{
+    // Start over from the beginning.
+    pTransfer->tryNum++;
+    pTransfer->uploadOffset = 0;
+    if (pTransfer->destFile != NULL)
+    {
+        fseeko(pTransfer->destFile, pTransfer->destFileStart, SEEK_SET);
+    }
+    gdrive_dlbuf_prepare(pTransfer->pBuf, pTransfer->curlHandle);
+    
+    clock_gettime(CLOCK_MONOTONIC, &pTransfer->retryTime);
+    pTransfer->retryTime.tv_sec += waitTime / 1000;
+    pTransfer->retryTime.tv_nsec += (waitTime % 1000) * 1000000L;
+    if (pTransfer->retryTime.tv_nsec >= 1000000000L)
+    {
+        pTransfer->retryTime.tv_sec++;
+        pTransfer->retryTime.tv_nsec -= 1000000000L;
+    }
+    
+    pthread_mutex_lock(&pEngine->mutex);
+    // Throw away any upload data that was waiting to be sent, and have 
+    // gdrive_xfer_feed() start over.
+    pTransfer->feedGeneration++;
+    pTransfer->feedPos = 0;
+    pTransfer->feedLength = 0;
+    pTransfer->feedEnd = false;
+    pTransfer->feedError = false;
+    pTransfer->feedPaused = false;
+    pTransfer->feedResume = false;
+    pthread_cond_broadcast(&pEngine->feedCond);
+    gdrive_xfer_list_append(&pEngine->pPending, pTransfer);
+    pthread_mutex_unlock(&pEngine->mutex);
+#if LIBCURL_VERSION_NUM >= 0x074400
+    // Needed when called from the authorization thread
+    curl_multi_wakeup(pEngine->multiHandle);
+#endif
+}
+
+static int gdrive_xfer_engine_queue_auth(Gdrive_Xfer_Engine* pEngine, 
+                                         Gdrive_Transfer* pTransfer)
+{
+    pthread_mutex_lock(&pEngine->mutex);
+    if (pEngine->authStopping)
+    {
+        // Shutting down
+        pthread_mutex_unlock(&pEngine->mutex);
+        return -1;
+    }
+    if (!pEngine->authRunning)
+    {
+        if (pthread_create(&pEngine->authThread, NULL, 
+                           gdrive_xfer_engine_auth_loop, pEngine) != 0
+                )
+        {
+            // Couldn't create the thread
+            pthread_mutex_unlock(&pEngine->mutex);
+            return -1;
+        }
+        pEngine->authRunning = true;
+    }
+    gdrive_xfer_list_append(&pEngine->pAuth, pTransfer);
+    pthread_cond_signal(&pEngine->authCond);
+    pthread_mutex_unlock(&pEngine->mutex);
+    return 0;
+}
+
+static void gdrive_xfer_engine_unpause(Gdrive_Xfer_Engine* pEngine)
+{
+    // Unpausing can call the read function, which takes the mutex, so don't 
+    // hold it here. Only this thread changes the running list.
+    for (Gdrive_Transfer* pTransfer = pEngine->pRunning; pTransfer != NULL; 
+            pTransfer = pTransfer->pNext)
+    {
+        if (pTransfer->feedUnpause)
+        {
+            pTransfer->feedUnpause = false;
+            curl_easy_pause(pTransfer->curlHandle, CURLPAUSE_CONT);
+        }
+    }
+}
+
+static long gdrive_xfer_engine_start_pending(Gdrive_Xfer_Engine* pEngine)
+{
+    long timeout = GDRIVE_XFER_ENGINE_MAX_WAIT;
+    long limitWait = gdrive_xfer_engine_refill(pEngine);
+    int queryRate = gdrive_get_queryrate();
+    size_t byteRate = gdrive_get_byterate();
+    
+    // Look at all the interactive transfers before any background ones. Once
+    // the rate limits hold a transfer back, don't start any others, so that 
+    // nothing overtakes it.
+    for (int priority = GDRIVE_XFER_PRIORITY_INTERACTIVE; 
+            priority <= GDRIVE_XFER_PRIORITY_BACKGROUND; priority++)
+    {
+        Gdrive_Transfer** ppTransfer = &pEngine->pPending;
+        while (*ppTransfer != NULL)
+        {
+            Gdrive_Transfer* pTransfer = *ppTransfer;
+            if ((int) pTransfer->priority != priority)
+            {
+                ppTransfer = &pTransfer->pNext;
+                continue;
+            }
+            
+            long waitTime = gdrive_xfer_ms_until(&pTransfer->retryTime);
+            if (waitTime <= 0)
+            {
+                waitTime = limitWait;
+            }
+            if (waitTime > 0)
+            {
+                // Not due yet, or held back by the rate limits
+                if (waitTime < timeout)
+                {
+                    timeout = waitTime;
+                }
+                ppTransfer = &pTransfer->pNext;
+                continue;
+            }
+            
+            *ppTransfer = pTransfer->pNext;
+            gdrive_xfer_list_append(&pEngine->pRunning, pTransfer);
+            pEngine->runningCount++;
+#if LIBCURL_VERSION_NUM >= 0x070F05
+            // The bucket is only charged after each attempt, so also share 
+            // the byte rate among the transfers in progress. A limit of 0 
+            // means no limit.
+            curl_off_t speedLimit = 
+                    (curl_off_t) (byteRate / pEngine->runningCount);
+            if (byteRate > 0 && speedLimit == 0)
+            {
+                speedLimit = 1;
+            }
+            curl_easy_setopt(pTransfer->curlHandle, 
+                             CURLOPT_MAX_RECV_SPEED_LARGE, speedLimit);
+            curl_easy_setopt(pTransfer->curlHandle, 
+                             CURLOPT_MAX_SEND_SPEED_LARGE, speedLimit);
+#endif
+            curl_multi_add_handle(pEngine->multiHandle, pTransfer->curlHandle);
+            if (queryRate > 0)
+            {
+                pEngine->queryTokens--;
+                limitWait = gdrive_xfer_engine_refill(pEngine);
+            }
+        }
+    }
+    
+    return timeout;
+}
+
+static long gdrive_xfer_engine_refill(Gdrive_Xfer_Engine* pEngine)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - pEngine->lastRefill.tv_sec) + 
+            (now.tv_nsec - pEngine->lastRefill.tv_nsec) / 1e9;
+    pEngine->lastRefill = now;
+    
+    long waitTime = 0;
+    
+    int queryRate = gdrive_get_queryrate();
+    if (queryRate > 0)
+    {
+        // Allow a burst of queries, but always at least one.
+        double maxTokens = (double) queryRate * GDRIVE_XFER_ENGINE_BURST;
+        if (maxTokens < 1)
+        {
+            maxTokens = 1;
+        }
+        pEngine->queryTokens += elapsed * queryRate;
+        if (pEngine->queryTokens > maxTokens)
+        {
+            pEngine->queryTokens = maxTokens;
+        }
+        if (pEngine->queryTokens < 1)
+        {
+            waitTime = (long) ((1 - pEngine->queryTokens) * 1000 / queryRate) 
+                    + 1;
+        }
+    }
+    
+    size_t byteRate = gdrive_get_byterate();
+    if (byteRate > 0)
+    {
+        double maxTokens = (double) byteRate * GDRIVE_XFER_ENGINE_BURST;
+        pEngine->byteTokens += elapsed * byteRate;
+        if (pEngine->byteTokens > maxTokens)
+        {
+            pEngine->byteTokens = maxTokens;
+        }
+        if (pEngine->byteTokens < 0)
+        {
+            // Paying off bytes that were already transferred
+            long byteWait = (long) (-pEngine->byteTokens * 1000 / byteRate) 
+                    + 1;
+            if (byteWait > waitTime)
+            {
+                waitTime = byteWait;
+            }
+        }
+    }
+    
+    return waitTime;
+}
+
+static void gdrive_xfer_engine_end_attempt(Gdrive_Xfer_Engine* pEngine, 
+                                           Gdrive_Transfer* pTransfer)
+{
+    CURL* curlHandle = pTransfer->curlHandle;
+    pthread_mutex_lock(&pEngine->mutex);
+    gdrive_xfer_list_remove(&pEngine->pRunning, pTransfer);
+    pEngine->runningCount--;
+    pTransfer->feedUnpause = false;
+    pthread_mutex_unlock(&pEngine->mutex);
+    
+    if (gdrive_get_byterate() == 0)
+    {
+        // No limit, so nothing to keep track of
+        return;
+    }
+    
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t received = 0;
+    curl_off_t sent = 0;
+    curl_easy_getinfo(curlHandle, CURLINFO_SIZE_DOWNLOAD_T, &received);
+    curl_easy_getinfo(curlHandle, CURLINFO_SIZE_UPLOAD_T, &sent);
+#else
+    double received = 0;
+    double sent = 0;
+    curl_easy_getinfo(curlHandle, CURLINFO_SIZE_DOWNLOAD, &received);
+    curl_easy_getinfo(curlHandle, CURLINFO_SIZE_UPLOAD, &sent);
+#endif
+    pthread_mutex_lock(&pEngine->mutex);
+    pEngine->byteTokens -= (double) received + (double) sent;
+    pthread_mutex_unlock(&pEngine->mutex);
+}
+
+static void gdrive_xfer_list_append(Gdrive_Transfer** ppList, 
+                                    Gdrive_Transfer* pTransfer)
+{
+    // Add to the end to keep transfers in the order they were submitted.
+    Gdrive_Transfer** ppTransfer = ppList;
+    while (*ppTransfer != NULL)
+    {
+        ppTransfer = &(*ppTransfer)->pNext;
+    }
+    pTransfer->pNext = NULL;
+    *ppTransfer = pTransfer;
+}
+
+static void gdrive_xfer_list_remove(Gdrive_Transfer** ppList, 
+                                    Gdrive_Transfer* pTransfer)
+{
+    for (Gdrive_Transfer** ppTransfer = ppList; *ppTransfer != NULL; 
+            ppTransfer = &(*ppTransfer)->pNext)
+    {
+        if (*ppTransfer == pTransfer)
+        {
+            *ppTransfer = pTransfer->pNext;
+            pTransfer->pNext = NULL;
+            return;
+        }
+    }
+}
+
+static long gdrive_xfer_ms_until(const struct timespec* pTime)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (pTime->tv_sec - now.tv_sec) * 1000 + 
+            (pTime->tv_nsec - now.tv_nsec) / 1000000;
+}
@@ -23,6 +23,20 @@ extern "C" {
     
 typedef struct Gdrive_Transfer Gdrive_Transfer;
 
+/*
+ * The order in which transfers waiting for the rate limits are started (see
+ * gdrive_xfer_set_priority()).
+ */
+enum Gdrive_Xfer_Priority
+{
+    // Something a user is waiting for, such as metadata or the data for a 
+    // read. The default.
+    GDRIVE_XFER_PRIORITY_INTERACTIVE,
+    // Work nobody is waiting for yet, such as prefetching and background 
+    // uploads
+    GDRIVE_XFER_PRIORITY_BACKGROUND
+};
+
 /*
  * gdrive_xfer_upload_callback: Signature for a callback function to be used
  *                              with gdrive_xfer_set_uploadcallback().
@@ -48,6 +62,30 @@ typedef struct Gdrive_Transfer Gdrive_Transfer;
 typedef size_t(*gdrive_xfer_upload_callback)
     (char* buffer, off_t offset, size_t size, void* userdata);
 
+/*
+ * gdrive_xfer_done_callback:   Signature for a callback function to be used
+ *                              with gdrive_xfer_submit().
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):
+ *              The transfer that finished. The callback function takes 
+ *              ownership of the transfer and is responsible for eventually 
+ *              passing it to gdrive_xfer_free().
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The results of the transfer, as would have been returned by 
+ *              gdrive_xfer_execute(). NULL if the transfer failed. If not NULL,
+ *              the callback function is responsible for eventually passing 
+ *              this pointer to gdrive_dlbuf_free().
+ *      userdata (void*):
+ *              The userdata argument given to gdrive_xfer_submit().
+ * Notes:
+ *      The callback function is called from the transfer engine's event loop
+ *      thread. No other transfers make progress while it runs, so it should 
+ *      return quickly and must not wait on another asynchronous transfer or 
+ *      call gdrive_xfer_execute().
+ */
+typedef void(*gdrive_xfer_done_callback)
+    (Gdrive_Transfer* pTransfer, Gdrive_Download_Buffer* pBuf, void* userdata);
+
 
 /*************************************************************************
  * Constructors, factory methods, destructors and similar
@@ -119,7 +157,8 @@ void gdrive_xfer_set_requesttype(Gdrive_Transfer* pTransfer,
  *      retry (bool):   
  *              If true, will refresh credentials and retry the transfer upon 
  *              authentication failure. If false, authentication failure will 
- *              not cause a retry.
+ *              not cause a retry. This is meant for the requests that obtain 
+ *              the credentials.
  */
 void gdrive_xfer_set_retryonautherror(Gdrive_Transfer* pTransfer, bool retry);
 
@@ -154,6 +193,67 @@ int gdrive_xfer_set_url(Gdrive_Transfer* pTransfer, const char* url);
  */
 void gdrive_xfer_set_destfile(Gdrive_Transfer* pTransfer, FILE* destFile);
 
+/*
+ * gdrive_xfer_set_destfd():    Sets the download destination to a part of a
+ *                              file, starting at a given offset. The data is
+ *                              written with pwrite(), so the descriptor's 
+ *                              file position doesn't matter, and several 
+ *                              transfers can download into different parts of
+ *                              the same file at the same time. Overrides 
+ *                              gdrive_xfer_set_destfile().
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      fd (int):
+ *              A descriptor that is already open for writing. It must stay 
+ *              open until the transfer is finished.
+ *      offset (off_t):
+ *              The position in the file at which to write the first byte.
+ */
+void gdrive_xfer_set_destfd(Gdrive_Transfer* pTransfer, int fd, off_t offset);
+
+/*
+ * gdrive_xfer_set_ownconnection(): Keeps a transfer from sharing a connection
+ *                                  with any other transfer that is in 
+ *                                  progress at the same time. Normally, 
+ *                                  concurrent transfers are multiplexed over
+ *                                  one HTTP/2 connection where possible, 
+ *                                  which limits them all to the throughput of
+ *                                  a single TCP connection. Idle connections
+ *                                  are still reused.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      ownConnection (bool):
+ *              If true, the transfer gets a connection to itself. The default
+ *              is false.
+ */
+void gdrive_xfer_set_ownconnection(Gdrive_Transfer* pTransfer, 
+                                   bool ownConnection);
+
+/*
+ * gdrive_xfer_set_priority():  Sets how urgent a transfer is. When the query
+ *                              or byte rate limits (see gdrive_get_queryrate()
+ *                              and gdrive_get_byterate()) hold transfers back,
+ *                              interactive transfers are started before any 
+ *                              background transfers. Unlike the other 
+ *                              setters, this can also be called while a 
+ *                              submitted transfer is still waiting to start,
+ *                              for example when a background download turns 
+ *                              out to be needed right away.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      priority (enum Gdrive_Xfer_Priority):
+ *              GDRIVE_XFER_PRIORITY_INTERACTIVE (the default) or 
+ *              GDRIVE_XFER_PRIORITY_BACKGROUND.
+ */
+void gdrive_xfer_set_priority(Gdrive_Transfer* pTransfer, 
+                              enum Gdrive_Xfer_Priority priority);
+
 /*
  * gdrive_xfer_set_body():  Set the body of the HTTP request explicitly. Only
  *                          one of gdrive_xfer_set_body(),
@@ -186,7 +286,11 @@ void gdrive_xfer_set_body(Gdrive_Transfer* pTransfer, const char* body);
  *      callback (gdrive_xfer_upload_callback): 
  *              A pointer to a callback function. This function will be 
  *              repeatedly called, capturing part of the request body in each
- *              call.
+ *              call. It is called on the thread waiting in 
+ *              gdrive_xfer_execute() or gdrive_xfer_wait(), so it can block 
+ *              or use other transfers without holding up the event loop. If
+ *              the transfer is submitted with a done callback, it is called 
+ *              on the event loop thread instead and must return quickly.
  *      userdata (void*):   
  *              Any state or other information that will be needed by the 
  *              callback function. This parameter will be passed unchanged to 
@@ -196,6 +300,22 @@ void gdrive_xfer_set_uploadcallback(Gdrive_Transfer* pTransfer,
                                     gdrive_xfer_upload_callback callback, 
                                     void* userdata);
 
+/*
+ * gdrive_xfer_set_uploadsize():    Sets the exact length of the request body
+ *                                  supplied by the upload callback (see 
+ *                                  gdrive_xfer_set_uploadcallback()), so that
+ *                                  it is sent with a Content-Length header. 
+ *                                  Without this, the body is sent using 
+ *                                  chunked transfer encoding.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      size (off_t):
+ *              The number of bytes the upload callback will supply.
+ */
+void gdrive_xfer_set_uploadsize(Gdrive_Transfer* pTransfer, off_t size);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -273,14 +393,18 @@ int gdrive_xfer_add_header(Gdrive_Transfer* pTransfer, const char* header);
 /*
  * gdrive_xfer_execute():   Perform the upload or download operation described
  *                          by a Gdrive_Transfer struct. If the transfer results
- *                          in an HTTP status code of 5XX (server error) or in
- *                          a Rate Limit Exceeded error, it will be retried 
- *                          using an exponential backoff strategy, up to a 
- *                          maximum of GDRIVE_RETRY_LIMIT attempts. Unless
+ *                          in an HTTP status code of 5XX (server error) or 429
+ *                          (Too Many Requests) or in a Rate Limit Exceeded 
+ *                          error, it will be retried using an exponential 
+ *                          backoff strategy (or after the delay given by a 
+ *                          Retry-After header), up to a maximum of 
+ *                          GDRIVE_RETRY_LIMIT attempts. Unless
  *                          gdrive_xfer_set_retryonautherror() has been called
  *                          with a value of false, authentication errors are
  *                          also retried after refreshing authentication 
- *                          information.
+ *                          information. The transfer is run by the same event
+ *                          loop as gdrive_xfer_submit(), so only the calling
+ *                          thread waits while a retry is pending.
  * Return value (Gdrive_Download_Buffer*):
  *      A pointer to a Gdrive_Download_Buffer struct containing the results of
  *      the transfer. The caller is responsible for passing the returned pointer
@@ -288,6 +412,75 @@ int gdrive_xfer_add_header(Gdrive_Transfer* pTransfer, const char* header);
  */
 Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer);
 
+/*
+ * gdrive_xfer_submit():    Start performing the upload or download operation
+ *                          described by a Gdrive_Transfer struct in the 
+ *                          background, and return without waiting for it to 
+ *                          finish. All submitted transfers are run 
+ *                          concurrently by a single event loop thread, which 
+ *                          is started the first time this function is called.
+ *                          Failed transfers are retried following the same 
+ *                          rules as gdrive_xfer_execute(), but without 
+ *                          blocking other transfers while waiting to retry.
+ *                          Each attempt starts as soon as the query and byte
+ *                          rate limits allow, in order of priority (see 
+ *                          gdrive_xfer_set_priority()).
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create(). The struct must not be modified or 
+ *              freed until the transfer is finished.
+ *      callback (gdrive_xfer_done_callback):
+ *              A function to be called when the transfer is finished. Can be 
+ *              NULL, in which case the caller must call gdrive_xfer_wait() to
+ *              get the results. If not NULL, gdrive_xfer_wait() must not be 
+ *              used with this transfer.
+ *      userdata (void*):
+ *              Any state or other information that will be needed by the 
+ *              callback function. This parameter will be passed unchanged to 
+ *              the callback function.
+ * Return value (int):
+ *      0 if the transfer was started successfully, other on failure. On 
+ *      failure, the callback function is not called, and the caller still 
+ *      owns pTransfer.
+ */
+int gdrive_xfer_submit(Gdrive_Transfer* pTransfer, 
+                       gdrive_xfer_done_callback callback, void* userdata);
+
+/*
+ * gdrive_xfer_wait():  Wait for a transfer started with gdrive_xfer_submit() 
+ *                      (without a callback function) to finish.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):
+ *              The transfer to wait for. After this function returns, the 
+ *              caller is still responsible for passing the pointer to 
+ *              gdrive_xfer_free().
+ * Return value (Gdrive_Download_Buffer*):
+ *      The same as the return value of gdrive_xfer_execute(): A pointer to a
+ *      Gdrive_Download_Buffer struct containing the results of the transfer,
+ *      or NULL on failure. The caller is responsible for passing the returned
+ *      pointer to gdrive_dlbuf_free().
+ * Notes:
+ *      If the transfer has an upload callback, the callback is called from 
+ *      this function, so the upload does not make progress until it is 
+ *      called.
+ */
+Gdrive_Download_Buffer* gdrive_xfer_wait(Gdrive_Transfer* pTransfer);
+
+/*
+ * gdrive_xfer_engine_cleanup():    Stop the event loop thread used by 
+ *                                  gdrive_xfer_submit(), if it was started, 
+ *                                  and free its resources. Any submitted 
+ *                                  transfers that haven't finished fail: 
+ *                                  their callbacks are called from this 
+ *                                  function with a NULL buffer, and 
+ *                                  gdrive_xfer_wait() returns NULL for the 
+ *                                  others. Transfers submitted while this 
+ *                                  function runs fail to start. It is safe to
+ *                                  call gdrive_xfer_submit() again afterward.
+ */
+void gdrive_xfer_engine_cleanup(void);
+
 
 #ifdef	__cplusplus
 }
@@ -7,6 +7,7 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <stdint.h>
 
 typedef struct Gdrive_Path
 {
@@ -87,6 +88,19 @@ long gdrive_divide_round_up(long dividend, long divisor)
         (dividend / divisor + 1);
 }
 
+size_t gdrive_string_hash(const char* str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* pChar = (const unsigned char*) str; *pChar; 
+            pChar++
+            )
+    {
+        hash ^= *pChar;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t) hash;
+}
+
 FILE* gdrive_power_fopen(const char* path, const char* mode)
 {
     // Any files we create would be authentication and possibly (not currently
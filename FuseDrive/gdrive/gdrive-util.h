@@ -90,6 +90,18 @@ void gdrive_path_free(Gdrive_Path* gpath);
  */
 long gdrive_divide_round_up(long dividend, long divisor);
 
+/*
+ * gdrive_string_hash():    Computes a hash value for a string, for use with
+ *                          hash tables. Currently uses 64-bit FNV-1a, 
+ *                          truncated to the size of size_t if necessary.
+ * Parameters:
+ *      str (const char*):
+ *              A null-terminated string.
+ * Return value (size_t):
+ *      The hash value.
+ */
+size_t gdrive_string_hash(const char* str);
+
 
 /*
  * gdrive_power_fopen():    Opens a file in a way similar to the fopen() system
@@ -40,6 +40,13 @@ extern "C" {
     
 #define GDRIVE_BASE_CHUNK_SIZE 262144L
 
+// The largest number of files Google Drive will return in one page of a
+// folder listing.
+#define GDRIVE_MAX_LIST_PAGE_SIZE 1000
+
+// The most connections used to download one chunk of a file at the same time
+#define GDRIVE_MAX_FETCH_CONNECTIONS 16
+
     
 enum Gdrive_Interaction
 {
@@ -55,6 +62,15 @@ enum Gdrive_Filetype
     GDRIVE_FILETYPE_FOLDER
 };
 
+enum Gdrive_Fetch_Policy
+{
+    // Download whole chunks (sized from the file size) when a file is read 
+    // sequentially, and blocks (see gdrive_get_blocksize()) otherwise
+    GDRIVE_FETCH_FIXED,
+    // Size downloads from how the file has been read recently
+    GDRIVE_FETCH_ADAPTIVE
+};
+
 typedef struct Gdrive_Info Gdrive_Info;
 
 
@@ -75,9 +91,10 @@ typedef struct Gdrive_Info Gdrive_Info;
  *                  has granted necessary access permissions for the Google 
  *                  Drive account.  This function MUST be called  EXACTLY ONCE, 
  *                  at the start of the program, prior to any other gdrive_*() 
- *                  calls.  If multi-threaded mode is ever supported (not 
- *                  currently planned), this function must be called BEFORE any 
- *                  extra threads are created.
+ *                  calls.  In multi-threaded programs, this function must be
+ *                  called BEFORE any extra threads are created. Other 
+ *                  gdrive_*() functions are safe to call from multiple 
+ *                  threads.
  *                  Note if using the curl library elsewhere: This function 
  *                  calls curl_global_init().
  * Parameters:
@@ -128,10 +145,9 @@ int gdrive_init_nocurl(int access, const char* authFilename, time_t cacheTTL,
  * gdrive_cleanup():    Closes the network connection and cleanly frees the 
  *                      memory associated with the Google Drive session.  This 
  *                      function MUST be called EXACTLY ONCE, at the end of the 
- *                      program, after any other gdrive_*() calls.  If 
- *                      multi-threaded mode is ever supported (not currently 
- *                      planned), this function must be called AFTER any extra 
- *                      threads are finished.
+ *                      program, after any other gdrive_*() calls.  In 
+ *                      multi-threaded programs, this function must be called 
+ *                      AFTER any extra threads are finished.
  *                      Note if using the curl library elsewhere: This function 
  *                      calls curl_global_cleanup().
  */
@@ -176,6 +192,224 @@ size_t gdrive_get_minchunksize(void);
  */
 int gdrive_get_maxchunks(void);
 
+/*
+ * gdrive_set_listpagesize():   Sets the number of files requested in each page
+ *                              of a folder listing. Larger pages need fewer
+ *                              requests for large folders, but each request
+ *                              takes longer.
+ * Parameters:
+ *      pageSize (int):
+ *              The number of files per page, up to GDRIVE_MAX_LIST_PAGE_SIZE
+ *              (larger values are reduced to GDRIVE_MAX_LIST_PAGE_SIZE). If 0
+ *              or less, Google Drive's default page size is used.
+ */
+void gdrive_set_listpagesize(int pageSize);
+
+/*
+ * gdrive_get_contentcachesize():   Retrieves the maximum number of bytes of
+ *                                  downloaded file contents kept on disk. 
+ *                                  Contents of closed files stay cached (and
+ *                                  are reused if the file is reopened without
+ *                                  having changed) until this limit forces the
+ *                                  least recently used chunks out.
+ * Return value (size_t):
+ *      The size limit, in bytes, of the file contents cache.
+ */
+size_t gdrive_get_contentcachesize(void);
+
+/*
+ * gdrive_set_contentcachesize():   Sets the maximum number of bytes of 
+ *                                  downloaded file contents kept on disk. See
+ *                                  gdrive_get_contentcachesize().
+ * Parameters:
+ *      cacheSize (size_t):
+ *              The size limit in bytes. If 0, file contents are discarded as
+ *              soon as they are no longer in use.
+ */
+void gdrive_set_contentcachesize(size_t cacheSize);
+
+/*
+ * gdrive_get_blocksize():  Retrieves the amount of data downloaded at a time
+ *                          when a file is being read at random (rather than 
+ *                          sequentially). Reads that miss the cache fetch only
+ *                          the blocks of this size that they touch, instead of
+ *                          a whole chunk.
+ * Return value (size_t):
+ *      The block size in bytes. Unless gdrive_set_blocksize() has been called,
+ *      this is the same as gdrive_get_minchunksize().
+ */
+size_t gdrive_get_blocksize(void);
+
+/*
+ * gdrive_set_blocksize():  Sets the amount of data downloaded at a time for 
+ *                          random reads. See gdrive_get_blocksize().
+ * Parameters:
+ *      blockSize (size_t):
+ *              The block size in bytes. If 0, gdrive_get_minchunksize() is 
+ *              used. Values larger than the normal chunk size for a file have
+ *              no effect on that file.
+ */
+void gdrive_set_blocksize(size_t blockSize);
+
+/*
+ * gdrive_get_fetchpolicy():    Retrieves the policy that decides how much of a
+ *                              file is downloaded at a time, and how far ahead
+ *                              of a reader.
+ * Return value (enum Gdrive_Fetch_Policy):
+ *      GDRIVE_FETCH_FIXED:     Downloads are a whole chunk (a fraction of the 
+ *                              file size, see gdrive_get_maxchunks()) while 
+ *                              the file is read sequentially, with up to a few
+ *                              chunks read ahead, and a block otherwise. This
+ *                              is the default.
+ *      GDRIVE_FETCH_ADAPTIVE:  Downloads for random reads are a block. While
+ *                              a file is read sequentially, downloads grow 
+ *                              with the amount read so far, regardless of the
+ *                              file size. Reads at a steady stride have the
+ *                              next few reads downloaded ahead of time.
+ */
+enum Gdrive_Fetch_Policy gdrive_get_fetchpolicy(void);
+
+/*
+ * gdrive_set_fetchpolicy():    Sets the policy that decides how much of a file
+ *                              is downloaded at a time. See 
+ *                              gdrive_get_fetchpolicy().
+ * Parameters:
+ *      policy (enum Gdrive_Fetch_Policy):
+ *              The policy to use for all files.
+ */
+void gdrive_set_fetchpolicy(enum Gdrive_Fetch_Policy policy);
+
+/*
+ * gdrive_get_fetchconnections():   Retrieves the number of connections used
+ *                                  to download each large chunk of a file. 
+ *                                  A chunk of at least this many megabytes 
+ *                                  (MiB) is split into that many ranges, which
+ *                                  are downloaded at the same time over 
+ *                                  separate connections, since a single 
+ *                                  connection often can't use all of the 
+ *                                  available bandwidth. Smaller chunks are 
+ *                                  split into fewer ranges of at least 1 MiB.
+ * Return value (int):
+ *      The number of connections per chunk, from 1 (chunks are never split) 
+ *      up to GDRIVE_MAX_FETCH_CONNECTIONS. The default is 1.
+ */
+int gdrive_get_fetchconnections(void);
+
+/*
+ * gdrive_set_fetchconnections():   Sets the number of connections used to 
+ *                                  download each large chunk of a file. See
+ *                                  gdrive_get_fetchconnections().
+ * Parameters:
+ *      connections (int):
+ *              The number of connections. Values less than 1 are treated as 1,
+ *              and values over GDRIVE_MAX_FETCH_CONNECTIONS are reduced to 
+ *              GDRIVE_MAX_FETCH_CONNECTIONS.
+ */
+void gdrive_set_fetchconnections(int connections);
+
+/*
+ * gdrive_get_queryrate():  Retrieves the most requests per second that will 
+ *                          be sent to Google Drive. Google Drive enforces a 
+ *                          per-user quota on requests and answers with 403 
+ *                          "userRateLimitExceeded" errors (which are retried 
+ *                          after a delay) when it is exceeded, so it's better
+ *                          to stay under the quota. Requests held back by the
+ *                          limit wait in a queue, and requests someone is 
+ *                          waiting for (such as metadata lookups and reads) 
+ *                          are sent before background prefetches and uploads.
+ *                          Up to a second's worth of requests can be sent in a
+ *                          burst after being idle.
+ * Return value (int):
+ *      The limit in requests per second, counting each retry as a request. If
+ *      0 (the default), there is no limit.
+ */
+int gdrive_get_queryrate(void);
+
+/*
+ * gdrive_set_queryrate():  Sets the most requests per second that will be 
+ *                          sent to Google Drive. See gdrive_get_queryrate().
+ * Parameters:
+ *      queryRate (int):
+ *              The limit in requests per second, or 0 for no limit. Negative
+ *              values are treated as 0.
+ */
+void gdrive_set_queryrate(int queryRate);
+
+/*
+ * gdrive_get_byterate():   Retrieves the most bytes per second that will be 
+ *                          uploaded and downloaded, counted together. No 
+ *                          single transfer goes faster than this, and new 
+ *                          transfers are held back (in the same queue and 
+ *                          order as for gdrive_get_queryrate()) until the 
+ *                          average over all transfers is back under the limit.
+ * Return value (size_t):
+ *      The limit in bytes per second. If 0 (the default), there is no limit.
+ */
+size_t gdrive_get_byterate(void);
+
+/*
+ * gdrive_set_byterate():   Sets the most bytes per second that will be 
+ *                          uploaded and downloaded. See gdrive_get_byterate().
+ * Parameters:
+ *      byteRate (size_t):
+ *              The limit in bytes per second, or 0 for no limit.
+ */
+void gdrive_set_byterate(size_t byteRate);
+
+/*
+ * gdrive_get_dirtylimit(): Retrieves the most data that can be waiting to be 
+ *                          uploaded in the background. Files that were written
+ *                          to are uploaded after they are closed, without 
+ *                          making the close wait for the upload. Once the files
+ *                          waiting to be uploaded add up to more than this 
+ *                          limit, writes to any file wait until enough uploads
+ *                          have finished.
+ * Return value (size_t):
+ *      The limit in bytes. If 0, files are uploaded before closing them 
+ *      returns.
+ */
+size_t gdrive_get_dirtylimit(void);
+
+/*
+ * gdrive_set_dirtylimit(): Sets the most data that can be waiting to be 
+ *                          uploaded in the background. See 
+ *                          gdrive_get_dirtylimit().
+ * Parameters:
+ *      dirtyLimit (size_t):
+ *              The limit in bytes, or 0 to upload files while closing them.
+ */
+void gdrive_set_dirtylimit(size_t dirtyLimit);
+
+/*
+ * gdrive_get_cachedir():   Retrieves the directory where downloaded file 
+ *                          contents are stored.
+ * Return value (const char*):
+ *      The path given to gdrive_set_cachedir(), or NULL if file contents are
+ *      stored in anonymous temporary files.
+ */
+const char* gdrive_get_cachedir(void);
+
+/*
+ * gdrive_set_cachedir():   Stores downloaded file contents in the given 
+ *                          directory instead of in anonymous temporary files.
+ *                          When the Google Drive session is cleaned up, 
+ *                          contents of unchanged files are left in the 
+ *                          directory along with an index. The next time this
+ *                          function is called with the same directory, those
+ *                          contents are picked up again, and any files that 
+ *                          have changed on Google Drive in the meantime are 
+ *                          discarded. Should be called at most once, after
+ *                          gdrive_init() and before any files are opened. Only
+ *                          one Google Drive session at a time should use a 
+ *                          given directory.
+ * Parameters:
+ *      path (const char*):
+ *              The directory to use. It is created if it doesn't exist.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_set_cachedir(const char* path);
+
 /*
  * gdrive_get_filesystem_perms():   Retrieve the overall filesystem permissions
  *                                  for a particular type of file (currently 
@@ -191,6 +425,21 @@ int gdrive_get_maxchunks(void);
  */
 int gdrive_get_filesystem_perms(enum Gdrive_Filetype type);
 
+/*
+ * gdrive_get_missing_stats():  Retrieves counts of lookups for paths that 
+ *                              don't exist, for reporting how well the cache
+ *                              of missing paths is working. Must be called 
+ *                              before gdrive_cleanup().
+ * Parameters:
+ *      pHits (unsigned long*):
+ *              The location to store the number of lookups answered from the
+ *              cache, without asking Google Drive.
+ *      pMisses (unsigned long*):
+ *              The location to store the number of lookups that had to be 
+ *              sent to Google Drive.
+ */
+void gdrive_get_missing_stats(unsigned long* pHits, unsigned long* pMisses);
+
 
 /******************
  * Other fully public functions
@@ -198,15 +447,57 @@ int gdrive_get_filesystem_perms(enum Gdrive_Filetype type);
 
 /*
  * gdrive_folder_list():    Retrieves a list of files within the given folder.
+ *                          The full file information for each file is also
+ *                          stored in the cache, so that looking up files 
+ *                          from the list afterward does not need another 
+ *                          request to Google Drive.
  * Parameters:
  *      folderId (const char*):
  *              The Google Drive file ID of the parent folder.
+ *      folderPath (const char*):
+ *              The path of the parent folder. If not NULL, the paths of all
+ *              the files in the folder are added to the file ID cache. Can be
+ *              NULL if the path isn't known.
  * Return value (Gdrive_Fileinfo_Array*):
  *      A list of Gdrive_Fileinfo structs, each containing information on one
- *      file within the parent folder. The parent folder is not included in the
- *      list.
+ *      file within the parent folder, or NULL on error. The parent folder is
+ *      not included in the list. The list is complete, even if Google Drive
+ *      returned it in several pages. The caller is responsible for passing
+ *      the returned pointer to gdrive_finfoarray_free().
+ */
+Gdrive_Fileinfo_Array*  gdrive_folder_list(const char* folderId, 
+                                           const char* folderPath);
+
+/*
+ * gdrive_folder_list_page():   Retrieves one page of the list of files within
+ *                              the given folder. Like gdrive_folder_list(),
+ *                              the file information is also stored in the
+ *                              cache. Useful for large folders, where
+ *                              gdrive_folder_list() would need to keep the
+ *                              entire list in memory.
+ * Parameters:
+ *      folderId (const char*):
+ *              The Google Drive file ID of the parent folder.
+ *      folderPath (const char*):
+ *              The path of the parent folder, or NULL. See
+ *              gdrive_folder_list().
+ *      pageToken (const char*):
+ *              NULL to retrieve the first page. To retrieve following pages,
+ *              the token stored at pNextPageToken by the previous call.
+ *      pNextPageToken (char**):
+ *              The address of a pointer that will be set to the token needed
+ *              to retrieve the next page, or to NULL if this is the last page
+ *              (or on error). If not NULL, the caller is responsible for
+ *              freeing the token.
+ * Return value (Gdrive_Fileinfo_Array*):
+ *      A list of Gdrive_Fileinfo structs for the files in this page, or NULL
+ *      on error. The list may be empty. The caller is responsible for passing
+ *      the returned pointer to gdrive_finfoarray_free().
  */
-Gdrive_Fileinfo_Array*  gdrive_folder_list(const char* folderId);
+Gdrive_Fileinfo_Array* gdrive_folder_list_page(const char* folderId, 
+                                               const char* folderPath, 
+                                               const char* pageToken, 
+                                               char** pNextPageToken);
 
 /*
  * gdrive_filepath_to_id(): Find the Google Drive file ID corresponding to a
@@ -67,7 +67,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=`pkg-config --libs fuse` `pkg-config --libs libcurl` `pkg-config --libs json-c` -lm   
+LDLIBSOPTIONS=`pkg-config --libs fuse` `pkg-config --libs libcurl` `pkg-config --libs json-c` -lm -lpthread   
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}